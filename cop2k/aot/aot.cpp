@@ -0,0 +1,77 @@
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "aot.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: aot <instr.txt> <file.bin> [-e <entry>]... [-o <out.cpp>]" << std::endl
+              << "       <entry> is an address like 40H where code is also entered" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    std::vector<unsigned char> entries;
+    const char *out_path = nullptr;
+    std::string out;
+
+    if (argc < 3) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (int i = 3; i < argc; i += 2) {
+            if (i + 1 >= argc) {
+                print_usage();
+                return EXIT_FAILURE;
+
+            } else if (!strcmp(argv[i], "-e"))
+                entries.push_back(COP2K::parse_addr(argv[i + 1]));
+
+            else if (!strcmp(argv[i], "-o"))
+                out_path = argv[i + 1];
+
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        std::string image;
+
+        try {
+            image = COP2K::read_image(argv[2]);
+
+        } catch (const std::runtime_error &e) {
+            throw std::runtime_error(std::format("{}: {}", argv[2], e.what()));
+        }
+
+        COP2K::load_instruction_set(argv[1], opcode);
+        out = COP2K::AOT(opcode).translate(image, entries, std::filesystem::path(argv[2]).filename().string());
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream ofs;
+
+    if (out_path) {
+        ofs.open(out_path);
+
+        if (!ofs)
+            return EXIT_FAILURE;
+    }
+
+    (out_path ? ofs : std::cout) << out;
+    return (out_path ? ofs.good() : std::cout.good()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
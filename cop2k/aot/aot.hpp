@@ -0,0 +1,502 @@
+#ifndef AOT_HPP_INCLUDED
+#define AOT_HPP_INCLUDED
+
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "dis/dis.hpp"
+#include "engine/decoded_engine.hpp"
+
+namespace COP2K
+{
+    /* translates a program image into C++, ahead of time
+     *
+     * every instruction found from reset and the entries becomes a label
+     * followed by the clocks of its micro program, each as the decoded
+     * engine would run it but with the micro word, IR and, until something
+     * loads it, PC known. a fetch becomes a goto, through a switch on PC
+     * only when the target is not known
+     *
+     * the program must not write over its code, which is checked, and
+     * interrupts are not translated
+     */
+    class AOT
+    {
+        public:
+            AOT(const Opcode &opcode)
+            {
+                dis.opcode = opcode;
+                dis.build_table();
+            }
+
+            // image must be 256 bytes
+            std::string translate(
+                const std::string &image,
+                const std::vector<unsigned char> &entries = {},
+                const std::string &source_name = std::string()
+            )
+            {
+                if (image.size() != 256)
+                    throw std::invalid_argument("memory image must be 256 bytes");
+
+                this->image = image;
+                starts = dis.find_code(image, entries);
+                code.reset();
+
+                for (unsigned i = 0; i < 256; i++)
+                    if (starts.test(i))
+                        for (unsigned j = 0; j < dis.decode(image.at(i)).size; j++)
+                            code.set((i + j) & 0xff);
+
+                std::string body, ret = PROLOGUE;
+
+                for (unsigned i = 0; i < 256; i++)
+                    if (starts.test(i))
+                        body += translate_instruction(i);
+
+                body += translate_fatch();
+                body += translate_dispatch();
+
+                ret = std::format("// translated from {} by aot, do not edit\n", source_name.empty() ? "an image" : source_name) + ret;
+                ret += "    static const bool code[256] = {";
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret += std::format("{}{}", i % 32 ? " " : "\n        ", code.test(i) ? "1," : "0,");
+
+                ret += "\n    };\n\n";
+                ret += "    static const uint8_t image[256] = {";
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret += std::format("{}0x{:02X},", i % 16 ? " " : "\n        ", static_cast<uint8_t>(image.at(i)));
+
+                ret += "\n    };\n";
+                return ret + RESET + body + RUN_END + MAIN;
+            }
+
+        private:
+            std::string translate_instruction(unsigned addr)
+            {
+                uint8_t byte = image.at(addr);
+                const DIS::Entry &e = dis.decode(byte);
+                std::optional<uint8_t> pc = (addr + 1) & 0xff;
+                std::string ret = std::format(
+                                      "\n    L_{:02X}: // {}\n",
+                                      addr, dis.format_instruction(byte, image.at((addr + 1) & 0xff))
+                                  );
+
+                for (unsigned i = 0; i < e.ins->signal_count; i++) {
+                    uint8_t upc = (byte & ~0x3) | i;
+                    DecodedEngine::Word word = DecodedEngine::decode(e.ins->microprogram.at(i), dis.opcode.is_um_safe(upc));
+                    std::string clock;
+
+                    if (!translate_clock(word, byte, pc, clock)) {
+                        ret += clock;
+                        return ret;
+                    }
+
+                    ret += clock;
+
+                    if (!word.fetch)
+                        continue;
+
+                    if (word.routing.at(0).abus != DecodedEngine::PC)
+                        throw std::runtime_error(
+                            std::format("instruction at 0{:02X}H fetches from elsewhere than PC", addr)
+                        );
+
+                    ret += "        if (++n == limit)\n            goto out;\n";
+
+                    if (pc) {
+                        unsigned next = (*pc - 1) & 0xff;
+
+                        // a jump to itself halts
+                        if (next == addr && e.flow == InstructionFlow::JUMP) {
+                            ret += "        halted = true;\n        goto out;\n";
+                            return ret;
+                        }
+
+                        ret += starts.test(next) ? std::format("        goto L_{:02X};\n", next) : "        goto dispatch;\n";
+                        return ret;
+                    }
+
+                    // where a jump or call goes, and where it goes if not taken
+                    std::vector<unsigned> targets;
+                    uint8_t target = image.at((addr + 1) & 0xff);
+
+                    /* a jump loads PC from the bus, so one to itself is
+                     * only told by where it went: the operand may have
+                     * been written since, and a conditional one not taken
+                     * goes on. taken, nothing it tests has changed
+                     */
+                    if (e.flow == InstructionFlow::JUMP && target == addr)
+                        ret += std::format(
+                                   "        if (pc == 0x{:02X}) {{\n            halted = true;\n            goto out;\n        }}\n\n",
+                                   (addr + 1) & 0xff
+                               );
+
+                    else if (e.flow == InstructionFlow::JUMP || e.flow == InstructionFlow::CALL)
+                        targets.push_back(target);
+
+                    if (e.conditional)
+                        targets.push_back((addr + e.size) & 0xff);
+
+                    for (unsigned t : targets)
+                        if (starts.test(t))
+                            ret += std::format("        if (pc == 0x{:02X})\n            goto L_{:02X};\n\n", (t + 1) & 0xff, t);
+
+                    ret += "        goto dispatch;\n";
+                    return ret;
+                }
+
+                throw std::runtime_error(std::format("instruction at 0{:02X}H never fetches the next", addr));
+            }
+
+            // _FATCH_ as run at reset, or on a byte that is not translated, with IR and PC unknown
+            std::string translate_fatch()
+            {
+                const Opcode::Instruction &ins = *dis.opcode.begin();
+                std::optional<uint8_t> pc;
+                std::string ret = "\n    fatch:\n";
+
+                for (unsigned i = 0; i < ins.signal_count; i++) {
+                    DecodedEngine::Word word = DecodedEngine::decode(ins.microprogram.at(i), dis.opcode.is_um_safe(i));
+                    std::string clock;
+
+                    if (!translate_clock(word, std::nullopt, pc, clock))
+                        return ret + clock;
+
+                    ret += clock;
+
+                    if (word.fetch)
+                        return ret + "        if (++n == limit)\n            goto out;\n        goto dispatch;\n";
+                }
+
+                throw std::runtime_error("_FATCH_ never fetches");
+            }
+
+            std::string translate_dispatch()
+            {
+                std::string ret = "\n    dispatch:\n        switch (static_cast<uint8_t>(pc - 1)) {\n";
+
+                for (unsigned i = 0; i < 256; i++)
+                    if (starts.test(i))
+                        ret += std::format(
+                                   "            case 0x{:02X}:\n                if (ir == 0x{:02X})\n"
+                                   "                    goto L_{:02X};\n\n                break;\n\n",
+                                   i, static_cast<uint8_t>(image.at(i)), i
+                               );
+
+                ret += "            default:\n                break;\n        }\n\n";
+                ret += "        if ((ir & ~0x3) == 0)\n            goto fatch;\n\n";
+                ret += "        FAIL(\"no translated instruction at PC\");\n";
+                return ret;
+            }
+
+            /* code of one clock, false if it always fails. pc is the value
+             * of PC while known, ir is unknown in _FATCH_
+             */
+            bool translate_clock(
+                const DecodedEngine::Word &word,
+                std::optional<uint8_t> ir,
+                std::optional<uint8_t> &pc,
+                std::string &ret
+            )
+            {
+                using E = DecodedEngine;
+                const E::Routing &route = word.routing.at(0);
+                std::string reg = ir ? std::format("r[{}]", *ir & 0x3) : "r[ir & 0x3]";
+                std::string jump; // empty if never, "1" if always
+
+                if (!ir)
+                    jump = "(ir & 0x8) || ((ir & 0xC) == 0x0 && cy) || ((ir & 0xC) == 0x4 && z)";
+
+                else if (*ir & 0x8)
+                    jump = "1";
+
+                else if ((*ir & 0xC) == 0x0)
+                    jump = "cy";
+
+                else if ((*ir & 0xC) == 0x4)
+                    jump = "z";
+
+                ret += std::format(
+                           "        CALC((s & 0x6) | 0x{:X});\n        CALC((s & 0x4) | 0x{:X});\n"
+                           "        CALC(0x{:X});\n        s = 0x{:X};\n        fen = {:d};\n        cn = {:d};\n",
+                           word.s & 0x1, word.s & 0x3, word.s, word.s, word.fen, word.cn
+                       );
+
+                if (route.conflict) {
+                    ret += "        FAIL(\"this bus already has a writer\");\n";
+                    return false;
+                }
+
+                if (word.eint)
+                    ret += "        iack = ireq = false;\n";
+
+                if (route.em_addr)
+                    ret += route.abus == E::PC ? "        em_addr = pc;\n" : "        em_addr = mar;\n";
+
+                static const char *const sources[] = {
+                    nullptr, "in", "ia", "st", "pc", "alu_d", "alu_l", "alu_r", nullptr, "em[em_addr]"
+                };
+                std::string dbus = route.dbus == E::FROM_REG ? reg : route.dbus == E::FROM_NONE ? "" : sources[route.dbus];
+
+                if (!dbus.empty())
+                    ret += std::format("        dbus = {};\n", dbus);
+
+                if (route.abus == E::PC) {
+                    ret += "        pc++;\n";
+
+                    if (pc)
+                        pc = *pc + 1;
+                }
+
+                if (route.ibus == E::EM)
+                    ret += "        ibus = em[em_addr];\n";
+
+                if (route.targets && dbus.empty()) {
+                    if (route.targets & ~E::TO_PC || jump == "1") {
+                        ret += "        FAIL(\"this bus has no writer\");\n";
+                        return false;
+                    }
+
+                    if (!jump.empty())
+                        ret += std::format("        if ({})\n            FAIL(\"this bus has no writer\");\n", jump);
+                }
+
+                if (route.targets & E::TO_EM)
+                    ret += "        if (code[em_addr])\n            FAIL(\"code is written\");\n        em[em_addr] = dbus;\n";
+
+                if (route.targets & E::TO_PC && !jump.empty()) {
+                    ret += jump == "1" ? "        pc = dbus;\n" : std::format("        if ({})\n            pc = dbus;\n", jump);
+                    pc.reset();
+                }
+
+                if (route.targets & E::TO_MAR)
+                    ret += "        mar = dbus;\n";
+
+                if (route.targets & E::TO_OUT)
+                    ret += "        out = dbus;\n";
+
+                if (route.targets & E::TO_ST)
+                    ret += "        st = dbus;\n";
+
+                if (route.targets & E::TO_REG)
+                    ret += std::format("        {} = dbus;\n", reg);
+
+                if (route.targets & E::TO_W)
+                    ret += std::format("        w = dbus;\n        CALC(0x{:X});\n", word.s);
+
+                if (route.targets & E::TO_A)
+                    ret += std::format("        a = dbus;\n        CALC(0x{:X});\n", word.s);
+
+                if (word.fetch) {
+                    if (route.ibus == E::NONE) {
+                        ret += "        FAIL(\"this bus has no writer\");\n";
+                        return false;
+                    }
+
+                    ret += "        ir = ibus;\n        upc = ibus & ~0x3;\n";
+                }
+
+                ret += "\n";
+                return true;
+            }
+
+            static constexpr const char *PROLOGUE = R"(
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace cop2k_aot
+{
+    struct State {
+        uint8_t a, w, r[4], pc, st, mar, out, in, ia, ir, upc;
+        bool cy, z, ireq, iack;
+        uint8_t em[256];
+        // of the last micro word, as they carry into the next clock
+        uint8_t s;
+        bool fen, cn;
+        uint8_t em_addr;
+        bool halted; // by a jump to itself
+        uint64_t instructions; // run so far, _FATCH_ at reset included
+    };
+
+    void reset(State &state);
+    uint64_t run(State &state, uint64_t limit = 0);
+
+    // the ALU, recomputed whenever S2-S0, A or W change
+    static inline void calc(
+        unsigned op, uint8_t a, uint8_t w, bool &cy, bool &z, bool fen, bool cn,
+        uint8_t &l, uint8_t &d, uint8_t &r
+    )
+    {
+        int result = 0;
+
+        switch (op) {
+            case 0:
+                result = a + w;
+                break;
+
+            case 1:
+                result = a - w;
+                break;
+
+            case 2:
+                result = a | w;
+                break;
+
+            case 3:
+                result = a & w;
+                break;
+
+            case 4:
+                result = a + w + cy;
+                break;
+
+            case 5:
+                result = a - w - cy;
+                break;
+
+            case 6:
+                result = ~a;
+                break;
+
+            case 7:
+                result = a;
+                break;
+        }
+
+        if (fen) {
+            cy = result < -128 || result > 127;
+            z = !result;
+        }
+
+        l = (result << 1) | (cy & cn);
+        d = result;
+        r = (result >> 1) | ((cy & cn) << 7);
+    }
+
+)";
+
+            static constexpr const char *RESET = R"(
+    void reset(State &state)
+    {
+        state = {};
+        state.s = 0x7;
+        state.fen = state.cn = true;
+
+        for (unsigned i = 0; i < 256; i++)
+            state.em[i] = image[i];
+    }
+
+#define CALC(op) calc((op), a, w, cy, z, fen, cn, alu_l, alu_d, alu_r)
+#define FAIL(message) do { error = (message); goto out; } while (0)
+
+    // runs up to limit instructions, 0 for no limit, or until a jump to itself
+    uint64_t run(State &state, uint64_t limit)
+    {
+        uint8_t a = state.a, w = state.w, r[4] = { state.r[0], state.r[1], state.r[2], state.r[3] };
+        uint8_t pc = state.pc, st = state.st, mar = state.mar, out = state.out, in = state.in, ia = state.ia;
+        uint8_t ir = state.ir, upc = state.upc, s = state.s, em_addr = state.em_addr;
+        bool cy = state.cy, z = state.z, ireq = state.ireq, iack = state.iack, fen = state.fen, cn = state.cn;
+        uint8_t *em = state.em;
+        uint8_t alu_l = 0, alu_d = 0, alu_r = 0, dbus = 0, ibus = 0;
+        bool halted = false;
+        const char *error = nullptr;
+        uint64_t n = 0;
+
+        if (ireq && !iack)
+            FAIL("interrupts are not translated");
+
+        if ((ir & ~0x3) == 0)
+            goto fatch;
+
+        goto dispatch;
+)";
+
+            static constexpr const char *RUN_END = R"(
+    out:
+        state.a = a;
+        state.w = w;
+
+        for (unsigned i = 0; i < 4; i++)
+            state.r[i] = r[i];
+
+        state.pc = pc;
+        state.st = st;
+        state.mar = mar;
+        state.out = out;
+        state.in = in;
+        state.ia = ia;
+        state.ir = ir;
+        state.upc = upc;
+        state.s = s;
+        state.em_addr = em_addr;
+        state.cy = cy;
+        state.z = z;
+        state.ireq = ireq;
+        state.iack = iack;
+        state.fen = fen;
+        state.cn = cn;
+        state.halted = halted;
+        state.instructions += n;
+        (void)ibus;
+        (void)dbus;
+
+        if (error)
+            throw std::logic_error(error);
+
+        return n;
+    }
+
+#undef CALC
+#undef FAIL
+}
+)";
+
+            static constexpr const char *MAIN = R"(
+// build with -DCOP2K_AOT_NO_MAIN for a library of reset() and run()
+#ifndef COP2K_AOT_NO_MAIN
+int main(int argc, char **argv)
+{
+    cop2k_aot::State state;
+    uint64_t limit = argc > 1 ? strtoull(argv[1], nullptr, 0) : 0;
+
+    cop2k_aot::reset(state);
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        cop2k_aot::run(state, limit);
+
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("A=%02X W=%02X R0=%02X R1=%02X R2=%02X R3=%02X PC=%02X ST=%02X MAR=%02X OUT=%02X CY=%d Z=%d\n",
+           state.a, state.w, state.r[0], state.r[1], state.r[2], state.r[3], state.pc, state.st,
+           state.mar, state.out, state.cy, state.z);
+    fprintf(stderr, "%llu instructions%s in %.3f s\n", static_cast<unsigned long long>(state.instructions),
+            state.halted ? ", halted" : "", elapsed.count());
+}
+#endif
+)";
+
+            DIS dis;
+            std::string image;
+            std::bitset<256> starts, code;
+    };
+}
+
+#endif // AOT_HPP_INCLUDED
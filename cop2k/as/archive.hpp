@@ -0,0 +1,175 @@
+#ifndef ARCHIVE_HPP_INCLUDED
+#define ARCHIVE_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <endian.h>
+
+namespace COP2K
+{
+    /* archive of a batch assembly
+     *
+     * layout (all integers are little endian):
+     *   ASArchiveHeader
+     *   ASArchiveEntry[count]     one per source file, in manifest order
+     *   char[256][count]          memory image of every file
+     *   char[]                    file names and diagnostics
+     *
+     * offsets are relative to the start of the archive
+     */
+    constexpr char AS_ARCHIVE_MAGIC[8] = { 'C', 'O', 'P', '2', 'K', 'A', 'S', 'A' };
+    constexpr uint32_t AS_ARCHIVE_VERSION = 1;
+
+    struct ASArchiveHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+    };
+
+    struct ASArchiveEntry {
+        uint32_t name_offset;
+        uint32_t name_size;
+        uint32_t diag_offset;
+        uint32_t diag_size;
+        uint32_t image_offset;
+        uint8_t ok; // 0 if the file failed to assemble
+        uint8_t reserved[3];
+    };
+
+    static_assert(sizeof(ASArchiveHeader) == 16);
+    static_assert(sizeof(ASArchiveEntry) == 24);
+
+    // result of assembling one file
+    struct ASResult {
+        std::string name;
+        std::string image; // 256 bytes, or empty on failure
+        std::string diagnostics;
+        bool ok;
+    };
+
+    inline void save_as_archive(const std::vector<ASResult> &results, FILE *out)
+    {
+        ASArchiveHeader header;
+        std::vector<ASArchiveEntry> entries(results.size());
+        std::string images(results.size() * 256, '\0');
+        std::string strings;
+        size_t strings_offset = sizeof(header) + entries.size() * sizeof(ASArchiveEntry) +
+                                images.size();
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const ASResult &r = results.at(i);
+            ASArchiveEntry &e = entries.at(i);
+
+            memset(&e, 0, sizeof(e));
+            e.image_offset = htole32(sizeof(header) + entries.size() * sizeof(ASArchiveEntry) +
+                                     i * 256);
+            e.ok = r.ok;
+            memcpy(images.data() + i * 256, r.image.data(), std::min<size_t>(r.image.size(), 256));
+
+            e.name_offset = htole32(strings_offset + strings.size());
+            e.name_size = htole32(r.name.size());
+            strings.append(r.name);
+            e.diag_offset = htole32(strings_offset + strings.size());
+            e.diag_size = htole32(r.diagnostics.size());
+            strings.append(r.diagnostics);
+        }
+
+        if (strings_offset + strings.size() > UINT32_MAX)
+            throw std::length_error("archive too large");
+
+        memcpy(header.magic, AS_ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = htole32(AS_ARCHIVE_VERSION);
+        header.count = htole32(results.size());
+
+        if (
+            fwrite(&header, sizeof(header), 1, out) != 1 ||
+            fwrite(entries.data(), sizeof(ASArchiveEntry), entries.size(), out) != entries.size() ||
+            fwrite(images.data(), 1, images.size(), out) != images.size() ||
+            fwrite(strings.data(), 1, strings.size(), out) != strings.size()
+        )
+            throw std::runtime_error("failed to write archive");
+    }
+
+    // read-only view of an archive in memory, e.g. a mapped file
+    class ASArchiveView
+    {
+        public:
+            ASArchiveView(const void *data, size_t size) :
+                base(static_cast<const char *>(data)), size(size)
+            {
+                ASArchiveHeader header;
+
+                if (size < sizeof(header) || memcmp(base, AS_ARCHIVE_MAGIC, sizeof(AS_ARCHIVE_MAGIC)))
+                    throw std::runtime_error("not an assembly archive");
+
+                memcpy(&header, base, sizeof(header));
+
+                if (le32toh(header.version) != AS_ARCHIVE_VERSION)
+                    throw std::runtime_error("unsupported assembly archive version");
+
+                entry_count = le32toh(header.count);
+
+                if ((size - sizeof(header)) / sizeof(ASArchiveEntry) < entry_count)
+                    throw std::runtime_error("corrupted assembly archive");
+            }
+
+            size_t count() const
+            {
+                return entry_count;
+            }
+
+            bool ok(size_t index) const
+            {
+                return get_entry(index).ok;
+            }
+
+            std::string_view name(size_t index) const
+            {
+                const ASArchiveEntry e = get_entry(index);
+                return get_range(le32toh(e.name_offset), le32toh(e.name_size));
+            }
+
+            std::string_view diagnostics(size_t index) const
+            {
+                const ASArchiveEntry e = get_entry(index);
+                return get_range(le32toh(e.diag_offset), le32toh(e.diag_size));
+            }
+
+            std::string_view image(size_t index) const
+            {
+                return get_range(le32toh(get_entry(index).image_offset), 256);
+            }
+
+        private:
+            ASArchiveEntry get_entry(size_t index) const
+            {
+                ASArchiveEntry e;
+
+                if (index >= entry_count)
+                    throw std::out_of_range("archive entry out of range");
+
+                memcpy(&e, base + sizeof(ASArchiveHeader) + index * sizeof(e), sizeof(e));
+                return e;
+            }
+
+            std::string_view get_range(size_t offset, size_t len) const
+            {
+                if (offset > size || len > size - offset)
+                    throw std::runtime_error("corrupted assembly archive");
+
+                return std::string_view(base + offset, len);
+            }
+
+            const char *base;
+            size_t size;
+            size_t entry_count;
+    };
+}
+
+#endif // ARCHIVE_HPP_INCLUDED
@@ -1,56 +1,443 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <utility>
 #include <iomanip>
 #include <cstdio>
+#include <vector>
 
 #include "libcop2k.hpp"
 #include "libopcode.hpp"
+#include "isa_image.hpp"
 #include "as.hpp"
+#include "archive.hpp"
+#include "optimizer.hpp"
+#include "incremental.hpp"
+#include "debug_info.hpp"
+#include "engine/program.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: as <instr.txt> <file.asm|-> [-O] [-o <out.bin>] [-g <out.dbg>]"
+              << " [-l <out.lst>]" << std::endl
+              << "       as --batch <instr.txt> <manifest|dir> -o <out.asa> [-j <threads>]"
+              << std::endl
+              << "       as --incremental <instr.txt> <file.asm> <edits>" << std::endl;
+}
+
+static int batch(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    const char *out_path = nullptr;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int i = 4; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return EXIT_FAILURE;
+
+        } else if (!strcmp(argv[i], "-o"))
+            out_path = argv[i + 1];
+
+        else if (!strcmp(argv[i], "-j") && atoi(argv[i + 1]) > 0)
+            threads = atoi(argv[i + 1]);
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc < 4 || !out_path) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::pair<std::string, std::filesystem::path>> sources;
+
+    try {
+        // the instruction set is loaded once and copied into every worker
+        COP2K::load_instruction_set(argv[2], opcode);
+        sources = COP2K::list_manifest(argv[3], ".asm");
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<COP2K::ASResult> results(sources.size());
+    std::vector<std::thread> pool;
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        COP2K::AS as;
+        std::ostringstream diagnostics;
+
+        as.opcode = opcode;
+        as.diagnostics = &diagnostics;
+
+        for (size_t i; (i = next++) < sources.size();) {
+            COP2K::ASResult &r = results.at(i);
+            FILE *in = fopen(sources.at(i).second.c_str(), "r");
+
+            diagnostics.str("");
+            r.name = sources.at(i).first;
+            r.ok = false;
+
+            if (!in) {
+                r.diagnostics = "error: failed to open file\n";
+                continue;
+            }
+
+            try {
+                as.assemble_file(in);
+
+                // entries of an archive are of the default layout
+                if (as.banks > 1)
+                    throw std::length_error("banked memory image");
+
+                r.image = as.dump_image();
+                r.ok = true;
+
+            } catch (const std::runtime_error &) {
+                // errors have been printed by the parser
+
+            } catch (const std::exception &e) {
+                diagnostics << "error: " << e.what() << std::endl;
+            }
+
+            fclose(in);
+            r.diagnostics = diagnostics.str();
+        }
+    };
+
+    threads = std::min<size_t>(threads, std::max<size_t>(sources.size(), 1));
+
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+
+    for (std::thread &i : pool)
+        i.join();
+
+    FILE *out_file = fopen(out_path, "wb");
+
+    if (!out_file)
+        return EXIT_FAILURE;
+
+    try {
+        COP2K::save_as_archive(results, out_file);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        fclose(out_file);
+        return EXIT_FAILURE;
+    }
+
+    fclose(out_file);
+
+    size_t failed = std::count_if(results.begin(), results.end(), [](const COP2K::ASResult & r) {
+        return !r.ok;
+    });
+
+    std::cerr << results.size() << " files assembled, " << failed << " failed" << std::endl;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+struct SourceEdit {
+    size_t first, count;
+    std::vector<std::string> text;
+};
+
+/* edits of a source, each starting with a line
+ *
+ *     @@ <line> <count>
+ *
+ * and replacing count lines from line, counted from 1, with the lines
+ * up to the next edit
+ */
+static std::vector<SourceEdit> load_edits(const char *path)
+{
+    std::vector<SourceEdit> ret;
+    std::ifstream ifs(path);
+    std::string line;
+
+    if (!ifs)
+        throw std::runtime_error(std::format("failed to open {}", path));
+
+    for (unsigned lineno = 1; std::getline(ifs, line); lineno++) {
+        std::istringstream iss(line);
+        std::string at, rest;
+        SourceEdit e = {};
+
+        if (!line.starts_with("@@")) {
+            if (ret.empty())
+                throw std::runtime_error(std::format("{}:{}: text before the first edit", path, lineno));
+
+            ret.back().text.push_back(line);
+            continue;
+        }
+
+        if (!(iss >> at >> e.first >> e.count) || (iss >> rest) || !e.first)
+            throw std::runtime_error(std::format("{}:{}: bad edit", path, lineno));
+
+        e.first--;
+        ret.push_back(e);
+    }
+
+    return ret;
+}
+
+// 256 bytes, or none if the source has errors
+static std::string assemble_text(COP2K::AS &as, const std::vector<std::string> &text)
+{
+    std::string source;
+    std::ostringstream diagnostics;
+
+    for (const std::string &i : text)
+        source += i + "\n";
+
+    FILE *in = fmemopen(source.data(), source.size(), "r");
+
+    if (!in)
+        throw std::runtime_error("failed to open source");
+
+    as.diagnostics = &diagnostics;
+
+    try {
+        as.assemble_file(in);
+
+    } catch (const std::runtime_error &) {
+        fclose(in);
+        return "";
+    }
+
+    fclose(in);
+    return as.dump_image();
+}
+
+/* applies every edit to the source with IncrementalAS, and checks that
+ * it ends up with what assemble_file() makes of the edited source
+ */
+static int incremental(int argc, char **argv)
+{
+    COP2K::IncrementalAS inc;
+    COP2K::AS as;
+    std::vector<SourceEdit> edits;
+    std::vector<std::string> text;
+    size_t differ = 0;
+
+    if (argc != 5) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::ifstream ifs(argv[3]);
+        std::string line;
+
+        if (!ifs)
+            throw std::runtime_error(std::format("failed to open {}", argv[3]));
+
+        while (std::getline(ifs, line))
+            text.push_back(line);
+
+        COP2K::load_instruction_set(argv[2], as.opcode);
+        inc.as.opcode = as.opcode;
+        inc.set_source("");
+        edits = load_edits(argv[4]);
+
+        // the whole source is the first edit
+        edits.insert(edits.begin(), { 0, 0, text });
+        text.clear();
+
+        for (size_t i = 0; i < edits.size(); i++) {
+            const SourceEdit &e = edits.at(i);
+
+            if (e.first > text.size() || e.count > text.size() - e.first)
+                throw std::runtime_error(std::format("edit {} is out of the source", i));
+
+            text.erase(text.begin() + e.first, text.begin() + e.first + e.count);
+            text.insert(text.begin() + e.first, e.text.begin(), e.text.end());
+            inc.edit(e.first, e.count, e.text);
+
+            std::string expected = assemble_text(as, text);
+            std::string got = inc.ok() ? inc.as.dump_image() : "";
+            std::string status = "same";
+
+            if (expected.empty() != got.empty())
+                status = got.empty() ? "errors, but assembles" : "assembles, but has errors";
+
+            else
+                for (size_t j = 0; j < got.size(); j++)
+                    if (got.at(j) != expected.at(j)) {
+                        status = std::format(
+                                     "{:02X} at {:02X}H, but {:02X} assembled",
+                                     static_cast<uint8_t>(got.at(j)), j, static_cast<uint8_t>(expected.at(j))
+                                 );
+                        break;
+                    }
+
+            differ += status != "same";
+            std::cout << std::format("edit {}: {}\n", i, status);
+        }
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << std::format("{} edits, {} differ\n", edits.size() - 1, differ);
+    return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
 int main(int argc, char **argv)
 {
     COP2K::AS as;
+    const char *out_path = nullptr, *debug_path = nullptr, *listing_path = nullptr;
+    bool optimize = false;
+
+    if (argc >= 2 && !strcmp(argv[1], "--batch"))
+        return batch(argc, argv);
+
+    if (argc >= 2 && !strcmp(argv[1], "--incremental"))
+        return incremental(argc, argv);
 
     if (argc < 3 || !strcmp(argv[1], "--help")) {
-        std::cerr << "usage: as <instr.txt> <file.asm> [-o <out.bin>]" << std::endl;
+        print_usage();
         return EXIT_FAILURE;
     }
 
-    FILE *instr_file = fopen(argv[1], "r");
-    FILE *asm_file = fopen(argv[2], "r");
-    FILE *out_file = stdout;
+    for (int i = 3; i < argc; i += 2) {
+        if (!strcmp(argv[i], "-O")) {
+            optimize = true;
+            i--;
 
-    if (argc == 5) {
-        if (strcmp(argv[3], "-o")) {
-            std::cerr << "usage: as <instr.txt> <file.asm> [-o <out.bin>]" << std::endl;
+        } else if (i + 1 >= argc) {
+            print_usage();
             return EXIT_FAILURE;
-        }
 
-        out_file = fopen(argv[4], "w");
+        } else if (!strcmp(argv[i], "-o"))
+            out_path = argv[i + 1];
+
+        else if (!strcmp(argv[i], "-g"))
+            debug_path = argv[i + 1];
+
+        else if (!strcmp(argv[i], "-l"))
+            listing_path = argv[i + 1];
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
     }
 
-    if (!instr_file || !asm_file || !out_file)
+    // the source is read only once, so it may come from a pipe
+    FILE *asm_file = strcmp(argv[2], "-") ? fopen(argv[2], "r") : stdin;
+    FILE *out_file = out_path ? fopen(out_path, "w") : stdout;
+    std::string source;
+    char buf[4096];
+    size_t len;
+
+    if (!asm_file || !out_file)
         return EXIT_FAILURE;
 
+    // kept for the debug information
+    while ((len = fread(buf, 1, sizeof(buf), asm_file)))
+        source.append(buf, len);
+
     try {
-        as.opcode.load_instr_txt(instr_file);
+        COP2K::load_instruction_set(argv[1], as.opcode);
 
     } catch (const std::runtime_error &) {
         return EXIT_FAILURE;
     }
 
-    fclose(instr_file);
+    if (optimize) {
+        COP2K::PeepholeOptimizer optimizer(as.opcode);
+        std::vector<COP2K::OptimizerRewrite> rewrites;
+        unsigned cycles = 0, bytes = 0;
+
+        // the listing in the debug information shows the optimized source
+        source = optimizer.optimize(source, rewrites);
+
+        for (const COP2K::OptimizerRewrite &i : rewrites) {
+            std::cerr << "line " << i.lineno << ": " << i.before << " -> "
+                      << (i.after.empty() ? "(removed)" : i.after)
+                      << ", " << i.cycles_saved << " cycles saved" << std::endl;
+            cycles += i.cycles_saved;
+            bytes += i.bytes_saved;
+        }
+
+        std::cerr << rewrites.size() << " rewrites, " << cycles << " cycles and "
+                  << bytes << " bytes saved" << std::endl;
+    }
+
+    FILE *source_file = fmemopen(source.data(), source.size(), "r");
+
+    if (!source_file)
+        return EXIT_FAILURE;
 
     try {
-        as.assemble_file(asm_file);
+        as.assemble_file(source_file);
 
     } catch (const std::runtime_error &) {
         return EXIT_FAILURE;
     }
 
-    std::string memory = as.em.dump_content();
+    fclose(source_file);
+
+    // both are of 256 bytes, and would leave out every bank but the first
+    if ((debug_path || listing_path) && as.banks > 1) {
+        std::cerr << "error: no debug information or listing of a banked memory image" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string memory = as.dump_image();
     fwrite(memory.c_str(), 1, memory.size(), out_file);
+
+    if (!debug_path && !listing_path)
+        return EXIT_SUCCESS;
+
+    std::vector<COP2K::DebugSymbol> symbols;
+
+    for (const auto &[name, i] : as.labels)
+        symbols.push_back({name, i.first, i.second, COP2K::SYMBOL_LABEL});
+
+    for (const auto &[name, i] : as.consts)
+        symbols.push_back({name, i.first, i.second, COP2K::SYMBOL_CONST});
+
+    // the listing is rendered from the same debug information
+    std::string debug_info = COP2K::make_debug_info(
+                                 source, memory, as.em_lines, as.em_instructions, symbols
+                             );
+
+    if (debug_path) {
+        FILE *debug_file = fopen(debug_path, "wb");
+
+        if (!debug_file)
+            return EXIT_FAILURE;
+
+        if (fwrite(debug_info.data(), 1, debug_info.size(), debug_file) != debug_info.size()) {
+            std::cerr << "error: failed to write debug information" << std::endl;
+            fclose(debug_file);
+            return EXIT_FAILURE;
+        }
+
+        fclose(debug_file);
+    }
+
+    if (listing_path) {
+        std::ofstream listing_file(listing_path);
+
+        if (!(listing_file << COP2K::DebugInfoView(debug_info.data(), debug_info.size())
+                               .to_listing(&as.opcode)))
+            return EXIT_FAILURE;
+    }
 }
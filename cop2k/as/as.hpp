@@ -2,12 +2,17 @@
 #define AS_HPP_INCLUDED
 
 #include <algorithm>
+#include <array>
+#include <bitset>
 #include <iterator>
 #include <cstdio>
+#include <iostream>
 #include <stdexcept>
+#include <string>
 #include <stack>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "libcop2k.hpp"
 
@@ -22,35 +27,84 @@ struct InstructionOperand {
      * for A, arg is ignored
      */
     unsigned char src, dst;
+    // for #II and MM, index of an expression waiting for a label, or -1
+    int src_pending, dst_pending;
 };
 
 namespace COP2K
 {
     class AS;
-    void assemble(FILE *in, AS *as, bool no_eval);
+    void assemble(FILE *in, AS *as);
+
+    // operators of assembler expressions, 'P' and 'N' are unary + and -
+    inline unsigned char apply_operator(char op, unsigned char a, unsigned char b)
+    {
+        switch (op) {
+            case '+': return a + b;
+            case '-': return a - b;
+            case '*': return a * b;
+            case '/': return a / b;
+            case '%': return a % b;
+            case '<': return a << b;
+            case '>': return a >> b;
+            case '^': return a ^ b;
+            case '&': return a & b;
+            case '|': return a | b;
+            case '!': return ~a;
+            case 'P': return +a;
+            case 'N': return -a;
+        }
+
+        throw std::logic_error("unknown operator");
+    }
 
     class AS
     {
         public:
-            AS() : overflow(false) {}
+            // the most a program may switch between with BANK
+            static constexpr unsigned MAX_BANKS = 16;
+
+            AS() : diagnostics(&std::cerr), banks(1), overflow(false)
+            {
+                em_lines.fill(0);
+            }
 
             void assemble_file(FILE *in)
             {
-                // we use two-pass mode to scan for any label / constants
+                /* labels used before their definition are patched
+                 * at the end of file, so the input is read only once
+                 * and may be a pipe
+                 */
                 consts.clear();
+                labels.clear();
+                fixups.clear();
                 em.clear();
-                assemble(in, this, true);
-                em.clear();
-                rewind(in);
-                assemble(in, this, false);
+                em_lines.fill(0);
+                em_instructions.reset();
+                banks = 1;
+                overflow = false;
+                assemble(in, this);
+            }
+
+            /* the 256 bytes of the default layout, or with BANK the common
+             * half and the window of every bank up to the last one named
+             */
+            std::string dump_image() const
+            {
+                return em.dump_content().substr(0, 0x80 + banks * 0x80);
             }
 
             void clear()
             {
                 consts.clear();
+                labels.clear();
+                fixups.clear();
                 em.clear();
+                em_lines.fill(0);
+                em_instructions.reset();
                 opcode.clear();
-                overflow=false;
+                banks = 1;
+                overflow = false;
             }
 
             void add_instruction(
@@ -65,11 +119,22 @@ namespace COP2K
         if (overflow) \
             throw std::out_of_range("em overflow");\
         em.set_data(b); \
+        if (em.get_physical_addr() < 256) { \
+            em_lines.at(em.get_physical_addr()) = lineno; \
+            em_instructions.reset(em.get_physical_addr()); \
+        } \
         if (em.get_addr() == 255) \
             overflow = true; \
         em.set_addr(em.get_addr() + 1); \
     } while (0)
 
+#define PUT_OPERAND(b, pending) \
+    do { \
+        if ((pending) >= 0) \
+            fixups.emplace_back(em.get_physical_addr(), pending); \
+        PUT_BYTE((pending) >= 0 ? 0 : (b)); \
+    } while (0)
+
                 if (
                     mnemonic == "end" ||
                     mnemonic == "if" ||
@@ -79,7 +144,7 @@ namespace COP2K
                     return;
 
                 else if (mnemonic == "db")
-                    PUT_BYTE(operand.src);
+                    PUT_OPERAND(operand.src, operand.src_pending);
 
                 else if (mnemonic == "org") {
                     if (operand.src == 255)
@@ -87,6 +152,13 @@ namespace COP2K
 
                     em.set_addr(operand.src);
 
+                } else if (mnemonic == "bank") {
+                    if (operand.src >= MAX_BANKS)
+                        throw std::out_of_range("no such bank");
+
+                    em.set_bank(operand.src);
+                    banks = std::max(banks, operand.src + 1u);
+
                 } else if (mnemonic == "00const")
                     // we use "construct if not exist, return if exists" feature of map
                     consts[label] = std::make_pair(operand.src, lineno);
@@ -101,6 +173,8 @@ namespace COP2K
                                                          operand.dst_type
                                                      );
 
+                    unsigned addr = em.get_physical_addr();
+
                     if (
                         operand.src_type == OperandType::REG ||
                         operand.src_type == OperandType::REGADDR
@@ -116,6 +190,9 @@ namespace COP2K
                     else
                         PUT_BYTE(ins.byte);
 
+                    if (addr < 256)
+                        em_instructions.set(addr);
+
                     switch (operand.src_type) {
                         case OperandType::NONE:
                         case OperandType::REG_A:
@@ -125,7 +202,7 @@ namespace COP2K
 
                         case OperandType::IMMED:
                         case OperandType::MEMADDR:
-                            PUT_BYTE(operand.src);
+                            PUT_OPERAND(operand.src, operand.src_pending);
                             break;
                     }
 
@@ -138,16 +215,17 @@ namespace COP2K
 
                         case OperandType::IMMED:
                         case OperandType::MEMADDR:
-                            PUT_BYTE(operand.dst);
+                            PUT_OPERAND(operand.dst, operand.dst_pending);
                             break;
                     }
                 }
 
+#undef PUT_OPERAND
 #undef PUT_BYTE
             }
 
             Opcode opcode;
-            Memory em;
+            BankedMemory<MAX_BANKS> em;
             // *INDENT-OFF*
             std::unordered_map<
                 std::string,
@@ -164,8 +242,59 @@ namespace COP2K
                 >
             > labels;
             // *INDENT-ON*
+            // physical em address and expression of operands waiting for a label
+            std::vector<std::pair<unsigned, int>> fixups;
+            // by physical address, which are those of the program without BANK
+            std::array<unsigned, 256> em_lines; // source line of every byte in em, 0 if none
+            std::bitset<256> em_instructions; // first byte of every instruction in em
+            std::ostream *diagnostics; // where assembly errors are printed
+            unsigned banks; // in the image, 1 unless BANK named another
             bool overflow;
     };
 }
 
+// expression referencing a label that is not defined yet
+struct PendingExpression {
+    char op; // '#' for number, 'L' for label, otherwise the operator
+    unsigned char value;
+    std::string symbol;
+    unsigned lineno;
+    int lhs, rhs;
+};
+
+// one source statement, before any symbol is resolved
+struct ASStatement {
+    std::string mnemonic; // "00label", "00const", "db", "org", "bank", "if", "else", "endif", "end" or an instruction
+    std::string label;
+    struct InstructionOperand operand;
+    unsigned lineno;
+};
+
+// state of one assembly run
+struct AsmParseContext {
+    COP2K::AS *as;
+    std::ostream *err;
+    bool has_error;
+    // if set, statements are collected here instead of being assembled
+    std::vector<ASStatement> *statements;
+    std::stack<bool> block_status; // one entry per nested 'if'
+    std::vector<PendingExpression> expressions;
+    // consts whose value depends on a label defined later
+    std::unordered_map<std::string, std::pair<int, unsigned>> pending_consts;
+};
+
+namespace COP2K
+{
+    /* parse without assembling, every symbol is left in expressions
+     * returns false on syntax errors, which are printed to err
+     */
+    bool parse_statements(
+        FILE *in,
+        unsigned lineno,
+        std::vector<ASStatement> &statements,
+        std::vector<PendingExpression> &expressions,
+        std::ostream &err
+    );
+}
+
 #endif // AS_HPP_INCLUDED
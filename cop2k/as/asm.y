@@ -6,53 +6,139 @@
 #include <functional>
 
 #include "as.hpp"
+%}
+
+%define api.pure full
 
-extern int yyasmlex(void);
-extern int yyasmlineno;
-extern void yyasmset_lineno(int);
-extern void yyasmset_in(FILE *);
-extern FILE *yyasmin;
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+struct AsmParseContext;
+}
 
-static bool no_eval;
-static std::stack<bool> block_status;
-static COP2K::AS *current_as = nullptr;
-static bool has_error = false;
+%code {
+extern int yyasmlex(YYSTYPE *, yyscan_t);
+extern int yyasmlex_init_extra(struct AsmParseContext *, yyscan_t *);
+extern int yyasmlex_destroy(yyscan_t);
+extern int yyasmget_lineno(yyscan_t);
+extern void yyasmset_lineno(int, yyscan_t);
+extern void yyasmset_in(FILE *, yyscan_t);
 
-static bool block_active() { return block_status.empty() || block_status.top(); }
-static void push_block(bool val) { block_status.push(val); }
-static void pop_block() { block_status.pop(); }
-static bool top_block() { return block_status.top(); }
-static bool no_block() { return block_status.empty(); }
+static bool block_active(struct AsmParseContext *ctx) { return ctx->block_status.empty() || ctx->block_status.top(); }
+static void push_block(struct AsmParseContext *ctx, bool val) { ctx->block_status.push(val); }
+static void pop_block(struct AsmParseContext *ctx) { ctx->block_status.pop(); }
+static bool top_block(struct AsmParseContext *ctx) { return ctx->block_status.top(); }
+static bool no_block(struct AsmParseContext *ctx) { return ctx->block_status.empty(); }
 
 #define RN_RN_NOT_SUPPORTED(a, b) \
     do { \
-        yyerror("R"#a", R"#b" not supported"); \
+        yyerror(scanner, ctx, "R"#a", R"#b" not supported"); \
         YYERROR; \
     } while(0)
 
 #define RN_ARN_NOT_SUPPORTED(a, b) \
     do { \
-        yyerror("R"#a", @R"#b" not supported"); \
+        yyerror(scanner, ctx, "R"#a", @R"#b" not supported"); \
         YYERROR; \
     } while(0)
 
 #define ARN_RN_NOT_SUPPORTED(a, b) \
     do { \
-        yyerror("@R"#a", R"#b" not supported"); \
+        yyerror(scanner, ctx, "@R"#a", R"#b" not supported"); \
         YYERROR; \
     } while(0)
 
 #define ARN_ARN_NOT_SUPPORTED(a, b) \
     do { \
-        yyerror("@R"#a", @R"#b" not supported"); \
+        yyerror(scanner, ctx, "@R"#a", @R"#b" not supported"); \
         YYERROR; \
     } while(0)
 
-void yyerror(const char *s)
+static void print_error(struct AsmParseContext *ctx, unsigned lineno, const char *s)
 {
-    std::cerr << "syntax error at line " << yyasmlineno << ": " << s << std::endl;
+    *ctx->err << "syntax error at line " << lineno << ": " << s << std::endl;
 }
-%}
+
+void yyerror(yyscan_t scanner, struct AsmParseContext *ctx, const char *s)
+{
+    print_error(ctx, yyasmget_lineno(scanner), s);
+}
+
+static int defer_symbol(struct AsmParseContext *ctx, const char *symbol, unsigned lineno)
+{
+    ctx->expressions.push_back({'L', 0, symbol, lineno, -1, -1});
+    return ctx->expressions.size() - 1;
+}
+
+static int defer(struct AsmParseContext *ctx, char op, int lhs, unsigned char lhs_value, int rhs,
+                 unsigned char rhs_value)
+{
+    // resolved operands become leaves
+    if (lhs < 0) {
+        ctx->expressions.push_back({'#', lhs_value, "", 0, -1, -1});
+        lhs = ctx->expressions.size() - 1;
+    }
+
+    if (rhs < 0) {
+        ctx->expressions.push_back({'#', rhs_value, "", 0, -1, -1});
+        rhs = ctx->expressions.size() - 1;
+    }
+
+    ctx->expressions.push_back({op, 0, "", 0, lhs, rhs});
+    return ctx->expressions.size() - 1;
+}
+
+static bool evaluate(struct AsmParseContext *ctx, int index, unsigned char &val)
+{
+    const PendingExpression &e = ctx->expressions.at(index);
+    unsigned char lhs, rhs;
+
+    switch (e.op) {
+        case '#':
+            val = e.value;
+            return true;
+
+        case 'L':
+            // consts defined after their usage are still rejected
+            if (
+                ctx->as->consts.count(e.symbol) ||
+                ctx->pending_consts.count(e.symbol) ||
+                !ctx->as->labels.count(e.symbol)
+            ) {
+                print_error(ctx, e.lineno, "constant not found");
+                return false;
+            }
+
+            val = ctx->as->labels.at(e.symbol).first;
+            return true;
+
+        default:
+            if (!evaluate(ctx, e.lhs, lhs) || !evaluate(ctx, e.rhs, rhs))
+                return false;
+
+            val = COP2K::apply_operator(e.op, lhs, rhs);
+            return true;
+    }
+}
+
+#define BINARY(res, a, op, b) \
+    do { \
+        if ((a).pending < 0 && (b).pending < 0) { \
+            (res).value = COP2K::apply_operator(op, (a).value, (b).value); \
+            (res).pending = -1; \
+        } else \
+            (res).pending = defer(ctx, op, (a).pending, (a).value, (b).pending, (b).value); \
+    } while (0)
+
+#define UNARY(res, op, a) BINARY(res, a, op, a)
+}
+
+// all parser state lives in ctx, so files can be assembled concurrently
+%param {yyscan_t scanner}
+%parse-param {struct AsmParseContext *ctx}
 
 %union {
     unsigned char number_v;
@@ -64,15 +150,19 @@ void yyerror(const char *s)
         struct InstructionOperand operand;
     } instruction_v;
     struct InstructionOperand instruction_operand_v;
+    struct {
+        unsigned char value;
+        int pending; // index into ctx->expressions, or -1 if resolved
+    } expression_v;
 }
 
 %token EQU R0 R1 R2 R3 AT_R0 AT_R1 AT_R2 AT_R3
-%token DB ORG END IF ELSE ENDIF
+%token DB ORG BANK END IF ELSE ENDIF
 
 %token <identifier_v>          IDENTIFIER
 %token <number_v>              NUMBER
 
-%type  <number_v>              expression
+%type  <expression_v>          expression
 %type  <instruction_v>         instruction
 %type  <instruction_operand_v> operand
 
@@ -90,13 +180,36 @@ program
     : // none
     | program instruction {
         if (!$2.is_empty) {
-            if (block_active())
-                current_as->add_instruction(
+            // the scanner is past the '\n' of the statement by now
+            unsigned lineno = yyasmget_lineno(scanner) - 1;
+
+            if (ctx->statements)
+                ctx->statements->push_back({
+                    $2.mnemonic,
+                    $2.label ? $2.label : "",
+                    $2.operand,
+                    lineno
+                });
+
+            else if (!block_active(ctx))
+                ;
+
+            else if (!strcmp($2.mnemonic, "00const") && $2.operand.src_pending >= 0) {
+                // evaluated once every label is known
+                ctx->as->consts.erase($2.label);
+                ctx->pending_consts[$2.label] = std::make_pair($2.operand.src_pending, lineno);
+
+            } else {
+                if (!strcmp($2.mnemonic, "00const"))
+                    ctx->pending_consts.erase($2.label);
+
+                ctx->as->add_instruction(
                     $2.mnemonic,
                     $2.label ? $2.label : "",
                     $2.operand,
-                    yyasmlineno
+                    lineno
                 );
+            }
 
             free($2.mnemonic);
             $2.mnemonic = nullptr;
@@ -134,7 +247,8 @@ instruction
         $$.label = $1;
         $$.operand.src_type = COP2K::OperandType::IMMED;
         $$.operand.dst_type = COP2K::OperandType::NONE;
-        $$.operand.src = $3;
+        $$.operand.src = $3.value;
+        $$.operand.src_pending = $3.pending;
     }
     | DB expression '\n' {
         $$.is_empty = false;
@@ -142,7 +256,8 @@ instruction
         $$.label = nullptr;
         $$.operand.src_type = COP2K::OperandType::MEMADDR;
         $$.operand.dst_type = COP2K::OperandType::NONE;
-        $$.operand.src = $2;
+        $$.operand.src = $2.value;
+        $$.operand.src_pending = $2.pending;
     }
     | ORG expression '\n' {
         $$.is_empty = false;
@@ -150,9 +265,55 @@ instruction
         $$.label = nullptr;
         $$.operand.src_type = COP2K::OperandType::MEMADDR;
         $$.operand.dst_type = COP2K::OperandType::NONE;
-        $$.operand.src = $2;
+        $$.operand.src = $2.value;
+        $$.operand.src_pending = -1;
+
+        // the location counter cannot wait for labels defined later
+        if (ctx->statements)
+            $$.operand.src_pending = $2.pending;
+
+        else if ($2.pending >= 0 && !evaluate(ctx, $2.pending, $$.operand.src)) {
+            free($$.mnemonic);
+            $$.mnemonic = nullptr;
+            $$.is_empty = true;
+            ctx->has_error = true;
+        }
+    }
+    | BANK expression '\n' {
+        $$.is_empty = false;
+        $$.mnemonic = strdup("bank");
+        $$.label = nullptr;
+        $$.operand.src_type = COP2K::OperandType::IMMED;
+        $$.operand.dst_type = COP2K::OperandType::NONE;
+        $$.operand.src = $2.value;
+        $$.operand.src_pending = -1;
+
+        // nor can the bank the location counter is in
+        if (ctx->statements)
+            $$.operand.src_pending = $2.pending;
+
+        else if ($2.pending >= 0 && !evaluate(ctx, $2.pending, $$.operand.src)) {
+            free($$.mnemonic);
+            $$.mnemonic = nullptr;
+            $$.is_empty = true;
+            ctx->has_error = true;
+
+        } else if ($$.operand.src >= COP2K::AS::MAX_BANKS) {
+            free($$.mnemonic);
+            $$.mnemonic = nullptr;
+            $$.is_empty = true;
+            ctx->has_error = true;
+
+            print_error(ctx, yyasmget_lineno(scanner) - 1, "no such bank");
+        }
     }
     | END '\n' {
+        if (ctx->statements) {
+            struct InstructionOperand none;
+            none.src_type = none.dst_type = COP2K::OperandType::NONE;
+            ctx->statements->push_back({"end", "", none, (unsigned) yyasmget_lineno(scanner) - 1});
+        }
+
         // original version of assembler halts RIGHT AFTER 'END'
         YYACCEPT;
 
@@ -167,9 +328,19 @@ instruction
         $$.label = nullptr;
         $$.operand.src_type = COP2K::OperandType::IMMED;
         $$.operand.dst_type = COP2K::OperandType::NONE;
-        $$.operand.src = $2;
+        $$.operand.src = $2.value;
+        $$.operand.src_pending = -1;
+
+        // neither can the condition
+        if (ctx->statements)
+            $$.operand.src_pending = $2.pending;
 
-        push_block($2);
+        else {
+            if ($2.pending >= 0 && !evaluate(ctx, $2.pending, $$.operand.src))
+                ctx->has_error = true;
+
+            push_block(ctx, $$.operand.src);
+        }
     }
     | ELSE '\n' {
         $$.is_empty = false;
@@ -177,17 +348,21 @@ instruction
         $$.label = nullptr;
         $$.operand.src_type = $$.operand.dst_type = COP2K::OperandType::NONE;
 
-        if (no_block()) {
+        if (ctx->statements)
+            ; // blocks are checked by whoever lays out the statements
+
+        else if (no_block(ctx)) {
             free($$.mnemonic);
             $$.mnemonic = nullptr;
 
-            yyerror("'else' with no corresponding 'if'");
+            yyerror(scanner, ctx, "'else' with no corresponding 'if'");
             YYABORT;
-        }
 
-        bool n = !top_block();
-        pop_block();
-        push_block(n);
+        } else {
+            bool n = !top_block(ctx);
+            pop_block(ctx);
+            push_block(ctx, n);
+        }
     }
     | ENDIF '\n' {
         $$.is_empty = false;
@@ -195,20 +370,23 @@ instruction
         $$.label = nullptr;
         $$.operand.src_type = $$.operand.dst_type = COP2K::OperandType::NONE;
 
-        if (no_block()) {
+        if (ctx->statements)
+            ;
+
+        else if (no_block(ctx)) {
             free($$.mnemonic);
             $$.mnemonic = nullptr;
 
-            yyerror("'endif' with no corresponding 'if'");
+            yyerror(scanner, ctx, "'endif' with no corresponding 'if'");
             YYABORT;
-        }
 
-        pop_block();
+        } else
+            pop_block(ctx);
     }
     | error '\n' {
         $$.is_empty = true;
         // error messages has been printed by their perspective rules
-        has_error = true;
+        ctx->has_error = true;
         yyerrok;
         yyclearin;
     }
@@ -265,12 +443,14 @@ operand
     | '#' expression {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::NONE;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
     }
     | expression {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::NONE;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
     }
     | 'a' ',' 'a' {
         $$.src_type = COP2K::OperandType::REG_A;
@@ -319,12 +499,14 @@ operand
     | 'a' ',' '#' expression {
         $$.src_type = COP2K::OperandType::REG_A;
         $$.dst_type = COP2K::OperandType::IMMED;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | 'a' ',' expression {
         $$.src_type = COP2K::OperandType::REG_A;
         $$.dst_type = COP2K::OperandType::MEMADDR;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | R0 ',' 'a' {
         $$.src_type = COP2K::OperandType::REG;
@@ -343,13 +525,15 @@ operand
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 0;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | R0 ',' expression {
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 0;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | R1 ',' 'a' {
         $$.src_type = COP2K::OperandType::REG;
@@ -368,13 +552,15 @@ operand
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 1;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | R1 ',' expression {
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 1;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | R2 ',' 'a' {
         $$.src_type = COP2K::OperandType::REG;
@@ -393,13 +579,15 @@ operand
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 2;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | R2 ',' expression {
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 2;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | R3 ',' 'a' {
         $$.src_type = COP2K::OperandType::REG;
@@ -418,13 +606,15 @@ operand
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 3;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | R3 ',' expression {
         $$.src_type = COP2K::OperandType::REG;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 3;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | AT_R0 ',' 'a' {
         $$.src_type = COP2K::OperandType::REGADDR;
@@ -443,13 +633,15 @@ operand
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 0;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | AT_R0 ',' expression {
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 0;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | AT_R1 ',' 'a' {
         $$.src_type = COP2K::OperandType::REGADDR;
@@ -468,13 +660,15 @@ operand
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 1;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | AT_R1 ',' expression {
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 1;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | AT_R2 ',' 'a' {
         $$.src_type = COP2K::OperandType::REGADDR;
@@ -493,13 +687,15 @@ operand
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 2;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | AT_R2 ',' expression {
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 2;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | AT_R3 ',' 'a' {
         $$.src_type = COP2K::OperandType::REGADDR;
@@ -518,219 +714,315 @@ operand
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::IMMED;
         $$.src = 3;
-        $$.dst = $4;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | AT_R3 ',' expression {
         $$.src_type = COP2K::OperandType::REGADDR;
         $$.dst_type = COP2K::OperandType::MEMADDR;
         $$.src = 3;
-        $$.dst = $3;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
     | '#' expression ',' 'a' {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REG_A;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
     }
     | '#' expression ',' R0 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 0;
     }
     | '#' expression ',' R1 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 1;
     }
     | '#' expression ',' R2 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 2;
     }
     | '#' expression ',' R3 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 3;
     }
     | '#' expression ',' AT_R0 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 0;
     }
     | '#' expression ',' AT_R1 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 1;
     }
     | '#' expression ',' AT_R2 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 2;
     }
     | '#' expression ',' AT_R3 {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $2;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
         $$.dst = 3;
     }
     | '#' expression ',' '#' expression {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::IMMED;
-        $$.src = $2;
-        $$.dst = $5;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
+        $$.dst = $5.value;
+        $$.dst_pending = $5.pending;
     }
     | '#' expression ',' expression {
         $$.src_type = COP2K::OperandType::IMMED;
         $$.dst_type = COP2K::OperandType::MEMADDR;
-        $$.src = $2;
-        $$.dst = $4;
+        $$.src = $2.value;
+        $$.src_pending = $2.pending;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | expression ',' 'a' {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REG_A;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
     }
     | expression ',' R0 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 0;
     }
     | expression ',' R1 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 1;
     }
     | expression ',' R2 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 2;
     }
     | expression ',' R3 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REG;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 3;
     }
     | expression ',' AT_R0 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 0;
     }
     | expression ',' AT_R1 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 1;
     }
     | expression ',' AT_R2 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 2;
     }
     | expression ',' AT_R3 {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::REGADDR;
-        $$.src = $1;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
         $$.dst = 3;
     }
     | expression ',' '#' expression {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::IMMED;
-        $$.src = $1;
-        $$.dst = $4;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
+        $$.dst = $4.value;
+        $$.dst_pending = $4.pending;
     }
     | expression ',' expression {
         $$.src_type = COP2K::OperandType::MEMADDR;
         $$.dst_type = COP2K::OperandType::MEMADDR;
-        $$.src = $1;
-        $$.dst = $3;
+        $$.src = $1.value;
+        $$.src_pending = $1.pending;
+        $$.dst = $3.value;
+        $$.dst_pending = $3.pending;
     }
 ;
 
 expression
-    : NUMBER
+    : NUMBER {
+        $$.value = $1;
+        $$.pending = -1;
+    }
     | IDENTIFIER {
-        if (no_eval)
-            $$ = 0;
+        /* const cannot be defined over its usage
+         * e.g.
+         * MOV A, C
+         * C EQU 3H
+         * is not allowed, and is reported when the file ends
+         * as consts seen so far are all defined above
+         */
+        std::unordered_map<std::string, std::pair<int, unsigned>>::const_iterator p;
 
-        else {
-            /* const cannot be defined over its usage
-             * e.g.
-             * MOV A, C
-             * C EQU 3H
-             * is not allowed
-             */
-            try {
-                const std::pair<unsigned char, unsigned> &c = current_as->consts.at($1);
-                if (c.second >= yyasmlineno) {
-                    /* '==' means it is defined at the same line
-                     * like 'CCC EQU CCC'
-                     */
-                    free($1);
-                    yyerror("constant not found");
-                    YYERROR;
-                }
+        if (ctx->statements)
+            // symbols are resolved when the statements are laid out
+            $$.pending = defer_symbol(ctx, $1, yyasmget_lineno(scanner));
+
+        else try {
+            const std::pair<unsigned char, unsigned> &c = ctx->as->consts.at($1);
+            $$.value = c.first;
+            $$.pending = -1;
+        } catch (const std::out_of_range &) {
+            if ((p = ctx->pending_consts.find($1)) != ctx->pending_consts.end())
+                $$.pending = p->second.first;
 
-                $$ = c.first;
-            } catch (const std::out_of_range &) {
+            else
                 /* but label can
                  * e.g.
                  * JMP C
                  * C:
                  */
                 try {
-                    const std::pair<unsigned char, unsigned> &c = current_as->labels.at($1);
-                    $$ = c.first;
+                    const std::pair<unsigned char, unsigned> &c = ctx->as->labels.at($1);
+                    $$.value = c.first;
+                    $$.pending = -1;
                 } catch (const std::out_of_range &) {
-                    free($1);
-                    yyerror("constant not found");
-                    YYERROR;
+                    $$.pending = defer_symbol(ctx, $1, yyasmget_lineno(scanner));
                 }
-            }
         }
 
         free($1);
     }
-    | expression '+' expression      { $$ = $1 + $3; }
-    | expression '-' expression      { $$ = $1 - $3; }
-    | expression '*' expression      { $$ = $1 * $3; }
-    | expression '/' expression      { $$ = $1 / $3; }
-    | expression '%' expression      { $$ = $1 % $3; }
-    | expression '<' expression      { $$ = $1 << $3; }
-    | expression '>' expression      { $$ = $1 >> $3; }
-    | expression '^' expression      { $$ = $1 ^ $3; }
-    | expression '&' expression      { $$ = $1 & $3; }
-    | expression '|' expression      { $$ = $1 | $3; }
-    | '!' expression                 { $$ = ~$2; }
-    | '+' expression   %prec UNPOS   { $$ = +$2; }
-    | '-' expression   %prec UNNEG   { $$ = -$2; }
-    | '(' expression ')'             { $$ = $2;  }
+    | expression '+' expression      { BINARY($$, $1, '+', $3); }
+    | expression '-' expression      { BINARY($$, $1, '-', $3); }
+    | expression '*' expression      { BINARY($$, $1, '*', $3); }
+    | expression '/' expression      { BINARY($$, $1, '/', $3); }
+    | expression '%' expression      { BINARY($$, $1, '%', $3); }
+    | expression '<' expression      { BINARY($$, $1, '<', $3); }
+    | expression '>' expression      { BINARY($$, $1, '>', $3); }
+    | expression '^' expression      { BINARY($$, $1, '^', $3); }
+    | expression '&' expression      { BINARY($$, $1, '&', $3); }
+    | expression '|' expression      { BINARY($$, $1, '|', $3); }
+    | '!' expression                 { UNARY($$, '!', $2); }
+    | '+' expression   %prec UNPOS   { UNARY($$, 'P', $2); }
+    | '-' expression   %prec UNNEG   { UNARY($$, 'N', $2); }
+    | '(' expression ')'             { $$ = $2; }
 ;
 
 %%
-void COP2K::assemble(FILE *in, AS *as, bool no_eval_val)
+void COP2K::assemble(FILE *in, AS *as)
 {
-    yyasmset_lineno(1);
-    yyasmset_in(in);
-    has_error = false;
-    no_eval = no_eval_val;
-    current_as = as;
+    struct AsmParseContext ctx;
+    yyscan_t scanner;
+    int result;
+    unsigned char val;
+
+    ctx.as = as;
+    ctx.err = as->diagnostics;
+    ctx.has_error = false;
+    ctx.statements = nullptr;
+
+    if (yyasmlex_init_extra(&ctx, &scanner))
+        throw std::runtime_error("failed to initialize scanner");
+
+    yyasmset_lineno(1, scanner);
+    yyasmset_in(in, scanner);
+
+    try {
+        result = yyparse(scanner, &ctx);
+
+    } catch (...) {
+        yyasmlex_destroy(scanner);
+        throw;
+    }
+
+    yyasmlex_destroy(scanner);
+
+    // every label is known by now, patch the forward references
+    for (const std::pair<unsigned, int> &i : as->fixups)
+        if (evaluate(&ctx, i.second, val))
+            as->em.set_data_at(i.first, val);
 
-    int result = yyparse();
+        else
+            ctx.has_error = true;
 
-    current_as = nullptr;
+    for (const auto &[name, c] : ctx.pending_consts)
+        if (evaluate(&ctx, c.first, val))
+            as->consts[name] = std::make_pair(val, c.second);
 
-    if (result || has_error)
+        else
+            ctx.has_error = true;
+
+    if (result || ctx.has_error)
         throw std::runtime_error("failed to assemble file");
 }
+
+bool COP2K::parse_statements(
+    FILE *in,
+    unsigned lineno,
+    std::vector<ASStatement> &statements,
+    std::vector<PendingExpression> &expressions,
+    std::ostream &err
+)
+{
+    struct AsmParseContext ctx;
+    yyscan_t scanner;
+    int result;
+
+    ctx.as = nullptr;
+    ctx.err = &err;
+    ctx.has_error = false;
+    ctx.statements = &statements;
+
+    if (yyasmlex_init_extra(&ctx, &scanner))
+        throw std::runtime_error("failed to initialize scanner");
+
+    yyasmset_lineno(lineno, scanner);
+    yyasmset_in(in, scanner);
+
+    try {
+        result = yyparse(scanner, &ctx);
+
+    } catch (...) {
+        yyasmlex_destroy(scanner);
+        throw;
+    }
+
+    yyasmlex_destroy(scanner);
+    expressions = std::move(ctx.expressions);
+
+    return !result && !ctx.has_error;
+}
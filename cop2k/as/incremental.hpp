@@ -0,0 +1,524 @@
+#ifndef INCREMENTAL_HPP_INCLUDED
+#define INCREMENTAL_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "as.hpp"
+
+namespace COP2K
+{
+    /* assembler for editors
+     *
+     * every source line is parsed once and cached, after an edit only
+     * the replaced lines are parsed again. addresses are then assigned
+     * again, which is cheap, and only the lines that changed, moved or
+     * use a label / const whose value changed are encoded again into em
+     *
+     * results follow assemble_file(), except that errors do not stop the
+     * rest of the file from being assembled
+     */
+    class IncrementalAS
+    {
+        public:
+            IncrementalAS() : overlapped(false), edit_first(0), edit_count(0), edit_delta(0) {}
+
+            // must be called again after as.opcode changes
+            void set_source(const std::string &source)
+            {
+                std::vector<std::string> text;
+                std::string::size_type begin = 0, end;
+
+                while ((end = source.find('\n', begin)) != std::string::npos) {
+                    text.push_back(source.substr(begin, end - begin));
+                    begin = end + 1;
+                }
+
+                if (begin < source.size())
+                    text.push_back(source.substr(begin));
+
+                lines.clear();
+                as.em.clear();
+                as.em_lines.fill(0);
+                as.em_instructions.reset();
+                as.consts.clear();
+                as.labels.clear();
+                owner.fill(-1);
+                overlapped = false;
+
+                edit(0, 0, text);
+            }
+
+            // replace count lines from first (0 based) with text
+            void edit(size_t first, size_t count, const std::vector<std::string> &text)
+            {
+                std::vector<Line> replacement(text.size());
+
+                if (first > lines.size() || count > lines.size() - first)
+                    throw std::out_of_range("edit out of range");
+
+                // the old bytes are owned by lines that are going away
+                for (size_t i = first; i < first + count; i++)
+                    clear_bytes(lines.at(i));
+
+                for (size_t i = 0; i < text.size(); i++)
+                    replacement.at(i).text = text.at(i);
+
+                lines.erase(lines.begin() + first, lines.begin() + first + count);
+                lines.insert(lines.begin() + first, replacement.begin(), replacement.end());
+
+                edit_first = first;
+                edit_count = count;
+                edit_delta = static_cast<long>(text.size()) - static_cast<long>(count);
+
+                // lines after the edit have shifted
+                for (int &i : owner)
+                    if (i >= static_cast<int>(first + count))
+                        i += edit_delta;
+
+                for (size_t i = 0; i < lines.size(); i++)
+                    // diagnostics carry line numbers, so those lines are parsed again once moved
+                    if (
+                        lines.at(i).dirty ||
+                        (!lines.at(i).parse_diagnostics.empty() && lines.at(i).parsed_line != i)
+                    )
+                        parse_line(i);
+
+                update();
+            }
+
+            bool ok() const
+            {
+                return std::all_of(lines.begin(), lines.end(), [](const Line & i) {
+                    return i.parse_diagnostics.empty() && i.diagnostics.empty() && i.emit_diagnostics.empty();
+                });
+            }
+
+            std::string diagnostics() const
+            {
+                std::string ret;
+
+                for (const Line &i : lines)
+                    ret += i.parse_diagnostics + i.diagnostics + i.emit_diagnostics;
+
+                return ret;
+            }
+
+            // address of a source line (0 based), or -1 if it emits nothing
+            int get_line_addr(size_t line) const
+            {
+                const Line &l = lines.at(line);
+                return l.size ? l.addr : -1;
+            }
+
+            // em, consts and labels hold the result, opcode is the instruction set
+            AS as;
+
+        private:
+            struct Line {
+                std::string text;
+                bool dirty = true;
+                size_t parsed_line = 0; // line numbers in statements are relative to this
+                std::string parse_diagnostics;
+                std::vector<ASStatement> statements;
+                std::vector<PendingExpression> expressions;
+                std::vector<std::string> symbols; // used by expressions
+
+                // layout
+                bool active = false;
+                unsigned addr = 0, size = 0;
+                std::string diagnostics;
+
+                // what is in em now, and the symbols it could not resolve
+                std::string emit_diagnostics;
+                bool emitted = false;
+                unsigned emitted_addr = 0, emitted_size = 0;
+            };
+
+            struct Symbol {
+                unsigned char value;
+                size_t line;
+                bool resolved;
+
+                bool operator==(const Symbol &) const = default;
+            };
+
+            // every definition of a name, in source order
+            typedef std::unordered_map<std::string, std::vector<Symbol>> SymbolTable;
+
+            // the last definition above line
+            static const Symbol *find_definition(const std::vector<Symbol> &defs, size_t line)
+            {
+                const Symbol *ret = nullptr;
+
+                for (const Symbol &i : defs)
+                    if (i.line < line)
+                        ret = &i;
+
+                return ret;
+            }
+
+            void parse_line(size_t index)
+            {
+                Line &l = lines.at(index);
+                std::string text = l.text + "\n";
+                std::ostringstream err;
+                FILE *in = fmemopen(text.data(), text.size(), "r");
+
+                if (!in)
+                    throw std::runtime_error("failed to open line");
+
+                l.statements.clear();
+                l.expressions.clear();
+                l.symbols.clear();
+
+                try {
+                    parse_statements(in, index + 1, l.statements, l.expressions, err);
+
+                } catch (...) {
+                    fclose(in);
+                    throw;
+                }
+
+                fclose(in);
+
+                for (const PendingExpression &i : l.expressions)
+                    if (i.op == 'L')
+                        l.symbols.push_back(i.symbol);
+
+                l.parse_diagnostics = err.str();
+                l.parsed_line = index;
+                l.dirty = true;
+            }
+
+            void print_error(Line &l, unsigned lineno, const std::string &s)
+            {
+                l.diagnostics += std::format("syntax error at line {}: {}\n", lineno, s);
+            }
+
+            /* same rules as the single pass assembler:
+             * consts must be defined above, labels may be anywhere
+             * unless later_labels is false
+             */
+            bool evaluate(Line &l, size_t line, int index, bool later_labels, unsigned char &val)
+            {
+                const PendingExpression &e = l.expressions.at(index);
+                unsigned char lhs, rhs;
+
+                switch (e.op) {
+                    case '#':
+                        val = e.value;
+                        return true;
+
+                    case 'L': {
+                        SymbolTable::const_iterator c = consts.find(e.symbol);
+                        SymbolTable::const_iterator b = labels.find(e.symbol);
+                        const Symbol *d;
+
+                        if (c != consts.end()) {
+                            if ((d = find_definition(c->second, line)) && d->resolved) {
+                                val = d->value;
+                                return true;
+                            }
+
+                        } else if (b != labels.end()) {
+                            // a label used before its definition takes the last one
+                            if ((d = find_definition(b->second, line)) || (later_labels && (d = &b->second.back()))) {
+                                val = d->value;
+                                return true;
+                            }
+                        }
+
+                        print_error(l, e.lineno + line - l.parsed_line, "constant not found");
+                        return false;
+                    }
+
+                    default:
+                        if (
+                            !evaluate(l, line, e.lhs, later_labels, lhs) ||
+                            !evaluate(l, line, e.rhs, later_labels, rhs)
+                        )
+                            return false;
+
+                        val = apply_operator(e.op, lhs, rhs);
+                        return true;
+                }
+            }
+
+            unsigned get_size(Line &l, size_t line, const ASStatement &s)
+            {
+                if (s.mnemonic == "db")
+                    return 1;
+
+                if (s.mnemonic.front() == '0' || s.mnemonic == "org" || s.mnemonic == "bank" || s.mnemonic == "if" ||
+                        s.mnemonic == "else" || s.mnemonic == "endif" || s.mnemonic == "end")
+                    return 0;
+
+                if (!as.opcode.find_from_mnemonic(s.mnemonic, s.operand.src_type, s.operand.dst_type)) {
+                    l.diagnostics += std::format("error: instruction {} undefined\n", s.mnemonic);
+                    return 0;
+                }
+
+                return 1 +
+                       (s.operand.src_type == OperandType::IMMED || s.operand.src_type == OperandType::MEMADDR) +
+                       (s.operand.dst_type == OperandType::IMMED || s.operand.dst_type == OperandType::MEMADDR);
+            }
+
+            // assign addresses, then resolve and encode what changed
+            void update()
+            {
+                SymbolTable old_consts, old_labels;
+                std::vector<size_t> pending_consts;
+                std::stack<bool> block_status;
+                std::array<unsigned char, 256> usage;
+                bool had_overlap = overlapped, ended = false;
+                unsigned addr = 0;
+
+                old_consts.swap(consts);
+                old_labels.swap(labels);
+                usage.fill(0);
+                overlapped = false;
+
+                for (size_t i = 0; i < lines.size(); i++) {
+                    Line &l = lines.at(i);
+                    unsigned old_addr = l.addr, old_size = l.size;
+                    bool old_active = l.active;
+
+                    l.diagnostics.clear();
+                    l.active = !ended && (block_status.empty() || block_status.top());
+                    l.addr = addr;
+                    l.size = 0;
+
+                    for (const ASStatement &s : l.statements) {
+                        unsigned char val = s.operand.src;
+
+                        if (ended)
+                            break;
+
+                        else if (s.mnemonic == "end")
+                            ended = true;
+
+                        else if (s.mnemonic == "if") {
+                            if (s.operand.src_pending >= 0 && !evaluate(l, i, s.operand.src_pending, false, val))
+                                val = 0;
+
+                            block_status.push(val);
+
+                        } else if (s.mnemonic == "else") {
+                            if (block_status.empty())
+                                print_error(l, s.lineno + 1 + i - l.parsed_line, "'else' with no corresponding 'if'");
+
+                            else {
+                                bool n = !block_status.top();
+                                block_status.pop();
+                                block_status.push(n);
+                            }
+
+                        } else if (s.mnemonic == "endif") {
+                            if (block_status.empty())
+                                print_error(l, s.lineno + 1 + i - l.parsed_line, "'endif' with no corresponding 'if'");
+
+                            else
+                                block_status.pop();
+
+                        } else if (!l.active)
+                            ;
+
+                        else if (s.mnemonic == "org") {
+                            if (s.operand.src_pending < 0 || evaluate(l, i, s.operand.src_pending, false, val))
+                                l.addr = addr = val;
+
+                        } else if (s.mnemonic == "bank")
+                            // addresses here are of the default layout only
+                            l.diagnostics += "error: BANK is left to the full assembler\n";
+
+                        else if (s.mnemonic == "00label")
+                            labels[s.label].push_back({static_cast<unsigned char>(addr), i, true});
+
+                        else if (s.mnemonic == "00const") {
+                            // may wait for labels defined later
+                            std::string diagnostics = l.diagnostics;
+                            bool resolved = s.operand.src_pending < 0 ||
+                                            evaluate(l, i, s.operand.src_pending, false, val);
+
+                            l.diagnostics = diagnostics;
+                            consts[s.label].push_back({val, i, resolved});
+
+                            if (!resolved)
+                                pending_consts.push_back(i);
+
+                        } else
+                            l.size = get_size(l, i, s);
+                    }
+
+                    if (l.size) {
+                        if (addr + l.size > 256) {
+                            l.diagnostics += "error: em overflow\n";
+                            l.size = 0;
+                        }
+
+                        for (unsigned j = addr; j < addr + l.size; j++)
+                            if (usage.at(j)++)
+                                overlapped = true;
+
+                        addr += l.size;
+                    }
+
+                    if (l.active != old_active || l.addr != old_addr || l.size != old_size)
+                        l.dirty = true;
+                }
+
+                for (size_t i : pending_consts)
+                    for (const ASStatement &s : lines.at(i).statements)
+                        if (s.mnemonic == "00const")
+                            for (Symbol &d : consts.at(s.label))
+                                if (d.line == i)
+                                    d.resolved = evaluate(lines.at(i), i, s.operand.src_pending, true, d.value);
+
+                std::unordered_map<std::string, bool> changed;
+                find_changes(old_consts, consts, changed);
+                find_changes(old_labels, labels, changed);
+                edit_count = edit_delta = 0;
+
+                // overlapping bytes depend on the order of writes, so start over
+                bool full = overlapped || had_overlap;
+
+                if (full) {
+                    as.em.clear();
+                    as.em_lines.fill(0);
+                    as.em_instructions.reset();
+                    owner.fill(-1);
+                }
+
+                for (size_t i = 0; i < lines.size(); i++) {
+                    Line &l = lines.at(i);
+
+                    // lines that failed to resolve are tried again, their line numbers may have moved
+                    if (full || l.dirty || !l.emit_diagnostics.empty() || std::any_of(l.symbols.begin(), l.symbols.end(),
+                    [&](const std::string & s) {
+                    return changed.count(s);
+                    })) {
+                        clear_bytes(l);
+                        emit(l, i);
+                    }
+
+                    l.dirty = false;
+                }
+
+                as.consts.clear();
+                as.labels.clear();
+
+                for (const auto &[name, c] : consts)
+                    if (c.back().resolved)
+                        as.consts[name] = std::make_pair(c.back().value, c.back().line + 1);
+
+                for (const auto &[name, c] : labels)
+                    as.labels[name] = std::make_pair(c.back().value, c.back().line + 1);
+            }
+
+            // symbols whose value changed, or which moved other than by the last edit
+            void find_changes(
+                const SymbolTable &a,
+                const SymbolTable &b,
+                std::unordered_map<std::string, bool> &changed
+            ) const
+            {
+                for (const auto &[name, defs] : a) {
+                    SymbolTable::const_iterator i = b.find(name);
+                    std::vector<Symbol> moved(defs);
+
+                    for (Symbol &d : moved)
+                        d.line = d.line < edit_first ? d.line :
+                                 d.line >= edit_first + edit_count ? d.line + edit_delta : SIZE_MAX;
+
+                    if (i == b.end() || i->second != moved)
+                        changed[name] = true;
+                }
+
+                for (const auto &[name, defs] : b)
+                    if (!a.count(name))
+                        changed[name] = true;
+            }
+
+            void clear_bytes(Line &l)
+            {
+                if (!l.emitted)
+                    return;
+
+                for (unsigned i = l.emitted_addr; i < l.emitted_addr + l.emitted_size; i++)
+                    if (owner.at(i) == &l - lines.data()) {
+                        as.em.set_data_at(i, 0);
+                        as.em_lines.at(i) = 0;
+                        as.em_instructions.reset(i);
+                        owner.at(i) = -1;
+                    }
+
+                l.emitted = false;
+            }
+
+            void emit(Line &l, size_t line)
+            {
+                std::string layout_diagnostics;
+
+                l.emit_diagnostics.clear();
+
+                if (!l.active || !l.size)
+                    return;
+
+                // evaluate() reports into diagnostics, which the next layout clears
+                layout_diagnostics.swap(l.diagnostics);
+
+                for (const ASStatement &s : l.statements) {
+                    struct InstructionOperand operand = s.operand;
+
+                    if (s.mnemonic.front() == '0' || s.mnemonic == "org" || s.mnemonic == "bank")
+                        continue;
+
+                    if (
+                        (operand.src_type == OperandType::IMMED || operand.src_type == OperandType::MEMADDR) &&
+                        operand.src_pending >= 0 &&
+                        !evaluate(l, line, operand.src_pending, true, operand.src)
+                    )
+                        operand.src = 0;
+
+                    if (
+                        (operand.dst_type == OperandType::IMMED || operand.dst_type == OperandType::MEMADDR) &&
+                        operand.dst_pending >= 0 &&
+                        !evaluate(l, line, operand.dst_pending, true, operand.dst)
+                    )
+                        operand.dst = 0;
+
+                    operand.src_pending = operand.dst_pending = -1;
+                    as.em.set_addr(l.addr);
+                    as.overflow = false;
+                    as.add_instruction(s.mnemonic, s.label, operand, s.lineno + line - l.parsed_line);
+                }
+
+                l.emit_diagnostics.swap(l.diagnostics);
+                l.diagnostics.swap(layout_diagnostics);
+
+                for (unsigned i = l.addr; i < l.addr + l.size; i++)
+                    owner.at(i) = line;
+
+                l.emitted = true;
+                l.emitted_addr = l.addr;
+                l.emitted_size = l.size;
+            }
+
+            std::vector<Line> lines;
+            SymbolTable consts, labels;
+            std::array<int, 256> owner; // line that wrote each byte of em
+            bool overlapped;
+            size_t edit_first, edit_count; // lines replaced by the last edit
+            long edit_delta;
+    };
+}
+
+#endif // INCREMENTAL_HPP_INCLUDED
@@ -0,0 +1,798 @@
+#ifndef OPTIMIZER_HPP_INCLUDED
+#define OPTIMIZER_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "as.hpp"
+
+namespace COP2K
+{
+    // one sequence replaced by the optimizer
+    struct OptimizerRewrite {
+        unsigned lineno; // of the first instruction replaced
+        std::string before, after; // instructions separated by "; ", after is empty if removed
+        unsigned cycles_saved, bytes_saved;
+    };
+
+    /* peephole optimizer working on assembly source
+     *
+     * straight line sequences of up to 3 instructions are replaced by a
+     * shorter subsequence or by one instruction of the loaded set when that
+     * takes fewer clocks (signal_count). a rewrite is only kept if running
+     * both versions on the machine, from many random states, always ends in
+     * the same registers, flags and memory
+     *
+     * the result has as many lines as the source, replaced instructions
+     * are commented out. code is expected to be addressed through labels:
+     * nothing that a literal memory operand points to is moved
+     */
+    class PeepholeOptimizer
+    {
+        public:
+            PeepholeOptimizer(const Opcode &opcode) :
+                opcode(opcode),
+                machine([](COP2K &, COP2KCallbackType) {})
+            {
+                machine.load_instruction(opcode);
+                machine.running_manually.neg();
+                machine.manual_dbus.neg();
+            }
+
+            // source is returned unchanged if it does not assemble
+            std::string optimize(const std::string &source, std::vector<OptimizerRewrite> &rewrites)
+            {
+                std::vector<ASStatement> statements;
+                std::vector<PendingExpression> expressions;
+                std::vector<std::vector<const ASStatement *>> line_statements;
+                std::ostringstream err;
+                AS as;
+
+                rewrites.clear();
+                operands.clear();
+                operand_index.clear();
+                pinned.clear();
+                lines.clear();
+                split_lines(source);
+
+                if (source.empty())
+                    return source;
+
+                as.opcode = opcode;
+                as.diagnostics = &err;
+
+                try {
+                    FILE *in = fmemopen(const_cast<char *>(source.data()), source.size(), "r");
+
+                    if (!in)
+                        return source;
+
+                    as.assemble_file(in);
+                    fclose(in);
+
+                    if (!err.str().empty())
+                        return source;
+
+                    in = fmemopen(const_cast<char *>(source.data()), source.size(), "r");
+
+                    if (!in)
+                        return source;
+
+                    bool ok = parse_statements(in, 1, statements, expressions, err);
+                    fclose(in);
+
+                    if (!ok)
+                        return source;
+
+                } catch (const std::exception &) {
+                    return source;
+                }
+
+                line_addr.assign(lines.size(), -1);
+                line_statements.resize(lines.size());
+
+                em_lines = as.em_lines;
+
+                for (int i = 255; i >= 0; i--)
+                    if (em_lines.at(i) && em_lines.at(i) <= lines.size())
+                        line_addr.at(em_lines.at(i) - 1) = i;
+
+                for (const ASStatement &s : statements) {
+                    if (s.lineno && s.lineno <= lines.size())
+                        line_statements.at(s.lineno - 1).push_back(&s);
+
+                    record_pinned(s);
+                }
+
+                std::vector<Item> block;
+
+                for (size_t i = 0; i < lines.size(); i++) {
+                    const std::vector<const ASStatement *> &l = line_statements.at(i);
+                    const Opcode::Instruction *ins = nullptr;
+
+                    // comments do not break sequences
+                    if (l.empty())
+                        continue;
+
+                    if (l.size() == 1 && line_addr.at(i) >= 0 && l.front()->mnemonic.front() != '0')
+                        ins = opcode.find_from_mnemonic(
+                                  l.front()->mnemonic,
+                                  l.front()->operand.src_type,
+                                  l.front()->operand.dst_type
+                              );
+
+                    if (ins && is_plain(*ins)) {
+                        block.push_back(make_item(*ins, *l.front(), i, expressions));
+                        continue;
+                    }
+
+                    optimize_block(block, rewrites);
+                    block.clear();
+                }
+
+                optimize_block(block, rewrites);
+
+                std::string ret;
+
+                for (size_t i = 0; i < lines.size(); i++) {
+                    ret += lines.at(i).text;
+
+                    if (i + 1 < lines.size() || lines.at(i).newline)
+                        ret += '\n';
+                }
+
+                return ret;
+            }
+
+        private:
+            // value of a #II or MM operand
+            struct Operand {
+                bool known; // a literal, otherwise it depends on symbols
+                unsigned char value;
+                std::string text;
+            };
+
+            struct Item {
+                const Opcode::Instruction *ins;
+                unsigned char reg; // for R? and @R?
+                int src, dst; // index in operands for #II and MM, or -1
+                size_t line;
+                std::array<std::string, 2> text; // of src and dst as written, if any
+            };
+
+            struct Line {
+                std::string text;
+                std::string original;
+                bool newline;
+            };
+
+            // machine state before a sequence runs
+            struct Trial {
+                std::array<unsigned char, 256> em;
+                std::vector<unsigned char> values; // of operands
+                unsigned char a, w, mar, st, out, in;
+                std::array<unsigned char, 4> r;
+                bool cy, z;
+            };
+
+            // what a sequence may change
+            struct State {
+                std::array<unsigned char, 256> em;
+                unsigned char a, w, mar, st, out, pc;
+                std::array<unsigned char, 4> r;
+                bool cy, z, fen, cn, s2, s1, s0;
+
+                bool operator==(const State &) const = default;
+            };
+
+            static constexpr unsigned MAX_WINDOW = 3;
+            static constexpr unsigned TRIAL_COUNT = 64;
+
+            static bool has_operand_byte(OperandType type)
+            {
+                return type == OperandType::IMMED || type == OperandType::MEMADDR;
+            }
+
+            static bool has_reg(OperandType type)
+            {
+                return type == OperandType::REG || type == OperandType::REGADDR;
+            }
+
+            static std::string trim(const std::string &s)
+            {
+                std::string::size_type begin = s.find_first_not_of(" \t\r");
+
+                if (begin == std::string::npos)
+                    return std::string();
+
+                return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+            }
+
+            void split_lines(const std::string &source)
+            {
+                std::string::size_type begin = 0, end;
+
+                while ((end = source.find('\n', begin)) != std::string::npos) {
+                    lines.push_back({source.substr(begin, end - begin), source.substr(begin, end - begin), true});
+                    begin = end + 1;
+                }
+
+                if (begin < source.size())
+                    lines.push_back({source.substr(begin), source.substr(begin), false});
+            }
+
+            // operands as written, e.g. "A" and "#COUNT + 1"
+            static std::vector<std::string> split_operands(const std::string &text)
+            {
+                std::vector<std::string> ret;
+                std::string s = text.substr(0, text.find(';'));
+                std::string::size_type begin = s.find_first_not_of(" \t");
+
+                if (begin == std::string::npos || (begin = s.find_first_of(" \t", begin)) == std::string::npos)
+                    return ret;
+
+                std::istringstream iss(s.substr(begin));
+                std::string tmp;
+
+                while (std::getline(iss, tmp, ','))
+                    ret.push_back(trim(tmp));
+
+                return ret;
+            }
+
+            static std::string expression_key(const std::vector<PendingExpression> &expressions, int index)
+            {
+                if (index < 0)
+                    return std::string();
+
+                const PendingExpression &e = expressions.at(index);
+
+                switch (e.op) {
+                    case '#':
+                        return std::to_string(e.value);
+
+                    case 'L':
+                        return e.symbol;
+
+                    default:
+                        return std::format("({}{}{})", expression_key(expressions, e.lhs), e.op,
+                                           expression_key(expressions, e.rhs));
+                }
+            }
+
+            int add_operand(
+                const std::vector<PendingExpression> &expressions,
+                unsigned char value,
+                int pending,
+                const std::string &text
+            )
+            {
+                // equal expressions always have equal values
+                std::string key = pending < 0 ? std::format("#{}", value) :
+                                  "E" + expression_key(expressions, pending);
+                std::map<std::string, int>::const_iterator i = operand_index.find(key);
+
+                if (i != operand_index.end())
+                    return i->second;
+
+                // literals are written again, as equal values may be written differently
+                operands.push_back({pending < 0, value, pending < 0 ? std::format("0{:02X}H", value) : text});
+                operand_index.emplace(key, operands.size() - 1);
+                return operands.size() - 1;
+            }
+
+            Item make_item(
+                const Opcode::Instruction &ins,
+                const ASStatement &s,
+                size_t line,
+                const std::vector<PendingExpression> &expressions
+            )
+            {
+                std::vector<std::string> text = split_operands(lines.at(line).text);
+                Item ret = {&ins, 0, -1, -1, line, {}};
+
+                text.resize(2);
+
+                for (unsigned i = 0; i < 2; i++)
+                    ret.text.at(i) = trim(text.at(i).substr(text.at(i).starts_with('#')));
+
+                if (has_reg(s.operand.src_type))
+                    ret.reg = s.operand.src;
+
+                else if (has_reg(s.operand.dst_type))
+                    ret.reg = s.operand.dst;
+
+                if (has_operand_byte(s.operand.src_type))
+                    ret.src = add_operand(expressions, s.operand.src, s.operand.src_pending, ret.text.at(0));
+
+                if (has_operand_byte(s.operand.dst_type))
+                    ret.dst = add_operand(expressions, s.operand.dst, s.operand.dst_pending, ret.text.at(1));
+
+                return ret;
+            }
+
+            // an immediate may as well be an address, loaded into a register
+            void record_pinned(const ASStatement &s)
+            {
+                if (has_operand_byte(s.operand.src_type) && s.operand.src_pending < 0)
+                    pinned.push_back(s.operand.src);
+
+                if (has_operand_byte(s.operand.dst_type) && s.operand.dst_pending < 0)
+                    pinned.push_back(s.operand.dst);
+            }
+
+            /* instructions that neither jump, touch interrupts nor do I/O,
+             * and whose micro words are all sound
+             */
+            bool is_plain(const Opcode::Instruction &ins) const
+            {
+                if (!ins.exist || !ins.signal_count || ins.mnemonic.front() == '_')
+                    return false;
+
+                for (unsigned char j = 0; j < ins.signal_count; j++) {
+                    const std::bitset<24> &word = ins.microprogram.at(j);
+
+                    if (
+                        opcode.get_um_issues((ins.byte & ~0x3) | j) ||
+                        !word.test(16) || // elp
+                        !word.test(17) || // eint
+                        !word.test(13) || // outen
+                        !(word.to_ulong() >> 5 & 0x7) // IN on the data bus
+                    )
+                        return false;
+                }
+
+                return true;
+            }
+
+            static bool same(const Item &a, const Item &b)
+            {
+                return a.ins == b.ins && a.reg == b.reg && a.src == b.src && a.dst == b.dst && a.line == b.line;
+            }
+
+            static unsigned get_cost(const std::vector<Item> &items)
+            {
+                unsigned ret = 0;
+
+                for (const Item &i : items)
+                    ret += i.ins->signal_count;
+
+                return ret;
+            }
+
+            static unsigned get_size(const std::vector<Item> &items)
+            {
+                unsigned ret = 0;
+
+                for (const Item &i : items)
+                    ret += 1 + has_operand_byte(i.ins->src) + has_operand_byte(i.ins->dst);
+
+                return ret;
+            }
+
+            std::string to_string(const Item &item) const
+            {
+                std::string ret = item.ins->mnemonic;
+                const char *sep = " ";
+
+                for (unsigned j = 0; j < 2; j++) {
+                    OperandType type = j ? item.ins->dst : item.ins->src;
+                    int index = j ? item.dst : item.src;
+                    std::string text = index < 0 ? std::string() :
+                                       !item.text.at(j).empty() ? item.text.at(j) : operands.at(index).text;
+
+                    switch (type) {
+                        case OperandType::NONE:
+                            continue;
+
+                        case OperandType::REG_A:
+                            ret += std::format("{}A", sep);
+                            break;
+
+                        case OperandType::REG:
+                            ret += std::format("{}R{}", sep, item.reg);
+                            break;
+
+                        case OperandType::REGADDR:
+                            ret += std::format("{}@R{}", sep, item.reg);
+                            break;
+
+                        case OperandType::IMMED:
+                            ret += std::format("{}#{}", sep, text);
+                            break;
+
+                        case OperandType::MEMADDR:
+                            ret += std::format("{}{}", sep, text);
+                            break;
+                    }
+
+                    sep = ", ";
+                }
+
+                return ret;
+            }
+
+            std::string to_string(const std::vector<Item> &items) const
+            {
+                std::string ret;
+
+                for (const Item &i : items)
+                    ret += (ret.empty() ? "" : "; ") + to_string(i);
+
+                return ret;
+            }
+
+            // identifies a sequence up to the naming of its symbolic operands
+            std::string get_key(const std::vector<Item> &items, std::map<int, int> &names) const
+            {
+                std::string ret;
+
+                for (const Item &i : items) {
+                    ret += std::format("{:02X}.{}", i.ins->byte, i.reg);
+
+                    for (int j : {
+                                i.src, i.dst
+                            })
+                        if (j < 0)
+                            ret += ",-";
+
+                        else if (operands.at(j).known)
+                            ret += std::format(",#{}", operands.at(j).value);
+
+                        else
+                            ret += std::format(",${}", names.emplace(j, names.size()).first->second);
+
+                    ret += ';';
+                }
+
+                return ret;
+            }
+
+            std::vector<unsigned char> encode(const std::vector<Item> &items, const Trial &t) const
+            {
+                std::vector<unsigned char> ret;
+
+                for (const Item &i : items) {
+                    ret.push_back(i.ins->byte | (has_reg(i.ins->src) || has_reg(i.ins->dst) ? i.reg : 0));
+
+                    if (i.src >= 0)
+                        ret.push_back(t.values.at(i.src));
+
+                    if (i.dst >= 0)
+                        ret.push_back(t.values.at(i.dst));
+                }
+
+                return ret;
+            }
+
+            // false if the machine rejects the sequence or it modifies itself
+            bool run(const std::vector<Item> &items, const Trial &t, unsigned base, unsigned span, State &ret)
+            {
+                std::vector<unsigned char> code = encode(items, t);
+                // _FATCH_ first, then every instruction ends by fetching the next one
+                unsigned clock_count = 1 + get_cost(items);
+
+                for (unsigned i = 0; i < 256; i++)
+                    machine.set_em_data(i, t.em.at(i));
+
+                for (unsigned i = 0; i < code.size(); i++)
+                    machine.set_em_data(base + i, code.at(i));
+
+                machine.a.set(t.a);
+                machine.w.set(t.w);
+                machine.r0.set(t.r.at(0));
+                machine.r1.set(t.r.at(1));
+                machine.r2.set(t.r.at(2));
+                machine.r3.set(t.r.at(3));
+                machine.mar.set(t.mar);
+                machine.st.set(t.st);
+                machine.out.set(t.out);
+                machine.in.set(t.in);
+                machine.set_cy(t.cy);
+                machine.set_z(t.z);
+                machine.ireq.neg();
+                machine.iack.neg();
+                machine.pc.set(base);
+                machine.upc.set(0);
+
+                try {
+                    while (clock_count--)
+                        machine.run_clock();
+
+                } catch (const std::logic_error &) {
+                    return false;
+                }
+
+                for (unsigned i = 0; i < code.size(); i++)
+                    if (machine.get_em_data(base + i) != code.at(i))
+                        return false;
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret.em.at(i) = i >= base && i < base + span ? 0 : machine.get_em_data(i);
+
+                ret.a = machine.a.get();
+                ret.w = machine.w.get();
+                ret.mar = machine.mar.get();
+                ret.st = machine.st.get();
+                ret.out = machine.out.get();
+                ret.pc = machine.pc.get() - code.size();
+                ret.r = {machine.r0.get(), machine.r1.get(), machine.r2.get(), machine.r3.get()};
+                ret.cy = machine.get_cy();
+                ret.z = machine.get_z();
+                ret.fen = machine.get_fen();
+                ret.cn = machine.get_cn();
+                ret.s2 = machine.s2.get();
+                ret.s1 = machine.s1.get();
+                ret.s0 = machine.s0.get();
+                return true;
+            }
+
+            /* random machine states, with symbolic operands sometimes equal
+             * to each other. addresses never point into the code
+             */
+            void make_trials(std::vector<Trial> &trials, unsigned base, unsigned span)
+            {
+                std::uniform_int_distribution<unsigned> byte(0, 255);
+                std::array<unsigned char, 4> edges = {0x00, 0xFF, 0x80, 0x7F};
+                auto address = [&]() {
+                    unsigned ret;
+
+                    do
+                        ret = byte(rng);
+
+                    while (ret >= base && ret < base + span);
+
+                    return static_cast<unsigned char>(ret);
+                };
+
+                trials.resize(TRIAL_COUNT);
+
+                for (unsigned i = 0; i < TRIAL_COUNT; i++) {
+                    Trial &t = trials.at(i);
+                    std::array<unsigned char, 2> pool = {address(), address()};
+
+                    for (unsigned char &j : t.em)
+                        j = byte(rng);
+
+                    t.a = i < edges.size() ? edges.at(i) : byte(rng);
+                    t.w = i < edges.size() ? edges.at(edges.size() - 1 - i) : byte(rng);
+                    t.st = byte(rng);
+                    t.out = byte(rng);
+                    t.in = byte(rng);
+                    t.mar = address();
+                    t.cy = byte(rng) & 1;
+                    t.z = byte(rng) & 1;
+
+                    for (unsigned char &j : t.r)
+                        j = address();
+
+                    t.values.resize(operands.size());
+
+                    for (size_t j = 0; j < operands.size(); j++)
+                        t.values.at(j) = operands.at(j).known ? operands.at(j).value :
+                                         i & 1 ? pool.at(byte(rng) & 1) : address();
+                }
+            }
+
+            // code address clear of every literal operand
+            bool find_base(unsigned span, unsigned &base) const
+            {
+                for (base = 0x40; base + span <= 256; base += 0x10)
+                    if (std::none_of(operands.begin(), operands.end(), [&](const Operand & i) {
+                    return i.known && i.value >= base && i.value < base + span;
+                }))
+                return true;
+
+                return false;
+            }
+
+            bool verify(
+                const std::vector<Item> &window,
+                const std::vector<Item> &candidate,
+                const std::vector<Trial> &trials,
+                const std::vector<State> &expected,
+                unsigned base,
+                unsigned span
+            )
+            {
+                std::map<int, int> names;
+                std::string key = get_key(window, names);
+                key += '|' + get_key(candidate, names);
+                std::map<std::string, bool>::const_iterator i = verified.find(key);
+                State s;
+
+                if (i != verified.end())
+                    return i->second;
+
+                for (size_t j = 0; j < trials.size(); j++)
+                    if (!run(candidate, trials.at(j), base, span, s) || !(s == expected.at(j)))
+                        return verified[key] = false;
+
+                return verified[key] = true;
+            }
+
+            // cheaper sequences that may do the same as window
+            void find_candidates(const std::vector<Item> &window, std::vector<std::vector<Item>> &ret) const
+            {
+                unsigned cost = get_cost(window);
+                std::vector<int> values;
+
+                for (unsigned mask = 0; mask + 1 < 1u << window.size(); mask++) {
+                    std::vector<Item> c;
+
+                    for (unsigned j = 0; j < window.size(); j++)
+                        if (mask & 1 << j)
+                            c.push_back(window.at(j));
+
+                    ret.push_back(c);
+                }
+
+                for (const Item &i : window)
+                    for (int j : {
+                                i.src, i.dst
+                            })
+                        if (j >= 0 && std::find(values.begin(), values.end(), j) == values.end())
+                            values.push_back(j);
+
+                for (const Opcode::Instruction &ins : opcode) {
+                    if (!ins.exist || ins.signal_count >= cost || !is_plain(ins))
+                        continue;
+
+                    std::vector<int> src = {-1}, dst = {-1};
+                    unsigned reg_count = has_reg(ins.src) || has_reg(ins.dst) ? 4 : 1;
+
+                    if (has_operand_byte(ins.src))
+                        src = values;
+
+                    if (has_operand_byte(ins.dst))
+                        dst = values;
+
+                    for (unsigned reg = 0; reg < reg_count; reg++)
+                        for (int s : src)
+                            for (int d : dst)
+                                ret.push_back({{&ins, static_cast<unsigned char>(reg), s, d, window.front().line, {}}});
+                }
+
+                std::stable_sort(ret.begin(), ret.end(), [](const std::vector<Item> &a, const std::vector<Item> &b) {
+                    unsigned ca = get_cost(a), cb = get_cost(b);
+                    return ca < cb || (ca == cb && get_size(a) < get_size(b));
+                });
+            }
+
+            /* changing the size of the window at line moves what follows it
+             * up to the next gap, where no literal operand may point
+             */
+            bool may_resize(size_t line) const
+            {
+                unsigned first = line_addr.at(line), last = first;
+
+                while (last < 255 && em_lines.at(last + 1))
+                    last++;
+
+                return std::none_of(pinned.begin(), pinned.end(), [&](unsigned char i) {
+                    return i > first && i <= last;
+                });
+            }
+
+            void comment_out(size_t line)
+            {
+                Line &l = lines.at(line);
+                std::string::size_type indent = l.original.find_first_not_of(" \t");
+
+                l.text = l.original.substr(0, indent) + "; -O: " + trim(l.original);
+            }
+
+            // replace the best window starting at first, false if there is none
+            bool rewrite(std::vector<Item> &block, size_t first, std::vector<OptimizerRewrite> &rewrites)
+            {
+                std::vector<Item> best, best_window;
+                unsigned best_saving = 0;
+
+                for (size_t size = 1; size <= MAX_WINDOW && first + size <= block.size(); size++) {
+                    std::vector<Item> window(block.begin() + first, block.begin() + first + size);
+                    std::vector<std::vector<Item>> candidates;
+                    std::vector<Trial> trials;
+                    std::vector<State> expected(TRIAL_COUNT);
+                    unsigned cost = get_cost(window), span = std::max(get_size(window), 3u) + 1, base;
+                    bool resizable = may_resize(window.front().line);
+
+                    if (!find_base(span, base))
+                        continue;
+
+                    make_trials(trials, base, span);
+                    bool runs = true;
+
+                    for (size_t i = 0; i < trials.size() && runs; i++)
+                        runs = run(window, trials.at(i), base, span, expected.at(i));
+
+                    // nor will any longer window
+                    if (!runs)
+                        break;
+
+                    find_candidates(window, candidates);
+
+                    for (const std::vector<Item> &c : candidates) {
+                        if (cost - get_cost(c) <= best_saving)
+                            break;
+
+                        if (
+                            (!resizable && get_size(c) != get_size(window)) ||
+                            !verify(window, c, trials, expected, base, span)
+                        )
+                            continue;
+
+                        best = c;
+                        best_window = window;
+                        best_saving = cost - get_cost(c);
+                        break;
+                    }
+                }
+
+                if (!best_saving)
+                    return false;
+
+                rewrites.push_back({
+                    static_cast<unsigned>(best_window.front().line + 1),
+                    to_string(best_window),
+                    to_string(best),
+                    best_saving,
+                    get_size(best_window) - std::min(get_size(best), get_size(best_window))
+                });
+
+                for (const Item &i : best_window) {
+                    std::vector<Item>::const_iterator j = std::find_if(best.begin(), best.end(), [&](const Item & k) {
+                        return k.line == i.line;
+                    });
+
+                    if (j == best.end())
+                        comment_out(i.line);
+
+                    // a new instruction takes the place of the first one
+                    else if (!same(*j, i)) {
+                        Line &l = lines.at(i.line);
+                        std::string::size_type indent = l.original.find_first_not_of(" \t");
+
+                        l.text = l.original.substr(0, indent) + to_string(*j) + " ; -O: " + trim(l.original);
+                    }
+                }
+
+                block.erase(block.begin() + first, block.begin() + first + best_window.size());
+                block.insert(block.begin() + first, best.begin(), best.end());
+                return true;
+            }
+
+            void optimize_block(std::vector<Item> &block, std::vector<OptimizerRewrite> &rewrites)
+            {
+                size_t i = 0;
+
+                // a rewrite may enable another one just before it
+                while (i < block.size())
+                    if (rewrite(block, i, rewrites))
+                        i = i >= MAX_WINDOW - 1 ? i - (MAX_WINDOW - 1) : 0;
+
+                    else
+                        i++;
+            }
+
+            const Opcode &opcode;
+            COP2K machine;
+            std::mt19937 rng;
+            std::vector<Operand> operands;
+            std::map<std::string, int> operand_index;
+            std::map<std::string, bool> verified; // sequence pairs already simulated
+            std::vector<unsigned char> pinned; // literal operands, any of which may be an address
+            std::vector<Line> lines;
+            std::vector<int> line_addr; // of every line, -1 if it emits nothing
+            std::array<unsigned, 256> em_lines; // before optimization
+    };
+}
+
+#endif // OPTIMIZER_HPP_INCLUDED
@@ -0,0 +1,3 @@
+mov a, #1
+bank 20
+mov a, #2
@@ -0,0 +1,9 @@
+; -O must not move data an immediate points to
+mov a, #01h
+mov a, #02h
+mov r0, #0ah
+mov a, @r0
+out
+halt:
+jmp halt
+db 0aah
@@ -0,0 +1,71 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "cc.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: cc <instr.txt> <file.c|-> [-o <out.asm>]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    const char *out_path = nullptr;
+
+    if ((argc != 3 && argc != 5) || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 5) {
+        if (strcmp(argv[3], "-o")) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        out_path = argv[4];
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[1], opcode);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream ifs;
+    std::istream &in = strcmp(argv[2], "-") ? (ifs.open(argv[2]), ifs) : std::cin;
+
+    if (!in)
+        return EXIT_FAILURE;
+
+    std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string out;
+
+    try {
+        COP2K::CC cc(opcode);
+        out = cc.compile(source);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!out_path) {
+        std::cout << out;
+        return EXIT_SUCCESS;
+    }
+
+    std::ofstream ofs(out_path);
+
+    if (!(ofs << out))
+        return EXIT_FAILURE;
+}
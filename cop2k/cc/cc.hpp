@@ -0,0 +1,1372 @@
+#ifndef CC_HPP_INCLUDED
+#define CC_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <format>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "libcop2k.hpp"
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    /* compiler of a small C subset to assembly for the loaded instruction set
+     *
+     *   program   := (global | function)*
+     *   global    := type name ('=' expr)? ';'
+     *   function  := type name '(' 'void'? ')' block
+     *   block     := '{' statement* '}'
+     *   statement := block | type name ('=' expr)? ';' | name '=' expr ';'
+     *              | name '(' ')' ';' | 'return' ';' | ';'
+     *              | 'if' '(' cond ')' statement ('else' statement)?
+     *              | 'while' '(' cond ')' statement
+     *   cond      := '!' term | '!' '(' cond ')' | expr (('==' | '!=') expr)?
+     *   expr      := and ('|' and)*
+     *   and       := sum ('&' sum)*
+     *   sum       := term (('+' | '-') term)*
+     *   term      := number | name | '(' expr ')'
+     *
+     * every type is an unsigned byte. globals and locals are bytes after
+     * the code, and as nothing can recurse every local has its own. the
+     * machine keeps a single return address in ST, so only main may call
+     * functions. main comes first in memory and ends in a jump to itself
+     *
+     * nothing is assumed about the instruction set: every primitive needed
+     * (A = [m], A = A + W, R = #k, ...) is found by running each instruction
+     * on the machine from random states, and every operation is emitted as
+     * the sequence of primitives taking the fewest clocks, e.g. ADD A, MM,
+     * or MOV R0, #II then ADD A, @R0 on a set without the former
+     */
+    class CC
+    {
+        public:
+            CC(const Opcode &opcode) :
+                opcode(opcode),
+                machine([](COP2K &, COP2KCallbackType) {})
+            {
+                machine.load_instruction(opcode);
+                machine.running_manually.neg();
+                machine.manual_dbus.neg();
+                find_primitives();
+                find_jumps();
+            }
+
+            // assembly for the as tool, throws std::runtime_error on the first error
+            std::string compile(const std::string &source)
+            {
+                std::string ret;
+
+                tokenize(source);
+                pos = 0;
+                label_count = 0;
+                labels.clear();
+                globals.clear();
+                functions.clear();
+                called.clear();
+                selections.clear();
+                data.clear();
+
+                while (peek().type != Token::END)
+                    parse_top_level();
+
+                auto main = std::find_if(functions.begin(), functions.end(), [](const Function & f) {
+                    return f.name == "main";
+                });
+
+                if (main == functions.end())
+                    throw std::runtime_error("no main function");
+
+                for (const auto &[name, line] : called)
+                    if (!find_function(name))
+                        throw std::runtime_error(std::format("line {}: undefined function {}", line, name));
+
+                ret += "; compiled by cc, operations used:\n";
+
+                for (const auto &[key, s] : selections)
+                    ret += std::format(";   {:<14}{} ({} clocks)\n", describe(key.first, key.second),
+                                       to_string(s), s.cost);
+
+                // reset starts at address 0
+                std::rotate(functions.begin(), main, main + 1);
+
+                for (const Function &f : functions)
+                    for (const std::string &i : f.code)
+                        ret += i + '\n';
+
+                for (const std::string &i : data)
+                    ret += i + '\n';
+
+                ret += "    END\n";
+                return ret;
+            }
+
+        private:
+            enum class Op {
+                NONE,
+                ADD,
+                SUB,
+                AND,
+                OR
+            };
+
+            // what a single instruction may do, R is a register and P its operand
+            enum class Prim {
+                LOAD_IMM, // A = P
+                LOAD, // A = [P]
+                STORE, // [P] = A
+                A_TO_W, // W = A
+                A_TO_R, // R = A
+                R_TO_A, // A = R
+                R_TO_W, // W = R
+                IMM_TO_R, // R = P
+                LOAD_IND, // A = [R]
+                STORE_IND, // [R] = A
+                OP_W, // A = A op W
+                OP_IMM, // A = A op P
+                OP_MEM, // A = A op [P]
+                OP_R, // A = A op R
+                OP_IND // A = A op [R]
+            };
+
+            // operations of the code generator
+            enum class Action {
+                LOAD_IMM, // A = k
+                LOAD, // A = [m]
+                STORE, // [m] = A
+                OP_IMM, // A = A op k
+                OP_MEM, // A = A op [m]
+                TEST // Z = A == 0
+            };
+
+            static constexpr int PARAM = -1; // the operand of the action
+
+            struct Form {
+                const Opcode::Instruction *ins;
+                unsigned char reg;
+                bool sets_z; // Z always follows A afterwards
+            };
+
+            struct Step {
+                Prim prim;
+                Op op;
+                int param; // PARAM, a constant, or -2 if none
+            };
+
+            struct Selection {
+                std::vector<Step> steps;
+                unsigned char reg; // used by every step with a register
+                unsigned cost;
+            };
+
+            struct Trial {
+                std::array<unsigned char, 256> em;
+                unsigned char a, w, st, p;
+                std::array<unsigned char, 4> r;
+            };
+
+            struct State {
+                std::array<unsigned char, 256> em;
+                unsigned char a, w, st;
+                std::array<unsigned char, 4> r;
+                bool z;
+
+                bool operator==(const State &) const = default;
+            };
+
+            struct Token {
+                enum Type {
+                    END,
+                    NAME,
+                    NUMBER,
+                    PUNCT
+                } type;
+                std::string text;
+                unsigned value;
+                unsigned line;
+            };
+
+            struct Expr {
+                char op; // '#' for a number, 'v' for a variable, or + - & |
+                unsigned char value;
+                std::string label; // of the variable
+                bool parenthesized;
+                std::unique_ptr<Expr> lhs, rhs;
+            };
+
+            struct Cond {
+                std::unique_ptr<Expr> expr;
+                bool zero_is_true;
+            };
+
+            struct Function {
+                std::string name, label;
+                std::vector<std::string> code;
+                std::map<std::string, std::string> locals; // name and label
+                std::vector<std::string> temps;
+            };
+
+            static constexpr unsigned CODE_BASE = 0xF8; // where instructions run while searched
+            static constexpr unsigned TRIAL_COUNT = 32;
+            static constexpr int NO_PARAM = -2;
+
+            // ---- instruction selection
+
+            static bool has_operand_byte(OperandType type)
+            {
+                return type == OperandType::IMMED || type == OperandType::MEMADDR;
+            }
+
+            static bool has_reg(OperandType type)
+            {
+                return type == OperandType::REG || type == OperandType::REGADDR;
+            }
+
+            static bool has_param(Prim prim)
+            {
+                return prim == Prim::LOAD_IMM || prim == Prim::LOAD || prim == Prim::STORE ||
+                       prim == Prim::IMM_TO_R || prim == Prim::OP_IMM || prim == Prim::OP_MEM;
+            }
+
+            static bool has_reg(Prim prim)
+            {
+                return prim == Prim::A_TO_R || prim == Prim::R_TO_A || prim == Prim::R_TO_W ||
+                       prim == Prim::IMM_TO_R || prim == Prim::LOAD_IND || prim == Prim::STORE_IND ||
+                       prim == Prim::OP_R || prim == Prim::OP_IND;
+            }
+
+            static bool has_op(Prim prim)
+            {
+                return prim == Prim::OP_W || prim == Prim::OP_IMM || prim == Prim::OP_MEM ||
+                       prim == Prim::OP_R || prim == Prim::OP_IND;
+            }
+
+            static unsigned char calc(Op op, unsigned char a, unsigned char b)
+            {
+                switch (op) {
+                    case Op::ADD:
+                        return a + b;
+
+                    case Op::SUB:
+                        return a - b;
+
+                    case Op::AND:
+                        return a & b;
+
+                    case Op::OR:
+                        return a | b;
+
+                    default:
+                        return a;
+                }
+            }
+
+            /* instructions that neither jump, touch interrupts nor do I/O,
+             * and whose micro words are all sound
+             */
+            bool is_plain(const Opcode::Instruction &ins) const
+            {
+                if (!ins.exist || !ins.signal_count || ins.mnemonic.front() == '_')
+                    return false;
+
+                for (unsigned char j = 0; j < ins.signal_count; j++) {
+                    const std::bitset<24> &word = ins.microprogram.at(j);
+
+                    if (
+                        opcode.get_um_issues((ins.byte & ~0x3) | j) ||
+                        !word.test(16) || // elp
+                        !word.test(17) || // eint
+                        !word.test(13) || // outen
+                        !(word.to_ulong() >> 5 & 0x7) // IN on the data bus
+                    )
+                        return false;
+                }
+
+                return true;
+            }
+
+            // false if the machine rejects the instruction or it modifies itself
+            bool run(const Opcode::Instruction &ins, unsigned char reg, const Trial &t, State &ret)
+            {
+                std::vector<unsigned char> code = {
+                    static_cast<unsigned char>(ins.byte | (has_reg(ins.src) || has_reg(ins.dst) ? reg : 0))
+                };
+                // _FATCH_ first, then the instruction ends by fetching the next one
+                unsigned clock_count = 1 + ins.signal_count;
+
+                for (OperandType i : { ins.src, ins.dst })
+                    if (has_operand_byte(i))
+                        code.push_back(t.p);
+
+                for (unsigned i = 0; i < 256; i++)
+                    machine.set_em_data(i, i < CODE_BASE ? t.em.at(i) : 0);
+
+                for (unsigned i = 0; i < code.size(); i++)
+                    machine.set_em_data(CODE_BASE + i, code.at(i));
+
+                machine.a.set(t.a);
+                machine.w.set(t.w);
+                machine.r0.set(t.r.at(0));
+                machine.r1.set(t.r.at(1));
+                machine.r2.set(t.r.at(2));
+                machine.r3.set(t.r.at(3));
+                machine.st.set(t.st);
+                machine.ireq.neg();
+                machine.iack.neg();
+                machine.pc.set(CODE_BASE);
+                machine.upc.set(0);
+
+                try {
+                    while (clock_count--)
+                        machine.run_clock();
+
+                } catch (const std::logic_error &) {
+                    return false;
+                }
+
+                for (unsigned i = 0; i < code.size(); i++)
+                    if (machine.get_em_data(CODE_BASE + i) != code.at(i))
+                        return false;
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret.em.at(i) = i < CODE_BASE ? machine.get_em_data(i) : 0;
+
+                ret.a = machine.a.get();
+                ret.w = machine.w.get();
+                ret.st = machine.st.get();
+                ret.r = {machine.r0.get(), machine.r1.get(), machine.r2.get(), machine.r3.get()};
+                ret.z = machine.get_z();
+                return true;
+            }
+
+            // only the destination of prim may change, and W after an operation
+            static bool matches(Prim prim, Op op, unsigned char reg, const Trial &t, const State &s)
+            {
+                State e = {t.em, t.a, t.w, t.st, t.r, s.z};
+                unsigned char r = t.r.at(reg);
+
+                for (unsigned i = CODE_BASE; i < 256; i++)
+                    e.em.at(i) = 0;
+
+                switch (prim) {
+                    case Prim::LOAD_IMM:
+                        e.a = t.p;
+                        break;
+
+                    case Prim::LOAD:
+                        e.a = t.em.at(t.p);
+                        break;
+
+                    case Prim::STORE:
+                        e.em.at(t.p) = t.a;
+                        break;
+
+                    case Prim::A_TO_W:
+                        e.w = t.a;
+                        break;
+
+                    case Prim::A_TO_R:
+                        e.r.at(reg) = t.a;
+                        break;
+
+                    case Prim::R_TO_A:
+                        e.a = r;
+                        break;
+
+                    case Prim::R_TO_W:
+                        e.w = r;
+                        break;
+
+                    case Prim::IMM_TO_R:
+                        e.r.at(reg) = t.p;
+                        break;
+
+                    case Prim::LOAD_IND:
+                        e.a = t.em.at(r);
+                        break;
+
+                    case Prim::STORE_IND:
+                        e.em.at(r) = t.a;
+                        break;
+
+                    case Prim::OP_W:
+                        e.a = calc(op, t.a, t.w);
+                        break;
+
+                    case Prim::OP_IMM:
+                        e.a = calc(op, t.a, t.p);
+                        break;
+
+                    case Prim::OP_MEM:
+                        e.a = calc(op, t.a, t.em.at(t.p));
+                        break;
+
+                    case Prim::OP_R:
+                        e.a = calc(op, t.a, r);
+                        break;
+
+                    case Prim::OP_IND:
+                        e.a = calc(op, t.a, t.em.at(r));
+                        break;
+                }
+
+                // W latches the other operand of the ALU
+                if (has_op(prim) && prim != Prim::OP_W)
+                    e.w = s.w;
+
+                return e == s;
+            }
+
+            // the cheapest instruction doing each primitive
+            void find_primitives()
+            {
+                std::mt19937 rng;
+                std::uniform_int_distribution<unsigned> byte(0, 255), address(0, CODE_BASE - 1);
+                std::array<unsigned char, 4> edges = {0x00, 0xFF, 0x80, 0x7F};
+                std::vector<Trial> trials(TRIAL_COUNT);
+                std::vector<State> states(TRIAL_COUNT);
+
+                for (unsigned i = 0; i < TRIAL_COUNT; i++) {
+                    Trial &t = trials.at(i);
+
+                    for (unsigned char &j : t.em)
+                        j = byte(rng);
+
+                    t.a = i < edges.size() ? edges.at(i) : byte(rng);
+                    t.w = i < edges.size() ? edges.at(edges.size() - 1 - i) : byte(rng);
+                    t.st = byte(rng);
+                    t.p = address(rng);
+
+                    for (unsigned char &j : t.r)
+                        j = address(rng);
+
+                    // operands equal to A, and adding up to 100H, as Z may come from the sum before it is cut to a byte
+                    if (i % 8 == 6) {
+                        t.a = std::max(t.p, static_cast<unsigned char>(256 - CODE_BASE + 1));
+                        t.p = 256 - t.a;
+                        t.em.at(t.p) = t.p;
+                        t.r.fill(t.p);
+                        t.w = t.p;
+
+                    } else if (i % 8 == 7) {
+                        t.a = t.p;
+                        t.em.at(t.p) = t.p;
+                        t.r.fill(t.p);
+                        t.w = t.p;
+                    }
+                }
+
+                for (const Opcode::Instruction &ins : opcode) {
+                    if (!is_plain(ins))
+                        continue;
+
+                    bool param = has_operand_byte(ins.src) || has_operand_byte(ins.dst);
+                    unsigned reg_count = has_reg(ins.src) || has_reg(ins.dst) ? 4 : 1;
+
+                    for (unsigned char v = 0; v < reg_count; v++) {
+                        bool ok = true;
+
+                        bool sets_z = true;
+
+                        for (unsigned i = 0; ok && i < TRIAL_COUNT; i++)
+                            ok = run(ins, v, trials.at(i), states.at(i));
+
+                        if (!ok)
+                            continue;
+
+                        for (const State &i : states)
+                            sets_z = sets_z && i.z == !i.a;
+
+                        for (Prim prim = Prim::LOAD_IMM; prim <= Prim::OP_IND;
+                                prim = static_cast<Prim>(static_cast<int>(prim) + 1)) {
+                            if (has_param(prim) != param)
+                                continue;
+
+                            for (Op op : { Op::NONE, Op::ADD, Op::SUB, Op::AND, Op::OR }) {
+                                if ((op != Op::NONE) != has_op(prim))
+                                    continue;
+
+                                for (unsigned char reg = 0; reg < (has_reg(prim) ? 4 : 1); reg++) {
+                                    bool same = true;
+
+                                    for (unsigned i = 0; same && i < TRIAL_COUNT; i++)
+                                        same = matches(prim, op, reg, trials.at(i), states.at(i));
+
+                                    if (!same)
+                                        continue;
+
+                                    auto found = forms.find({prim, op, reg});
+
+                                    if (
+                                        found == forms.end() ||
+                                        found->second.ins->signal_count > ins.signal_count ||
+                                        (found->second.ins->signal_count == ins.signal_count && sets_z &&
+                                         !found->second.sets_z)
+                                    )
+                                        forms[ {prim, op, reg}] = {&ins, v, sets_z};
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            // jumps, calls and returns are recognized from their micro programs
+            void find_jumps()
+            {
+                jump_ins = jz_ins = call_ins = return_ins = nullptr;
+
+                auto keep = [](const Opcode::Instruction *&best, const Opcode::Instruction &ins) {
+                    if (!best || ins.signal_count < best->signal_count)
+                        best = &ins;
+                };
+
+                for (const Opcode::Instruction &ins : opcode) {
+                    if (!ins.exist || ins.mnemonic.front() == '_')
+                        continue;
+
+                    bool eint = false;
+
+                    for (unsigned char i = 0; i < ins.signal_count; i++)
+                        eint = eint || !ins.microprogram.at(i).test(17);
+
+                    switch (ins.get_flow()) {
+                        case InstructionFlow::JUMP:
+                            if (ins.src != OperandType::MEMADDR || ins.dst != OperandType::NONE)
+                                break;
+
+                            if (!ins.is_conditional())
+                                keep(jump_ins, ins);
+
+                            else if ((ins.byte & 0xC) >> 2 == 1)
+                                keep(jz_ins, ins);
+
+                            break;
+
+                        case InstructionFlow::CALL:
+                            if (ins.src == OperandType::MEMADDR && ins.dst == OperandType::NONE && !ins.is_conditional())
+                                keep(call_ins, ins);
+
+                            break;
+
+                        case InstructionFlow::RETURN:
+                            if (ins.src == OperandType::NONE && !ins.is_conditional() && !eint)
+                                keep(return_ins, ins);
+
+                            break;
+
+                        default:
+                            break;
+                    }
+                }
+            }
+
+            // sequences of primitives doing an action, every R is the same register
+            static std::vector<std::vector<Step>> get_recipes(Action action, Op op)
+            {
+                switch (action) {
+                    case Action::LOAD_IMM:
+                        return {
+                            {{Prim::LOAD_IMM, Op::NONE, PARAM}},
+                            {{Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::R_TO_A, Op::NONE, NO_PARAM}}
+                        };
+
+                    case Action::LOAD:
+                        return {
+                            {{Prim::LOAD, Op::NONE, PARAM}},
+                            {{Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::LOAD_IND, Op::NONE, NO_PARAM}}
+                        };
+
+                    case Action::STORE:
+                        return {
+                            {{Prim::STORE, Op::NONE, PARAM}},
+                            {{Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::STORE_IND, Op::NONE, NO_PARAM}}
+                        };
+
+                    case Action::OP_IMM:
+                        return {
+                            {{Prim::OP_IMM, op, PARAM}},
+                            {{Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::OP_R, op, NO_PARAM}},
+                            {
+                                {Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::R_TO_W, Op::NONE, NO_PARAM},
+                                {Prim::OP_W, op, NO_PARAM}
+                            },
+                            {
+                                {Prim::A_TO_R, Op::NONE, NO_PARAM}, {Prim::LOAD_IMM, Op::NONE, PARAM},
+                                {Prim::A_TO_W, Op::NONE, NO_PARAM}, {Prim::R_TO_A, Op::NONE, NO_PARAM},
+                                {Prim::OP_W, op, NO_PARAM}
+                            }
+                        };
+
+                    case Action::OP_MEM:
+                        return {
+                            {{Prim::OP_MEM, op, PARAM}},
+                            {{Prim::IMM_TO_R, Op::NONE, PARAM}, {Prim::OP_IND, op, NO_PARAM}},
+                            {
+                                {Prim::A_TO_R, Op::NONE, NO_PARAM}, {Prim::LOAD, Op::NONE, PARAM},
+                                {Prim::A_TO_W, Op::NONE, NO_PARAM}, {Prim::R_TO_A, Op::NONE, NO_PARAM},
+                                {Prim::OP_W, op, NO_PARAM}
+                            }
+                        };
+
+                    case Action::TEST:
+                        return {
+                            {{Prim::OP_IMM, Op::OR, 0x00}},
+                            {{Prim::OP_IMM, Op::AND, 0xFF}},
+                            {{Prim::OP_IMM, Op::ADD, 0x00}},
+                            {{Prim::OP_IMM, Op::SUB, 0x00}},
+                            {{Prim::A_TO_W, Op::NONE, NO_PARAM}, {Prim::OP_W, Op::AND, NO_PARAM}},
+                            {{Prim::A_TO_W, Op::NONE, NO_PARAM}, {Prim::OP_W, Op::OR, NO_PARAM}},
+                            {{Prim::A_TO_R, Op::NONE, NO_PARAM}, {Prim::OP_R, Op::AND, NO_PARAM}},
+                            {{Prim::A_TO_R, Op::NONE, NO_PARAM}, {Prim::OP_R, Op::OR, NO_PARAM}}
+                        };
+                }
+
+                return {};
+            }
+
+            static std::string describe(Action action, Op op)
+            {
+                const char *name = op == Op::ADD ? "+" : op == Op::SUB ? "-" : op == Op::AND ? "&" : "|";
+
+                switch (action) {
+                    case Action::LOAD_IMM:
+                        return "A = k";
+
+                    case Action::LOAD:
+                        return "A = [m]";
+
+                    case Action::STORE:
+                        return "[m] = A";
+
+                    case Action::OP_IMM:
+                        return std::format("A = A {} k", name);
+
+                    case Action::OP_MEM:
+                        return std::format("A = A {} [m]", name);
+
+                    case Action::TEST:
+                        return "test A";
+                }
+
+                return std::string();
+            }
+
+            const Selection &select(Action action, Op op)
+            {
+                auto found = selections.find({action, op});
+                Selection best = {{}, 0, 0};
+
+                if (found != selections.end())
+                    return found->second;
+
+                for (const std::vector<Step> &recipe : get_recipes(action, op))
+                    for (unsigned char reg = 0; reg < 4; reg++) {
+                        unsigned cost = 0;
+                        bool ok = true;
+
+                        for (const Step &i : recipe) {
+                            auto form = forms.find({i.prim, i.op, has_reg(i.prim) ? reg : 0});
+
+                            // a test is only good for the Z it leaves
+                            if (
+                                form == forms.end() ||
+                                (action == Action::TEST && &i == &recipe.back() && !form->second.sets_z)
+                            ) {
+                                ok = false;
+                                break;
+                            }
+
+                            cost += form->second.ins->signal_count;
+                        }
+
+                        if (ok && (best.steps.empty() || cost < best.cost))
+                            best = {recipe, reg, cost};
+                    }
+
+                if (best.steps.empty())
+                    throw std::runtime_error(
+                        std::format("the instruction set has no way to do {}", describe(action, op))
+                    );
+
+                return selections.emplace(std::make_pair(action, op), best).first->second;
+            }
+
+            static std::string to_string(const Opcode::Instruction &ins, unsigned char reg, const std::string &param)
+            {
+                std::string ret = ins.mnemonic;
+                const char *sep = " ";
+
+                for (OperandType type : { ins.src, ins.dst }) {
+                    switch (type) {
+                        case OperandType::NONE:
+                            continue;
+
+                        case OperandType::REG_A:
+                            ret += std::format("{}A", sep);
+                            break;
+
+                        case OperandType::REG:
+                            ret += std::format("{}R{}", sep, reg);
+                            break;
+
+                        case OperandType::REGADDR:
+                            ret += std::format("{}@R{}", sep, reg);
+                            break;
+
+                        case OperandType::IMMED:
+                            ret += std::format("{}#{}", sep, param);
+                            break;
+
+                        case OperandType::MEMADDR:
+                            ret += std::format("{}{}", sep, param);
+                            break;
+                    }
+
+                    sep = ", ";
+                }
+
+                return ret;
+            }
+
+            std::vector<std::string> to_lines(const Selection &s, const std::string &param) const
+            {
+                std::vector<std::string> ret;
+
+                for (const Step &i : s.steps) {
+                    const Form &f = forms.at({i.prim, i.op, has_reg(i.prim) ? s.reg : 0});
+                    ret.push_back(to_string(*f.ins, f.reg, i.param == PARAM ? param :
+                                            i.param >= 0 ? std::format("0{:02X}H", i.param) : std::string()));
+                }
+
+                return ret;
+            }
+
+            std::string to_string(const Selection &s) const
+            {
+                std::string ret;
+
+                for (const std::string &i : to_lines(s, "P"))
+                    ret += (ret.empty() ? "" : "; ") + i;
+
+                return ret;
+            }
+
+            // ---- code generation
+
+            void emit(const std::string &line)
+            {
+                function->code.push_back("    " + line);
+            }
+
+            void emit(Action action, Op op, const std::string &param)
+            {
+                const Selection &s = select(action, op);
+                const Step &last = s.steps.back();
+
+                for (const std::string &i : to_lines(s, param))
+                    emit(i);
+
+                z_valid = has_op(last.prim) && forms.at({last.prim, last.op, has_reg(last.prim) ? s.reg : 0}).sets_z;
+            }
+
+            void emit_jump(const Opcode::Instruction *ins, const char *what, const std::string &label)
+            {
+                if (!ins)
+                    throw std::runtime_error(std::format("the instruction set has no {}", what));
+
+                emit(to_string(*ins, 0, label));
+            }
+
+            void emit_label(const std::string &label)
+            {
+                function->code.push_back(label + ":");
+            }
+
+            // unique among labels, which the assembler compares ignoring case
+            std::string make_label(const std::string &base)
+            {
+                std::string ret = base, lower;
+
+                for (unsigned i = 2; ; i++) {
+                    lower = ret;
+                    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+                    if (labels.insert(lower).second)
+                        return ret;
+
+                    ret = std::format("{}_{}", base, i);
+                }
+            }
+
+            std::string make_label()
+            {
+                return make_label(std::format("L{}", label_count++));
+            }
+
+            static bool is_leaf(const Expr &e)
+            {
+                return e.op == '#' || e.op == 'v';
+            }
+
+            static Op to_op(char c)
+            {
+                return c == '+' ? Op::ADD : c == '-' ? Op::SUB : c == '&' ? Op::AND : Op::OR;
+            }
+
+            // A = e
+            void gen(const Expr &e)
+            {
+                if (e.op == '#') {
+                    emit(Action::LOAD_IMM, Op::NONE, std::format("0{:02X}H", e.value));
+                    return;
+                }
+
+                if (e.op == 'v') {
+                    emit(Action::LOAD, Op::NONE, e.label);
+                    return;
+                }
+
+                const Expr *lhs = e.lhs.get(), *rhs = e.rhs.get();
+
+                if (!is_leaf(*rhs) && is_leaf(*lhs) && e.op != '-')
+                    std::swap(lhs, rhs);
+
+                if (is_leaf(*rhs)) {
+                    gen(*lhs);
+
+                    if (rhs->op == '#')
+                        emit(Action::OP_IMM, to_op(e.op), std::format("0{:02X}H", rhs->value));
+
+                    else
+                        emit(Action::OP_MEM, to_op(e.op), rhs->label);
+
+                    return;
+                }
+
+                // the right side waits in a temporary of this function
+                if (temp_depth == function->temps.size()) {
+                    function->temps.push_back(make_label(std::format("t_{}_{}", function->name, temp_depth)));
+                    data.push_back(std::format("{}:\n    DB 0", function->temps.back()));
+                }
+
+                std::string temp = function->temps.at(temp_depth++);
+
+                gen(*rhs);
+                emit(Action::STORE, Op::NONE, temp);
+                gen(*lhs);
+                emit(Action::OP_MEM, to_op(e.op), temp);
+                temp_depth--;
+            }
+
+            // jumps to label unless cond holds
+            void jump_unless(const Cond &c, const std::string &label)
+            {
+                if (c.expr->op == '#') {
+                    if (!c.expr->value != c.zero_is_true)
+                        emit_jump(jump_ins, "unconditional jump", label);
+
+                    return;
+                }
+
+                gen(*c.expr);
+
+                if (!z_valid)
+                    emit(Action::TEST, Op::NONE, std::string());
+
+                if (!c.zero_is_true) {
+                    emit_jump(jz_ins, "jump on zero", label);
+                    return;
+                }
+
+                std::string taken = make_label();
+                emit_jump(jz_ins, "jump on zero", taken);
+                emit_jump(jump_ins, "unconditional jump", label);
+                emit_label(taken);
+            }
+
+            // ---- parsing
+
+            void tokenize(const std::string &source)
+            {
+                unsigned line = 1;
+                size_t i = 0;
+
+                tokens.clear();
+
+                while (i < source.size()) {
+                    char c = source.at(i);
+
+                    if (c == '\n') {
+                        line++;
+                        i++;
+
+                    } else if (isspace(static_cast<unsigned char>(c)))
+                        i++;
+
+                    else if (source.compare(i, 2, "//") == 0)
+                        i = std::min(source.find('\n', i), source.size());
+
+                    else if (source.compare(i, 2, "/*") == 0) {
+                        size_t end = source.find("*/", i + 2);
+
+                        if (end == std::string::npos)
+                            throw std::runtime_error(std::format("line {}: unterminated comment", line));
+
+                        line += std::count(source.begin() + i, source.begin() + end, '\n');
+                        i = end + 2;
+
+                    } else if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                        size_t begin = i;
+
+                        while (i < source.size() && (isalnum(static_cast<unsigned char>(source.at(i))) || source.at(i) == '_'))
+                            i++;
+
+                        tokens.push_back({Token::NAME, source.substr(begin, i - begin), 0, line});
+
+                    } else if (isdigit(static_cast<unsigned char>(c))) {
+                        size_t end;
+                        unsigned long value = std::stoul(source.substr(i), &end, 0);
+
+                        if (value > 0xff)
+                            throw std::runtime_error(std::format("line {}: {} does not fit in a byte", line,
+                                                                 source.substr(i, end)));
+
+                        if (i + end < source.size() && isalnum(static_cast<unsigned char>(source.at(i + end))))
+                            throw std::runtime_error(std::format("line {}: bad number", line));
+
+                        tokens.push_back({Token::NUMBER, source.substr(i, end), static_cast<unsigned>(value), line});
+                        i += end;
+
+                    } else {
+                        std::string text(1, c);
+
+                        for (const char *op : { "==", "!=", "&&", "||" })
+                            if (source.compare(i, 2, op) == 0)
+                                text = op;
+
+                        if (text == "&&" || text == "||")
+                            throw std::runtime_error(std::format("line {}: {} is not supported", line, text));
+
+                        if (std::string("{}();=+-&|!").find(c) == std::string::npos)
+                            throw std::runtime_error(std::format("line {}: unexpected '{}'", line, c));
+
+                        tokens.push_back({Token::PUNCT, text, 0, line});
+                        i += text.size();
+                    }
+                }
+
+                tokens.push_back({Token::END, std::string(), 0, line});
+            }
+
+            const Token &peek() const
+            {
+                return tokens.at(pos);
+            }
+
+            const Token &next()
+            {
+                const Token &ret = tokens.at(pos);
+
+                if (ret.type != Token::END)
+                    pos++;
+
+                return ret;
+            }
+
+            [[noreturn]] void error(const std::string &message) const
+            {
+                throw std::runtime_error(std::format("line {}: {}", peek().line, message));
+            }
+
+            bool accept(const char *text)
+            {
+                if (peek().type != Token::PUNCT || peek().text != text)
+                    return false;
+
+                pos++;
+                return true;
+            }
+
+            void expect(const char *text)
+            {
+                if (!accept(text))
+                    error(std::format("expected '{}'", text));
+            }
+
+            static bool is_type(const Token &t)
+            {
+                return t.type == Token::NAME &&
+                       (t.text == "char" || t.text == "int" || t.text == "unsigned" || t.text == "signed" ||
+                        t.text == "void");
+            }
+
+            static bool is_keyword(const std::string &s)
+            {
+                return s == "char" || s == "int" || s == "unsigned" || s == "signed" || s == "void" ||
+                       s == "if" || s == "else" || s == "while" || s == "return";
+            }
+
+            std::string expect_name()
+            {
+                if (peek().type != Token::NAME || is_keyword(peek().text))
+                    error("expected a name");
+
+                return next().text;
+            }
+
+            void skip_type()
+            {
+                if (!is_type(peek()))
+                    error("expected a type");
+
+                while (is_type(peek()))
+                    next();
+            }
+
+            Function *find_function(const std::string &name)
+            {
+                for (Function &f : functions)
+                    if (f.name == name)
+                        return &f;
+
+                return nullptr;
+            }
+
+            std::string find_variable(const std::string &name)
+            {
+                if (function) {
+                    auto local = function->locals.find(name);
+
+                    if (local != function->locals.end())
+                        return local->second;
+                }
+
+                auto global = globals.find(name);
+
+                if (global == globals.end())
+                    error(std::format("undefined variable {}", name));
+
+                return global->second;
+            }
+
+            void parse_top_level()
+            {
+                skip_type();
+
+                std::string name = expect_name();
+
+                if (!accept("(")) {
+                    if (globals.count(name) || find_function(name))
+                        error(std::format("{} redefined", name));
+
+                    std::string label = make_label("g_" + name);
+                    unsigned char value = 0;
+
+                    if (accept("=")) {
+                        std::unique_ptr<Expr> e = parse_expr();
+
+                        if (e->op != '#')
+                            error("initializer of a global must be constant");
+
+                        value = e->value;
+                    }
+
+                    expect(";");
+                    globals.emplace(name, label);
+                    data.push_back(std::format("{}:\n    DB 0{:02X}H", label, value));
+                    return;
+                }
+
+                if (find_function(name) || globals.count(name))
+                    error(std::format("{} redefined", name));
+
+                if (peek().type == Token::NAME && peek().text == "void")
+                    next();
+
+                expect(")");
+
+                if (!accept("{"))
+                    error("expected a function body");
+
+                // calls may come first, so the label must be predictable
+                if (make_label("f_" + name) != "f_" + name)
+                    error(std::format("{} differs from another name only in case", name));
+
+                functions.push_back({name, "f_" + name, {}, {}, {}});
+                function = &functions.back();
+                temp_depth = 0;
+                z_valid = false;
+                emit_label(function->label);
+                halt_label = name == "main" ? make_label("halt") : std::string();
+
+                while (!accept("}"))
+                    parse_statement();
+
+                if (name == "main") {
+                    emit_label(halt_label);
+                    emit_jump(jump_ins, "unconditional jump", halt_label);
+
+                } else
+                    emit_jump(return_ins, "return", std::string());
+
+                function = nullptr;
+            }
+
+            void parse_statement()
+            {
+                const Token &t = peek();
+
+                if (t.type == Token::END)
+                    error("unexpected end of file");
+
+                if (accept("{")) {
+                    while (!accept("}"))
+                        parse_statement();
+
+                    return;
+                }
+
+                if (accept(";"))
+                    return;
+
+                if (is_type(t)) {
+                    skip_type();
+
+                    std::string name = expect_name();
+
+                    if (function->locals.count(name))
+                        error(std::format("{} redefined", name));
+
+                    std::string label = make_label(std::format("v_{}_{}", function->name, name));
+                    function->locals.emplace(name, label);
+                    data.push_back(std::format("{}:\n    DB 0", label));
+
+                    if (accept("=")) {
+                        gen(*parse_expr());
+                        emit(Action::STORE, Op::NONE, label);
+                    }
+
+                    expect(";");
+                    return;
+                }
+
+                if (t.type != Token::NAME)
+                    error("expected a statement");
+
+                if (t.text == "if") {
+                    std::string skip = make_label();
+
+                    next();
+                    expect("(");
+                    jump_unless(parse_cond(), skip);
+                    expect(")");
+                    parse_statement();
+
+                    if (peek().type == Token::NAME && peek().text == "else") {
+                        std::string end = make_label();
+
+                        next();
+                        emit_jump(jump_ins, "unconditional jump", end);
+                        emit_label(skip);
+                        parse_statement();
+                        emit_label(end);
+
+                    } else
+                        emit_label(skip);
+
+                    z_valid = false;
+                    return;
+                }
+
+                if (t.text == "while") {
+                    std::string top = make_label(), end = make_label();
+
+                    next();
+                    emit_label(top);
+                    expect("(");
+                    jump_unless(parse_cond(), end);
+                    expect(")");
+                    parse_statement();
+                    emit_jump(jump_ins, "unconditional jump", top);
+                    emit_label(end);
+                    z_valid = false;
+                    return;
+                }
+
+                if (t.text == "return") {
+                    next();
+
+                    if (!accept(";"))
+                        error("functions do not return values");
+
+                    if (function->name == "main")
+                        emit_jump(jump_ins, "unconditional jump", halt_label);
+
+                    else
+                        emit_jump(return_ins, "return", std::string());
+
+                    return;
+                }
+
+                std::string name = expect_name();
+
+                if (accept("(")) {
+                    // reported at the call, before reading past its line
+                    if (function->name != "main")
+                        error("only main may call functions, ST keeps a single return address");
+
+                    if (name == "main")
+                        error("main may not be called");
+
+                    expect(")");
+                    expect(";");
+
+                    called.emplace(name, t.line);
+                    emit_jump(call_ins, "call", "f_" + name);
+                    z_valid = false;
+                    return;
+                }
+
+                std::string label = find_variable(name);
+
+                expect("=");
+                gen(*parse_expr());
+                emit(Action::STORE, Op::NONE, label);
+                expect(";");
+            }
+
+            Cond parse_cond()
+            {
+                Cond ret;
+
+                if (accept("!")) {
+                    if (accept("(")) {
+                        ret = parse_cond();
+                        expect(")");
+
+                    } else
+                        ret = {parse_term(), false};
+
+                    ret.zero_is_true = !ret.zero_is_true;
+                    return ret;
+                }
+
+                ret.expr = parse_expr();
+                ret.zero_is_true = false;
+
+                for (const char *op : { "==", "!=" })
+                    if (accept(op)) {
+                        std::unique_ptr<Expr> rhs = parse_expr();
+
+                        // C would compare before & and |, which is rarely what was meant
+                        for (const Expr *i : { ret.expr.get(), rhs.get() })
+                            if ((i->op == '&' || i->op == '|') && !i->parenthesized)
+                                error(std::format("parenthesize & and | next to {}", op));
+
+                        ret.expr = make_binary('-', std::move(ret.expr), std::move(rhs));
+                        ret.zero_is_true = op[0] == '=';
+                        break;
+                    }
+
+                return ret;
+            }
+
+            static std::unique_ptr<Expr> make_binary(char op, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+            {
+                if (lhs->op == '#' && rhs->op == '#') {
+                    lhs->value = calc(to_op(op), lhs->value, rhs->value);
+                    lhs->parenthesized = false;
+                    return lhs;
+                }
+
+                // x + 0, x - 0 and x | 0 are x
+                if (rhs->op == '#' && !rhs->value && op != '&')
+                    return lhs;
+
+                std::unique_ptr<Expr> ret(new Expr{op, 0, std::string(), false, std::move(lhs), std::move(rhs)});
+                return ret;
+            }
+
+            std::unique_ptr<Expr> parse_expr()
+            {
+                std::unique_ptr<Expr> ret = parse_and();
+
+                while (accept("|"))
+                    ret = make_binary('|', std::move(ret), parse_and());
+
+                return ret;
+            }
+
+            std::unique_ptr<Expr> parse_and()
+            {
+                std::unique_ptr<Expr> ret = parse_sum();
+
+                while (accept("&"))
+                    ret = make_binary('&', std::move(ret), parse_sum());
+
+                return ret;
+            }
+
+            std::unique_ptr<Expr> parse_sum()
+            {
+                std::unique_ptr<Expr> ret = parse_term();
+
+                while (true) {
+                    if (accept("+"))
+                        ret = make_binary('+', std::move(ret), parse_term());
+
+                    else if (accept("-"))
+                        ret = make_binary('-', std::move(ret), parse_term());
+
+                    else
+                        return ret;
+                }
+            }
+
+            std::unique_ptr<Expr> parse_term()
+            {
+                if (peek().type == Token::NUMBER)
+                    return std::unique_ptr<Expr>(new Expr{'#', static_cast<unsigned char>(next().value), std::string(), false, nullptr, nullptr});
+
+                if (accept("(")) {
+                    std::unique_ptr<Expr> ret = parse_expr();
+                    expect(")");
+                    ret->parenthesized = true;
+                    return ret;
+                }
+
+                std::string label = find_variable(expect_name());
+                return std::unique_ptr<Expr>(new Expr{'v', 0, label, false, nullptr, nullptr});
+            }
+
+            const Opcode &opcode;
+            COP2K machine;
+            std::map<std::tuple<Prim, Op, unsigned char>, Form> forms; // register is 0 if unused
+            const Opcode::Instruction *jump_ins, *jz_ins, *call_ins, *return_ins;
+            std::map<std::pair<Action, Op>, Selection> selections;
+
+            std::vector<Token> tokens;
+            size_t pos;
+            unsigned label_count;
+            std::set<std::string> labels; // lower case
+            std::map<std::string, std::string> globals; // name and label
+            std::vector<Function> functions;
+            std::map<std::string, unsigned> called; // function and line of the first call
+            std::vector<std::string> data;
+            Function *function = nullptr; // being compiled
+            std::string halt_label;
+            unsigned temp_depth = 0;
+            bool z_valid = false; // Z follows A
+    };
+}
+
+#endif // CC_HPP_INCLUDED
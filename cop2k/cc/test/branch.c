@@ -0,0 +1,17 @@
+// x and y both end at 4
+char x = 3;
+char y;
+
+void main(void)
+{
+    if (x == 3)
+        y = x + 1;
+    else
+        y = 0;
+
+    if (!(y != 4))
+        x = y & 6;
+    else {
+        x = 0;
+    }
+}
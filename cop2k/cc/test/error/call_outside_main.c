@@ -0,0 +1,13 @@
+void a(void)
+{
+}
+
+void b(void)
+{
+    a();
+}
+
+void main(void)
+{
+    b();
+}
@@ -0,0 +1,6 @@
+char x;
+
+void main(void)
+{
+    x = 256;
+}
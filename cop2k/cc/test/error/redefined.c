@@ -0,0 +1,6 @@
+char x;
+char x;
+
+void main(void)
+{
+}
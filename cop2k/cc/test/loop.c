@@ -0,0 +1,18 @@
+// total ends at 0FH, count at 0; risc.txt has no return for the call
+char count;
+char total;
+
+void add(void)
+{
+    total = total + count;
+}
+
+void main(void)
+{
+    count = 5;
+
+    while (count != 0) {
+        add();
+        count = count - 1;
+    }
+}
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "engine/coverage.hpp"
+#include "engine/decoded_engine.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: coverage run <instr.txt> <file.asm|file.bin|dir>... -o <out.cov> "
+              "[-m <max instructions>] [-i <instruction>]..." << std::endl;
+    std::cerr << "       coverage merge <in.cov>... -o <out.cov>" << std::endl;
+    std::cerr << "       coverage report <instr.txt|dir> <in.cov>..." << std::endl;
+}
+
+static const char *const SIGNAL_NAMES[] = {
+    "S0", "S1", "S2", "AEN", "WEN", "X0", "X1", "X2", "FEN", "CN", "RWR", "RRD",
+    "STEN", "OUTEN", "MAROE", "MAREN", "ELP", "EINT", "IREN", "EMEN", "PCOE", "EMRD", "EMWR"
+};
+
+static std::vector<COP2K::Coverage> load_coverage(const char *path)
+{
+    std::ifstream ifs(path);
+
+    if (!ifs)
+        throw std::runtime_error(std::format("failed to open {}", path));
+
+    try {
+        return COP2K::Coverage::load_file(ifs);
+
+    } catch (const std::runtime_error &e) {
+        throw std::runtime_error(std::format("{}: {}", path, e.what()));
+    }
+}
+
+static bool save_coverage(const std::vector<COP2K::Coverage> &sections, const char *path)
+{
+    std::ofstream ofs(path);
+
+    if (!ofs)
+        return false;
+
+    COP2K::Coverage::save_file(sections, ofs);
+    return static_cast<bool>(ofs);
+}
+
+static int run(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    COP2K::DecodedEngine engine;
+    COP2K::Coverage coverage;
+    std::vector<std::filesystem::path> programs;
+    std::vector<unsigned long> interrupts;
+    const char *out_path = nullptr;
+    unsigned long max = 100000;
+
+    if (argc < 4) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (int i = 3; i < argc; i++) {
+            if (i + 1 < argc && !strcmp(argv[i], "-o"))
+                out_path = argv[++i];
+
+            else if (i + 1 < argc && !strcmp(argv[i], "-m") && strtoul(argv[i + 1], nullptr, 0))
+                max = strtoul(argv[++i], nullptr, 0);
+
+            else if (i + 1 < argc && !strcmp(argv[i], "-i") && strtoul(argv[i + 1], nullptr, 0))
+                interrupts.push_back(strtoul(argv[++i], nullptr, 0));
+
+            else if (argv[i][0] == '-') {
+                print_usage();
+                return EXIT_FAILURE;
+
+            } else
+                for (const std::filesystem::path &j : COP2K::list_files(argv[i], { ".asm", ".bin" }))
+                    programs.push_back(j);
+        }
+
+        if (!out_path) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        COP2K::load_instruction_set(argv[2], opcode);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::sort(interrupts.begin(), interrupts.end());
+    coverage.isa_hash = COP2K::Coverage::hash_opcode(opcode);
+    coverage.isa_name = std::filesystem::path(argv[2]).filename().string();
+    engine.set_coverage(&coverage);
+
+    for (const std::filesystem::path &program : programs) {
+        std::string image;
+        size_t next_interrupt = 0;
+        unsigned long i = 0;
+
+        try {
+            image = COP2K::load_program(program, opcode);
+
+        } catch (const std::runtime_error &e) {
+            std::cerr << std::format("{}: skipped, {}\n", program.string(), e.what());
+            continue;
+        }
+
+        engine.reset(opcode, image);
+        coverage.runs++;
+
+        try {
+            for (; i < max; i++) {
+                uint8_t pc = engine.get_state().pc;
+
+                for (; next_interrupt < interrupts.size() && interrupts.at(next_interrupt) <= i + 1; next_interrupt++)
+                    engine.trigger_interrupt();
+
+                engine.step();
+
+                // a jump to itself halts
+                if (engine.get_state().pc == pc && next_interrupt == interrupts.size())
+                    break;
+            }
+
+        } catch (const std::exception &e) {
+            // what ran before the program went wrong still counts
+            std::cerr << std::format("{}: stopped at instruction {}, {}\n", program.string(), i + 1, e.what());
+        }
+    }
+
+    if (!save_coverage({ coverage }, out_path))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static int merge(int argc, char **argv)
+{
+    std::vector<COP2K::Coverage> sections;
+    const char *out_path = nullptr;
+
+    try {
+        for (int i = 2; i < argc; i++) {
+            if (i + 1 < argc && !strcmp(argv[i], "-o"))
+                out_path = argv[++i];
+
+            else
+                for (const COP2K::Coverage &j : load_coverage(argv[i]))
+                    COP2K::Coverage::merge_into(sections, j);
+        }
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!out_path) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!save_coverage(sections, out_path))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+// as in the instruction set file, with the register if given
+static std::string describe(const COP2K::Opcode::Instruction &ins, int reg)
+{
+    std::string ret = ins.mnemonic;
+    std::string r = reg < 0 ? "?" : std::to_string(reg);
+    bool first = true;
+
+    for (COP2K::OperandType i : { ins.src, ins.dst }) {
+        if (i == COP2K::OperandType::NONE)
+            continue;
+
+        ret += first ? " " : ", ";
+        first = false;
+
+        switch (i) {
+            case COP2K::OperandType::NONE:
+                break;
+
+            case COP2K::OperandType::REG_A:
+                ret += "A";
+                break;
+
+            case COP2K::OperandType::REG:
+                ret += "R" + r;
+                break;
+
+            case COP2K::OperandType::REGADDR:
+                ret += "@R" + r;
+                break;
+
+            case COP2K::OperandType::IMMED:
+                ret += "#II";
+                break;
+
+            case COP2K::OperandType::MEMADDR:
+                ret += "MM";
+                break;
+        }
+    }
+
+    return ret;
+}
+
+static void report_set(const std::filesystem::path &set, const std::vector<COP2K::Coverage> &sections)
+{
+    COP2K::Opcode opcode;
+    std::string name = set.filename().string();
+
+    try {
+        COP2K::load_instruction_set(set.c_str(), opcode);
+
+    } catch (const std::exception &e) {
+        std::cout << std::format("{}: skipped, {}\n", name, e.what());
+        return;
+    }
+
+    uint64_t hash = COP2K::Coverage::hash_opcode(opcode);
+    auto c = std::find_if(sections.begin(), sections.end(), [hash](const COP2K::Coverage &i) {
+        return i.isa_hash == hash;
+    });
+
+    if (c == sections.end()) {
+        std::cout << std::format("{}: no coverage\n", name);
+        return;
+    }
+
+    std::vector<std::string> steps, forms, signals;
+    unsigned step_count = 0, step_run = 0, form_count = 0, form_run = 0, ins_count = 0, ins_run = 0;
+
+    for (const COP2K::Opcode::Instruction &ins : opcode) {
+        if (!ins.exist)
+            continue;
+
+        bool by_reg =
+            ins.src == COP2K::OperandType::REG || ins.src == COP2K::OperandType::REGADDR ||
+            ins.dst == COP2K::OperandType::REG || ins.dst == COP2K::OperandType::REGADDR;
+        std::string unrun;
+        bool any = false;
+
+        for (unsigned j = 0; j < ins.signal_count; j++) {
+            unsigned addr = ins.byte | j;
+            uint32_t expected = ~ins.microprogram.at(j).to_ulong() & COP2K::Coverage::SIGNAL_MASK;
+
+            step_count++;
+
+            if (!c->upc.test(addr)) {
+                unrun += std::format(" {}", j);
+                continue;
+            }
+
+            step_run++;
+
+            // in a word that ran, only an interrupt keeps a signal off
+            for (unsigned k = 0; k < 23; k++)
+                if ((expected & ~c->signals.at(addr)) >> k & 1)
+                    signals.push_back(std::format("{:02X}  {}  step {}: {}", addr, describe(ins, -1), j, SIGNAL_NAMES[k]));
+        }
+
+        if (!unrun.empty())
+            steps.push_back(std::format("{:02X}  {}  steps{}", ins.byte, describe(ins, -1), unrun));
+
+        for (unsigned j = 0; j < (by_reg ? 4u : 1u); j++) {
+            bool run = false;
+
+            for (unsigned k = 0; k < 4; k++)
+                if ((!by_reg || k == j) && c->ir.test(ins.byte | k))
+                    run = true;
+
+            form_count++;
+            form_run += run;
+            any |= run;
+
+            if (!run)
+                forms.push_back(std::format("{:02X}  {}", ins.byte | j, describe(ins, by_reg ? j : -1)));
+        }
+
+        ins_count++;
+        ins_run += any;
+    }
+
+    std::cout << std::format(
+                     "{}: {} runs, micro steps {}/{}, instructions {}/{}, forms {}/{}, "
+                     "memory {} executed {} read {} written\n",
+                     name, c->runs, step_run, step_count, ins_run, ins_count, form_run, form_count,
+                     c->executed.count(), c->read.count(), c->written.count()
+                 );
+
+    auto list = [](const char *title, const std::vector<std::string> &lines) {
+        if (lines.empty())
+            return;
+
+        std::cout << "  " << title << ":\n";
+
+        for (const std::string &i : lines)
+            std::cout << "    " << i << "\n";
+    };
+
+    list("micro steps never run", steps);
+    list("forms never run", forms);
+    list("signals never asserted", signals);
+}
+
+static int report(int argc, char **argv)
+{
+    std::vector<COP2K::Coverage> sections;
+    std::vector<std::filesystem::path> sets;
+
+    if (argc < 4) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        sets = COP2K::list_files(argv[2], { ".txt" });
+
+        for (int i = 3; i < argc; i++)
+            for (const COP2K::Coverage &j : load_coverage(argv[i]))
+                COP2K::Coverage::merge_into(sections, j);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (const std::filesystem::path &i : sets)
+        report_set(i, sections);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "run"))
+        return run(argc, argv);
+
+    if (argc >= 2 && !strcmp(argv[1], "merge"))
+        return merge(argc, argv);
+
+    if (argc >= 2 && !strcmp(argv[1], "report"))
+        return report(argc, argv);
+
+    print_usage();
+    return EXIT_FAILURE;
+}
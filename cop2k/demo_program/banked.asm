@@ -0,0 +1,25 @@
+; for a banked machine: 80H holds a routine in every bank, which one
+; runs is chosen by writing the bank to port 0FFH
+ENTRY EQU 80H
+    MOV  A, #01H
+    WRITE 0FFH, A
+    CALL ENTRY
+    MOV  R0, A
+    MOV  A, #02H
+    WRITE 0FFH, A
+    CALL ENTRY
+    ADD  A, R0
+    OUT
+HALT:
+    JMP  HALT
+
+    BANK 1
+    ORG  ENTRY
+    MOV  A, #10H
+    RET
+
+    BANK 2
+    ORG  ENTRY
+    MOV  A, #20H
+    RET
+    END
@@ -0,0 +1,25 @@
+; for multicore: every core adds 1 to the byte at 0C0H ten times,
+; holding the lock at 0FCH while it does
+    MOV  R1, #0AH
+TAKE:
+    MOV  A, 0FCH        ; reading a lock takes it, and gives what it held
+    OR   A, #00H
+    JZ   TAKEN
+    JMP  TAKE
+TAKEN:
+    MOV  A, 0C0H
+    ADD  A, #01H
+    MOV  0C0H, A
+    MOV  A, #00H
+    MOV  0FCH, A        ; writing 0 gives it back
+    MOV  A, R1
+    SUB  A, #01H
+    MOV  R1, A
+    JZ   DONE
+    JMP  TAKE
+DONE:
+    MOV  A, 0C0H
+    OUT
+HALT:
+    JMP  HALT
+    END
@@ -1,44 +1,154 @@
-#include <fstream>
-#include <iostream>
 #include <algorithm>
-#include <iterator>
+#include <atomic>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "isa_image.hpp"
+#include "engine/program.hpp"
 #include "dis.hpp"
 
-int main(int argc, char **argv)
+static void print_usage()
+{
+    std::cerr << "usage: dis <instr.txt> <file.bin> [-e <entry>]..." << std::endl
+              << "       dis --batch <instr.txt> <manifest|dir> -o <out dir> [-j <threads>] [-e <entry>]..."
+              << std::endl
+              << "       <entry> is an address like 40H where code is also entered, e.g. by interrupts"
+              << std::endl;
+}
+
+static int batch(int argc, char **argv)
 {
     COP2K::DIS dis;
+    const char *out_dir = nullptr;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned char> entries;
+    std::vector<std::pair<std::string, std::filesystem::path>> images;
 
-    if (argc < 3 || !strcmp(argv[1], "--help")) {
-        std::cerr << "usage: dis <instr.txt> <file.bin>" << std::endl;
+    try {
+        for (int i = 4; i < argc; i += 2) {
+            if (i + 1 >= argc) {
+                print_usage();
+                return EXIT_FAILURE;
+
+            } else if (!strcmp(argv[i], "-o"))
+                out_dir = argv[i + 1];
+
+            else if (!strcmp(argv[i], "-j") && atoi(argv[i + 1]) > 0)
+                threads = atoi(argv[i + 1]);
+
+            else if (!strcmp(argv[i], "-e"))
+                entries.push_back(COP2K::parse_addr(argv[i + 1]));
+
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (argc < 4 || !out_dir) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        // the instruction set is decoded once and shared by every worker
+        COP2K::load_instruction_set(argv[2], dis.opcode);
+        dis.build_table();
+        images = COP2K::list_manifest(argv[3], ".bin");
+        std::filesystem::create_directories(out_dir);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    FILE *instr_txt = fopen(argv[1], "r");
+    std::vector<std::string> errors(images.size());
+    std::vector<std::thread> pool;
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < images.size();) {
+            std::filesystem::path out_path = std::filesystem::path(out_dir) / images.at(i).first;
+
+            out_path.replace_extension(".asm");
+
+            try {
+                std::string out = dis.disassemble(COP2K::read_image(images.at(i).second, true), entries);
+                std::ofstream ofs(out_path);
 
-    if (!instr_txt)
+                if (!(ofs << out))
+                    throw std::runtime_error(std::format("failed to write {}", out_path.string()));
+
+            } catch (const std::exception &e) {
+                errors.at(i) = e.what();
+            }
+        }
+    };
+
+    threads = std::min<size_t>(threads, std::max<size_t>(images.size(), 1));
+
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+
+    for (std::thread &i : pool)
+        i.join();
+
+    size_t failed = 0;
+
+    for (size_t i = 0; i < images.size(); i++)
+        if (!errors.at(i).empty()) {
+            std::cerr << images.at(i).first << ": error: " << errors.at(i) << std::endl;
+            failed++;
+        }
+
+    std::cerr << images.size() - failed << " of " << images.size() << " images disassembled" << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::DIS dis;
+    std::vector<unsigned char> entries;
+    std::string image;
+
+    if (argc >= 2 && !strcmp(argv[1], "--batch"))
+        return batch(argc, argv);
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
         return EXIT_FAILURE;
+    }
 
     try {
-        dis.opcode.load_instr_txt(instr_txt);
+        for (int i = 3; i < argc; i += 2) {
+            if (i + 1 >= argc || strcmp(argv[i], "-e")) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+
+            entries.push_back(COP2K::parse_addr(argv[i + 1]));
+        }
+
+        COP2K::load_instruction_set(argv[1], dis.opcode);
+        dis.build_table();
 
-    } catch (const std::runtime_error &) {
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    fclose(instr_txt);
-    std::ifstream ifs(argv[2]);
-    std::string instr_byte;
+    try {
+        image = COP2K::read_image(argv[2], true);
 
-    if (!ifs)
+    } catch (const std::runtime_error &e) {
+        std::cerr << std::format("error: {}: {}", argv[2], e.what()) << std::endl;
         return EXIT_FAILURE;
+    }
 
-    std::copy(
-        std::istream_iterator<unsigned char>(std::cin),
-        std::istream_iterator<unsigned char>(),
-        std::back_inserter(instr_byte)
-    );
-    ifs.close();
-    std::cout << dis.disassemble(instr_byte) << std::endl;
+    std::cout << dis.disassemble(image, entries);
 }
@@ -1,11 +1,12 @@
 #ifndef DIS_HPP_INCLUDED
 #define DIS_HPP_INCLUDED
 
-#include <iostream>
+#include <array>
+#include <bitset>
+#include <format>
+#include <stdexcept>
+#include <string>
 #include <vector>
-#include <utility>
-#include <sstream>
-#include <map>
 
 #include "libopcode.hpp"
 
@@ -13,179 +14,273 @@ namespace COP2K
 {
     class DIS
     {
-        /* NOTE: this decompiler will aggressively treat everything as code
-         * rather than as data
-         * it is not going to be another IDA
+        /* code is told from data by following control flow from reset and
+         * from the given entries: only bytes reached as instructions are
+         * code, everything else is DB. a jump into the operand of another
+         * instruction keeps its address rather than a label, and so do
+         * jumps through ST or a register, which cannot be followed.
+         * zero bytes nobody refers to are skipped with ORG
          */
         public:
-            std::string disassemble(const std::string &instr_byte) const
+            // one byte of the image as the first byte of an instruction
+            struct Entry {
+                const Opcode::Instruction *ins; // nullptr when it cannot start one
+                unsigned char size;
+                InstructionFlow flow;
+                bool conditional;
+                std::array<OperandType, 2> type; // src and dst
+                std::array<std::string, 2> text; // of operands other than IMMED and MEMADDR
+                bool in_image; // the MEMADDR operand is an address of the image, not of a port
+            };
+
+            /* must be called after loading opcode. the table is only read
+             * afterwards, so one DIS serves any number of threads
+             */
+            void build_table()
             {
-                struct Line {
-                    std::string mnemonic;
-                    std::string operand;
-                    std::string label;
-                    std::string byte;
-                    bool src_is_memaddr;
-                    unsigned char src_memaddr;
-                    bool dst_is_memaddr;
-                    unsigned char dst_memaddr;
-                };
-                std::istringstream in(instr_byte);
-                std::ostringstream oss;
-                std::map<unsigned char, struct Line> lines;
-                unsigned label_count = 0;
-                unsigned cur_pos;
+                for (unsigned i = 0; i < 256; i++) {
+                    const Opcode::Instruction *ins = opcode.find_from_byte(i & ~0x3);
+                    Entry &e = table.at(i);
 
-                while ((cur_pos = in.tellg()) < 256) {
-                    bool src_is_memaddr = false, dst_is_memaddr = false;
-                    unsigned char src_memaddr = 0, dst_memaddr = 0;
-                    const Opcode::Instruction *ins = nullptr;
-                    unsigned char byte = in.get();
-                    unsigned char tmpbyte = 0;
-                    std::string ins_operand, b(std::format("{:02X}", byte));
+                    e = { nullptr, 1, InstructionFlow::NEXT, false, {}, {}, false };
 
-                    if (!byte) // do not put NULL byte
+                    // we do not output _FATCH_ even if it was manually assembled
+                    if (!ins || ins->mnemonic == "_FATCH_")
                         continue;
 
-                    try {
-                        ins = &opcode.get_from_byte(byte & ~0x3);
-
-                        if (ins->mnemonic == "_FATCH_")
-                            /* we do not output _FATCH_ even if it was
-                             * manually assembled
-                             */
-                            throw std::out_of_range("");
-
-                    } catch (const std::out_of_range &) {
-                        lines.emplace(
-                            cur_pos,
-                            Line(
-                                std::string("DB"),
-                                std::format("{:02X}H", byte),
-                                std::string(),
-                                std::move(b),
-                                false,
-                                0,
-                                false,
-                                0
-                            )
-                        );
+                    e.ins = ins;
+                    e.flow = ins->get_flow();
+                    e.conditional = e.flow != InstructionFlow::NEXT && ins->is_conditional();
+                    e.type = { ins->src, ins->dst };
+                    e.in_image = e.flow == InstructionFlow::JUMP || e.flow == InstructionFlow::CALL;
+
+                    // memory is read or written at MAR
+                    for (unsigned j = 0; j < ins->signal_count; j++)
+                        if (!ins->microprogram.at(j).test(14) && !ins->microprogram.at(j).test(19))
+                            e.in_image = true;
+
+                    e.in_image = e.in_image && (ins->src == OperandType::MEMADDR || ins->dst == OperandType::MEMADDR);
+
+                    for (unsigned j = 0; j < 2; j++)
+                        switch (e.type.at(j)) {
+                            case OperandType::NONE:
+                                break;
+
+                            case OperandType::REG_A:
+                                e.text.at(j) = "A";
+                                break;
+
+                            case OperandType::IMMED:
+                            case OperandType::MEMADDR:
+                                e.size++;
+                                break;
+
+                            case OperandType::REG:
+                                e.text.at(j) = std::format("R{}", i & 0x3);
+                                break;
+
+                            case OperandType::REGADDR:
+                                e.text.at(j) = std::format("@R{}", i & 0x3);
+                                break;
+                        }
+                }
+
+                table_built = true;
+            }
+
+            const Entry &decode(unsigned char byte) const
+            {
+                return table.at(byte);
+            }
+
+            // addresses holding the first byte of an instruction
+            std::bitset<256> find_code(const std::string &image, const std::vector<unsigned char> &entries) const
+            {
+                std::bitset<256> ret, covered;
+                std::vector<unsigned char> pending(entries.rbegin(), entries.rend());
+
+                pending.push_back(0);
+
+                while (!pending.empty()) {
+                    unsigned addr = pending.back();
+                    pending.pop_back();
+
+                    if (covered.test(addr))
                         continue;
-                    }
 
-                    switch (ins->src) {
-                        case Operand::NONE:
-                            break;
+                    const Entry &e = table.at(static_cast<unsigned char>(image.at(addr)));
+                    bool overlaps = false;
 
-                        case Operand::REG_A:
-                            ins_operand.append("A");
-                            break;
+                    if (!e.ins || addr + e.size > 256)
+                        continue;
 
-                        case Operand::IMMED:
-                            ins_operand.append(std::format("#{:02X}H", (tmpbyte = in.get())));
-                            b.append(std::format(" {:02X}", tmpbyte));
-                            break;
+                    for (unsigned i = addr; i < addr + e.size; i++)
+                        overlaps = overlaps || covered.test(i);
 
-                        case Operand::MEMADDR:
-                            src_is_memaddr = true;
-                            src_memaddr = in.get();
-                            b.append(std::format(" {:02X}", src_memaddr));
-                            break;
+                    if (overlaps)
+                        continue;
 
-                        case Operand::REG:
-                            ins_operand.append(std::format("R{}", byte & 0x3));
-                            break;
+                    for (unsigned i = addr; i < addr + e.size; i++)
+                        covered.set(i);
 
-                        case Operand::REGADDR:
-                            ins_operand.append(std::format("@R{}", byte & 0x3));
-                            break;
-                    }
+                    ret.set(addr);
 
-                    switch (ins->dst) {
-                        case Operand::NONE:
-                            break;
-
-                        case Operand::REG_A:
-                            ins_operand.append(", A");
-                            break;
-
-                        case Operand::IMMED:
-                            ins_operand.append(std::format(", #{:02X}H", (tmpbyte = in.get())));
-                            b.append(std::format(" {:02X}", tmpbyte));
-                            break;
-
-                        case Operand::MEMADDR:
-                            dst_is_memaddr = true;
-                            dst_memaddr = in.get();
-                            ins_operand.append(", ");
-                            b.append(std::format(" {:02X}", dst_memaddr));
-                            break;
-
-                        case Operand::REG:
-                            ins_operand.append(std::format(", R{}", byte & 0x3));
-                            break;
-
-                        case Operand::REGADDR:
-                            ins_operand.append(std::format(", @R{}", byte & 0x3));
-                            break;
-                    }
+                    if (e.flow == InstructionFlow::JUMP || e.flow == InstructionFlow::CALL)
+                        pending.push_back(image.at(addr + 1));
 
-                    lines.emplace(
-                        cur_pos,
-                        Line(
-                            ins->mnemonic,
-                            std::move(ins_operand),
-                            std::string(),
-                            std::move(b),
-                            src_is_memaddr,
-                            src_memaddr,
-                            dst_is_memaddr,
-                            dst_memaddr
-                        )
-                    );
+                    if (
+                        (e.flow != InstructionFlow::JUMP && e.flow != InstructionFlow::RETURN &&
+                         e.flow != InstructionFlow::INDIRECT) || e.conditional
+                    )
+                        if (addr + e.size < 256)
+                            pending.push_back(addr + e.size);
                 }
 
-                for (std::pair<const unsigned char, struct Line> &i : lines) {
-                    if (i.second.src_is_memaddr) {
-                        try {
-                            std::string &label = lines.at(i.second.src_memaddr).label;
+                return ret;
+            }
 
-                            if (label.empty())
-                                label = std::format("L{}", label_count++);
+            // an instruction with its operand byte, if any, and the label to show for an address
+            std::string format_instruction(
+                unsigned char byte,
+                unsigned char operand_byte,
+                const std::string &label = std::string()
+            ) const
+            {
+                const Entry &e = table.at(byte);
+                std::string operand;
 
-                            i.second.operand.insert(0, label);
+                if (!e.ins)
+                    return std::format("DB 0{:02X}H", byte);
 
-                        } catch (const std::out_of_range &) {
-                            i.second.operand.insert(0, std::format("{:02X}H", i.second.src_memaddr));
-                        }
-                    }
+                for (unsigned i = 0; i < 2; i++) {
+                    if (e.type.at(i) == OperandType::NONE)
+                        continue;
 
-                    if (i.second.dst_is_memaddr) {
-                        try {
-                            std::string &label = lines.at(i.second.dst_memaddr).label;
+                    if (i && !operand.empty())
+                        operand += ", ";
 
-                            if (label.empty())
-                                label = std::format("L{}", label_count++);
+                    if (e.type.at(i) == OperandType::IMMED)
+                        operand += std::format("#0{:02X}H", operand_byte);
 
-                            i.second.operand.append(label);
+                    else if (e.type.at(i) == OperandType::MEMADDR)
+                        operand += label.empty() ? std::format("0{:02X}H", operand_byte) : label;
 
-                        } catch (const std::out_of_range &) {
-                            i.second.operand.append(std::format("{:02X}H", i.second.dst_memaddr));
-                        }
-                    }
+                    else
+                        operand += e.text.at(i);
                 }
 
-                for (const std::pair<const unsigned char, struct Line> &i : lines) {
-                    if (!i.second.label.empty())
-                        oss << i.second.label << ':' << std::endl;
+                return operand.empty() ? e.ins->mnemonic : e.ins->mnemonic + ' ' + operand;
+            }
+
+            /* image must be 256 bytes, or the common half and 128 bytes more
+             * per bank as a banked machine lays it out. entries are where
+             * interrupts or others come in
+             */
+            std::string disassemble(const std::string &image, const std::vector<unsigned char> &entries = {}) const
+            {
+                if (!table_built)
+                    throw std::logic_error("decode table not built");
+
+                if (image.size() < 256 || image.size() % 0x80)
+                    throw std::invalid_argument("memory image must be 256 bytes, or 128 more per bank");
 
-                    oss << "    " << i.second.mnemonic << ' ' << i.second.operand << "    ; " << i.second.byte << std::endl;
+                std::array<std::string, 256> labels;
+                std::string ret;
+                unsigned label_count = 0;
+
+                /* every bank is seen behind the window as the machine would,
+                 * the common half is only listed with bank 0
+                 */
+                for (unsigned bank = 0; bank < image.size() / 0x80 - 1; bank++) {
+                    if (bank)
+                        ret += std::format("    BANK {}\n", bank);
+
+                    ret += disassemble_view(
+                               image.substr(0, 0x80) + image.substr(0x80 + bank * 0x80, 0x80),
+                               entries, bank ? 0x80 : 0, labels, label_count
+                           );
                 }
 
-                return oss.str();
+                return ret + "    END\n";
             }
 
             Opcode opcode;
+
+        private:
+            /* the lines of a 256 byte view from first on. labels before
+             * first are kept from the views listed earlier
+             */
+            std::string disassemble_view(
+                const std::string &image,
+                const std::vector<unsigned char> &entries,
+                unsigned first,
+                std::array<std::string, 256> &labels,
+                unsigned &label_count
+            ) const
+            {
+                std::bitset<256> code = find_code(image, entries), referred, starts;
+                std::string ret;
+                bool skipped = first;
+
+                // lines start at instructions and at bytes outside them
+                for (unsigned addr = 0; addr < 256;) {
+                    unsigned size = code.test(addr) ? table.at(static_cast<unsigned char>(image.at(addr))).size : 1;
+
+                    starts.set(addr);
+
+                    if (code.test(addr) && table.at(static_cast<unsigned char>(image.at(addr))).in_image)
+                        referred.set(static_cast<unsigned char>(image.at(addr + 1)));
+
+                    addr += size;
+                }
+
+                for (unsigned i = first; i < 256; i++)
+                    labels.at(i) = referred.test(i) && starts.test(i) ? std::format("L{}", label_count++) : std::string();
+
+                for (unsigned addr = 0; addr < 256;) {
+                    unsigned char byte = image.at(addr);
+                    std::string line, bytes = std::format("{:02X}", byte);
+
+                    if (addr < first) {
+                        addr += code.test(addr) ? table.at(byte).size : 1;
+                        continue;
+                    }
+
+                    if (!code.test(addr)) {
+                        if (!byte && !referred.test(addr)) {
+                            skipped = true;
+                            addr++;
+                            continue;
+                        }
+
+                        line = std::format("DB 0{:02X}H", byte);
+
+                    } else {
+                        const Entry &e = table.at(byte);
+                        unsigned char operand_byte = e.size > 1 ? image.at(addr + 1) : 0;
+
+                        line = format_instruction(byte, operand_byte, e.in_image ? labels.at(operand_byte) : std::string());
+
+                        if (e.size > 1)
+                            bytes += std::format(" {:02X}", operand_byte);
+                    }
+
+                    if (skipped)
+                        ret += std::format("    ORG 0{:02X}H\n", addr);
+
+                    if (!labels.at(addr).empty())
+                        ret += labels.at(addr) + ":\n";
+
+                    ret += std::format("    {:<20}; {}\n", line, bytes);
+                    skipped = false;
+                    addr += code.test(addr) ? table.at(byte).size : 1;
+                }
+
+                return ret;
+            }
+
+            std::array<Entry, 256> table;
+            bool table_built = false;
     };
 }
 
@@ -0,0 +1,497 @@
+#ifndef BLOCK_ENGINE_HPP_INCLUDED
+#define BLOCK_ENGINE_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "decoded_engine.hpp"
+
+namespace COP2K
+{
+    struct BlockStatistics {
+        uint64_t compiled, invalidated; // blocks
+        uint64_t in_blocks, interpreted; // instructions
+    };
+
+    /* the decoded engine, with runs of instructions that are entered often
+     * turned into blocks by a derived engine, which also runs them
+     *
+     * an address is hot once an instruction has been fetched from it
+     * HOT_COUNT times, and its block is then compiled. what an instruction
+     * does is worked out from its decoded micro words by translate(): the
+     * micro words, IR, register fields and PC are known, so what is left
+     * is moving bytes and the ALU, which is still computed every time it
+     * would be, unless the next computation hides it
+     *
+     * a block relies on the opcodes it fetches after the first. writing
+     * one of them, from the program or through set_em_data(), and changing
+     * a micro word it runs through set_um_data(), throws the block away,
+     * and after MAX_INVALIDATIONS of them its address is no longer
+     * compiled. interrupts, single steps, single clocks and coverage all go
+     * through the decoded engine
+     */
+    class BlockEngine : public DecodedEngine
+    {
+        public:
+            static constexpr unsigned HOT_COUNT = 16;
+            static constexpr unsigned MAX_BLOCK_INSTRUCTIONS = 64;
+            static constexpr unsigned MAX_INVALIDATIONS = 8;
+            static constexpr size_t MAX_BLOCKS = 4096;
+
+            BlockEngine()
+            {
+                watched = translated.data();
+            }
+
+            void reset(const Opcode &opcode, const std::string &image) override
+            {
+                DecodedEngine::reset(opcode, image);
+                clear_blocks();
+                invalidations.fill(0);
+                statistics = {};
+            }
+
+            uint64_t run(uint64_t instructions) override
+            {
+                uint64_t ret = 0, done = 0;
+
+                // by single clocks since
+                check_written();
+
+                while (done < instructions) {
+                    uint8_t addr = pc - 1;
+
+                    // only between two instructions that did not start an interrupt
+                    if (!coverage && !(ireq && !iack) && upc == (ir & ~0x3)) {
+                        int index = blocks_at.at(addr);
+
+                        if (index < 0 && hits.at(addr) < HOT_COUNT && ++hits.at(addr) == HOT_COUNT && em.at(addr) == ir) {
+                            uint64_t before = done;
+
+                            index = compile(addr, instructions, done, ret);
+                            check_written();
+
+                            // compiling ran some, and the next one is elsewhere
+                            if (done != before)
+                                continue;
+                        }
+
+                        if (index >= 0 && blocks.at(index).byte == ir && blocks.at(index).clocks.size() <= instructions - done) {
+                            unsigned n = enter(index);
+
+                            if (n) {
+                                done += n;
+                                ret += blocks.at(index).clocks.at(n - 1);
+                                statistics.in_blocks += n;
+                                check_written();
+                                continue;
+                            }
+                        }
+                    }
+
+                    ret += step();
+                    done++;
+                    statistics.interpreted++;
+                    check_written();
+                }
+
+                return ret;
+            }
+
+            void set_em_data(uint8_t addr, uint8_t val) override
+            {
+                DecodedEngine::set_em_data(addr, val);
+
+                if (translated.at(addr))
+                    invalidate_stale();
+            }
+
+            void set_um_data(uint8_t addr, const std::bitset<24> &val) override
+            {
+                DecodedEngine::set_um_data(addr, val);
+
+                for (Block &i : blocks)
+                    if (i.valid && i.slots >> (addr >> 2) & 1)
+                        invalidate(i);
+
+                update_translated();
+            }
+
+            const BlockStatistics &get_statistics() const
+            {
+                return statistics;
+            }
+
+            std::string get_summary() const override
+            {
+                return std::format(
+                           "{} blocks compiled, {} invalidated, {} instructions in blocks, {} interpreted",
+                           statistics.compiled, statistics.invalidated, statistics.in_blocks, statistics.interpreted
+                       );
+            }
+
+        protected:
+            struct Block {
+                uint8_t addr, byte;
+                std::vector<uint64_t> clocks; // run by the first n + 1 instructions
+                std::vector<std::pair<uint8_t, uint8_t>> opcodes; // fetched and relied on
+                uint64_t slots; // of the instruction set it runs
+                bool valid;
+            };
+
+            // what a block does, before the ALU computations that are hidden are left out
+            struct Op {
+                enum Kind : uint8_t {
+                    CALC, // with s, fen and cn
+                    DBUS_FROM, // the byte at disp, or imm
+                    DBUS_FROM_IMM,
+                    DBUS_FROM_EM,
+                    IBUS_FROM_EM,
+                    LATCH_EM_ADDR, // from disp, or imm
+                    LATCH_EM_ADDR_IMM,
+                    INC_PC,
+                    STORE, // dbus into disp
+                    STORE_IMM,
+                    STORE_EM,
+                    STORE_PC, // dbus, when the condition holds
+                    ENABLE_INT,
+                    FETCH,
+                    EXIT, // with n, s, fen, cn and pc, when a watched byte was written, or always
+                    CHECK_PC, // exit as EXIT does unless PC is imm
+                } kind;
+                uint8_t s = 0;
+                bool fen = false, cn = false;
+                int32_t disp = 0;
+                uint8_t imm = 0;
+                std::optional<uint8_t> em_addr = std::nullopt; // known to hold it
+                std::optional<uint8_t> pc = std::nullopt; // known at the exit
+                unsigned n = 0;
+                bool always = false; // the exit, or the jump
+                bool on_cy = false, on_z = false; // the jump otherwise
+                bool reads_alu = false; // the data bus is driven by D, L or R
+            };
+
+            // what is known while translating
+            struct Known {
+                uint8_t s;
+                bool fen, cn;
+                std::optional<uint8_t> pc, em_addr;
+            };
+
+            /* compiles the block of the instruction in IR at addr, returning
+             * its index, -1 if there is none. it may run instructions on the
+             * way, adding them to done and their clocks to clocks, as long as
+             * done stays below limit
+             */
+            virtual int compile(uint8_t addr, uint64_t limit, uint64_t &done, uint64_t &clocks) = 0;
+
+            // runs a block, returns the instructions run, 0 if it could not start
+            virtual unsigned enter(int index) = 0;
+
+            virtual void clear_blocks()
+            {
+                blocks.clear();
+                blocks_at.fill(-1);
+                hits.fill(0);
+                translated.fill(0);
+                watched_written = false;
+            }
+
+            int add_block(Block &&block)
+            {
+                for (const auto &[i, byte] : block.opcodes)
+                    translated.at(i) = 1;
+
+                blocks_at.at(block.addr) = blocks.size();
+                blocks.push_back(std::move(block));
+                statistics.compiled++;
+                return blocks.size() - 1;
+            }
+
+            int32_t at(const void *p) const
+            {
+                return static_cast<int32_t>(static_cast<const uint8_t *>(p) - reinterpret_cast<const uint8_t *>(this));
+            }
+
+            int32_t at_em(unsigned addr = 0) const
+            {
+                return at(em.data() + addr);
+            }
+
+            /* the clocks of the instruction in byte, false if it is one the
+             * decoded engine could throw in or it never fetches. next is
+             * where the next instruction comes from, if known. with fall, a
+             * jump leaves PC where it is when not taken, if that is known
+             */
+            bool translate(
+                uint8_t byte, Known &known, std::vector<Op> &ops, unsigned &clocks, std::optional<uint8_t> &next,
+                std::optional<uint8_t> *fall = nullptr
+            ) const
+            {
+                std::optional<uint8_t> not_taken;
+                bool jumps = false;
+
+                for (unsigned i = 0; i < 4; i++) {
+                    const Word &word = words.at((byte & ~0x3) | i);
+                    const Routing &route = word.routing.at(0);
+                    const bool on_cy = !(byte & 0x8) && (byte & 0xC) == 0x0;
+                    const bool on_z = !(byte & 0x8) && (byte & 0xC) == 0x4;
+
+                    if (route.conflict || (route.targets && route.dbus == FROM_NONE))
+                        return false;
+
+                    ops.push_back(calc_op((known.s & 0x6) | (word.s & 0x1), known));
+                    ops.push_back(calc_op((known.s & 0x4) | (word.s & 0x3), known));
+                    ops.push_back(calc_op(word.s, known));
+                    known.s = word.s;
+                    known.fen = word.fen;
+                    known.cn = word.cn;
+
+                    if (word.eint)
+                        ops.push_back({ .kind = Op::ENABLE_INT });
+
+                    if (route.em_addr) {
+                        known.em_addr = route.abus == PC ? known.pc : std::nullopt;
+
+                        // the next opcode is no longer where PC says
+                        if (route.abus != PC)
+                            not_taken.reset();
+
+                        if (known.em_addr)
+                            ops.push_back({ .kind = Op::LATCH_EM_ADDR_IMM, .imm = *known.em_addr });
+
+                        else
+                            ops.push_back({ .kind = Op::LATCH_EM_ADDR, .disp = at(route.abus == PC ? &pc : &mar) });
+                    }
+
+                    switch (route.dbus) {
+                        case FROM_NONE:
+                            break;
+
+                        case FROM_PC:
+                            if (known.pc)
+                                ops.push_back({ .kind = Op::DBUS_FROM_IMM, .imm = *known.pc });
+
+                            else
+                                ops.push_back({ .kind = Op::DBUS_FROM, .disp = at(&pc) });
+
+                            break;
+
+                        case FROM_EM:
+                            ops.push_back({ .kind = Op::DBUS_FROM_EM, .em_addr = known.em_addr });
+                            break;
+
+                        default:
+                            ops.push_back({
+                                .kind = Op::DBUS_FROM, .disp = source(route.dbus, byte),
+                                .reads_alu = route.dbus == FROM_D || route.dbus == FROM_L || route.dbus == FROM_R
+                            });
+                            break;
+                    }
+
+                    if (route.abus == PC) {
+                        if (known.pc)
+                            known.pc = *known.pc + 1;
+
+                        else {
+                            ops.push_back({ .kind = Op::INC_PC });
+
+                            if (not_taken)
+                                not_taken = *not_taken + 1;
+                        }
+                    }
+
+                    if (route.ibus == EM)
+                        ops.push_back({ .kind = Op::IBUS_FROM_EM, .em_addr = known.em_addr });
+
+                    if (route.targets & TO_EM)
+                        ops.push_back({ .kind = Op::STORE_EM, .em_addr = known.em_addr });
+
+                    if (route.targets & TO_PC) {
+                        // PC is stored as known in case the jump is not taken
+                        if (known.pc)
+                            ops.push_back({ .kind = Op::STORE_IMM, .disp = at(&pc), .imm = *known.pc });
+
+                        ops.push_back({ .kind = Op::STORE_PC, .always = !on_cy && !on_z, .on_cy = on_cy, .on_z = on_z });
+                        not_taken = jumps ? std::nullopt : known.pc;
+                        known.pc.reset();
+                        jumps = true;
+                    }
+
+                    for (auto [target, field] : {
+                             std::pair<uint8_t, const uint8_t *>(TO_MAR, &mar), { TO_OUT, &out }, { TO_ST, &st },
+                             { TO_REG, &regs.at(byte & 0x3) }
+                         })
+                        if (route.targets & target)
+                            ops.push_back({ .kind = Op::STORE, .disp = at(field) });
+
+                    if (route.targets & TO_W) {
+                        ops.push_back({ .kind = Op::STORE, .disp = at(&w) });
+                        ops.push_back(calc_op(word.s, known));
+                    }
+
+                    if (route.targets & TO_A) {
+                        ops.push_back({ .kind = Op::STORE, .disp = at(&a) });
+                        ops.push_back(calc_op(word.s, known));
+                    }
+
+                    if (!word.fetch)
+                        continue;
+
+                    if (route.ibus != EM)
+                        return false;
+
+                    ops.push_back({ .kind = Op::FETCH });
+                    clocks = i + 1;
+                    next = jumps ? std::nullopt : known.em_addr;
+
+                    if (fall)
+                        *fall = not_taken;
+
+                    return true;
+                }
+
+                return false;
+            }
+
+            Op calc_op(uint8_t s, const Known &known) const
+            {
+                return { .kind = Op::CALC, .s = s, .fen = known.fen, .cn = known.cn };
+            }
+
+            int32_t source(DBusSource source, uint8_t byte) const
+            {
+                switch (source) {
+                    case FROM_IN:
+                        return at(&in);
+
+                    case FROM_IA:
+                        return at(&ia);
+
+                    case FROM_ST:
+                        return at(&st);
+
+                    case FROM_D:
+                        return at(&d);
+
+                    case FROM_L:
+                        return at(&l);
+
+                    case FROM_R:
+                        return at(&r);
+
+                    default:
+                        return at(&regs.at(byte & 0x3));
+                }
+            }
+
+            Op exit_op(unsigned n, const Known &known, bool always) const
+            {
+                return {
+                    .kind = Op::EXIT, .s = known.s, .fen = known.fen, .cn = known.cn,
+                    .pc = known.pc, .n = n, .always = always
+                };
+            }
+
+            /* a computation is hidden when the next one overwrites all it
+             * did before anything reads it: it left the flags alone, or the
+             * next one sets them without reading the carry
+             */
+            static void leave_out_hidden(std::vector<Op> &ops)
+            {
+                std::vector<bool> hidden(ops.size());
+
+                for (size_t i = 0; i < ops.size(); i++) {
+                    if (ops.at(i).kind != Op::CALC)
+                        continue;
+
+                    for (size_t j = i + 1; j < ops.size(); j++) {
+                        const Op &next = ops.at(j);
+
+                        if (next.kind == Op::CALC) {
+                            hidden.at(i) = !ops.at(i).fen || (next.fen && next.s != 4 && next.s != 5);
+                            break;
+                        }
+
+                        if (next.kind == Op::EXIT || next.kind == Op::CHECK_PC || next.kind == Op::STORE_PC || next.reads_alu)
+                            break;
+                    }
+                }
+
+                size_t kept = 0;
+
+                for (size_t i = 0; i < ops.size(); i++)
+                    if (!hidden.at(i))
+                        ops.at(kept++) = ops.at(i);
+
+                ops.resize(kept);
+            }
+
+            static bool stores_em(const std::vector<Op> &ops)
+            {
+                return std::find_if(ops.begin(), ops.end(), [](const Op &i) {
+                    return i.kind == Op::STORE_EM;
+                }) != ops.end();
+            }
+
+            void check_written()
+            {
+                if (watched_written) {
+                    watched_written = false;
+                    invalidate_stale();
+                }
+            }
+
+            void invalidate(Block &block)
+            {
+                block.valid = false;
+                blocks_at.at(block.addr) = -1;
+                statistics.invalidated++;
+
+                // code that keeps changing is left to the decoded engine
+                if (++invalidations.at(block.addr) < MAX_INVALIDATIONS)
+                    hits.at(block.addr) = 0;
+            }
+
+            // throws away the blocks that rely on opcodes no longer in memory
+            void invalidate_stale()
+            {
+                for (Block &i : blocks)
+                    if (i.valid)
+                        for (const auto &[addr, byte] : i.opcodes)
+                            if (em.at(addr) != byte) {
+                                invalidate(i);
+                                break;
+                            }
+
+                update_translated();
+            }
+
+            void update_translated()
+            {
+                translated.fill(0);
+
+                for (const Block &i : blocks)
+                    if (i.valid)
+                        for (const auto &[addr, byte] : i.opcodes)
+                            translated.at(addr) = 1;
+            }
+
+            std::vector<Block> blocks;
+            std::array<int, 256> blocks_at; // by the address of the first instruction
+            std::array<unsigned, 256> hits;
+            std::array<unsigned, 256> invalidations;
+            std::array<uint8_t, 256> translated; // opcodes some block relies on, watched
+            BlockStatistics statistics = {};
+    };
+}
+
+#endif // BLOCK_ENGINE_HPP_INCLUDED
@@ -0,0 +1,244 @@
+#ifndef COVERAGE_HPP_INCLUDED
+#define COVERAGE_HPP_INCLUDED
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    /* what ran under one instruction set, as bitmaps that merge with OR
+     *
+     * a coverage file is a list of sections, one per instruction set:
+     *
+     *     COP2K coverage 1
+     *     isa <hash> <name>
+     *     runs <n>
+     *     upc <bitmap>
+     *     signals <upc> <asserted>      for every upc that ran
+     *     ir <bitmap>
+     *     read <bitmap>
+     *     written <bitmap>
+     *     executed <bitmap>
+     *     end
+     *
+     * a bitmap is 64 hex digits, the first holding bits 0-3. asserted is
+     * 6 hex digits with the bits of the micro word that were active (low)
+     */
+    struct Coverage {
+        uint64_t isa_hash = 0; // of the micro program, see hash_opcode()
+        std::string isa_name;
+        uint64_t runs = 0;
+
+        std::bitset<256> upc; // micro program addresses that ran
+        std::array<uint32_t, 256> signals = {}; // control signals asserted at each of them
+        std::bitset<256> ir; // instruction bytes loaded into IR: opcode and register field
+        // memory bytes, where executed means read at PC: opcodes and their operands
+        std::bitset<256> read, written, executed;
+
+        static constexpr uint32_t SIGNAL_MASK = 0x7FFFFF;
+
+        // FNV-1a of all 256 micro words, slots without an instruction included
+        static uint64_t hash_opcode(const Opcode &opcode)
+        {
+            uint64_t ret = 0xcbf29ce484222325;
+
+            for (const Opcode::Instruction &i : opcode)
+                for (const std::bitset<24> &j : i.microprogram) {
+                    unsigned long word = i.exist ? j.to_ulong() : 0xFFFFFF;
+
+                    for (unsigned k = 0; k < 3; k++)
+                        ret = (ret ^ (word >> k * 8 & 0xff)) * 0x100000001b3;
+                }
+
+            return ret;
+        }
+
+        void merge(const Coverage &other)
+        {
+            if (other.isa_hash != isa_hash)
+                throw std::invalid_argument("coverage of different instruction sets");
+
+            runs += other.runs;
+            upc |= other.upc;
+            ir |= other.ir;
+            read |= other.read;
+            written |= other.written;
+            executed |= other.executed;
+
+            for (unsigned i = 0; i < 256; i++)
+                signals.at(i) |= other.signals.at(i);
+        }
+
+        void save(std::ostream &out) const
+        {
+            out << std::format("isa {:016x} {}\n", isa_hash, isa_name);
+            out << std::format("runs {}\n", runs);
+            out << "upc " << bitmap_to_hex(upc) << "\n";
+
+            for (unsigned i = 0; i < 256; i++)
+                if (upc.test(i))
+                    out << std::format("signals {:02X} {:06X}\n", i, signals.at(i));
+
+            out << "ir " << bitmap_to_hex(ir) << "\n";
+            out << "read " << bitmap_to_hex(read) << "\n";
+            out << "written " << bitmap_to_hex(written) << "\n";
+            out << "executed " << bitmap_to_hex(executed) << "\n";
+            out << "end\n";
+        }
+
+        static void save_file(const std::vector<Coverage> &sections, std::ostream &out)
+        {
+            out << "COP2K coverage 1\n";
+
+            for (const Coverage &i : sections)
+                i.save(out);
+        }
+
+        static std::vector<Coverage> load_file(std::istream &in)
+        {
+            std::vector<Coverage> ret;
+            std::string line;
+            unsigned lineno = 1;
+            bool in_section = false;
+
+            if (!std::getline(in, line) || line != "COP2K coverage 1")
+                throw std::runtime_error("not a coverage file");
+
+            while (std::getline(in, line)) {
+                std::istringstream iss(line);
+                std::string key, value;
+
+                lineno++;
+                iss >> key;
+
+                if (key.empty())
+                    continue;
+
+                if (key == "isa") {
+                    if (in_section)
+                        throw std::runtime_error(std::format("line {}: section not ended", lineno));
+
+                    ret.emplace_back();
+                    in_section = true;
+                    iss >> value;
+                    ret.back().isa_hash = parse_hex(value, 16, lineno);
+                    iss >> std::ws;
+                    std::getline(iss, ret.back().isa_name);
+                    continue;
+                }
+
+                if (!in_section)
+                    throw std::runtime_error(std::format("line {}: {} outside a section", lineno, key));
+
+                Coverage &c = ret.back();
+                iss >> value;
+
+                if (key == "runs")
+                    c.runs = std::stoull(value);
+
+                else if (key == "upc")
+                    c.upc = bitmap_from_hex(value, lineno);
+
+                else if (key == "signals") {
+                    std::string mask;
+                    unsigned addr = parse_hex(value, 2, lineno);
+
+                    iss >> mask;
+                    c.signals.at(addr) |= parse_hex(mask, 6, lineno) & SIGNAL_MASK;
+
+                } else if (key == "ir")
+                    c.ir = bitmap_from_hex(value, lineno);
+
+                else if (key == "read")
+                    c.read = bitmap_from_hex(value, lineno);
+
+                else if (key == "written")
+                    c.written = bitmap_from_hex(value, lineno);
+
+                else if (key == "executed")
+                    c.executed = bitmap_from_hex(value, lineno);
+
+                else if (key == "end")
+                    in_section = false;
+
+                else
+                    throw std::runtime_error(std::format("line {}: unknown key {}", lineno, key));
+            }
+
+            if (in_section)
+                throw std::runtime_error("coverage file ends inside a section");
+
+            return ret;
+        }
+
+        // adds a section into the list, merged into the one of the same instruction set
+        static void merge_into(std::vector<Coverage> &sections, const Coverage &c)
+        {
+            for (Coverage &i : sections)
+                if (i.isa_hash == c.isa_hash) {
+                    i.merge(c);
+                    return;
+                }
+
+            sections.push_back(c);
+        }
+
+        static std::string bitmap_to_hex(const std::bitset<256> &bits)
+        {
+            std::string ret;
+
+            for (unsigned i = 0; i < 256; i += 4)
+                ret.push_back("0123456789ABCDEF"[
+                                  bits.test(i) | bits.test(i + 1) << 1 | bits.test(i + 2) << 2 | bits.test(i + 3) << 3
+                              ]);
+
+            return ret;
+        }
+
+        static std::bitset<256> bitmap_from_hex(const std::string &s, unsigned lineno)
+        {
+            std::bitset<256> ret;
+
+            if (s.size() != 64)
+                throw std::runtime_error(std::format("line {}: bad bitmap", lineno));
+
+            for (unsigned i = 0; i < 64; i++) {
+                unsigned digit = parse_hex(s.substr(i, 1), 1, lineno);
+
+                for (unsigned j = 0; j < 4; j++)
+                    ret.set(i * 4 + j, digit >> j & 1);
+            }
+
+            return ret;
+        }
+
+        static uint64_t parse_hex(const std::string &s, size_t digits, unsigned lineno)
+        {
+            size_t end = 0;
+            uint64_t ret = 0;
+
+            try {
+                ret = std::stoull(s, &end, 16);
+
+            } catch (const std::logic_error &) {
+            }
+
+            if (s.size() != digits || end != digits)
+                throw std::runtime_error(std::format("line {}: bad number {}", lineno, s));
+
+            return ret;
+        }
+    };
+}
+
+#endif // COVERAGE_HPP_INCLUDED
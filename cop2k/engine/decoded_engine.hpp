@@ -0,0 +1,494 @@
+#ifndef DECODED_ENGINE_HPP_INCLUDED
+#define DECODED_ENGINE_HPP_INCLUDED
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+
+#include "libopcode.hpp"
+#include "engine.hpp"
+
+namespace COP2K
+{
+    /* COP2K with every micro word decoded once into what it drives and
+     * reads, and the state kept in plain bytes, so a clock is a handful
+     * of branches instead of bus objects and callbacks
+     *
+     * the order of everything COP2K does in a clock is kept, as the ALU
+     * quirks depend on it: setting S0, S1 and S2 in turn recomputes the
+     * ALU with the FEN of the previous word, and so does loading W or A
+     * with the FEN of this one. each time, the flags change when FEN is
+     * set, and a carry operation sees the carry of the time before
+     */
+    class DecodedEngine : public Engine
+    {
+        public:
+            const char *get_name() const override
+            {
+                return "decoded";
+            }
+
+            void reset(const Opcode &opcode, const std::string &image) override
+            {
+                if (image.size() != 256)
+                    throw std::invalid_argument("memory image must be 256 bytes");
+
+                this->opcode = opcode;
+
+                for (unsigned i = 0; i < 256; i++)
+                    decode_slot(i);
+
+                a = w = pc = st = mar = out = in = ia = ir = upc = em_addr = l = d = r = 0;
+                regs = {};
+                s = 0x7;
+                cy = z = ireq = iack = em_from_pc = false;
+                fen = cn = true;
+
+                for (unsigned i = 0; i < 256; i++)
+                    em.at(i) = image.at(i);
+            }
+
+            unsigned step() override
+            {
+                for (unsigned i = 1; i <= MAX_STEP_CLOCKS; i++)
+                    if (clock())
+                        return i;
+
+                throw std::runtime_error(std::format("no instruction fetched in {} clocks", MAX_STEP_CLOCKS));
+            }
+
+            bool run_clock() override
+            {
+                clock();
+                return true;
+            }
+
+            bool set_coverage(Coverage *c) override
+            {
+                coverage = c;
+                return true;
+            }
+
+            EngineState get_state() const override
+            {
+                return { a, w, regs, pc, st, mar, out, in, ia, ir, upc, cy, z, ireq, iack, em };
+            }
+
+            void set_in(uint8_t val) override
+            {
+                in = val;
+            }
+
+            void trigger_interrupt() override
+            {
+                ireq = true;
+            }
+
+            void set_em_data(uint8_t addr, uint8_t val) override
+            {
+                em.at(addr) = val;
+            }
+
+            // the safety of every word of the instruction may change
+            void set_um_data(uint8_t addr, const std::bitset<24> &val) override
+            {
+                opcode.patch_um(addr, val);
+
+                for (unsigned i = addr & ~0x3; i <= (addr | 0x3); i++)
+                    decode_slot(i);
+            }
+
+            enum DBusSource : uint8_t {
+                FROM_NONE,
+                FROM_IN,
+                FROM_IA,
+                FROM_ST,
+                FROM_PC,
+                FROM_D,
+                FROM_L,
+                FROM_R,
+                FROM_REG,
+                FROM_EM
+            };
+
+            // in the order COP2K adds them
+            enum DBusTarget : uint8_t {
+                TO_EM = 1 << 0,
+                TO_PC = 1 << 1,
+                TO_MAR = 1 << 2,
+                TO_OUT = 1 << 3,
+                TO_ST = 1 << 4,
+                TO_REG = 1 << 5,
+                TO_W = 1 << 6,
+                TO_A = 1 << 7
+            };
+
+            enum BusSource : uint8_t {
+                NONE,
+                PC, // address bus
+                MAR,
+                EM, // instruction bus
+                INTERRUPT
+            };
+
+            struct Routing {
+                DBusSource dbus;
+                uint8_t targets;
+                BusSource abus, ibus;
+                bool em_addr; // memory takes its address from the address bus
+                bool conflict; // COP2K throws as the word was not proven safe
+                uint32_t asserted; // active signals, for coverage
+            };
+
+            struct Word {
+                uint8_t s; // ALU operation
+                bool fen, cn, eint;
+                bool fetch; // IR and uPC read the instruction bus
+                std::array<Routing, 2> routing; // as is, and with EMRD taken by an interrupt
+            };
+
+            // what a micro word drives and reads, also what the AOT translator emits code from
+            static Word decode(const std::bitset<24> &word, bool safe)
+            {
+                return decode(static_cast<uint32_t>(word.to_ulong()), safe);
+            }
+
+            // also at compile time, for instruction sets built in
+            static constexpr Word decode(uint32_t word, bool safe)
+            {
+                auto test = [word](unsigned bit) {
+                    return (word >> bit & 1) != 0;
+                };
+                Word ret = {
+                    static_cast<uint8_t>(word & 0x7),
+                    test(8), test(9), !test(17), !test(18), {}
+                };
+                unsigned x = word >> 5 & 0x7;
+                bool emen = !test(19), emwr = !test(22);
+
+                for (unsigned i = 0; i < 2; i++) {
+                    Routing &r = ret.routing.at(i);
+                    bool emrd = !i && !test(21);
+                    unsigned dbus_writers = 0, abus_writers = 0;
+
+                    r = { FROM_NONE, 0, NONE, NONE, false, false, static_cast<uint32_t>(~word & Coverage::SIGNAL_MASK) };
+
+                    if (i) {
+                        r.ibus = INTERRUPT;
+                        r.asserted &= ~(1u << 21); // EMRD
+                    }
+
+                    if (emrd)
+                        r.ibus = EM;
+
+                    if (!test(20)) {
+                        r.abus = PC;
+                        abus_writers++;
+                    }
+
+                    if (emen) {
+                        if (emwr)
+                            r.targets |= TO_EM;
+
+                        if (emrd) {
+                            r.dbus = FROM_EM;
+                            dbus_writers++;
+                        }
+                    }
+
+                    if (!test(16))
+                        r.targets |= TO_PC;
+
+                    if (!test(15))
+                        r.targets |= TO_MAR;
+
+                    if (!test(14)) {
+                        r.abus = MAR;
+                        abus_writers++;
+                    }
+
+                    if (!test(13))
+                        r.targets |= TO_OUT;
+
+                    if (!test(12))
+                        r.targets |= TO_ST;
+
+                    if (!test(11)) {
+                        r.dbus = FROM_REG;
+                        dbus_writers++;
+                    }
+
+                    if (!test(10))
+                        r.targets |= TO_REG;
+
+                    if (!test(4))
+                        r.targets |= TO_W;
+
+                    if (!test(3))
+                        r.targets |= TO_A;
+
+                    if (x != 7) {
+                        constexpr DBusSource sources[] = {
+                            FROM_IN, FROM_IA, FROM_ST, FROM_PC, FROM_D, FROM_R, FROM_L
+                        };
+
+                        r.dbus = sources[x];
+                        dbus_writers++;
+                    }
+
+                    r.em_addr = r.abus != NONE && (emrd || (emen && emwr));
+                    r.conflict = !safe && (dbus_writers > 1 || abus_writers > 1);
+                }
+
+                return ret;
+            }
+
+        protected:
+            // slots without an instruction all hold the word of no signals
+            void decode_slot(uint8_t upc)
+            {
+                const Opcode::Instruction &ins = opcode.begin()[upc >> 2];
+
+                words.at(upc) = decode(
+                                    ins.exist ? ins.microprogram.at(upc & 0x3) : std::bitset<24>().set(),
+                                    opcode.is_um_safe(upc)
+                                );
+            }
+
+            void calc(uint8_t op)
+            {
+                calc(op, fen, cn);
+            }
+
+            // with the FEN and CN a word is known to have
+            void calc(uint8_t op, bool fen, bool cn)
+            {
+                int result = 0; // must use `int` to test overflow
+
+                switch (op) {
+                    case 0:
+                        result = a + w;
+                        break;
+
+                    case 1:
+                        result = a - w;
+                        break;
+
+                    case 2:
+                        result = a | w;
+                        break;
+
+                    case 3:
+                        result = a & w;
+                        break;
+
+                    case 4:
+                        result = a + w + cy;
+                        break;
+
+                    case 5:
+                        result = a - w - cy;
+                        break;
+
+                    case 6:
+                        result = ~a;
+                        break;
+
+                    case 7:
+                        result = a;
+                        break;
+                }
+
+                if (fen) {
+                    cy = result < -128 || result > 127;
+                    z = !result;
+                }
+
+                l = (result << 1) | (cy & cn);
+                d = result;
+                r = (result >> 1) | ((cy & cn) << 7);
+            }
+
+            // returns whether the clock fetched an instruction
+            bool clock()
+            {
+                const Word &word = words.at(upc);
+                bool interrupted = ireq && !iack;
+                const Routing &route = word.routing.at(interrupted);
+                uint8_t abus = 0, dbus = 0, ibus = 0;
+
+                // S0, S1 and S2 are set one at a time
+                calc((s & 0x6) | (word.s & 0x1));
+                calc((s & 0x4) | (word.s & 0x3));
+                calc(word.s);
+                s = word.s;
+                fen = word.fen;
+                cn = word.cn;
+
+                if (interrupted)
+                    iack = true;
+
+                if (route.conflict)
+                    throw std::logic_error("this bus already has a writer");
+
+                if (word.eint)
+                    iack = ireq = false;
+
+                if (route.abus == PC)
+                    abus = pc;
+
+                else if (route.abus == MAR)
+                    abus = mar;
+
+                if (route.em_addr) {
+                    em_addr = abus;
+                    em_from_pc = route.abus == PC;
+                }
+
+                if (coverage) {
+                    coverage->upc.set(upc);
+                    coverage->signals.at(upc) |= route.asserted;
+
+                    if (route.dbus == FROM_EM)
+                        (em_from_pc ? coverage->executed : coverage->read).set(em_addr);
+
+                    if (route.targets & TO_EM)
+                        coverage->written.set(em_addr);
+                }
+
+                switch (route.dbus) {
+                    case FROM_NONE:
+                        break;
+
+                    case FROM_IN:
+                        dbus = in;
+                        break;
+
+                    case FROM_IA:
+                        dbus = ia;
+                        break;
+
+                    case FROM_ST:
+                        dbus = st;
+                        break;
+
+                    case FROM_PC:
+                        dbus = pc;
+                        break;
+
+                    case FROM_D:
+                        dbus = d;
+                        break;
+
+                    case FROM_L:
+                        dbus = l;
+                        break;
+
+                    case FROM_R:
+                        dbus = r;
+                        break;
+
+                    case FROM_REG:
+                        dbus = regs.at(ir & 0x3);
+                        break;
+
+                    case FROM_EM:
+                        dbus = em.at(em_addr);
+                        break;
+                }
+
+                if (route.abus == PC)
+                    pc++;
+
+                if (route.ibus == EM)
+                    ibus = em.at(em_addr);
+
+                else if (route.ibus == INTERRUPT)
+                    ibus = 0xB8;
+
+                if (route.targets) {
+                    const bool driven = route.dbus != FROM_NONE;
+                    const bool jump =
+                        (ir & 0x8) || // jump unconditionally
+                        ((ir & 0xC) >> 2 == 0 && cy) || // jump on carry
+                        ((ir & 0xC) >> 2 == 1 && z); // jump on zero
+
+                    if (!driven && (route.targets & ~TO_PC || jump))
+                        throw std::logic_error("this bus has no writer");
+
+                    if (route.targets & TO_EM) {
+                        em.at(em_addr) = dbus;
+
+                        if (watched && watched[em_addr])
+                            watched_written = true;
+                    }
+
+                    if (route.targets & TO_PC && jump)
+                        pc = dbus;
+
+                    if (route.targets & TO_MAR)
+                        mar = dbus;
+
+                    if (route.targets & TO_OUT)
+                        out = dbus;
+
+                    if (route.targets & TO_ST)
+                        st = dbus;
+
+                    if (route.targets & TO_REG)
+                        regs.at(ir & 0x3) = dbus;
+
+                    if (route.targets & TO_W) {
+                        w = dbus;
+                        calc(s);
+                    }
+
+                    if (route.targets & TO_A) {
+                        a = dbus;
+                        calc(s);
+                    }
+                }
+
+                if (!word.fetch) {
+                    upc++;
+                    return false;
+                }
+
+                if (route.ibus == NONE)
+                    throw std::logic_error("this bus has no writer");
+
+                ir = ibus;
+                upc = ibus & ~0x3;
+
+                if (coverage) {
+                    coverage->ir.set(ibus);
+
+                    if (route.ibus == EM)
+                        coverage->executed.set(em_addr);
+                }
+
+                return true;
+            }
+
+            Opcode opcode;
+            std::array<Word, 256> words;
+            Coverage *coverage = nullptr;
+            const uint8_t *watched = nullptr; // 256 flags, a write to a byte flagged sets watched_written
+            uint8_t watched_written = false;
+
+            uint8_t a, w, pc, st, mar, out, in, ia, ir, upc;
+            std::array<uint8_t, 4> regs;
+            uint8_t l, d, r; // ALU outputs
+            uint8_t s; // S2-S0 as last set
+            bool cy, z, fen, cn;
+            bool ireq, iack;
+            uint8_t em_addr;
+            bool em_from_pc; // em_addr was taken from PC
+            std::array<uint8_t, 256> em;
+    };
+}
+
+#endif // DECODED_ENGINE_HPP_INCLUDED
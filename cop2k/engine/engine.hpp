@@ -0,0 +1,212 @@
+#ifndef ENGINE_HPP_INCLUDED
+#define ENGINE_HPP_INCLUDED
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "libcop2k.hpp"
+#include "libopcode.hpp"
+#include "coverage.hpp"
+
+namespace COP2K
+{
+    // what a program can observe of the machine between two instructions
+    struct EngineState {
+        uint8_t a, w;
+        std::array<uint8_t, 4> r;
+        uint8_t pc, st, mar, out, in, ia, ir, upc;
+        bool cy, z, ireq, iack;
+        std::array<uint8_t, 256> em;
+
+        bool operator==(const EngineState &) const = default;
+
+        // FNV-1a of every field
+        uint64_t hash() const
+        {
+            uint64_t ret = 0xcbf29ce484222325;
+            auto add = [&ret](uint8_t byte) {
+                ret = (ret ^ byte) * 0x100000001b3;
+            };
+
+            for (uint8_t i : { a, w, r.at(0), r.at(1), r.at(2), r.at(3), pc, st, mar, out, in, ia, ir, upc })
+                add(i);
+
+            add(cy << 3 | z << 2 | ireq << 1 | iack);
+
+            for (uint8_t i : em)
+                add(i);
+
+            return ret;
+        }
+
+        std::string to_string() const
+        {
+            std::string ret = std::format(
+                                  "A={:02X} W={:02X} R0={:02X} R1={:02X} R2={:02X} R3={:02X} "
+                                  "PC={:02X} ST={:02X} MAR={:02X} OUT={:02X} IN={:02X} IA={:02X} "
+                                  "IR={:02X} UPC={:02X} CY={:d} Z={:d} IREQ={:d} IACK={:d}\n",
+                                  a, w, r.at(0), r.at(1), r.at(2), r.at(3), pc, st, mar, out, in, ia,
+                                  ir, upc, cy, z, ireq, iack
+                              );
+
+            for (unsigned i = 0; i < 256; i++)
+                ret += std::format("{:02X}{}", em.at(i), (i & 0xf) == 0xf ? "\n" : " ");
+
+            return ret;
+        }
+    };
+
+    /* a way of running programs. every engine must behave like COP2K
+     * running automatically, down to its quirks, which is what lockstep
+     * checks
+     */
+    class Engine
+    {
+        public:
+            virtual ~Engine() = default;
+
+            virtual const char *get_name() const = 0;
+
+            // power-on state with the instruction set and a 256 byte image loaded
+            virtual void reset(const Opcode &opcode, const std::string &image) = 0;
+
+            // runs up to and including the clock that loads IR, returns the clocks run
+            virtual unsigned step() = 0;
+
+            /* runs up to the given number of instructions, returns the clocks
+             * run. unlike step(), engines may run many of them at once
+             */
+            virtual uint64_t run(uint64_t instructions)
+            {
+                uint64_t ret = 0;
+
+                for (uint64_t i = 0; i < instructions; i++)
+                    ret += step();
+
+                return ret;
+            }
+
+            // runs a single clock, engines that cannot stop inside an instruction return false
+            virtual bool run_clock()
+            {
+                return false;
+            }
+
+            // records what runs into coverage until set to nullptr, engines that cannot return false
+            virtual bool set_coverage(Coverage *)
+            {
+                return false;
+            }
+
+            virtual EngineState get_state() const = 0;
+
+            virtual void set_in(uint8_t val) = 0;
+
+            virtual void trigger_interrupt() = 0;
+
+            // changes memory or the micro program between instructions, as a debugger would
+            virtual void set_em_data(uint8_t addr, uint8_t val) = 0;
+
+            virtual void set_um_data(uint8_t addr, const std::bitset<24> &val) = 0;
+
+            // what the engine counted about itself since the reset, empty for none
+            virtual std::string get_summary() const
+            {
+                return {};
+            }
+
+            // an instruction that never fetches the next one runs into the next slots
+            static constexpr unsigned MAX_STEP_CLOCKS = 1024;
+    };
+
+    // the reference: COP2K itself, one clock at a time
+    class ClockEngine : public Engine
+    {
+        public:
+            const char *get_name() const override
+            {
+                return "clock";
+            }
+
+            void reset(const Opcode &opcode, const std::string &image) override
+            {
+                if (image.size() != 256)
+                    throw std::invalid_argument("memory image must be 256 bytes");
+
+                machine = std::make_unique<COP2K>([](COP2K &, COP2KCallbackType) {});
+                machine->load_instruction(opcode);
+                machine->clear_em();
+
+                for (unsigned i = 0; i < 256; i++)
+                    machine->set_em_data(i, image.at(i));
+
+                machine->running_manually.neg();
+                machine->manual_dbus.neg();
+            }
+
+            unsigned step() override
+            {
+                for (unsigned i = 1; i <= MAX_STEP_CLOCKS; i++) {
+                    machine->run_clock();
+
+                    if (!machine->iren.get())
+                        return i;
+                }
+
+                throw std::runtime_error(std::format("no instruction fetched in {} clocks", MAX_STEP_CLOCKS));
+            }
+
+            bool run_clock() override
+            {
+                machine->run_clock();
+                return true;
+            }
+
+            EngineState get_state() const override
+            {
+                EngineState ret = {
+                    machine->a.get(), machine->w.get(),
+                    { machine->r0.get(), machine->r1.get(), machine->r2.get(), machine->r3.get() },
+                    machine->pc.get(), machine->st.get(), machine->mar.get(), machine->out.get(),
+                    machine->in.get(), machine->ia.get(), machine->ir.get(), machine->upc.get(),
+                    machine->get_cy(), machine->get_z(), machine->ireq.get(), machine->iack.get(),
+                    {}
+                };
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret.em.at(i) = machine->get_em_data(i);
+
+                return ret;
+            }
+
+            void set_in(uint8_t val) override
+            {
+                machine->in.set(val);
+            }
+
+            void trigger_interrupt() override
+            {
+                machine->trigger_interrupt();
+            }
+
+            void set_em_data(uint8_t addr, uint8_t val) override
+            {
+                machine->set_em_data(addr, val);
+            }
+
+            void set_um_data(uint8_t addr, const std::bitset<24> &val) override
+            {
+                machine->set_um_data(addr, val);
+            }
+
+        private:
+            std::unique_ptr<COP2K> machine;
+    };
+}
+
+#endif // ENGINE_HPP_INCLUDED
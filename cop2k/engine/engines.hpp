@@ -0,0 +1,61 @@
+#ifndef ENGINES_HPP_INCLUDED
+#define ENGINES_HPP_INCLUDED
+
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+#include "decoded_engine.hpp"
+#include "static_engine.hpp"
+#include "memo_engine.hpp"
+#include "jit_engine.hpp"
+#include "trace_engine.hpp"
+#include "../preset_instruction_set/inst.hpp"
+
+namespace COP2K
+{
+    inline std::vector<std::string> get_engine_names()
+    {
+        std::vector<std::string> ret = { "clock", "decoded", "static", "memo" };
+
+#ifdef COP2K_TRACE
+        ret.push_back("trace");
+#endif
+#ifdef COP2K_JIT
+        ret.push_back("jit");
+#endif
+        return ret;
+    }
+
+    inline std::unique_ptr<Engine> make_engine(const std::string &name)
+    {
+        if (name == "clock")
+            return std::make_unique<ClockEngine>();
+
+        if (name == "decoded")
+            return std::make_unique<DecodedEngine>();
+
+        // specialized to the preset instruction set, decoded for any other
+        if (name == "static")
+            return std::make_unique<StaticEngine<PresetInst>>();
+
+        if (name == "memo")
+            return std::make_unique<MemoEngine>();
+
+#ifdef COP2K_TRACE
+        if (name == "trace")
+            return std::make_unique<TraceEngine>();
+#endif
+#ifdef COP2K_JIT
+        if (name == "jit")
+            return std::make_unique<JitEngine>();
+#endif
+
+        throw std::runtime_error(std::format("no engine named {}", name));
+    }
+}
+
+#endif // ENGINES_HPP_INCLUDED
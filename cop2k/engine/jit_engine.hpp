@@ -0,0 +1,523 @@
+#ifndef JIT_ENGINE_HPP_INCLUDED
+#define JIT_ENGINE_HPP_INCLUDED
+
+// machine code is only emitted for x86-64, and mapped the way Linux does it
+#if defined(__x86_64__) && defined(__linux__)
+#define COP2K_JIT 1
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "block_engine.hpp"
+
+namespace COP2K
+{
+    /* the few x86-64 instructions the JIT needs. memory operands are all
+     * [rbx + disp32] or [rbx + index + disp32], bytes at a displacement
+     * from the engine
+     */
+    class X86Emitter
+    {
+        public:
+            enum Reg : uint8_t {
+                EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI, R8D, R9D
+            };
+
+            enum Cond : uint8_t {
+                E = 0x4,
+                NE = 0x5,
+                A = 0x7
+            };
+
+            // movzx dst, byte [rbx + disp]
+            void load(Reg dst, int32_t disp)
+            {
+                rex(dst, false);
+                emit({ 0x0F, 0xB6 });
+                mem(dst, disp);
+            }
+
+            // movzx dst, byte [rbx + index + disp]
+            void load(Reg dst, Reg index, int32_t disp)
+            {
+                rex(dst, false);
+                emit({ 0x0F, 0xB6 });
+                mem(dst, index, disp);
+            }
+
+            // mov byte [rbx + disp], src
+            void store(int32_t disp, Reg src)
+            {
+                rex(src, true);
+                emit({ 0x88 });
+                mem(src, disp);
+            }
+
+            void store(Reg index, int32_t disp, Reg src)
+            {
+                rex(src, true);
+                emit({ 0x88 });
+                mem(src, index, disp);
+            }
+
+            // mov byte [rbx + disp], imm
+            void store_imm(int32_t disp, uint8_t imm)
+            {
+                emit({ 0xC6 });
+                mem(EAX, disp);
+                emit({ imm });
+            }
+
+            // cmp byte [rbx + disp], imm
+            void compare_imm(int32_t disp, uint8_t imm)
+            {
+                emit({ 0x80 });
+                mem(static_cast<Reg>(7), disp);
+                emit({ imm });
+            }
+
+            void compare_imm(Reg index, int32_t disp, uint8_t imm)
+            {
+                emit({ 0x80 });
+                mem(static_cast<Reg>(7), index, disp);
+                emit({ imm });
+            }
+
+            // inc byte [rbx + disp]
+            void increment(int32_t disp)
+            {
+                emit({ 0xFE });
+                mem(EAX, disp);
+            }
+
+            // <op> dst, src on 32 bits: 0x01 add, 0x09 or, 0x21 and, 0x29 sub, 0x31 xor, 0x85 test, 0x89 mov
+            void alu(uint8_t op, Reg dst, Reg src)
+            {
+                rex_rr(src, dst);
+                emit({ op, static_cast<uint8_t>(0xC0 | (src & 0x7) << 3 | (dst & 0x7)) });
+            }
+
+            // <ext> dst, imm32: 0 add, 1 or, 4 and, 5 sub, 7 cmp
+            void alu_imm(uint8_t ext, Reg dst, int32_t imm)
+            {
+                rex_rr(EAX, dst);
+                emit({ 0x81, static_cast<uint8_t>(0xC0 | ext << 3 | (dst & 0x7)) });
+                emit32(imm);
+            }
+
+            // <ext> dst, count: 4 shl, 7 sar
+            void shift(uint8_t ext, Reg dst, uint8_t count)
+            {
+                rex_rr(EAX, dst);
+                emit({ 0xC1, static_cast<uint8_t>(0xC0 | ext << 3 | (dst & 0x7)), count });
+            }
+
+            void negate_bits(Reg dst)
+            {
+                rex_rr(EAX, dst);
+                emit({ 0xF7, static_cast<uint8_t>(0xD0 | (dst & 0x7)) });
+            }
+
+            // set<cond> dst
+            void set(Cond cond, Reg dst)
+            {
+                rex(dst, true, true);
+                emit({ 0x0F, static_cast<uint8_t>(0x90 | cond), static_cast<uint8_t>(0xC0 | (dst & 0x7)) });
+            }
+
+            // set<cond> byte [rbx + disp]
+            void set(Cond cond, int32_t disp)
+            {
+                emit({ 0x0F, static_cast<uint8_t>(0x90 | cond) });
+                mem(EAX, disp);
+            }
+
+            void move_imm(Reg dst, uint32_t imm)
+            {
+                rex_rr(EAX, dst);
+                emit({ static_cast<uint8_t>(0xB8 | (dst & 0x7)) });
+                emit32(imm);
+            }
+
+            // j<cond> over the code of skipped, which is appended
+            void skip_if(Cond cond, const X86Emitter &skipped)
+            {
+                emit({ 0x0F, static_cast<uint8_t>(0x80 | cond) });
+                emit32(static_cast<int32_t>(skipped.code.size()));
+                code.insert(code.end(), skipped.code.begin(), skipped.code.end());
+            }
+
+            // push rbx, mov rbx, rdi
+            void enter()
+            {
+                emit({ 0x53, 0x48, 0x89, 0xFB });
+            }
+
+            // pop rbx, ret
+            void leave()
+            {
+                emit({ 0x5B, 0xC3 });
+            }
+
+            std::vector<uint8_t> code;
+
+        private:
+            void emit(std::initializer_list<uint8_t> bytes)
+            {
+                code.insert(code.end(), bytes);
+            }
+
+            void emit32(int32_t value)
+            {
+                for (unsigned i = 0; i < 4; i++)
+                    code.push_back(static_cast<uint32_t>(value) >> i * 8);
+            }
+
+            // SIL and DIL as bytes need a REX prefix, R8 and up its R or B bit
+            void rex(Reg reg, bool byte, bool in_rm = false)
+            {
+                if (reg >= R8D || (byte && reg >= ESP))
+                    emit({ static_cast<uint8_t>(0x40 | (reg >= R8D) << (in_rm ? 0 : 2)) });
+            }
+
+            void rex_rr(Reg reg, Reg rm)
+            {
+                if (reg >= R8D || rm >= R8D)
+                    emit({ static_cast<uint8_t>(0x40 | (reg >= R8D) << 2 | (rm >= R8D)) });
+            }
+
+            void mem(Reg reg, int32_t disp)
+            {
+                emit({ static_cast<uint8_t>(0x83 | (reg & 0x7) << 3) });
+                emit32(disp);
+            }
+
+            void mem(Reg reg, Reg index, int32_t disp)
+            {
+                emit({ static_cast<uint8_t>(0x84 | (reg & 0x7) << 3), static_cast<uint8_t>((index & 0x7) << 3 | 0x3) });
+                emit32(disp);
+            }
+    };
+
+    /* the block engine, with its blocks compiled into x86-64 code working
+     * on the state of the engine directly. a block runs straight on to
+     * the first instruction that may load PC or fetch from an address not
+     * known in advance
+     */
+    class JitEngine : public BlockEngine
+    {
+        public:
+            static constexpr size_t CODE_SIZE = 1 << 20;
+
+            JitEngine()
+            {
+                void *p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+                if (p == MAP_FAILED)
+                    throw std::bad_alloc();
+
+                code = static_cast<uint8_t *>(p);
+            }
+
+            JitEngine(const JitEngine &) = delete;
+            JitEngine &operator=(const JitEngine &) = delete;
+
+            ~JitEngine()
+            {
+                munmap(code, CODE_SIZE);
+            }
+
+            const char *get_name() const override
+            {
+                return "jit";
+            }
+
+        private:
+            using Entry = unsigned (*)(void *);
+
+            unsigned enter(int index) override
+            {
+                return entries.at(index)(this);
+            }
+
+            void clear_blocks() override
+            {
+                BlockEngine::clear_blocks();
+                entries.clear();
+                code_used = 0;
+            }
+
+            void emit_calc(X86Emitter &x, const Op &op) const
+            {
+                using X = X86Emitter;
+                static constexpr uint8_t ops[] = { 0x01, 0x29, 0x09, 0x21, 0x01, 0x29 };
+
+                x.load(X::EAX, at(&a));
+
+                if (op.s < 6) {
+                    x.load(X::ECX, at(&w));
+                    x.alu(ops[op.s], X::EAX, X::ECX);
+                }
+
+                if (op.s == 4 || op.s == 5) {
+                    x.load(X::ECX, at(&cy));
+                    x.alu(ops[op.s], X::EAX, X::ECX);
+                }
+
+                if (op.s == 6)
+                    x.negate_bits(X::EAX);
+
+                // cy when the result is not in -128..127, as an unsigned compare
+                if (op.fen) {
+                    x.alu(0x89, X::ECX, X::EAX);
+                    x.alu_imm(0, X::ECX, 128);
+                    x.alu_imm(7, X::ECX, 255);
+                    x.set(X::A, X::ECX);
+                    x.store(at(&cy), X::ECX);
+                    x.alu(0x85, X::EAX, X::EAX);
+                    x.set(X::E, at(&z));
+                }
+
+                if (op.cn)
+                    x.load(X::ECX, at(&cy));
+
+                else
+                    x.alu(0x31, X::ECX, X::ECX);
+
+                x.store(at(&d), X::EAX);
+                x.alu(0x89, X::R8D, X::EAX);
+                x.shift(4, X::R8D, 1);
+                x.alu(0x09, X::R8D, X::ECX);
+                x.store(at(&l), X::R8D);
+                x.alu(0x89, X::R9D, X::EAX);
+                x.shift(7, X::R9D, 1);
+                x.shift(4, X::ECX, 7);
+                x.alu(0x09, X::R9D, X::ECX);
+                x.store(at(&r), X::R9D);
+            }
+
+            // EDX holds the data bus and ESI the instruction bus
+            void emit(X86Emitter &x, const Op &op) const
+            {
+                using X = X86Emitter;
+
+                switch (op.kind) {
+                    case Op::CALC:
+                        emit_calc(x, op);
+                        break;
+
+                    case Op::DBUS_FROM:
+                        x.load(X::EDX, op.disp);
+                        break;
+
+                    case Op::DBUS_FROM_IMM:
+                        x.move_imm(X::EDX, op.imm);
+                        break;
+
+                    case Op::DBUS_FROM_EM:
+                    case Op::IBUS_FROM_EM: {
+                        X::Reg dst = op.kind == Op::DBUS_FROM_EM ? X::EDX : X::ESI;
+
+                        if (op.em_addr)
+                            x.load(dst, at_em(*op.em_addr));
+
+                        else {
+                            x.load(X::ECX, at(&em_addr));
+                            x.load(dst, X::ECX, at_em());
+                        }
+
+                        break;
+                    }
+
+                    case Op::LATCH_EM_ADDR:
+                        x.load(X::EAX, op.disp);
+                        x.store(at(&em_addr), X::EAX);
+                        break;
+
+                    case Op::LATCH_EM_ADDR_IMM:
+                        x.store_imm(at(&em_addr), op.imm);
+                        break;
+
+                    case Op::INC_PC:
+                        x.increment(at(&pc));
+                        break;
+
+                    case Op::STORE:
+                        x.store(op.disp, X::EDX);
+                        break;
+
+                    case Op::STORE_IMM:
+                        x.store_imm(op.disp, op.imm);
+                        break;
+
+                    case Op::STORE_EM: {
+                        X86Emitter mark;
+
+                        // a write over an opcode some block relies on ends the block after the instruction
+                        mark.store_imm(at(&watched_written), 1);
+
+                        if (op.em_addr) {
+                            x.store(at_em(*op.em_addr), X::EDX);
+                            x.compare_imm(at(translated.data() + *op.em_addr), 0);
+
+                        } else {
+                            x.load(X::ECX, at(&em_addr));
+                            x.store(X::ECX, at_em(), X::EDX);
+                            x.compare_imm(X::ECX, at(translated.data()), 0);
+                        }
+
+                        x.skip_if(X::E, mark);
+                        break;
+                    }
+
+                    case Op::STORE_PC: {
+                        X86Emitter jump;
+
+                        jump.store(at(&pc), X::EDX);
+
+                        if (op.always)
+                            x.code.insert(x.code.end(), jump.code.begin(), jump.code.end());
+
+                        else {
+                            x.compare_imm(at(op.on_cy ? &cy : &z), 0);
+                            x.skip_if(X::E, jump);
+                        }
+
+                        break;
+                    }
+
+                    case Op::ENABLE_INT:
+                        x.store_imm(at(&iack), 0);
+                        x.store_imm(at(&ireq), 0);
+                        break;
+
+                    case Op::FETCH:
+                        x.store(at(&ir), X::ESI);
+                        x.alu_imm(4, X::ESI, ~0x3);
+                        x.store(at(&upc), X::ESI);
+                        break;
+
+                    case Op::EXIT:
+                    case Op::CHECK_PC: {
+                        X86Emitter out;
+
+                        out.store_imm(at(&s), op.s);
+                        out.store_imm(at(&fen), op.fen);
+                        out.store_imm(at(&cn), op.cn);
+
+                        if (op.pc)
+                            out.store_imm(at(&pc), *op.pc);
+
+                        out.move_imm(X::EAX, op.n);
+                        out.leave();
+
+                        if (op.kind == Op::CHECK_PC) {
+                            x.compare_imm(at(&pc), op.imm);
+                            x.skip_if(X::E, out);
+
+                        } else if (op.always)
+                            x.code.insert(x.code.end(), out.code.begin(), out.code.end());
+
+                        else {
+                            x.compare_imm(at(&watched_written), 0);
+                            x.skip_if(X::E, out);
+                        }
+
+                        break;
+                    }
+                }
+            }
+
+            // nothing runs while compiling
+            int compile(uint8_t addr, uint64_t, uint64_t &, uint64_t &) override
+            {
+                Block block = { addr, ir, {}, {}, 0, true };
+                Known known = { s, fen, cn, static_cast<uint8_t>(addr + 1), std::nullopt };
+                std::vector<Op> ops;
+                uint8_t byte = ir;
+                uint64_t clocks = 0;
+                bool stores = false;
+
+                while (block.clocks.size() < MAX_BLOCK_INSTRUCTIONS) {
+                    std::vector<Op> instruction;
+                    Known after = known;
+                    std::optional<uint8_t> next;
+                    unsigned n = 0;
+
+                    if (!translate(byte, after, instruction, n, next))
+                        break;
+
+                    // a write in the one before may have changed this opcode
+                    if (stores)
+                        ops.push_back(exit_op(block.clocks.size(), known, false));
+
+                    ops.insert(ops.end(), instruction.begin(), instruction.end());
+                    known = after;
+                    block.clocks.push_back(clocks += n);
+                    block.slots |= uint64_t(1) << (byte >> 2);
+                    stores = stores_em(instruction);
+
+                    if (!next)
+                        break;
+
+                    byte = em.at(*next);
+                    block.opcodes.emplace_back(*next, byte);
+                }
+
+                if (block.clocks.empty())
+                    return -1;
+
+                // the opcode fetched last is not relied on
+                if (block.opcodes.size() == block.clocks.size())
+                    block.opcodes.pop_back();
+
+                ops.push_back(exit_op(block.clocks.size(), known, true));
+                leave_out_hidden(ops);
+
+                X86Emitter x;
+
+                // s, fen and cn are known from the instruction before
+                X86Emitter mismatch;
+
+                mismatch.move_imm(X86Emitter::EAX, 0);
+                mismatch.leave();
+                x.enter();
+
+                for (auto [field, value] : { std::pair<const void *, uint8_t>(&s, s), { &fen, fen }, { &cn, cn } }) {
+                    x.compare_imm(at(field), value);
+                    x.skip_if(X86Emitter::E, mismatch);
+                }
+
+                for (const Op &i : ops)
+                    emit(x, i);
+
+                if (code_used + x.code.size() > CODE_SIZE || blocks.size() >= MAX_BLOCKS)
+                    clear_blocks();
+
+                if (code_used + x.code.size() > CODE_SIZE)
+                    return -1;
+
+                mprotect(code, CODE_SIZE, PROT_READ | PROT_WRITE);
+                memcpy(code + code_used, x.code.data(), x.code.size());
+                mprotect(code, CODE_SIZE, PROT_READ | PROT_EXEC);
+                entries.push_back(reinterpret_cast<Entry>(code + code_used));
+                code_used += x.code.size();
+                return add_block(std::move(block));
+            }
+
+            uint8_t *code;
+            size_t code_used = 0;
+            std::vector<Entry> entries; // of the blocks
+    };
+}
+
+#endif
+
+#endif // JIT_ENGINE_HPP_INCLUDED
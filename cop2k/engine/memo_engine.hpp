@@ -0,0 +1,351 @@
+#ifndef MEMO_ENGINE_HPP_INCLUDED
+#define MEMO_ENGINE_HPP_INCLUDED
+
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "libopcode.hpp"
+#include "decoded_engine.hpp"
+
+namespace COP2K
+{
+    struct MemoStatistics {
+        uint64_t hits, misses; // instructions looked up
+        uint64_t bypassed; // run without looking up, see MemoEngine
+        uint64_t entries;
+    };
+
+    /* the decoded engine, remembering what each instruction did for the
+     * state it read, and doing it again without running its micro words
+     * when that state comes back
+     *
+     * which registers an instruction reads and writes is worked out from
+     * its decoded words, once per opcode byte: a key holds S, FEN and CN
+     * left by the instruction before, CY, Z, and the registers it reads, A
+     * and W always as the ALU runs on them every clock. memory is not in
+     * the key: an entry holds the bytes it read, which must still be there
+     * for a hit, and those it wrote. each is read at an address set by the
+     * key and the bytes read before it, so the whole run is the same
+     *
+     * instructions that read more registers than a key holds, may throw,
+     * or run past their slot, are bypassed, as are single clocks,
+     * interrupts and coverage. a table keeps MAX_ENTRIES per opcode byte
+     * and then stops growing
+     */
+    class MemoEngine : public DecodedEngine
+    {
+        public:
+            static constexpr size_t MAX_ENTRIES = 4096;
+
+            const char *get_name() const override
+            {
+                return "memo";
+            }
+
+            void reset(const Opcode &opcode, const std::string &image) override
+            {
+                DecodedEngine::reset(opcode, image);
+
+                for (unsigned i = 0; i < 256; i++) {
+                    footprints.at(i) = find_footprint(i);
+                    tables.at(i).clear();
+                }
+
+                statistics = {};
+            }
+
+            unsigned step() override
+            {
+                const Footprint &f = footprints.at(ir);
+
+                if (!f.memoizable || coverage || (ireq && !iack) || upc != (ir & ~0x3)) {
+                    statistics.bypassed++;
+                    return DecodedEngine::step();
+                }
+
+                std::unordered_map<uint64_t, Entry> &table = tables.at(ir);
+                uint64_t key = make_key(f);
+                auto found = table.find(key);
+
+                if (found != table.end() && replay(f, found->second)) {
+                    statistics.hits++;
+                    return found->second.clocks;
+                }
+
+                Entry e;
+                unsigned ret = record(f, e);
+
+                statistics.misses++;
+
+                if (found != table.end())
+                    found->second = e;
+
+                else if (table.size() < MAX_ENTRIES) {
+                    table.emplace(key, e);
+                    statistics.entries++;
+                }
+
+                return ret;
+            }
+
+            // the words of the instruction may no longer do what was remembered
+            void set_um_data(uint8_t addr, const std::bitset<24> &val) override
+            {
+                DecodedEngine::set_um_data(addr, val);
+
+                for (unsigned i = addr & ~0x3; i <= (addr | 0x3); i++) {
+                    statistics.entries -= tables.at(i).size();
+                    tables.at(i).clear();
+                    footprints.at(i) = find_footprint(i);
+                }
+            }
+
+            const MemoStatistics &get_statistics() const
+            {
+                return statistics;
+            }
+
+            std::string get_summary() const override
+            {
+                uint64_t looked_up = statistics.hits + statistics.misses;
+
+                return std::format(
+                           "{} hits, {} misses ({:.1f}% hit), {} bypassed, {} entries",
+                           statistics.hits, statistics.misses,
+                           looked_up ? 100.0 * statistics.hits / looked_up : 0.0,
+                           statistics.bypassed, statistics.entries
+                       );
+            }
+
+        private:
+            // registers in the order their values are kept
+            enum Field : uint8_t {
+                F_A,
+                F_W,
+                F_PC,
+                F_MAR,
+                F_ST,
+                F_IN,
+                F_IA,
+                F_OUT,
+                F_REG,
+                F_EM_ADDR,
+                FIELD_COUNT
+            };
+
+            struct Footprint {
+                uint16_t reads, writes; // 1 << Field
+                bool memoizable;
+                bool enables_int;
+            };
+
+            struct Entry {
+                unsigned clocks;
+                std::array<uint8_t, FIELD_COUNT> values; // of the fields written, in order
+                std::array<std::pair<uint8_t, uint8_t>, 8> em_read; // in order
+                std::array<std::pair<uint8_t, uint8_t>, 4> em_written;
+                uint8_t em_read_count, em_written_count;
+                uint8_t ir, upc, s, l, d, r;
+                bool fen, cn, cy, z, em_from_pc;
+            };
+
+            // what the instruction in byte reads and writes, as long as no interrupt comes
+            Footprint find_footprint(uint8_t byte) const
+            {
+                Footprint ret = { 1 << F_A | 1 << F_W, 0, false, false };
+                bool latched = false;
+
+                for (unsigned i = 0; i < 4; i++) {
+                    const Word &word = words.at((byte & ~0x3) | i);
+                    const Routing &route = word.routing.at(0);
+                    static constexpr std::pair<DBusSource, Field> sources[] = {
+                        { FROM_IN, F_IN }, { FROM_IA, F_IA }, { FROM_ST, F_ST }, { FROM_PC, F_PC }, { FROM_REG, F_REG }
+                    };
+                    static constexpr std::pair<DBusTarget, Field> targets[] = {
+                        { TO_PC, F_PC }, { TO_MAR, F_MAR }, { TO_OUT, F_OUT }, { TO_ST, F_ST }, { TO_REG, F_REG },
+                        { TO_W, F_W }, { TO_A, F_A }
+                    };
+
+                    // COP2K would throw, or may
+                    if (route.conflict || (route.targets && route.dbus == FROM_NONE))
+                        return ret;
+
+                    ret.enables_int |= word.eint;
+
+                    if (route.abus == PC)
+                        ret.reads |= 1 << F_PC;
+
+                    else if (route.abus == MAR)
+                        ret.reads |= 1 << F_MAR;
+
+                    // memory read at an address from before the instruction
+                    if ((route.dbus == FROM_EM || route.ibus == EM || route.targets & TO_EM) && !latched && !route.em_addr)
+                        ret.reads |= 1 << F_EM_ADDR;
+
+                    if (route.em_addr) {
+                        latched = true;
+                        ret.writes |= 1 << F_EM_ADDR;
+                    }
+
+                    for (auto [source, field] : sources)
+                        if (route.dbus == source)
+                            ret.reads |= 1 << field;
+
+                    if (route.abus == PC)
+                        ret.writes |= 1 << F_PC;
+
+                    for (auto [target, field] : targets)
+                        if (route.targets & target)
+                            ret.writes |= 1 << field;
+
+                    if (word.fetch) {
+                        ret.memoizable = route.ibus == EM && std::popcount(ret.reads) <= 7;
+                        return ret;
+                    }
+                }
+
+                return ret;
+            }
+
+            uint8_t &field(Field f)
+            {
+                switch (f) {
+                    case F_A:
+                        return a;
+
+                    case F_W:
+                        return w;
+
+                    case F_PC:
+                        return pc;
+
+                    case F_MAR:
+                        return mar;
+
+                    case F_ST:
+                        return st;
+
+                    case F_IN:
+                        return in;
+
+                    case F_IA:
+                        return ia;
+
+                    case F_OUT:
+                        return out;
+
+                    case F_REG:
+                        return regs.at(ir & 0x3);
+
+                    default:
+                        return em_addr;
+                }
+            }
+
+            // the registers read, a byte each from bit 0, then S, FEN, CN, CY and Z
+            uint64_t make_key(const Footprint &f)
+            {
+                uint64_t ret = 0;
+                unsigned shift = 0;
+
+                for (unsigned i = 0; i < FIELD_COUNT; i++)
+                    if (f.reads >> i & 1) {
+                        ret |= uint64_t(field(static_cast<Field>(i))) << shift;
+                        shift += 8;
+                    }
+
+                return ret | uint64_t(s | fen << 3 | cn << 4 | cy << 5 | z << 6) << shift;
+            }
+
+            // false if memory no longer holds what the entry read
+            bool replay(const Footprint &f, const Entry &e)
+            {
+                unsigned k = 0;
+
+                for (unsigned i = 0; i < e.em_read_count; i++)
+                    if (em.at(e.em_read.at(i).first) != e.em_read.at(i).second)
+                        return false;
+
+                // REG is the one IR picks before the fetch
+                for (unsigned i = 0; i < FIELD_COUNT; i++)
+                    if (f.writes >> i & 1)
+                        field(static_cast<Field>(i)) = e.values.at(k++);
+
+                for (unsigned i = 0; i < e.em_written_count; i++)
+                    em.at(e.em_written.at(i).first) = e.em_written.at(i).second;
+
+                if (f.enables_int)
+                    iack = ireq = false;
+
+                ir = e.ir;
+                upc = e.upc;
+                s = e.s;
+                fen = e.fen;
+                cn = e.cn;
+                cy = e.cy;
+                z = e.z;
+                l = e.l;
+                d = e.d;
+                r = e.r;
+                em_from_pc = e.em_from_pc;
+                return true;
+            }
+
+            // runs the instruction a clock at a time, into e
+            unsigned record(const Footprint &f, Entry &e)
+            {
+                uint8_t reg = ir & 0x3;
+                unsigned k = 0;
+
+                e.em_read_count = e.em_written_count = 0;
+
+                for (e.clocks = 1; ; e.clocks++) {
+                    const Word &word = words.at(upc);
+                    const Routing &route = word.routing.at(0);
+                    uint8_t addr = !route.em_addr ? em_addr : route.abus == PC ? pc : mar;
+                    bool fetched;
+
+                    if ((route.dbus == FROM_EM || route.ibus == EM) && e.em_read_count < e.em_read.size())
+                        e.em_read.at(e.em_read_count++) = { addr, em.at(addr) };
+
+                    fetched = clock();
+
+                    if (route.targets & TO_EM && e.em_written_count < e.em_written.size())
+                        e.em_written.at(e.em_written_count++) = { em_addr, em.at(em_addr) };
+
+                    if (fetched)
+                        break;
+                }
+
+                for (unsigned i = 0; i < FIELD_COUNT; i++)
+                    if (f.writes >> i & 1)
+                        e.values.at(k++) = i == F_REG ? regs.at(reg) : field(static_cast<Field>(i));
+
+                e.ir = ir;
+                e.upc = upc;
+                e.s = s;
+                e.fen = fen;
+                e.cn = cn;
+                e.cy = cy;
+                e.z = z;
+                e.l = l;
+                e.d = d;
+                e.r = r;
+                e.em_from_pc = em_from_pc;
+                return e.clocks;
+            }
+
+            std::array<Footprint, 256> footprints;
+            std::array<std::unordered_map<uint64_t, Entry>, 256> tables; // by opcode byte
+            MemoStatistics statistics = {};
+    };
+}
+
+#endif // MEMO_ENGINE_HPP_INCLUDED
@@ -0,0 +1,187 @@
+#ifndef PROGRAM_HPP_INCLUDED
+#define PROGRAM_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "as/as.hpp"
+
+namespace COP2K
+{
+    // a file, or every file in a directory with one of the extensions, sorted
+    inline std::vector<std::filesystem::path> list_files(const char *arg, const std::vector<std::string> &extensions)
+    {
+        std::vector<std::filesystem::path> ret;
+        std::filesystem::path base(arg);
+
+        if (!std::filesystem::is_directory(base)) {
+            ret.push_back(base);
+            return ret;
+        }
+
+        for (const std::filesystem::directory_entry &i : std::filesystem::directory_iterator(base))
+            if (
+                i.is_regular_file() &&
+                std::find(extensions.begin(), extensions.end(), i.path().extension()) != extensions.end()
+            )
+                ret.push_back(i.path());
+
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+    /* files with a name each: every file of the extension in a directory,
+     * named by its file name, or one path per line of a manifest, named as
+     * written there and relative to it. `#` starts a comment line
+     */
+    inline std::vector<std::pair<std::string, std::filesystem::path>> list_manifest(
+        const char *arg,
+        const std::string &extension
+    )
+    {
+        std::vector<std::pair<std::string, std::filesystem::path>> ret;
+        std::filesystem::path base(arg);
+
+        if (std::filesystem::is_directory(base)) {
+            for (const std::filesystem::directory_entry &i : std::filesystem::directory_iterator(base))
+                if (i.is_regular_file() && i.path().extension() == extension)
+                    ret.emplace_back(i.path().filename().string(), i.path());
+
+            std::sort(ret.begin(), ret.end());
+            return ret;
+        }
+
+        std::ifstream manifest(base);
+        std::string line;
+
+        if (!manifest)
+            throw std::runtime_error(std::format("failed to open {}", arg));
+
+        while (std::getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            if (line.empty() || line.front() == '#')
+                continue;
+
+            ret.emplace_back(line, base.parent_path() / line);
+        }
+
+        return ret;
+    }
+
+    // a number in the syntax of the assembler: 0FFH, or decimal
+    inline unsigned long parse_number(const std::string &s)
+    {
+        size_t end = 0;
+        unsigned long ret;
+
+        if (!s.empty() && (s.back() == 'H' || s.back() == 'h')) {
+            ret = std::stoul(s.substr(0, s.size() - 1), &end, 16);
+            end++;
+
+        } else
+            ret = std::stoul(s, &end, 10);
+
+        if (end != s.size())
+            throw std::invalid_argument(s);
+
+        return ret;
+    }
+
+    // an address like 40H, throws runtime_error if it is not one
+    inline unsigned char parse_addr(const std::string &s)
+    {
+        unsigned long ret = 0;
+        bool valid = true;
+
+        try {
+            ret = parse_number(s);
+
+        } catch (const std::logic_error &) {
+            valid = false;
+        }
+
+        if (!valid || ret > 0xff)
+            throw std::runtime_error(std::format("bad address {}", s));
+
+        return ret;
+    }
+
+    /* a memory image padded to 256 bytes. banked, it may also be the
+     * common half and 128 bytes per bank. like load_program(), throws
+     * runtime_error with what went wrong, but not where
+     */
+    inline std::string read_image(const std::filesystem::path &path, bool banked = false)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        std::string image((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+        if (!ifs && !ifs.eof())
+            throw std::runtime_error("failed to read file");
+
+        if (image.size() > 256 && !banked)
+            throw std::runtime_error("a banked memory image, larger than 256 bytes");
+
+        if (image.size() > 256 && image.size() % 0x80)
+            throw std::runtime_error("larger than 256 bytes and not in banks of 128");
+
+        if (image.size() < 256)
+            image.resize(256, '\0');
+
+        return image;
+    }
+
+    /* an image as read_image() reads it, assembled with the instruction
+     * set if it is source. throws runtime_error with what went wrong, but
+     * not where: for source that is the first diagnostic, which says more
+     * than the exception
+     */
+    inline std::string load_program(const std::filesystem::path &path, const Opcode &opcode, bool banked = false)
+    {
+        std::string image;
+
+        if (path.extension() != ".asm")
+            return read_image(path, banked);
+
+        AS as;
+        std::ostringstream diagnostics;
+        FILE *in = fopen(path.c_str(), "r");
+
+        if (!in)
+            throw std::runtime_error("failed to open file");
+
+        as.opcode = opcode;
+        as.diagnostics = &diagnostics;
+
+        try {
+            as.assemble_file(in);
+            image = as.dump_image();
+
+        } catch (const std::exception &e) {
+            std::string first = diagnostics.str();
+
+            fclose(in);
+            throw std::runtime_error(first.empty() ? e.what() : first.substr(0, first.find('\n')));
+        }
+
+        fclose(in);
+
+        if (image.size() > 256 && !banked)
+            throw std::runtime_error("assembled into a banked memory image");
+
+        return image;
+    }
+}
+
+#endif // PROGRAM_HPP_INCLUDED
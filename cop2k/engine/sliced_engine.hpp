@@ -0,0 +1,502 @@
+#ifndef SLICED_ENGINE_HPP_INCLUDED
+#define SLICED_ENGINE_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "engine.hpp"
+
+namespace COP2K
+{
+    // a line held at one level whatever drives it
+    struct StuckAt {
+        enum Site : uint8_t {
+            SIGNAL, // a bit of the micro word, as it leaves the micro program memory
+            DBUS,
+            ABUS,
+            IBUS
+        };
+
+        Site site;
+        uint8_t bit;
+        bool value;
+
+        static constexpr const char *SIGNAL_NAMES[] = {
+            "S0", "S1", "S2", "AEN", "WEN", "X0", "X1", "X2", "FEN", "CN", "RWR", "RRD",
+            "STEN", "OUTEN", "MAROE", "MAREN", "ELP", "EINT", "IREN", "EMEN", "PCOE", "EMRD", "EMWR"
+        };
+        static constexpr unsigned SIGNAL_COUNT = 23;
+
+        // as in a fault list: EMWR sa1, DBUS3 sa0
+        std::string to_string() const
+        {
+            static constexpr const char *buses[] = { "", "DBUS", "ABUS", "IBUS" };
+
+            if (site == SIGNAL)
+                return std::format("{} sa{:d}", SIGNAL_NAMES[bit], value);
+
+            return std::format("{}{} sa{:d}", buses[site], bit, value);
+        }
+
+        static StuckAt parse(const std::string &line, const std::string &level)
+        {
+            std::string name = line;
+            StuckAt ret;
+
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+                return std::toupper(c);
+            });
+
+            if (level == "sa0" || level == "SA0")
+                ret.value = false;
+
+            else if (level == "sa1" || level == "SA1")
+                ret.value = true;
+
+            else
+                throw std::invalid_argument(std::format("expected sa0 or sa1 after {}, got {}", line, level));
+
+            for (unsigned i = 0; i < SIGNAL_COUNT; i++)
+                if (name == SIGNAL_NAMES[i]) {
+                    ret.site = SIGNAL;
+                    ret.bit = i;
+                    return ret;
+                }
+
+            if (
+                name.size() == 5 && name.at(4) >= '0' && name.at(4) <= '7' &&
+                (name.starts_with("DBUS") || name.starts_with("ABUS") || name.starts_with("IBUS"))
+            ) {
+                ret.site = name.at(0) == 'D' ? DBUS : name.at(0) == 'A' ? ABUS : IBUS;
+                ret.bit = name.at(4) - '0';
+                return ret;
+            }
+
+            throw std::invalid_argument(std::format("{} is neither a control signal nor a bus bit", line));
+        }
+
+        // every single stuck-at fault, signals first
+        static std::vector<StuckAt> all()
+        {
+            std::vector<StuckAt> ret;
+
+            for (unsigned i = 0; i < SIGNAL_COUNT; i++)
+                for (bool v : { false, true })
+                    ret.push_back({ SIGNAL, static_cast<uint8_t>(i), v });
+
+            for (Site i : { DBUS, ABUS, IBUS })
+                for (uint8_t j = 0; j < 8; j++)
+                    for (bool v : { false, true })
+                        ret.push_back({ i, j, v });
+
+            return ret;
+        }
+    };
+
+    /* COP2K bit-sliced: every register is kept as 8 words of 64 bits, bit
+     * k of word j being bit j of the register in machine k, so a clock
+     * steps 64 machines at once with the same logic operations, each
+     * machine with its own faults
+     *
+     * a clock is the one of DecodedEngine, down to the ALU quirks, with
+     * each signal a mask of the machines asserting it. where machines
+     * differ in something that picks a value, the micro word at their uPC,
+     * a memory address, the register of IR, they are split into groups
+     * that agree, one for the usual faults that changed nothing yet
+     *
+     * a machine stops when COP2K would throw, as a faulty machine driving
+     * a bus twice or none has no program left to run. no interrupt is
+     * raised, and there is no coverage. it does not share the Engine
+     * interface: its state is 64 states
+     */
+    class SlicedEngine
+    {
+        public:
+            using Lanes = uint64_t; // a bit per machine
+            using Byte = std::array<Lanes, 8>; // a register in all machines, a word per bit
+
+            static constexpr unsigned LANES = 64;
+
+            // machine k with the stuck lines in faults.at(k), those left without
+            void reset(const Opcode &opcode, const std::string &image, const std::vector<std::vector<StuckAt>> &faults)
+            {
+                if (image.size() != 256)
+                    throw std::invalid_argument("memory image must be 256 bytes");
+
+                if (faults.size() > LANES)
+                    throw std::invalid_argument(std::format("at most {} machines run at once", LANES));
+
+                for (unsigned i = 0; i < 256; i++) {
+                    const Opcode::Instruction &ins = opcode.begin()[i >> 2];
+
+                    words.at(i) = ins.exist ? ins.microprogram.at(i & 0x3).to_ulong() : 0xFFFFFF;
+                    safe.at(i) = opcode.is_um_safe(i);
+                }
+
+                stuck0 = stuck1 = {};
+                patched = 0;
+
+                for (unsigned i = 0; i < faults.size(); i++)
+                    for (const StuckAt &j : faults.at(i)) {
+                        unsigned line = j.bit + (j.site == StuckAt::SIGNAL ? 0 : 24 + (j.site - 1) * 8);
+
+                        (j.value ? stuck1 : stuck0).at(line) |= Lanes(1) << i;
+
+                        if (j.site == StuckAt::SIGNAL)
+                            patched |= Lanes(1) << i;
+                    }
+
+                a = w = pc = st = mar = out = in = ia = ir = upc = em_addr = l = d = r = {};
+                regs = {};
+                s = { ~Lanes(0), ~Lanes(0), ~Lanes(0) };
+                cy = z = 0;
+                fen = cn = ~Lanes(0);
+                failed = 0;
+
+                for (unsigned i = 0; i < 256; i++)
+                    em.at(i) = broadcast(image.at(i));
+            }
+
+            // one clock of the machines in lanes, the others may change in any way
+            void clock(Lanes lanes)
+            {
+                std::array<Lanes, 24> signal = {};
+                Lanes unsafe = patched; // a word proven safe is no longer the word run
+
+                lanes &= ~failed;
+
+                for (Lanes left = lanes; left; ) {
+                    uint8_t at = get(upc, std::countr_zero(left));
+                    Lanes group = equals(upc, at) & left;
+
+                    for (unsigned i = 0; i < 24; i++)
+                        if (words.at(at) >> i & 1)
+                            signal.at(i) |= group;
+
+                    if (!safe.at(at))
+                        unsafe |= group;
+
+                    left &= ~group;
+                }
+
+                for (unsigned i = 0; i < 24; i++)
+                    signal.at(i) = stuck(signal.at(i), i);
+
+                // active low from here on, but S, FEN and CN
+                const Lanes to_a = ~signal.at(3), to_w = ~signal.at(4);
+                const Lanes to_reg = ~signal.at(10), from_reg = ~signal.at(11);
+                const Lanes to_st = ~signal.at(12), to_out = ~signal.at(13);
+                const Lanes abus_mar = ~signal.at(14), to_mar = ~signal.at(15), to_pc = ~signal.at(16);
+                const Lanes fetch = ~signal.at(18), emen = ~signal.at(19), abus_pc = ~signal.at(20);
+                const Lanes emrd = ~signal.at(21), emwr = ~signal.at(22);
+                const Lanes from_x = ~(signal.at(5) & signal.at(6) & signal.at(7));
+                const Lanes from_em = emen & emrd, to_em = emen & emwr;
+                const Lanes driven = from_em | from_reg | from_x;
+                Byte abus, dbus = {}, ibus;
+
+                // S0, S1 and S2 are set one at a time
+                calc({ signal.at(0), s.at(1), s.at(2) }, fen, cn, lanes);
+                calc({ signal.at(0), signal.at(1), s.at(2) }, fen, cn, lanes);
+                calc({ signal.at(0), signal.at(1), signal.at(2) }, fen, cn, lanes);
+                s = { signal.at(0), signal.at(1), signal.at(2) };
+                fen = signal.at(8);
+                cn = signal.at(9);
+
+                failed |= lanes & unsafe & (
+                              (from_em & from_reg) | (from_em & from_x) | (from_reg & from_x) | (abus_pc & abus_mar)
+                          );
+
+                // MAR wins over PC on a word proven safe, and PC is then not counted up
+                for (unsigned i = 0; i < 8; i++)
+                    abus.at(i) = stuck((abus_mar & mar.at(i)) | (abus_pc & ~abus_mar & pc.at(i)), 24 + 8 + i);
+
+                assign(em_addr, abus, lanes & (abus_pc | abus_mar) & (emrd | to_em));
+
+                // and IN to L over RRD over EMRD
+                dbus = read_em(from_em & ~from_reg & ~from_x & lanes);
+                assign(dbus, read_reg(), from_reg & ~from_x);
+
+                for (uint8_t i = 0; i < 7; i++) {
+                    static constexpr Byte SlicedEngine::*sources[] = {
+                        &SlicedEngine::in, &SlicedEngine::ia, &SlicedEngine::st, &SlicedEngine::pc,
+                        &SlicedEngine::d, &SlicedEngine::r, &SlicedEngine::l
+                    };
+                    Lanes x = from_x;
+
+                    for (unsigned j = 0; j < 3; j++)
+                        x &= i >> j & 1 ? signal.at(5 + j) : ~signal.at(5 + j);
+
+                    assign(dbus, this->*sources[i], x);
+                }
+
+                for (unsigned i = 0; i < 8; i++)
+                    dbus.at(i) = stuck(dbus.at(i), 24 + i);
+
+                increment(pc, lanes & abus_pc & ~abus_mar);
+                ibus = read_em(lanes & emrd);
+
+                for (unsigned i = 0; i < 8; i++)
+                    ibus.at(i) = stuck(ibus.at(i), 24 + 16 + i);
+
+                const Lanes jump =
+                    ir.at(3) | // jump unconditionally
+                    (~ir.at(3) & ~ir.at(2) & cy) | // jump on carry
+                    (~ir.at(3) & ir.at(2) & z); // jump on zero
+                const Lanes targets = to_em | to_mar | to_out | to_st | to_reg | to_w | to_a;
+
+                failed |= lanes & ~driven & (targets | (to_pc & jump));
+                write_em(dbus, lanes & to_em);
+                assign(pc, dbus, lanes & to_pc & jump);
+                assign(mar, dbus, lanes & to_mar);
+                assign(out, dbus, lanes & to_out);
+                assign(st, dbus, lanes & to_st);
+
+                for (uint8_t i = 0; i < 4; i++)
+                    assign(regs.at(i), dbus, lanes & to_reg & equals_reg(i));
+
+                assign(w, dbus, lanes & to_w);
+                calc(s, fen, cn, lanes & to_w);
+                assign(a, dbus, lanes & to_a);
+                calc(s, fen, cn, lanes & to_a);
+
+                failed |= lanes & fetch & ~emrd;
+                increment(upc, lanes & ~fetch);
+                assign(ir, ibus, lanes & fetch);
+                ibus.at(0) = ibus.at(1) = 0;
+                assign(upc, ibus, lanes & fetch);
+            }
+
+            void set_in(uint8_t val)
+            {
+                in = broadcast(val);
+            }
+
+            // the machines that would have thrown, their state is left as it was
+            Lanes get_failed() const
+            {
+                return failed;
+            }
+
+            // the machines whose state is not this one, which a single machine has
+            Lanes differs(const EngineState &state) const
+            {
+                const std::pair<const Byte *, uint8_t> bytes[] = {
+                    { &a, state.a }, { &w, state.w }, { &pc, state.pc }, { &st, state.st }, { &mar, state.mar },
+                    { &out, state.out }, { &in, state.in }, { &ia, state.ia }, { &ir, state.ir },
+                    { &upc, state.upc }, { &regs.at(0), state.r.at(0) }, { &regs.at(1), state.r.at(1) },
+                    { &regs.at(2), state.r.at(2) }, { &regs.at(3), state.r.at(3) }
+                };
+                Lanes ret = 0;
+
+                for (auto [byte, value] : bytes)
+                    ret |= differs(*byte, value);
+
+                ret |= cy ^ (state.cy ? ~Lanes(0) : 0);
+                ret |= z ^ (state.z ? ~Lanes(0) : 0);
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret |= differs(em.at(i), state.em.at(i));
+
+                return ret;
+            }
+
+            // what a program can show while it runs
+            Lanes out_differs(uint8_t val) const
+            {
+                return differs(out, val);
+            }
+
+            EngineState get_state(unsigned lane) const
+            {
+                EngineState ret = {
+                    get(a, lane), get(w, lane),
+                    { get(regs.at(0), lane), get(regs.at(1), lane), get(regs.at(2), lane), get(regs.at(3), lane) },
+                    get(pc, lane), get(st, lane), get(mar, lane), get(out, lane), get(in, lane), get(ia, lane),
+                    get(ir, lane), get(upc, lane), (cy >> lane & 1) != 0, (z >> lane & 1) != 0, false, false, {}
+                };
+
+                for (unsigned i = 0; i < 256; i++)
+                    ret.em.at(i) = get(em.at(i), lane);
+
+                return ret;
+            }
+
+        private:
+            static Byte broadcast(uint8_t val)
+            {
+                Byte ret;
+
+                for (unsigned i = 0; i < 8; i++)
+                    ret.at(i) = val >> i & 1 ? ~Lanes(0) : 0;
+
+                return ret;
+            }
+
+            static uint8_t get(const Byte &bytes, unsigned lane)
+            {
+                uint8_t ret = 0;
+
+                for (unsigned i = 0; i < 8; i++)
+                    ret |= (bytes.at(i) >> lane & 1) << i;
+
+                return ret;
+            }
+
+            static Lanes equals(const Byte &bytes, uint8_t val)
+            {
+                Lanes ret = ~Lanes(0);
+
+                for (unsigned i = 0; i < 8; i++)
+                    ret &= val >> i & 1 ? bytes.at(i) : ~bytes.at(i);
+
+                return ret;
+            }
+
+            static Lanes differs(const Byte &bytes, uint8_t val)
+            {
+                return ~equals(bytes, val);
+            }
+
+            static void assign(Byte &to, const Byte &from, Lanes lanes)
+            {
+                for (unsigned i = 0; i < 8; i++)
+                    to.at(i) = (to.at(i) & ~lanes) | (from.at(i) & lanes);
+            }
+
+            static void increment(Byte &bytes, Lanes lanes)
+            {
+                for (unsigned i = 0; i < 8; i++) {
+                    Lanes carry = bytes.at(i) & lanes;
+
+                    bytes.at(i) ^= lanes;
+                    lanes = carry;
+                }
+            }
+
+            // a line of the micro word, then DBUS, ABUS and IBUS
+            Lanes stuck(Lanes val, unsigned line) const
+            {
+                return (val & ~stuck0.at(line)) | stuck1.at(line);
+            }
+
+            Lanes equals_reg(uint8_t reg) const
+            {
+                return (reg & 0x1 ? ir.at(0) : ~ir.at(0)) & (reg & 0x2 ? ir.at(1) : ~ir.at(1));
+            }
+
+            Byte read_reg() const
+            {
+                Byte ret = {};
+
+                for (uint8_t i = 0; i < 4; i++) {
+                    Lanes lanes = equals_reg(i);
+
+                    for (unsigned j = 0; j < 8; j++)
+                        ret.at(j) |= regs.at(i).at(j) & lanes;
+                }
+
+                return ret;
+            }
+
+            // at em_addr in each machine, 0 outside lanes
+            Byte read_em(Lanes lanes) const
+            {
+                Byte ret = {};
+
+                for (Lanes left = lanes; left; ) {
+                    uint8_t addr = get(em_addr, std::countr_zero(left));
+                    Lanes group = equals(em_addr, addr) & left;
+
+                    for (unsigned i = 0; i < 8; i++)
+                        ret.at(i) |= em.at(addr).at(i) & group;
+
+                    left &= ~group;
+                }
+
+                return ret;
+            }
+
+            void write_em(const Byte &val, Lanes lanes)
+            {
+                for (Lanes left = lanes; left; ) {
+                    uint8_t addr = get(em_addr, std::countr_zero(left));
+                    Lanes group = equals(em_addr, addr) & left;
+
+                    assign(em.at(addr), val, group);
+                    left &= ~group;
+                }
+            }
+
+            /* DecodedEngine::calc() in the machines in lanes. the result is
+             * kept in 10 bits, which hold every value the int there takes
+             */
+            void calc(const std::array<Lanes, 3> &op, Lanes fen, Lanes cn, Lanes lanes)
+            {
+                if (!lanes)
+                    return;
+
+                const Lanes arith = ~op.at(1);
+                const Lanes op_or = op.at(1) & ~op.at(2) & ~op.at(0), op_and = op.at(1) & ~op.at(2) & op.at(0);
+                const Lanes op_not = op.at(1) & op.at(2) & ~op.at(0), op_a = op.at(1) & op.at(2) & op.at(0);
+                // subtracting adds ~W and 1, less the carry if used
+                Lanes carry = (op.at(2) & (op.at(0) ^ cy)) | (~op.at(2) & op.at(0));
+                std::array<Lanes, 10> result;
+                Lanes new_cy, new_z = 0, shifted;
+
+                for (unsigned i = 0; i < 10; i++) {
+                    Lanes x = i < 8 ? a.at(i) : 0;
+                    Lanes y = (i < 8 ? w.at(i) : 0) ^ op.at(0);
+                    Lanes sum = x ^ y ^ carry;
+
+                    carry = (x & y) | (carry & (x ^ y));
+                    result.at(i) = (arith & sum) | op_not;
+
+                    if (i < 8)
+                        result.at(i) = (arith & sum) | (op_or & (x | w.at(i))) | (op_and & x & w.at(i)) |
+                                       (op_not & ~x) | (op_a & x);
+
+                    new_z |= result.at(i);
+                }
+
+                // outside -128 to 127 when bits 7 to 9 differ
+                new_cy = (result.at(7) | result.at(8) | result.at(9)) & ~(result.at(7) & result.at(8) & result.at(9));
+                cy = (cy & ~(lanes & fen)) | (new_cy & lanes & fen);
+                z = (z & ~(lanes & fen)) | (~new_z & lanes & fen);
+                shifted = cy & cn;
+
+                for (unsigned i = 0; i < 8; i++) {
+                    Lanes left = i ? result.at(i - 1) : shifted;
+                    Lanes right = i < 7 ? result.at(i + 1) : result.at(8) | shifted;
+
+                    d.at(i) = (d.at(i) & ~lanes) | (result.at(i) & lanes);
+                    l.at(i) = (l.at(i) & ~lanes) | (left & lanes);
+                    r.at(i) = (r.at(i) & ~lanes) | (right & lanes);
+                }
+            }
+
+            std::array<uint32_t, 256> words; // 0xFFFFFF where no instruction is
+            std::array<bool, 256> safe;
+            std::array<Lanes, 48> stuck0, stuck1; // by line, see stuck()
+            Lanes patched; // with a stuck signal
+            Lanes failed;
+
+            Byte a, w, pc, st, mar, out, in, ia, ir, upc;
+            std::array<Byte, 4> regs;
+            Byte l, d, r; // ALU outputs
+            std::array<Lanes, 3> s; // S2-S0 as last set
+            Lanes cy, z, fen, cn;
+            Byte em_addr;
+            std::array<Byte, 256> em;
+    };
+}
+
+#endif // SLICED_ENGINE_HPP_INCLUDED
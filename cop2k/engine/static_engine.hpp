@@ -0,0 +1,248 @@
+#ifndef STATIC_ENGINE_HPP_INCLUDED
+#define STATIC_ENGINE_HPP_INCLUDED
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "libopcode.hpp"
+#include "decoded_engine.hpp"
+
+namespace COP2K
+{
+    // the micro words of an instruction set built in, decoded by the compiler
+    template <typename ISA>
+    constexpr std::array<DecodedEngine::Word, 256> built_in_words = [] {
+        std::array<DecodedEngine::Word, 256> ret = {};
+
+        for (unsigned i = 0; i < 256; i++)
+            ret.at(i) = DecodedEngine::decode(ISA::MICRO_PROGRAM.at(i), ISA::SAFE.at(i >> 6) >> (i & 0x3F) & 1);
+
+        return ret;
+    }();
+
+    /* the decoded engine, specialized at compile time to an instruction
+     * set built in, as written by isa_compiler --header. each uPC has its
+     * own clock, holding only what its word does, and a step goes from one
+     * to the next through a table of them
+     *
+     * the instruction set loaded still decides: when it is not the one
+     * built in, or a micro word has been patched away from it, and while
+     * coverage is collected, clocks go through the decoded engine
+     */
+    template <typename ISA>
+    class StaticEngine : public DecodedEngine
+    {
+        public:
+            const char *get_name() const override
+            {
+                return "static";
+            }
+
+            void reset(const Opcode &opcode, const std::string &image) override
+            {
+                DecodedEngine::reset(opcode, image);
+                built_in = is_built_in(opcode);
+            }
+
+            unsigned step() override
+            {
+                if (!built_in || coverage)
+                    return DecodedEngine::step();
+
+                for (unsigned i = 1; i <= MAX_STEP_CLOCKS; i++)
+                    if ((this->*clocks().at(upc))())
+                        return i;
+
+                throw std::runtime_error(std::format("no instruction fetched in {} clocks", MAX_STEP_CLOCKS));
+            }
+
+            bool run_clock() override
+            {
+                if (!built_in || coverage)
+                    clock();
+
+                else
+                    (this->*clocks().at(upc))();
+
+                return true;
+            }
+
+            void set_um_data(uint8_t addr, const std::bitset<24> &val) override
+            {
+                DecodedEngine::set_um_data(addr, val);
+                built_in = is_built_in(opcode);
+            }
+
+            static bool is_built_in(const Opcode &opcode)
+            {
+                for (unsigned i = 0; i < 256; i++) {
+                    const Opcode::Instruction &ins = opcode.begin()[i >> 2];
+                    uint32_t word = ins.exist ? ins.microprogram.at(i & 0x3).to_ulong() : 0xFFFFFF;
+
+                    if (word != ISA::MICRO_PROGRAM.at(i) || opcode.is_um_safe(i) != (ISA::SAFE.at(i >> 6) >> (i & 0x3F) & 1))
+                        return false;
+                }
+
+                return true;
+            }
+
+        private:
+            using Clock = bool (StaticEngine::*)();
+
+            template <size_t... UPC>
+            static constexpr std::array<Clock, 256> make_clocks(std::index_sequence<UPC...>)
+            {
+                return { &StaticEngine::clock_at<UPC>... };
+            }
+
+            static const std::array<Clock, 256> &clocks()
+            {
+                static constexpr std::array<Clock, 256> ret = make_clocks(std::make_index_sequence<256>());
+
+                return ret;
+            }
+
+            template <size_t UPC>
+            bool clock_at()
+            {
+                return ireq && !iack ? clock_with<UPC, true>() : clock_with<UPC, false>();
+            }
+
+            // DecodedEngine::clock() with the word known, but no coverage
+            template <size_t UPC, bool INTERRUPTED>
+            bool clock_with()
+            {
+                constexpr Word word = built_in_words<ISA>.at(UPC);
+                constexpr Routing route = word.routing.at(INTERRUPTED);
+                [[maybe_unused]] uint8_t abus = 0, dbus = 0, ibus = 0;
+
+                // S0, S1 and S2 are set one at a time
+                calc((s & 0x6) | (word.s & 0x1));
+                calc((s & 0x4) | (word.s & 0x3));
+                calc(word.s);
+                s = word.s;
+                fen = word.fen;
+                cn = word.cn;
+
+                if constexpr (INTERRUPTED)
+                    iack = true;
+
+                if constexpr (route.conflict)
+                    throw std::logic_error("this bus already has a writer");
+
+                if constexpr (word.eint)
+                    iack = ireq = false;
+
+                if constexpr (route.abus == PC)
+                    abus = pc;
+
+                else if constexpr (route.abus == MAR)
+                    abus = mar;
+
+                if constexpr (route.em_addr) {
+                    em_addr = abus;
+                    em_from_pc = route.abus == PC;
+                }
+
+                if constexpr (route.dbus == FROM_IN)
+                    dbus = in;
+
+                else if constexpr (route.dbus == FROM_IA)
+                    dbus = ia;
+
+                else if constexpr (route.dbus == FROM_ST)
+                    dbus = st;
+
+                else if constexpr (route.dbus == FROM_PC)
+                    dbus = pc;
+
+                else if constexpr (route.dbus == FROM_D)
+                    dbus = d;
+
+                else if constexpr (route.dbus == FROM_L)
+                    dbus = l;
+
+                else if constexpr (route.dbus == FROM_R)
+                    dbus = r;
+
+                else if constexpr (route.dbus == FROM_REG)
+                    dbus = regs[ir & 0x3];
+
+                else if constexpr (route.dbus == FROM_EM)
+                    dbus = em[em_addr];
+
+                if constexpr (route.abus == PC)
+                    pc++;
+
+                if constexpr (route.ibus == EM)
+                    ibus = em[em_addr];
+
+                else if constexpr (route.ibus == INTERRUPT)
+                    ibus = 0xB8;
+
+                if constexpr (route.targets != 0) {
+                    const bool jump =
+                        (ir & 0x8) || // jump unconditionally
+                        ((ir & 0xC) >> 2 == 0 && cy) || // jump on carry
+                        ((ir & 0xC) >> 2 == 1 && z); // jump on zero
+
+                    if constexpr (route.dbus == FROM_NONE) {
+                        if (route.targets & ~TO_PC || jump)
+                            throw std::logic_error("this bus has no writer");
+                    }
+
+                    if constexpr ((route.targets & TO_EM) != 0)
+                        em[em_addr] = dbus;
+
+                    if constexpr ((route.targets & TO_PC) != 0) {
+                        if (jump)
+                            pc = dbus;
+                    }
+
+                    if constexpr ((route.targets & TO_MAR) != 0)
+                        mar = dbus;
+
+                    if constexpr ((route.targets & TO_OUT) != 0)
+                        out = dbus;
+
+                    if constexpr ((route.targets & TO_ST) != 0)
+                        st = dbus;
+
+                    if constexpr ((route.targets & TO_REG) != 0)
+                        regs[ir & 0x3] = dbus;
+
+                    if constexpr ((route.targets & TO_W) != 0) {
+                        w = dbus;
+                        calc(s);
+                    }
+
+                    if constexpr ((route.targets & TO_A) != 0) {
+                        a = dbus;
+                        calc(s);
+                    }
+                }
+
+                if constexpr (!word.fetch) {
+                    upc++;
+                    return false;
+
+                } else {
+                    if constexpr (route.ibus == NONE)
+                        throw std::logic_error("this bus has no writer");
+
+                    ir = ibus;
+                    upc = ibus & ~0x3;
+                    return true;
+                }
+            }
+
+            bool built_in = false;
+    };
+}
+
+#endif // STATIC_ENGINE_HPP_INCLUDED
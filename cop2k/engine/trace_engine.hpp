@@ -0,0 +1,449 @@
+#ifndef TRACE_ENGINE_HPP_INCLUDED
+#define TRACE_ENGINE_HPP_INCLUDED
+
+// threaded dispatch takes the address of labels, which GCC and Clang allow
+#if defined(__GNUC__)
+#define COP2K_TRACE 1
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "block_engine.hpp"
+
+namespace COP2K
+{
+    /* the block engine, with its blocks recorded as traces while they run:
+     * from a hot address on to the first jump that is taken, through the
+     * ones that are not, which are checked to still not be taken when the
+     * trace is replayed. where the JIT stops at any jump, a trace carries
+     * on past a loop test, and needs no code generator
+     *
+     * what an instruction does comes from the words decoded from its
+     * microprogram, translated the way the JIT does. the trace is a linked
+     * array of records, each holding the address of its handler in
+     * replay(), which jumps from one to the next with computed gotos.
+     * moving a byte and fetching from a known address are single
+     * superinstructions
+     */
+    class TraceEngine : public BlockEngine
+    {
+        public:
+            const char *get_name() const override
+            {
+                return "trace";
+            }
+
+        private:
+            // the handlers in replay(), in its order
+            enum Handler : uint8_t {
+                GUARD, // s, fen and cn are what the trace starts with
+                CALC, // CALC + s, with fen and cn
+                DBUS_FROM = CALC + 8, // the byte at p, or imm
+                DBUS_FROM_IMM,
+                DBUS_FROM_EM,
+                IBUS_FROM,
+                IBUS_FROM_EM,
+                LATCH_EM_ADDR,
+                LATCH_EM_ADDR_IMM,
+                INC_PC,
+                STORE, // dbus into p
+                STORE_IMM,
+                STORE_EM_AT, // dbus into p, which is watched when q is set
+                STORE_EM,
+                JUMP,
+                JUMP_ON_CY,
+                JUMP_ON_Z,
+                ENABLE_INT,
+                FETCH,
+                EXIT_IF_WRITTEN, // with n, s, fen, cn and pc
+                EXIT,
+                CHECK_PC, // exit unless PC is imm
+                MOVE, // the byte at p into q
+                MOVE_IMM,
+                FETCH_FROM, // the byte at p
+                HANDLER_COUNT
+            };
+
+            struct Record {
+                const void *handler = nullptr;
+                uint8_t *p = nullptr, *q = nullptr;
+                uint8_t imm = 0, s = 0;
+                bool fen = false, cn = false;
+                std::optional<uint8_t> pc = std::nullopt;
+                unsigned n = 0;
+                Handler kind = GUARD;
+            };
+
+            unsigned enter(int index) override
+            {
+                return replay(traces.at(index).data());
+            }
+
+            void clear_blocks() override
+            {
+                BlockEngine::clear_blocks();
+                traces.clear();
+            }
+
+            // records the trace by running it
+            int compile(uint8_t addr, uint64_t limit, uint64_t &done, uint64_t &clocks) override
+            {
+                Block block = { addr, ir, {}, {}, 0, true };
+                Known known = { s, fen, cn, static_cast<uint8_t>(addr + 1), std::nullopt };
+                const Known start = known;
+                std::vector<Op> ops;
+                uint64_t total = 0;
+                uint8_t fetched_from = addr;
+                bool stores = false;
+
+                while (block.clocks.size() < MAX_BLOCK_INSTRUCTIONS && done < limit && !(ireq && !iack)) {
+                    std::vector<Op> instruction;
+                    Known after = known;
+                    std::optional<uint8_t> next, fall;
+                    uint8_t byte = ir;
+                    unsigned n = 0, ran;
+
+                    if (!translate(byte, after, instruction, n, next, &fall))
+                        break;
+
+                    if (!block.clocks.empty())
+                        block.opcodes.emplace_back(fetched_from, byte);
+
+                    // a write in the one before may have changed this opcode
+                    if (stores)
+                        ops.push_back(exit_op(block.clocks.size(), known, false));
+
+                    ops.insert(ops.end(), instruction.begin(), instruction.end());
+                    known = after;
+                    block.slots |= uint64_t(1) << (byte >> 2);
+                    stores = stores_em(instruction);
+
+                    ran = step();
+                    done++;
+                    clocks += ran;
+                    statistics.interpreted++;
+                    check_written();
+                    block.clocks.push_back(total += n);
+
+                    if (ran != n)
+                        return -1;
+
+                    if (fall) {
+                        if (pc != *fall)
+                            break;
+
+                        ops.push_back({
+                            .kind = Op::CHECK_PC, .s = known.s, .fen = known.fen, .cn = known.cn, .imm = *fall,
+                            .n = static_cast<unsigned>(block.clocks.size())
+                        });
+                        known.pc = fall;
+
+                    } else if (!next)
+                        break;
+
+                    fetched_from = em_addr;
+                }
+
+                // the trace changed its own code while it was recorded
+                for (const auto &[i, byte] : block.opcodes)
+                    if (em.at(i) != byte)
+                        return -1;
+
+                if (block.clocks.empty())
+                    return -1;
+
+                ops.push_back(exit_op(block.clocks.size(), known, true));
+                leave_out_hidden(ops);
+
+                if (blocks.size() >= MAX_BLOCKS)
+                    clear_blocks();
+
+                traces.push_back(link(ops, start));
+                return add_block(std::move(block));
+            }
+
+            std::vector<Record> link(const std::vector<Op> &ops, const Known &start)
+            {
+                std::vector<Record> ret = { { .s = start.s, .fen = start.fen, .cn = start.cn, .kind = GUARD } };
+
+                for (const Op &i : ops) {
+                    Record rec = { .imm = i.imm, .s = i.s, .fen = i.fen, .cn = i.cn, .pc = i.pc, .n = i.n };
+                    uint8_t *p = reinterpret_cast<uint8_t *>(this) + i.disp;
+
+                    switch (i.kind) {
+                        case Op::CALC:
+                            rec.kind = static_cast<Handler>(CALC + i.s);
+                            break;
+
+                        case Op::DBUS_FROM:
+                            rec.kind = DBUS_FROM;
+                            rec.p = p;
+                            break;
+
+                        case Op::DBUS_FROM_IMM:
+                            rec.kind = DBUS_FROM_IMM;
+                            break;
+
+                        case Op::DBUS_FROM_EM:
+                        case Op::IBUS_FROM_EM:
+                            if (i.em_addr) {
+                                rec.kind = i.kind == Op::DBUS_FROM_EM ? DBUS_FROM : IBUS_FROM;
+                                rec.p = &em.at(*i.em_addr);
+
+                            } else
+                                rec.kind = i.kind == Op::DBUS_FROM_EM ? DBUS_FROM_EM : IBUS_FROM_EM;
+
+                            break;
+
+                        case Op::LATCH_EM_ADDR:
+                            rec.kind = LATCH_EM_ADDR;
+                            rec.p = p;
+                            break;
+
+                        case Op::LATCH_EM_ADDR_IMM:
+                            rec.kind = LATCH_EM_ADDR_IMM;
+                            break;
+
+                        case Op::INC_PC:
+                            rec.kind = INC_PC;
+                            break;
+
+                        case Op::STORE:
+                        case Op::STORE_IMM:
+                            rec.kind = i.kind == Op::STORE ? STORE : STORE_IMM;
+                            rec.p = p;
+                            break;
+
+                        case Op::STORE_EM:
+                            rec.kind = i.em_addr ? STORE_EM_AT : STORE_EM;
+
+                            if (i.em_addr) {
+                                rec.p = &em.at(*i.em_addr);
+                                rec.q = &translated.at(*i.em_addr);
+                            }
+
+                            break;
+
+                        case Op::STORE_PC:
+                            rec.kind = i.always ? JUMP : i.on_cy ? JUMP_ON_CY : JUMP_ON_Z;
+                            break;
+
+                        case Op::ENABLE_INT:
+                            rec.kind = ENABLE_INT;
+                            break;
+
+                        case Op::FETCH:
+                            rec.kind = FETCH;
+                            break;
+
+                        case Op::EXIT:
+                            rec.kind = i.always ? EXIT : EXIT_IF_WRITTEN;
+                            break;
+
+                        case Op::CHECK_PC:
+                            rec.kind = CHECK_PC;
+                            break;
+                    }
+
+                    // superinstructions
+                    Record &last = ret.back();
+
+                    if ((last.kind == DBUS_FROM || last.kind == DBUS_FROM_IMM) && rec.kind == STORE) {
+                        last.kind = last.kind == DBUS_FROM ? MOVE : MOVE_IMM;
+                        last.q = rec.p;
+
+                    } else if (last.kind == IBUS_FROM && rec.kind == FETCH)
+                        last.kind = FETCH_FROM;
+
+                    else
+                        ret.push_back(rec);
+                }
+
+                replay(nullptr, &ret);
+                return ret;
+            }
+
+            // returns the instructions run, or with link, sets the handlers of its records
+            unsigned replay(const Record *rec, std::vector<Record> *link = nullptr)
+            {
+                static const void *const handlers[HANDLER_COUNT] = {
+                    &&guard, &&calc_0, &&calc_1, &&calc_2, &&calc_3, &&calc_4, &&calc_5, &&calc_6, &&calc_7,
+                    &&dbus_from, &&dbus_from_imm, &&dbus_from_em, &&ibus_from, &&ibus_from_em,
+                    &&latch_em_addr, &&latch_em_addr_imm, &&inc_pc, &&store, &&store_imm, &&store_em_at,
+                    &&store_em, &&jump, &&jump_on_cy, &&jump_on_z, &&enable_int, &&fetch, &&exit_if_written,
+                    &&exit, &&check_pc, &&move, &&move_imm, &&fetch_from
+                };
+                uint8_t dbus = 0, ibus = 0;
+
+                if (link) {
+                    for (Record &i : *link)
+                        i.handler = handlers[i.kind];
+
+                    return 0;
+                }
+
+                goto *rec->handler;
+
+            guard:
+                if (s != rec->s || fen != rec->fen || cn != rec->cn)
+                    return 0;
+
+                goto *(++rec)->handler;
+
+            calc_0:
+                calc(0, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_1:
+                calc(1, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_2:
+                calc(2, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_3:
+                calc(3, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_4:
+                calc(4, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_5:
+                calc(5, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_6:
+                calc(6, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            calc_7:
+                calc(7, rec->fen, rec->cn);
+                goto *(++rec)->handler;
+
+            dbus_from:
+                dbus = *rec->p;
+                goto *(++rec)->handler;
+
+            dbus_from_imm:
+                dbus = rec->imm;
+                goto *(++rec)->handler;
+
+            dbus_from_em:
+                dbus = em[em_addr];
+                goto *(++rec)->handler;
+
+            ibus_from:
+                ibus = *rec->p;
+                goto *(++rec)->handler;
+
+            ibus_from_em:
+                ibus = em[em_addr];
+                goto *(++rec)->handler;
+
+            latch_em_addr:
+                em_addr = *rec->p;
+                goto *(++rec)->handler;
+
+            latch_em_addr_imm:
+                em_addr = rec->imm;
+                goto *(++rec)->handler;
+
+            inc_pc:
+                pc++;
+                goto *(++rec)->handler;
+
+            store:
+                *rec->p = dbus;
+                goto *(++rec)->handler;
+
+            store_imm:
+                *rec->p = rec->imm;
+                goto *(++rec)->handler;
+
+            // a write over an opcode some trace relies on ends the trace after the instruction
+            store_em_at:
+                *rec->p = dbus;
+                watched_written |= *rec->q;
+                goto *(++rec)->handler;
+
+            store_em:
+                em[em_addr] = dbus;
+                watched_written |= translated[em_addr];
+                goto *(++rec)->handler;
+
+            jump:
+                pc = dbus;
+                goto *(++rec)->handler;
+
+            jump_on_cy:
+                if (cy)
+                    pc = dbus;
+
+                goto *(++rec)->handler;
+
+            jump_on_z:
+                if (z)
+                    pc = dbus;
+
+                goto *(++rec)->handler;
+
+            enable_int:
+                iack = ireq = false;
+                goto *(++rec)->handler;
+
+            fetch:
+                ir = ibus;
+                upc = ibus & ~0x3;
+                goto *(++rec)->handler;
+
+            exit_if_written:
+                if (watched_written)
+                    goto exit;
+
+                goto *(++rec)->handler;
+
+            check_pc:
+                if (pc == rec->imm)
+                    goto *(++rec)->handler;
+
+                goto exit;
+
+            move:
+                dbus = *rec->p;
+                *rec->q = dbus;
+                goto *(++rec)->handler;
+
+            move_imm:
+                dbus = rec->imm;
+                *rec->q = dbus;
+                goto *(++rec)->handler;
+
+            fetch_from:
+                ibus = *rec->p;
+                ir = ibus;
+                upc = ibus & ~0x3;
+                goto *(++rec)->handler;
+
+            exit:
+                s = rec->s;
+                fen = rec->fen;
+                cn = rec->cn;
+
+                if (rec->pc)
+                    pc = *rec->pc;
+
+                return rec->n;
+            }
+
+            std::vector<std::vector<Record>> traces; // of the blocks
+    };
+}
+
+#endif
+
+#endif // TRACE_ENGINE_HPP_INCLUDED
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "engine/decoded_engine.hpp"
+#include "engine/sliced_engine.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: fault [-f <faults.txt>]... [-m <max>] [-i <in>] [-c out|state] "
+              "<instr.txt> <file.asm|file.bin|dir>" << std::endl;
+}
+
+/* one faulty machine per line, with one or more lines stuck:
+ *
+ *     <signal|DBUSn|ABUSn|IBUSn> sa0|sa1[, ...]
+ *
+ * where a signal is named as in the micro word, EMWR to S0, and `#`
+ * starts a comment
+ */
+static std::vector<std::vector<COP2K::StuckAt>> load_faults(const char *path)
+{
+    std::vector<std::vector<COP2K::StuckAt>> ret;
+    std::ifstream ifs(path);
+    std::string line;
+
+    if (!ifs)
+        throw std::runtime_error(std::format("failed to open {}", path));
+
+    for (unsigned lineno = 1; std::getline(ifs, line); lineno++) {
+        std::string text = line.substr(0, line.find('#'));
+        std::vector<COP2K::StuckAt> machine;
+
+        std::replace(text.begin(), text.end(), ',', ' ');
+
+        std::istringstream iss(text);
+        std::string name, level;
+
+        try {
+            while (iss >> name) {
+                if (!(iss >> level))
+                    throw std::invalid_argument(std::format("expected sa0 or sa1 after {}", name));
+
+                machine.push_back(COP2K::StuckAt::parse(name, level));
+            }
+
+        } catch (const std::invalid_argument &e) {
+            throw std::runtime_error(std::format("{}:{}: {}", path, lineno, e.what()));
+        }
+
+        if (!machine.empty())
+            ret.push_back(machine);
+    }
+
+    return ret;
+}
+
+// what the machine without faults did, which the faulty ones must do
+struct Golden {
+    std::vector<std::pair<unsigned, uint8_t>> steps; // clocks and OUT after, per instruction
+    COP2K::EngineState last;
+};
+
+// up to a jump to itself or max instructions, throws if the program is at fault
+static Golden run_golden(const COP2K::Opcode &opcode, const std::string &image, uint8_t in, unsigned long max)
+{
+    COP2K::DecodedEngine engine;
+    Golden ret;
+
+    engine.reset(opcode, image);
+    engine.set_in(in);
+
+    for (unsigned long i = 0; i < max; i++) {
+        uint8_t pc = engine.get_state().pc;
+        unsigned clocks = engine.step();
+
+        ret.steps.push_back({ clocks, engine.get_state().out });
+
+        if (engine.get_state().pc == pc)
+            break;
+    }
+
+    ret.last = engine.get_state();
+    return ret;
+}
+
+// per machine: '.' not detected, 'D' detected by what it did, 'E' stopped as COP2K would throw
+static std::string run_faulty(
+    const COP2K::Opcode &opcode,
+    const std::string &image,
+    uint8_t in,
+    const Golden &golden,
+    const std::vector<std::vector<COP2K::StuckAt>> &machines,
+    bool whole_state
+)
+{
+    std::string ret;
+    COP2K::SlicedEngine engine;
+
+    for (size_t first = 0; first < machines.size(); first += COP2K::SlicedEngine::LANES) {
+        std::vector<std::vector<COP2K::StuckAt>> batch(
+            machines.begin() + first,
+            machines.begin() + std::min(machines.size(), first + COP2K::SlicedEngine::LANES)
+        );
+        COP2K::SlicedEngine::Lanes used = ~COP2K::SlicedEngine::Lanes(0) >> (COP2K::SlicedEngine::LANES - batch.size());
+        COP2K::SlicedEngine::Lanes detected = 0;
+
+        engine.reset(opcode, image, batch);
+        engine.set_in(in);
+
+        // a machine found faulty is not run any further
+        for (const auto &[clocks, out] : golden.steps) {
+            for (unsigned i = 0; i < clocks; i++)
+                engine.clock(used & ~detected);
+
+            detected |= (engine.get_failed() | engine.out_differs(out)) & used;
+
+            if (detected == used)
+                break;
+        }
+
+        if (whole_state)
+            detected |= engine.differs(golden.last) & used;
+
+        for (unsigned i = 0; i < batch.size(); i++)
+            ret += engine.get_failed() >> i & 1 ? 'E' : detected >> i & 1 ? 'D' : '.';
+    }
+
+    return ret;
+}
+
+static std::string describe(const std::vector<COP2K::StuckAt> &machine)
+{
+    std::string ret;
+
+    for (const COP2K::StuckAt &i : machine)
+        ret += (ret.empty() ? "" : ", ") + i.to_string();
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    std::vector<std::vector<COP2K::StuckAt>> machines;
+    std::vector<std::filesystem::path> programs;
+    unsigned long max = 100000, in = 0;
+    bool whole_state = true;
+    int i = 1;
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (; i + 2 < argc; i += 2) {
+            if (!strcmp(argv[i], "-f")) {
+                std::vector<std::vector<COP2K::StuckAt>> list = load_faults(argv[i + 1]);
+
+                machines.insert(machines.end(), list.begin(), list.end());
+
+            } else if (!strcmp(argv[i], "-m") && strtoul(argv[i + 1], nullptr, 0))
+                max = strtoul(argv[i + 1], nullptr, 0);
+
+            else if (!strcmp(argv[i], "-i") && strtoul(argv[i + 1], nullptr, 0) <= 0xff)
+                in = strtoul(argv[i + 1], nullptr, 0);
+
+            else if (!strcmp(argv[i], "-c") && (!strcmp(argv[i + 1], "out") || !strcmp(argv[i + 1], "state")))
+                whole_state = !strcmp(argv[i + 1], "state");
+
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (i + 2 != argc) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        COP2K::load_instruction_set(argv[i], opcode);
+        programs = COP2K::list_files(argv[i + 1], { ".asm", ".bin" });
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (machines.empty())
+        for (const COP2K::StuckAt &j : COP2K::StuckAt::all())
+            machines.push_back({ j });
+
+    std::vector<std::string> names, columns;
+    size_t width = 0;
+
+    for (const std::filesystem::path &program : programs) {
+        std::string name = program.filename().string();
+        std::string image;
+        Golden golden;
+
+        try {
+            image = COP2K::load_program(program, opcode);
+
+        } catch (const std::runtime_error &e) {
+            std::cout << std::format("{}: skipped, {}\n", name, e.what());
+            continue;
+        }
+
+        try {
+            golden = run_golden(opcode, image, in, max);
+
+        } catch (const std::exception &e) {
+            // without faults it already goes wrong, there is nothing to compare with
+            std::cout << std::format("{}: skipped, stops with {}\n", name, e.what());
+            continue;
+        }
+
+        names.push_back(name);
+        columns.push_back(run_faulty(opcode, image, in, golden, machines, whole_state));
+        std::cout << std::format(
+                         "{:>3}  {}: {} instructions, {} detected\n",
+                         names.size(), name, golden.steps.size(),
+                         machines.size() - std::count(columns.back().begin(), columns.back().end(), '.')
+                     );
+    }
+
+    for (const std::vector<COP2K::StuckAt> &j : machines)
+        width = std::max(width, describe(j).size());
+
+    // a row per faulty machine, a column per program
+    std::cout << std::format("\n{:{}}", "", width);
+
+    for (size_t j = 0; j < names.size(); j++)
+        std::cout << std::format(" {:>3}", j + 1);
+
+    std::cout << std::endl;
+
+    unsigned undetected = 0;
+
+    for (size_t j = 0; j < machines.size(); j++) {
+        bool any = false;
+
+        std::cout << std::format("{:{}}", describe(machines.at(j)), width);
+
+        for (const std::string &k : columns) {
+            std::cout << std::format(" {:>3}", k.at(j));
+            any |= k.at(j) != '.';
+        }
+
+        std::cout << std::endl;
+        undetected += !any;
+    }
+
+    std::cout << std::format(
+                     "\n{} faulty machines, {} detected by some program, {} by none\n",
+                     machines.size(), machines.size() - undetected, undetected
+                 );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    const char *header_name = nullptr;
+
+    if (argc == 5 && !strcmp(argv[1], "--header")) {
+        header_name = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc != 3 || !strcmp(argv[1], "--help")) {
+        std::cerr << "usage: isa_compiler <instr.txt|file.ins> <out.isa>" << std::endl;
+        std::cerr << "       isa_compiler --header <name> <instr.txt|file.ins|file.isa> <out.hpp>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[1], opcode);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    FILE *out_file = fopen(argv[2], "wb");
+
+    if (!out_file)
+        return EXIT_FAILURE;
+
+    try {
+        if (header_name)
+            COP2K::save_isa_header(
+                opcode, header_name, std::filesystem::path(argv[1]).filename().string(), out_file
+            );
+
+        else
+            COP2K::save_isa_image(opcode, out_file);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        fclose(out_file);
+        return EXIT_FAILURE;
+    }
+
+    fclose(out_file);
+}
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "engine/engines.hpp"
+#include "lockstep.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: lockstep [-a <engine>] [-b <engine>] [-n <every>] [-m <max>] [-s <schedule>] "
+              "<instr.txt|dir> <file.asm|file.bin|dir>" << std::endl;
+    std::cerr << "engines:";
+
+    for (const std::string &i : COP2K::get_engine_names())
+        std::cerr << " " << i;
+
+    std::cerr << std::endl;
+}
+
+/* one event per line, before the instruction counted from 1:
+ *
+ *     <instruction> in <value>
+ *     <instruction> int
+ *
+ * and `#` starts a comment
+ */
+static std::vector<COP2K::LockstepEvent> load_schedule(const char *path)
+{
+    std::vector<COP2K::LockstepEvent> ret;
+    std::ifstream ifs(path);
+    std::string line;
+
+    if (!ifs)
+        throw std::runtime_error(std::format("failed to open {}", path));
+
+    for (unsigned lineno = 1; std::getline(ifs, line); lineno++) {
+        std::istringstream iss(line.substr(0, line.find('#')));
+        std::string at, what, value, rest;
+        COP2K::LockstepEvent e = {};
+
+        if (!(iss >> at))
+            continue;
+
+        iss >> what >> value >> rest;
+
+        try {
+            e.instruction = COP2K::parse_number(at);
+
+            if (what == "int" && value.empty())
+                e.interrupt = true;
+
+            else if (what == "in" && rest.empty() && COP2K::parse_number(value) <= 0xff)
+                e.in = COP2K::parse_number(value);
+
+            else
+                throw std::invalid_argument(line);
+
+        } catch (const std::logic_error &) {
+            throw std::runtime_error(std::format("{}:{}: bad event", path, lineno));
+        }
+
+        if (e.instruction)
+            e.instruction--;
+
+        ret.push_back(e);
+    }
+
+    std::stable_sort(ret.begin(), ret.end(), [](const COP2K::LockstepEvent &a, const COP2K::LockstepEvent &b) {
+        return a.instruction < b.instruction;
+    });
+    return ret;
+}
+
+static void print_divergence(const COP2K::LockstepResult &r, const char *name_a, const char *name_b)
+{
+    std::cout << std::format("  {}\n", r.reason);
+    std::cout << std::format(
+                     "  first differs at instruction {}, {} {}\n",
+                     r.first_instruction, r.cycle_exact ? "cycle" : "in the instruction from cycle", r.first_cycle
+                 );
+
+    std::vector<std::string> fields;
+    auto compare = [&fields](const char *name, unsigned a, unsigned b) {
+        if (a != b)
+            fields.push_back(std::format("{} {:02X}/{:02X}", name, a, b));
+    };
+
+    compare("A", r.a.a, r.b.a);
+    compare("W", r.a.w, r.b.w);
+
+    for (unsigned i = 0; i < 4; i++)
+        compare(std::format("R{}", i).c_str(), r.a.r.at(i), r.b.r.at(i));
+
+    compare("PC", r.a.pc, r.b.pc);
+    compare("ST", r.a.st, r.b.st);
+    compare("MAR", r.a.mar, r.b.mar);
+    compare("OUT", r.a.out, r.b.out);
+    compare("IN", r.a.in, r.b.in);
+    compare("IA", r.a.ia, r.b.ia);
+    compare("IR", r.a.ir, r.b.ir);
+    compare("UPC", r.a.upc, r.b.upc);
+    compare("CY", r.a.cy, r.b.cy);
+    compare("Z", r.a.z, r.b.z);
+    compare("IREQ", r.a.ireq, r.b.ireq);
+    compare("IACK", r.a.iack, r.b.iack);
+
+    for (unsigned i = 0; i < 256; i++)
+        compare(std::format("[{:02X}]", i).c_str(), r.a.em.at(i), r.b.em.at(i));
+
+    if (!fields.empty()) {
+        std::cout << "  differs:";
+
+        for (const std::string &i : fields)
+            std::cout << " " << i;
+
+        std::cout << std::endl;
+    }
+
+    std::cout << std::format("  {}:\n{}", name_a, r.a.to_string());
+    std::cout << std::format("  {}:\n{}", name_b, r.b.to_string());
+}
+
+int main(int argc, char **argv)
+{
+    std::string name_a = "clock", name_b = "decoded";
+    std::unique_ptr<COP2K::Engine> a, b;
+    std::vector<COP2K::LockstepEvent> schedule;
+    unsigned long every = 64, max = 100000;
+    std::vector<std::filesystem::path> sets, programs;
+    int i = 1;
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (; i + 2 < argc; i += 2) {
+            if (!strcmp(argv[i], "-a"))
+                name_a = argv[i + 1];
+
+            else if (!strcmp(argv[i], "-b"))
+                name_b = argv[i + 1];
+
+            else if (!strcmp(argv[i], "-n") && strtoul(argv[i + 1], nullptr, 0))
+                every = strtoul(argv[i + 1], nullptr, 0);
+
+            else if (!strcmp(argv[i], "-m") && strtoul(argv[i + 1], nullptr, 0))
+                max = strtoul(argv[i + 1], nullptr, 0);
+
+            else if (!strcmp(argv[i], "-s"))
+                schedule = load_schedule(argv[i + 1]);
+
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (i + 2 != argc) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        a = COP2K::make_engine(name_a);
+        b = COP2K::make_engine(name_b);
+        sets = COP2K::list_files(argv[i], { ".txt" });
+        programs = COP2K::list_files(argv[i + 1], { ".asm", ".bin" });
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    unsigned passed = 0, diverged = 0, skipped = 0;
+
+    for (const std::filesystem::path &set : sets) {
+        COP2K::Opcode opcode;
+
+        try {
+            COP2K::load_instruction_set(set.c_str(), opcode);
+
+        } catch (const std::exception &e) {
+            std::cout << std::format("{}: skipped, {}\n", set.filename().string(), e.what());
+            skipped += programs.size();
+            continue;
+        }
+
+        for (const std::filesystem::path &program : programs) {
+            std::string name = std::format("{} {}", set.filename().string(), program.filename().string());
+            std::string image;
+
+            try {
+                image = COP2K::load_program(program, opcode);
+
+            } catch (const std::runtime_error &e) {
+                std::cout << std::format("{}: skipped, {}\n", name, e.what());
+                skipped++;
+                continue;
+            }
+
+            COP2K::Lockstep lockstep(*a, *b);
+            COP2K::LockstepResult r;
+
+            lockstep.schedule = schedule;
+            lockstep.check_every = every;
+            lockstep.max_instructions = max;
+
+            try {
+                r = lockstep.run(opcode, image);
+
+            } catch (const std::exception &e) {
+                // both engines agree the program is at fault
+                std::cout << std::format("{}: agree, both stop with {}\n", name, e.what());
+                passed++;
+                continue;
+            }
+
+            if (r.diverged) {
+                std::cout << std::format("{}: DIVERGED\n", name);
+                print_divergence(r, a->get_name(), b->get_name());
+                diverged++;
+                continue;
+            }
+
+            std::cout << std::format(
+                             "{}: agree, {} instructions, {} cycles{}, hash {:016x}\n",
+                             name, r.instructions, r.cycles, r.halted ? ", halted" : "", r.a.hash()
+                         );
+
+            for (const COP2K::Engine *engine : { a.get(), b.get() })
+                if (!engine->get_summary().empty())
+                    std::cout << std::format("  {}: {}\n", engine->get_name(), engine->get_summary());
+
+            passed++;
+        }
+    }
+
+    std::cout << std::format("{} agree, {} diverged, {} skipped\n", passed, diverged, skipped);
+    return diverged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+#ifndef LOCKSTEP_HPP_INCLUDED
+#define LOCKSTEP_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "engine/engine.hpp"
+
+namespace COP2K
+{
+    // something a program gets from outside, before the given instruction
+    struct LockstepEvent {
+        uint64_t instruction;
+        bool interrupt; // otherwise IN is set
+        uint8_t in;
+    };
+
+    struct LockstepResult {
+        bool diverged;
+        bool halted; // a run between two checks changed nothing, with no input left to come
+        uint64_t instructions, cycles; // run in step
+        // where the engines first differ
+        uint64_t first_instruction; // counted from 1, _FATCH_ included
+        uint64_t first_cycle; // counted from 1
+        bool cycle_exact; // both engines can run single clocks
+        std::string reason;
+        EngineState a, b;
+    };
+
+    /* runs two engines side by side on the same instruction set, image
+     * and input, comparing state hashes every check_every instructions.
+     * each engine runs the instructions between two checks, or up to the
+     * next event, at once, so engines that translate blocks run them.
+     * when they differ, both are run again from reset to the last check
+     * that matched and compared after every instruction, then after every
+     * clock of the first instruction that differs
+     */
+    class Lockstep
+    {
+        public:
+            Lockstep(Engine &a, Engine &b) : a(a), b(b) {}
+
+            LockstepResult run(const Opcode &opcode, const std::string &image)
+            {
+                LockstepResult ret = {};
+                uint64_t checked = 0;
+                EngineState before;
+
+                restart(opcode, image);
+                before = a.get_state();
+
+                while (instructions < max_instructions) {
+                    std::string why;
+
+                    if (!step_both(std::min(instructions / check_every * check_every + check_every, max_instructions), why))
+                        return locate(opcode, image, checked, ret, why);
+
+                    EngineState after = a.get_state();
+                    bool halted = after == before && next_event == schedule.size();
+
+                    if (halted || instructions % check_every == 0 || instructions == max_instructions) {
+                        if (after.hash() != b.get_state().hash())
+                            return locate(opcode, image, checked, ret, "states differ");
+
+                        checked = instructions;
+                    }
+
+                    if (halted) {
+                        ret.halted = true;
+                        break;
+                    }
+
+                    before = after;
+                }
+
+                ret.instructions = instructions;
+                ret.cycles = cycles;
+                ret.a = a.get_state();
+                ret.b = b.get_state();
+                return ret;
+            }
+
+            std::vector<LockstepEvent> schedule; // in order of instruction
+            uint64_t check_every = 64;
+            uint64_t max_instructions = 100000;
+
+        private:
+            void restart(const Opcode &opcode, const std::string &image)
+            {
+                a.reset(opcode, image);
+                b.reset(opcode, image);
+                instructions = cycles = 0;
+                next_event = 0;
+            }
+
+            void deliver_events()
+            {
+                for (; next_event < schedule.size() && schedule.at(next_event).instruction <= instructions; next_event++)
+                    for (Engine *i : { &a, &b })
+                        if (schedule.at(next_event).interrupt)
+                            i->trigger_interrupt();
+
+                        else
+                            i->set_in(schedule.at(next_event).in);
+            }
+
+            /* runs both up to instruction until, or the next event if sooner.
+             * false with the reason when the engines disagree on them
+             */
+            bool step_both(uint64_t until, std::string &why)
+            {
+                std::string error_a, error_b;
+                uint64_t n, clocks_a = 0, clocks_b = 0;
+
+                deliver_events();
+                n = until - instructions;
+
+                if (next_event < schedule.size())
+                    n = std::min(n, schedule.at(next_event).instruction - instructions);
+
+                try {
+                    clocks_a = a.run(n);
+
+                } catch (const std::exception &e) {
+                    error_a = e.what();
+                }
+
+                try {
+                    clocks_b = b.run(n);
+
+                } catch (const std::exception &e) {
+                    error_b = e.what();
+                }
+
+                if (error_a != error_b) {
+                    why = std::format(
+                              "{}: {}, {}: {}",
+                              a.get_name(), error_a.empty() ? "no error" : error_a,
+                              b.get_name(), error_b.empty() ? "no error" : error_b
+                          );
+                    return false;
+                }
+
+                // both fail the same way, which is a fault of the program
+                if (!error_a.empty())
+                    throw std::runtime_error(error_a);
+
+                if (clocks_a != clocks_b) {
+                    why = std::format("{} instructions take {} clocks in {} but {} in {}",
+                                      n, clocks_a, a.get_name(), clocks_b, b.get_name());
+                    return false;
+                }
+
+                instructions += n;
+                cycles += clocks_a;
+                return true;
+            }
+
+            LockstepResult locate(
+                const Opcode &opcode,
+                const std::string &image,
+                uint64_t checked,
+                LockstepResult &ret,
+                const std::string &why
+            )
+            {
+                std::string reason;
+                uint64_t first;
+
+                restart(opcode, image);
+
+                while (instructions < checked)
+                    step_both(checked, reason);
+
+                // compare after every instruction
+                while (true) {
+                    first = instructions + 1;
+
+                    if (instructions == max_instructions) {
+                        reason = why + ", but not when run again";
+                        break;
+                    }
+
+                    if (!step_both(instructions + 1, reason))
+                        break;
+
+                    if (a.get_state() != b.get_state()) {
+                        reason = "states differ";
+                        break;
+                    }
+                }
+
+                ret.diverged = true;
+                ret.reason = reason;
+                ret.first_instruction = first;
+                ret.instructions = instructions;
+                ret.cycles = cycles;
+                ret.a = a.get_state();
+                ret.b = b.get_state();
+
+                // and after every clock of that instruction
+                restart(opcode, image);
+
+                while (instructions < first - 1)
+                    step_both(first - 1, reason);
+
+                deliver_events();
+                ret.first_cycle = cycles + 1;
+                ret.cycle_exact = false;
+
+                for (unsigned i = 1; i <= Engine::MAX_STEP_CLOCKS; i++) {
+                    bool failed = false;
+
+                    try {
+                        if (!a.run_clock() || !b.run_clock())
+                            break;
+
+                    } catch (const std::exception &) {
+                        failed = true;
+                    }
+
+                    if (failed || a.get_state() != b.get_state()) {
+                        ret.first_cycle = cycles + i;
+                        ret.cycle_exact = true;
+                        ret.a = a.get_state();
+                        ret.b = b.get_state();
+                        break;
+                    }
+                }
+
+                return ret;
+            }
+
+            Engine &a, &b;
+            uint64_t instructions, cycles;
+            size_t next_event;
+    };
+}
+
+#endif // LOCKSTEP_HPP_INCLUDED
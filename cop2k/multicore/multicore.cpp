@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "multicore.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: multicore [-n <cores>] [-l <latency>] [-q <quantum>] [-j <threads>] [-m <max cycles>] "
+              "[-s <first>:<last>] [-k <first>:<last>|none] <instr.txt> <file.asm|file.bin>..." << std::endl;
+}
+
+// <first>:<last>, both in memory
+static void parse_range(const std::string &s, uint8_t &first, uint8_t &last)
+{
+    size_t colon = s.find(':');
+
+    if (colon == std::string::npos)
+        throw std::invalid_argument(s);
+
+    unsigned long a = COP2K::parse_number(s.substr(0, colon)), b = COP2K::parse_number(s.substr(colon + 1));
+
+    if (a > b || b > 0xff)
+        throw std::invalid_argument(s);
+
+    first = a;
+    last = b;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    COP2K::MultiCore system;
+    std::vector<std::string> names, images;
+    unsigned long cores = 0;
+    int i = 1;
+
+    system.threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+            unsigned long n = strtoul(argv[i + 1], nullptr, 0);
+
+            if (!strcmp(argv[i], "-n") && n)
+                cores = n;
+
+            else if (!strcmp(argv[i], "-l") && n)
+                system.latency = n;
+
+            else if (!strcmp(argv[i], "-q") && n)
+                system.quantum = n;
+
+            else if (!strcmp(argv[i], "-j") && n)
+                system.threads = n;
+
+            else if (!strcmp(argv[i], "-m") && n)
+                system.max_cycles = n;
+
+            else if (!strcmp(argv[i], "-s"))
+                parse_range(argv[i + 1], system.shared_first, system.shared_last);
+
+            else if (!strcmp(argv[i], "-k") && !strcmp(argv[i + 1], "none")) {
+                system.lock_first = 1;
+                system.lock_last = 0;
+
+            } else if (!strcmp(argv[i], "-k"))
+                parse_range(argv[i + 1], system.lock_first, system.lock_last);
+
+            else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (i + 2 > argc) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        COP2K::load_instruction_set(argv[i], opcode);
+
+        for (int j = i + 1; j < argc; j++) {
+            names.push_back(std::filesystem::path(argv[j]).filename().string());
+
+            try {
+                images.push_back(COP2K::load_program(argv[j], opcode));
+
+            } catch (const std::runtime_error &e) {
+                throw std::runtime_error(std::format("{}: {}", argv[j], e.what()));
+            }
+        }
+
+        // one program for every core, or a program each
+        if (cores && images.size() == 1) {
+            names.resize(cores, names.front());
+            images.resize(cores, images.front());
+
+        } else if (cores && cores != images.size())
+            throw std::runtime_error(std::format("{} programs for {} cores", images.size(), cores));
+
+    } catch (const std::invalid_argument &e) {
+        std::cerr << "error: bad number " << e.what() << std::endl;
+        return EXIT_FAILURE;
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    COP2K::MultiCoreResult r;
+
+    try {
+        r = system.run(opcode, images);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    uint64_t cycles = 0;
+
+    for (size_t j = 0; j < r.cores.size(); j++) {
+        const COP2K::CoreResult &c = r.cores.at(j);
+
+        cycles = std::max(cycles, c.cycles);
+        std::cout << std::format(
+                         "core {}: {}, {} cycles, {} instructions, {} stalled, {} reads, {} writes, "
+                         "{} locks taken, OUT={:02X}{}\n",
+                         j, names.at(j), c.cycles, c.instructions, c.stalled, c.reads, c.writes,
+                         c.locks_taken, c.out,
+                         c.halted ? ", halted" : !c.error.empty() ? ", stopped with " + c.error : ""
+                     );
+    }
+
+    std::cout << std::format(
+                     "bus: {} requests, {} waited, busy {} of {} cycles ({:.1f}%), {} phases\n",
+                     r.requests, r.waited, r.bus_busy, cycles, cycles ? 100.0 * r.bus_busy / cycles : 0.0, r.phases
+                 );
+    std::cout << "shared:";
+
+    for (unsigned j = system.shared_first; j <= system.shared_last; j++)
+        std::cout << std::format("{}{:02X}", (j - system.shared_first) % 16 ? " " : std::format("\n{:02X}: ", j), r.shared.at(j));
+
+    std::cout << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,342 @@
+#ifndef MULTICORE_HPP_INCLUDED
+#define MULTICORE_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libcop2k.hpp"
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    struct CoreResult {
+        uint64_t cycles; // the clock it reached
+        uint64_t instructions;
+        uint64_t stalled; // cycles waiting for the bus or for memory
+        uint64_t reads, writes; // of shared memory
+        uint64_t locks_taken; // reads of a lock byte that found it free
+        uint8_t out;
+        bool halted; // jumped to itself from the same state, with nothing shared in between
+        std::string error; // COP2K threw
+    };
+
+    struct MultiCoreResult {
+        std::vector<CoreResult> cores;
+        uint64_t requests; // granted on the bus
+        uint64_t waited; // requests that found the bus taken
+        uint64_t bus_busy; // cycles
+        uint64_t phases; // of running in parallel
+        std::array<uint8_t, 256> shared; // memory, where it is shared
+    };
+
+    /* N COP2K cores, each the full datapath of libcop2k with its own
+     * memory, sharing the bytes from shared_first to shared_last through
+     * one bus. IN of a core holds its number
+     *
+     * a clock that reads or writes a shared byte asks for the bus and
+     * waits for it: the bus serves one request for latency cycles, to the
+     * next core in turn from the one served last when several wait, and
+     * the clock runs in the last of them. a read of a lock byte, from
+     * lock_first to lock_last, also sets it to 1 in the same request, so
+     * whoever reads 0 holds the lock until it writes 0
+     *
+     * cores run in parallel host threads for up to quantum cycles past the
+     * slowest, or until they ask for the bus. between two such phases the
+     * requests are granted, in the order of the cycle they were made in,
+     * only once no core still running can make one that would go first.
+     * as only shared memory is common to the cores, the result does not
+     * depend on the quantum nor on the threads, which only trade waiting
+     * at the end of a phase against how often phases end
+     */
+    class MultiCore
+    {
+        public:
+            MultiCoreResult run(const Opcode &opcode, const std::vector<std::string> &images)
+            {
+                MultiCoreResult ret = {};
+
+                if (images.empty())
+                    throw std::invalid_argument("no program to run");
+
+                if (latency < 1)
+                    throw std::invalid_argument("the bus takes at least a cycle");
+
+                cores.clear();
+                bus_free = requests = waited = 0;
+                last_served = images.size() - 1;
+
+                for (unsigned i = 0; i < images.size(); i++) {
+                    if (images.at(i).size() != 256)
+                        throw std::invalid_argument("memory image must be 256 bytes");
+
+                    Core &core = *cores.emplace_back(std::make_unique<Core>());
+
+                    core.machine = std::make_unique<COP2K>([](COP2K &, COP2KCallbackType) {});
+                    core.machine->load_instruction(opcode);
+                    core.machine->clear_em();
+
+                    for (unsigned j = 0; j < 256; j++)
+                        core.machine->set_em_data(j, images.at(i).at(j));
+
+                    core.machine->running_manually.neg();
+                    core.machine->manual_dbus.neg();
+                    core.machine->in.set(i);
+                }
+
+                // as the first program leaves it
+                for (unsigned i = 0; i < 256; i++)
+                    shared.at(i) = images.at(0).at(i);
+
+                unsigned workers = std::max(1u, std::min<unsigned>(threads, cores.size()));
+                std::atomic<size_t> next(0);
+                uint64_t horizon = 0;
+                bool done = false;
+                std::barrier phase(workers);
+                std::vector<std::thread> pool;
+
+                // the first thread also grants requests between phases
+                auto worker = [&](unsigned index) {
+                    while (true) {
+                        if (!index) {
+                            grant();
+                            horizon = start_phase(done);
+                            next = 0;
+                            ret.phases += !done;
+                        }
+
+                        phase.arrive_and_wait();
+
+                        if (done)
+                            return;
+
+                        for (size_t i; (i = next++) < cores.size();)
+                            run_core(*cores.at(i), horizon);
+
+                        phase.arrive_and_wait();
+                    }
+                };
+
+                for (unsigned i = 1; i < workers; i++)
+                    pool.emplace_back(worker, i);
+
+                worker(0);
+
+                for (std::thread &i : pool)
+                    i.join();
+
+                for (const std::unique_ptr<Core> &i : cores) {
+                    i->result.cycles = i->time;
+                    i->result.out = i->machine->out.get();
+                    ret.cores.push_back(i->result);
+                }
+
+                ret.requests = requests;
+                ret.waited = waited;
+                ret.bus_busy = requests * latency;
+                ret.shared = shared;
+                return ret;
+            }
+
+            uint8_t shared_first = 0xC0, shared_last = 0xFF;
+            uint8_t lock_first = 0xFC, lock_last = 0xFF; // none when first is past last
+            unsigned latency = 1; // cycles a request holds the bus
+            uint64_t quantum = 1000;
+            unsigned threads = 1;
+            uint64_t max_cycles = 1000000; // per core
+
+        private:
+            enum class CoreStatus {
+                RUNNING,
+                WAITING, // for the bus, at the clock it asked in
+                STOPPED
+            };
+
+            struct Core {
+                std::unique_ptr<COP2K> machine;
+                uint64_t time = 0; // of the next clock
+                CoreStatus status = CoreStatus::RUNNING;
+                COP2K::EMAccess access; // while waiting
+                CoreResult result = {};
+
+                // finding a jump to itself
+                int last_fetch = -1;
+                bool shared_since_fetch = false;
+                std::vector<uint8_t> snapshot;
+            };
+
+            bool is_shared(const COP2K::EMAccess &access) const
+            {
+                return (access.read || access.write) && access.addr >= shared_first && access.addr <= shared_last;
+            }
+
+            // up to horizon, or a clock that needs the bus
+            void run_core(Core &core, uint64_t horizon)
+            {
+                while (core.status == CoreStatus::RUNNING && core.time < horizon) {
+                    COP2K::EMAccess access = core.machine->next_em_access();
+
+                    if (is_shared(access)) {
+                        core.access = access;
+                        core.status = CoreStatus::WAITING;
+                        return;
+                    }
+
+                    clock(core, access);
+                }
+            }
+
+            void clock(Core &core, const COP2K::EMAccess &access)
+            {
+                try {
+                    core.machine->run_clock();
+
+                } catch (const std::exception &e) {
+                    core.result.error = e.what();
+                    core.status = CoreStatus::STOPPED;
+                    return;
+                }
+
+                core.time++;
+
+                if (!core.machine->iren.get()) {
+                    core.result.instructions++;
+
+                    if (access.addr == core.last_fetch && !core.shared_since_fetch)
+                        check_halted(core);
+
+                    else
+                        core.snapshot.clear();
+
+                    core.last_fetch = access.addr;
+                    core.shared_since_fetch = false;
+                }
+
+                if (core.time >= max_cycles && core.status == CoreStatus::RUNNING)
+                    core.status = CoreStatus::STOPPED;
+            }
+
+            /* run the same instruction twice in a row from the same state,
+             * with nothing shared in between, a core does so for ever
+             */
+            void check_halted(Core &core)
+            {
+                const COP2K &m = *core.machine;
+                std::vector<uint8_t> now = {
+                    m.a.get(), m.w.get(), m.r0.get(), m.r1.get(), m.r2.get(), m.r3.get(), m.pc.get(),
+                    m.st.get(), m.mar.get(), m.out.get(), m.ia.get(), m.ir.get(), m.upc.get(),
+                    static_cast<uint8_t>(m.get_cy() << 1 | m.get_z())
+                };
+
+                for (unsigned i = 0; i < 256; i++)
+                    now.push_back(m.get_em_data(i));
+
+                if (now == core.snapshot) {
+                    core.result.halted = true;
+                    core.status = CoreStatus::STOPPED;
+                }
+
+                core.snapshot = std::move(now);
+            }
+
+            // the horizon of the next phase, done when no core is left to run
+            uint64_t start_phase(bool &done) const
+            {
+                uint64_t slowest = std::numeric_limits<uint64_t>::max();
+
+                for (const std::unique_ptr<Core> &i : cores)
+                    if (i->status == CoreStatus::RUNNING)
+                        slowest = std::min(slowest, i->time);
+
+                done = slowest == std::numeric_limits<uint64_t>::max();
+                return done ? 0 : std::min(slowest + quantum, max_cycles);
+            }
+
+            // every request whose turn is known
+            void grant()
+            {
+                while (true) {
+                    uint64_t earliest = std::numeric_limits<uint64_t>::max();
+                    uint64_t running = std::numeric_limits<uint64_t>::max();
+
+                    for (const std::unique_ptr<Core> &i : cores)
+                        if (i->status == CoreStatus::WAITING)
+                            earliest = std::min(earliest, i->time);
+
+                        else if (i->status == CoreStatus::RUNNING)
+                            running = std::min(running, i->time);
+
+                    if (earliest == std::numeric_limits<uint64_t>::max())
+                        return;
+
+                    // a core still running may yet ask at or before the bus is next free
+                    uint64_t at = std::max(earliest, bus_free);
+
+                    if (running <= at)
+                        return;
+
+                    for (size_t i = 1; i <= cores.size(); i++) {
+                        size_t index = (last_served + i) % cores.size();
+                        Core &core = *cores.at(index);
+
+                        if (core.status == CoreStatus::WAITING && core.time <= at) {
+                            serve(core, at);
+                            last_served = index;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // the clock of core runs in the last cycle of the request
+            void serve(Core &core, uint64_t at)
+            {
+                const COP2K::EMAccess &access = core.access;
+                uint8_t addr = access.addr;
+                bool lock = addr >= lock_first && addr <= lock_last;
+
+                requests++;
+                waited += at > core.time;
+                core.result.stalled += at + latency - 1 - core.time;
+                core.time = at + latency - 1;
+                bus_free = at + latency;
+
+                core.shared_since_fetch = true;
+
+                if (access.read) {
+                    core.machine->set_em_data(addr, shared.at(addr));
+                    core.result.reads++;
+
+                    if (lock) {
+                        core.result.locks_taken += !shared.at(addr);
+                        shared.at(addr) = 1;
+                    }
+                }
+
+                core.status = CoreStatus::RUNNING;
+                clock(core, access);
+
+                if (access.write && core.result.error.empty()) {
+                    shared.at(addr) = core.machine->get_em_data(addr);
+                    core.result.writes++;
+                }
+            }
+
+            std::vector<std::unique_ptr<Core>> cores;
+            std::array<uint8_t, 256> shared;
+            uint64_t bus_free; // the first cycle the bus is not serving a request
+            size_t last_served; // wins a tie last
+            uint64_t requests, waited;
+    };
+}
+
+#endif // MULTICORE_HPP_INCLUDED
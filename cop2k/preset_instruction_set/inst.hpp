@@ -0,0 +1,54 @@
+// generated by isa_compiler --header from inst.txt, do not edit
+#ifndef PRESET_INST_HPP_INCLUDED
+#define PRESET_INST_HPP_INCLUDED
+
+#include <array>
+#include <cstdint>
+
+namespace COP2K
+{
+    struct PresetInst {
+        static constexpr std::array<uint32_t, 256> MICRO_PROGRAM = {
+            0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+            0x7FF7EF, 0x7FFE90, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE90, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE90, 0x4BFFFF, 0x47FFEF, 0x7FFE90, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7EF, 0x7FFE94, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE94, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE94, 0x4BFFFF, 0x47FFEF, 0x7FFE94, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7EF, 0x7FFE91, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE91, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE91, 0x4BFFFF, 0x47FFEF, 0x7FFE91, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7EF, 0x7FFE95, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE95, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE95, 0x4BFFFF, 0x47FFEF, 0x7FFE95, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7EF, 0x7FFE93, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE93, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE93, 0x4BFFFF, 0x47FFEF, 0x7FFE93, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7EF, 0x7FFE92, 0x4BFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFEF, 0x7FFE92, 0x4BFFFF,
+            0x477FFF, 0x57BFEF, 0x7FFE92, 0x4BFFFF, 0x47FFEF, 0x7FFE92, 0x4BFFFF, 0x7FFFFF,
+            0x7FF7F7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7F77FF, 0x57BFF7, 0x4BFFFF, 0x7FFFFF,
+            0x477FFF, 0x57BFF7, 0x4BFFFF, 0x7FFFFF, 0x47FFF7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0x7FFB9F, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7F77FF, 0x37BF9F, 0x4BFFFF, 0x7FFFFF,
+            0x477FFF, 0x37BF9F, 0x4BFFFF, 0x7FFFFF, 0x47FBFF, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0x477FFF, 0x7F7FEE, 0x4BFFFF, 0x7FFFFF, 0x477FFF, 0x7F9F9F, 0x4BFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+            0x46FFFF, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x46FFFF, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0x46FFFF, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+            0x7FEF7F, 0x7EFF3F, 0x4BFFFF, 0x7FFFFF, 0x6F7F7F, 0x7FEF7F, 0x56BFFF, 0x4BFFFF,
+            0x7FFF17, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FDF9F, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0x7EFF5F, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0x7FFCB7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFCD7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0x7FFEB7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFED7, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0x4BFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFE96, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0x7CFF5F, 0x4BFFFF, 0x7FFFFF, 0x7FFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+            0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
+        };
+        static constexpr std::array<uint64_t, 4> SAFE = {
+            0xFFFFFFFFFFFF000F,
+            0xFFFFFFFFFFFFFFFF,
+            0xFF00F0FF00FFFFFF,
+            0x0000F0FFFFFFF0FF,
+        };
+    };
+}
+
+#endif // PRESET_INST_HPP_INCLUDED
@@ -0,0 +1,201 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "libcop2k.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "debug_info.hpp"
+#include "profiler.hpp"
+
+static std::atomic<bool> stop(false);
+
+static void print_usage()
+{
+    std::cerr << "usage: prof record <instr.txt> <file.bin> [-i <interval>] [-r] [-c <clocks>] [-o <out.samples>]"
+              << std::endl;
+    std::cerr << "       prof fold <instr.txt> <file.samples> -g <file.dbg> [-o <out.folded>]" << std::endl;
+}
+
+static int record(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    COP2K::COP2K machine([](COP2K::COP2K &, COP2K::COP2KCallbackType) {});
+    const char *out_path = nullptr;
+    unsigned long interval = 1000;
+    uint64_t clocks = std::numeric_limits<uint64_t>::max();
+    bool random = false;
+
+    if (argc < 4) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 4; i < argc; i++) {
+        if (!strcmp(argv[i], "-r"))
+            random = true;
+
+        else if (i + 1 >= argc) {
+            print_usage();
+            return EXIT_FAILURE;
+
+        } else if (!strcmp(argv[i], "-i") && strtoul(argv[i + 1], nullptr, 0))
+            interval = strtoul(argv[++i], nullptr, 0);
+
+        else if (!strcmp(argv[i], "-c") && strtoull(argv[i + 1], nullptr, 0))
+            clocks = strtoull(argv[++i], nullptr, 0);
+
+        else if (!strcmp(argv[i], "-o"))
+            out_path = argv[++i];
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[2], opcode);
+        machine.load_instruction(opcode);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string image;
+
+    try {
+        image = COP2K::read_image(argv[3]);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << std::format("error: {}: {}", argv[3], e.what()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned i = 0; i < 256; i++)
+        machine.set_em_data(i, image.at(i));
+
+    machine.running_manually.neg();
+    machine.manual_dbus.neg();
+
+    // the samples so far are kept when interrupted
+    signal(SIGINT, [](int) {
+        stop = true;
+    });
+
+    COP2K::Profiler profiler(machine, interval, random);
+    auto start = std::chrono::steady_clock::now();
+    int ret = EXIT_SUCCESS;
+
+    try {
+        profiler.run(clocks, &stop);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        ret = EXIT_FAILURE;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << std::format(
+                  "{} clocks in {:.3f} s, {:.0f} clocks/s\n",
+                  profiler.get_clocks(), elapsed.count(), profiler.get_clocks() / elapsed.count()
+              );
+
+    std::ofstream ofs;
+
+    if (out_path) {
+        ofs.open(out_path);
+
+        if (!ofs)
+            return EXIT_FAILURE;
+    }
+
+    profiler.save(out_path ? ofs : std::cout);
+    return ret;
+}
+
+static int fold(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    const char *out_path = nullptr, *debug_path = nullptr;
+
+    if (argc < 4) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 4; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return EXIT_FAILURE;
+
+        } else if (!strcmp(argv[i], "-g"))
+            debug_path = argv[i + 1];
+
+        else if (!strcmp(argv[i], "-o"))
+            out_path = argv[i + 1];
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!debug_path) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    std::map<std::string, uint64_t> stacks;
+
+    try {
+        std::ifstream samples(argv[3]);
+
+        if (!samples)
+            throw std::runtime_error(std::format("failed to open {}", argv[3]));
+
+        COP2K::load_instruction_set(argv[2], opcode);
+        COP2K::DebugInfo debug(debug_path);
+        stacks = COP2K::fold_samples(COP2K::Profiler::load(samples), opcode, debug);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream ofs;
+
+    if (out_path) {
+        ofs.open(out_path);
+
+        if (!ofs)
+            return EXIT_FAILURE;
+    }
+
+    std::ostream &out = out_path ? ofs : std::cout;
+
+    for (const auto &[stack, count] : stacks)
+        out << stack << " " << count << "\n";
+
+    return out ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "record"))
+        return record(argc, argv);
+
+    if (argc >= 2 && !strcmp(argv[1], "fold"))
+        return fold(argc, argv);
+
+    print_usage();
+    return EXIT_FAILURE;
+}
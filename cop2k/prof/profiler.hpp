@@ -0,0 +1,303 @@
+#ifndef PROFILER_HPP_INCLUDED
+#define PROFILER_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "libcop2k.hpp"
+#include "libopcode.hpp"
+#include "debug_info.hpp"
+
+namespace COP2K
+{
+    /* samples PC, uPC and IR of a running COP2K every interval clocks,
+     * or at random intervals of the same mean so loops of that period do
+     * not alias, with the address IR was fetched from
+     *
+     * between samples the machine runs in a loop that does nothing but
+     * count, so a run is as fast as run_forever(): a clock is only some 40
+     * ns, and even checking IREN every clock would cost more than 1%. only
+     * the last FETCH_WINDOW clocks before a sample watch for a fetch, which
+     * is enough for an instruction of up to 4 steps. samples go into a
+     * fixed ring, which is only folded into counts when full or when
+     * asked for them
+     */
+    class Profiler
+    {
+        public:
+            struct Sample {
+                uint8_t pc, upc, ir, fetch;
+            };
+
+            static constexpr size_t RING_SIZE = 4096;
+            static constexpr unsigned FETCH_WINDOW = 4;
+
+            Profiler(COP2K &machine, unsigned interval, bool random) :
+                machine(machine), interval(interval ? interval : 1), random(random)
+            {
+                countdown = next_interval();
+            }
+
+            /* runs until clocks have run or stop is set, which is checked at
+             * every sample. returns the clocks run, which are counted in
+             * get_clocks() even when run_clock() throws
+             */
+            uint64_t run(uint64_t clocks, const std::atomic<bool> *stop = nullptr)
+            {
+                uint64_t ran = 0;
+                unsigned n = 0, left = 0;
+
+                try {
+                    while (ran < clocks) {
+                        n = std::min<uint64_t>(countdown, clocks - ran);
+                        left = n;
+
+                        for (; left && countdown - (n - left) > FETCH_WINDOW; left--)
+                            machine.run_clock();
+
+                        for (; left; left--) {
+                            COP2K::EMAccess access = machine.next_em_access();
+
+                            machine.run_clock();
+
+                            if (!machine.iren.get())
+                                fetch = access.addr;
+                        }
+
+                        ran += n;
+                        countdown -= n;
+
+                        if (countdown)
+                            break;
+
+                        ring.at(ring_used++) = { machine.pc.get(), machine.upc.get(), machine.ir.get(), fetch };
+                        countdown = next_interval();
+
+                        if (ring_used == RING_SIZE)
+                            drain();
+
+                        if (stop && stop->load(std::memory_order_relaxed))
+                            break;
+                    }
+
+                } catch (...) {
+                    total_clocks += ran + n - left;
+                    throw;
+                }
+
+                total_clocks += ran;
+                return ran;
+            }
+
+            // sample counts by fetch, pc, upc and ir, from the highest byte
+            const std::map<uint32_t, uint64_t> &get_counts()
+            {
+                drain();
+                return counts;
+            }
+
+            uint64_t get_clocks() const
+            {
+                return total_clocks;
+            }
+
+            /*     COP2K samples 2
+             *     interval <clocks> <fixed|random>
+             *     clocks <clocks run>
+             *     <pc> <upc> <ir> <fetch> <count>       all hex but count
+             */
+            void save(std::ostream &out)
+            {
+                out << "COP2K samples 2\n";
+                out << std::format("interval {} {}\n", interval, random ? "random" : "fixed");
+                out << std::format("clocks {}\n", total_clocks);
+
+                for (const auto &[key, count] : get_counts())
+                    out << std::format(
+                            "{:02X} {:02X} {:02X} {:02X} {}\n",
+                            key >> 16 & 0xff, key >> 8 & 0xff, key & 0xff, key >> 24, count
+                        );
+            }
+
+            static uint32_t make_key(const Sample &s)
+            {
+                return static_cast<uint32_t>(s.fetch) << 24 | s.pc << 16 | s.upc << 8 | s.ir;
+            }
+
+            static Sample from_key(uint32_t key)
+            {
+                return {
+                    static_cast<uint8_t>(key >> 16), static_cast<uint8_t>(key >> 8),
+                    static_cast<uint8_t>(key), static_cast<uint8_t>(key >> 24)
+                };
+            }
+
+            // counts of a file written by save()
+            static std::map<uint32_t, uint64_t> load(std::istream &in)
+            {
+                std::map<uint32_t, uint64_t> ret;
+                std::string line;
+                unsigned lineno = 3;
+
+                if (!std::getline(in, line) || line != "COP2K samples 2")
+                    throw std::runtime_error("not a samples file");
+
+                // the header lines are only for whoever reads the file
+                std::getline(in, line);
+                std::getline(in, line);
+
+                while (std::getline(in, line)) {
+                    std::istringstream iss(line);
+                    unsigned pc, upc, ir, fetch;
+                    uint64_t count;
+
+                    lineno++;
+
+                    if (line.empty())
+                        continue;
+
+                    if (
+                        !(iss >> std::hex >> pc >> upc >> ir >> fetch >> std::dec >> count) ||
+                        pc > 0xff || upc > 0xff || ir > 0xff || fetch > 0xff
+                    )
+                        throw std::runtime_error(std::format("line {}: bad sample", lineno));
+
+                    ret[make_key({
+                        static_cast<uint8_t>(pc), static_cast<uint8_t>(upc),
+                        static_cast<uint8_t>(ir), static_cast<uint8_t>(fetch)
+                    })] += count;
+                }
+
+                return ret;
+            }
+
+        private:
+            unsigned next_interval()
+            {
+                if (!random)
+                    return interval;
+
+                // xorshift32, uniform in [1, 2 * interval - 1]
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                return interval == 1 ? 1 : 1 + seed % (2 * interval - 1);
+            }
+
+            void drain()
+            {
+                for (size_t i = 0; i < ring_used; i++)
+                    counts[make_key(ring.at(i))]++;
+
+                ring_used = 0;
+            }
+
+            COP2K &machine;
+            unsigned interval;
+            bool random;
+            unsigned countdown;
+            uint8_t fetch = 0;
+            uint32_t seed = 2463534242u;
+            uint64_t total_clocks = 0;
+
+            std::array<Sample, RING_SIZE> ring;
+            size_t ring_used = 0;
+            std::map<uint32_t, uint64_t> counts;
+    };
+
+    /* the address of the instruction in IR when a sample was taken, -1 if
+     * it cannot be told: the fetch is only watched for so many clocks
+     * before a sample, so an instruction that runs into the next slot is
+     * lost, and so is one the image does not have there
+     */
+    inline int find_sample_addr(const Profiler::Sample &s, const Opcode &opcode, const DebugInfoView &debug)
+    {
+        const Opcode::Instruction *ins = opcode.find_from_byte(s.ir & ~0x3);
+        std::string_view image = debug.image();
+        unsigned steps = s.upc - (s.ir & ~0x3);
+
+        if (!ins || steps >= Profiler::FETCH_WINDOW)
+            return -1;
+
+        if (!debug.is_instruction(s.fetch) || (static_cast<uint8_t>(image.at(s.fetch)) & ~0x3) != (s.ir & ~0x3))
+            return -1;
+
+        return s.fetch;
+    }
+
+    /* folded stacks for flame graphs, one line per stack:
+     *
+     *     <label>;<line>: <source>;<instruction> step <n> <count>
+     *
+     * where label is the last one at or before the instruction, and the
+     * step is the next one to run. samples in the interrupt slot, or
+     * outside the source, get the address alone
+     */
+    inline std::map<std::string, uint64_t> fold_samples(
+        const std::map<uint32_t, uint64_t> &counts,
+        const Opcode &opcode,
+        const DebugInfoView &debug
+    )
+    {
+        std::map<std::string, uint64_t> ret;
+        std::array<std::string, 256> labels;
+
+        for (size_t i = 0; i < debug.get_symbol_count(); i++) {
+            DebugInfoSymbol s = debug.get_symbol(i);
+
+            if (s.kind == SYMBOL_LABEL)
+                labels.at(s.value) = debug.get_symbol_name(i);
+        }
+
+        for (unsigned i = 1; i < 256; i++)
+            if (labels.at(i).empty())
+                labels.at(i) = labels.at(i - 1);
+
+        for (const auto &[key, count] : counts) {
+            Profiler::Sample s = Profiler::from_key(key);
+            const Opcode::Instruction *ins = opcode.find_from_byte(s.ir & ~0x3);
+            int addr = find_sample_addr(s, opcode, debug);
+            unsigned line = addr < 0 ? 0 : debug.get_line(addr);
+            std::string where, step;
+
+            step = std::format(
+                       "{} step {}", ins ? ins->mnemonic : std::format("0{:02X}H", s.ir), s.upc & 0x3
+                   );
+
+            if ((s.ir & ~0x3) == 0xB8)
+                where = "_INT_";
+
+            else if (!line)
+                where = addr < 0 ? "_unknown_" : std::format("0{:02X}H", addr);
+
+            else {
+                std::string text(debug.get_line_text(line));
+
+                // no comments, and nothing that breaks a frame
+                text = text.substr(0, text.find(';'));
+                text.erase(0, text.find_first_not_of(" \t"));
+                text.erase(text.find_last_not_of(" \t\r\n") + 1);
+
+                where = std::format(
+                            "{};{}: {}", labels.at(addr).empty() ? "_start_" : labels.at(addr), line, text
+                        );
+            }
+
+            ret[where + ";" + step] += count;
+        }
+
+        return ret;
+    }
+}
+
+#endif // PROFILER_HPP_INCLUDED
@@ -0,0 +1,288 @@
+#ifndef COMMIT_LOG_HPP_INCLUDED
+#define COMMIT_LOG_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <format>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "libcop2k.hpp"
+#include "dis/dis.hpp"
+
+namespace COP2K
+{
+    /* one line per executed instruction: the clock it started at, its
+     * address, its text, and the registers and memory it changed. PC
+     * is left out as it always changes
+     *
+     * the machine thread only copies raw values into records, which are
+     * handed over in batches to a thread that formats and writes them.
+     * that thread keeps the text of every address it has formatted, and
+     * drops it when the record shows the byte, or the operand after it,
+     * was written, so self-modifying code is shown as it ran
+     */
+    class CommitLog
+    {
+        public:
+            enum CommitLogRegister : unsigned char {
+                REG_A,
+                REG_W,
+                REG_R0,
+                REG_R1,
+                REG_R2,
+                REG_R3,
+                REG_ST,
+                REG_MAR,
+                REG_OUT,
+                REG_CY,
+                REG_Z,
+                REG_COUNT
+            };
+
+            struct Record {
+                uint64_t cycle; // clocks before the instruction
+                unsigned char addr; // of the instruction
+                unsigned char byte, operand_byte;
+                bool interrupt; // _INT_ entered by hardware
+                std::array<unsigned char, REG_COUNT> regs; // afterwards
+                std::bitset<REG_COUNT> changed;
+                std::array<std::pair<unsigned char, unsigned char>, 4> writes; // address and value
+                unsigned char write_count;
+            };
+
+            // dis must have its table built, both must outlive the log
+            CommitLog(COP2K &machine, const DIS &dis, std::ostream &out) :
+                machine(machine),
+                dis(dis),
+                out(out),
+                formatter([this]() {
+                format_records();
+            })
+            {
+                batch.reserve(BATCH_SIZE);
+            }
+
+            ~CommitLog()
+            {
+                flush();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    quit = true;
+                }
+
+                ready.notify_one();
+                formatter.join();
+            }
+
+            /* runs the machine to the end of the next instruction. _FATCH_
+             * after reset runs too but is not logged
+             */
+            Record step()
+            {
+                Record r = {};
+                std::array<unsigned char, REG_COUNT> before;
+
+                // reset fetches the first instruction with _FATCH_
+                if (!fetched)
+                    run_to_fetch(r);
+
+                r.cycle = cycle;
+                r.addr = next_addr;
+                r.interrupt = next_interrupt;
+                r.byte = machine.ir.get();
+                r.operand_byte = machine.get_em_data(next_addr + 1);
+                r.write_count = 0;
+                before = read_regs();
+
+                run_to_fetch(r);
+                r.regs = read_regs();
+
+                for (unsigned i = 0; i < REG_COUNT; i++)
+                    r.changed.set(i, r.regs.at(i) != before.at(i));
+
+                batch.push_back(r);
+
+                if (batch.size() == BATCH_SIZE)
+                    hand_over();
+
+                return r;
+            }
+
+            // hands the records so far to the formatter, and waits until they are written
+            void flush()
+            {
+                hand_over();
+
+                std::unique_lock<std::mutex> lock(mutex);
+
+                done.wait(lock, [this]() {
+                    return queue.empty() && !formatting;
+                });
+                out.flush();
+            }
+
+            unsigned char get_next_addr() const
+            {
+                return next_addr;
+            }
+
+            uint64_t get_cycle() const
+            {
+                return cycle;
+            }
+
+            static constexpr const char *register_names[REG_COUNT] = {
+                "A", "W", "R0", "R1", "R2", "R3", "ST", "MAR", "OUT", "CY", "Z"
+            };
+
+        private:
+            static constexpr size_t BATCH_SIZE = 4096;
+
+            /* double buffered: the batch is swapped in while the formatter
+             * works on the one before, and only waits for it to take that
+             */
+            void hand_over()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                done.wait(lock, [this]() {
+                    return queue.empty();
+                });
+                queue.swap(batch);
+                ready.notify_one();
+            }
+
+            std::array<unsigned char, REG_COUNT> read_regs() const
+            {
+                return {
+                    machine.a.get(), machine.w.get(),
+                    machine.r0.get(), machine.r1.get(), machine.r2.get(), machine.r3.get(),
+                    machine.st.get(), machine.mar.get(), machine.out.get(),
+                    machine.get_cy(), machine.get_z()
+                };
+            }
+
+            // runs clocks up to and including the one loading IR
+            void run_to_fetch(Record &r)
+            {
+                // no step of an instruction runs twice before it fetches
+                for (unsigned i = 0; i < 4; i++) {
+                    machine.run_clock();
+                    cycle++;
+
+                    const DBus &dbus = machine.get_dbus();
+
+                    if (
+                        std::find(dbus.get_reader().begin(), dbus.get_reader().end(), DBusReaderType::EM) !=
+                        dbus.get_reader().end() && r.write_count < r.writes.size()
+                    )
+                        r.writes.at(r.write_count++) = { machine.get_abus().get_data(), dbus.get_data() };
+
+                    if (!machine.iren.get()) {
+                        const IBus &ibus = machine.get_ibus();
+
+                        next_interrupt = ibus.get_writer() == IBusWriterType::INTERRUPT;
+                        next_addr = next_interrupt ? 0 : machine.get_abus().get_data();
+                        fetched = true;
+                        return;
+                    }
+                }
+
+                throw std::runtime_error(
+                    std::format("instruction {:02X}H at {:02X}H never fetches the next one", r.byte, r.addr)
+                );
+            }
+
+            void format_records()
+            {
+                std::array<std::string, 256> text;
+                std::bitset<256> cached;
+                std::vector<Record> records;
+
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+
+                        formatting = false;
+                        done.notify_all();
+                        ready.wait(lock, [this]() {
+                            return quit || !queue.empty();
+                        });
+
+                        if (queue.empty())
+                            return;
+
+                        records.swap(queue);
+                        formatting = true;
+                        done.notify_all();
+                    }
+
+                    std::string lines;
+
+                    for (const Record &i : records) {
+                        std::string &t = text.at(i.addr);
+
+                        if (i.interrupt)
+                            lines += std::format("{:>10}  INT  {:<20}", i.cycle, "_INT_");
+
+                        else {
+                            if (!cached.test(i.addr)) {
+                                t = dis.format_instruction(i.byte, i.operand_byte);
+                                cached.set(i.addr);
+                            }
+
+                            lines += std::format("{:>10}  {:02X}H  {:<20}", i.cycle, i.addr, t);
+                        }
+
+                        for (unsigned j = 0; j < REG_COUNT; j++)
+                            if (i.changed.test(j))
+                                lines += std::format(" {}={:02X}", register_names[j], i.regs.at(j));
+
+                        for (unsigned j = 0; j < i.write_count; j++) {
+                            unsigned char addr = i.writes.at(j).first;
+
+                            lines += std::format(" [{:02X}H]={:02X}", addr, i.writes.at(j).second);
+                            cached.reset(addr);
+                            cached.reset(static_cast<unsigned char>(addr - 1));
+                        }
+
+                        // nothing changed
+                        while (lines.back() == ' ')
+                            lines.pop_back();
+
+                        lines += '\n';
+                    }
+
+                    records.clear();
+                    out << lines;
+                }
+            }
+
+            COP2K &machine;
+            const DIS &dis;
+            std::ostream &out;
+            uint64_t cycle = 0;
+            bool fetched = false;
+            unsigned char next_addr = 0;
+            bool next_interrupt = false;
+            std::vector<Record> batch;
+
+            // shared with the formatter
+            std::mutex mutex;
+            std::condition_variable ready, done;
+            std::vector<Record> queue;
+            bool formatting = false, quit = false;
+            std::thread formatter;
+    };
+}
+
+#endif // COMMIT_LOG_HPP_INCLUDED
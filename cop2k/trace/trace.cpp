@@ -0,0 +1,100 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "libcop2k.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "dis/dis.hpp"
+#include "commit_log.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: trace <instr.txt> <file.bin> [-n <instructions>] [-o <out.log>]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::DIS dis;
+    COP2K::COP2K machine([](COP2K::COP2K &, COP2K::COP2KCallbackType) {});
+    const char *out_path = nullptr;
+    unsigned long limit = 100000;
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 3; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return EXIT_FAILURE;
+
+        } else if (!strcmp(argv[i], "-n"))
+            limit = strtoul(argv[i + 1], nullptr, 0);
+
+        else if (!strcmp(argv[i], "-o"))
+            out_path = argv[i + 1];
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[1], dis.opcode);
+        dis.build_table();
+        machine.load_instruction(dis.opcode);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string image;
+
+    try {
+        image = COP2K::read_image(argv[2]);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << std::format("error: {}: {}", argv[2], e.what()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned i = 0; i < 256; i++)
+        machine.set_em_data(i, image.at(i));
+
+    machine.running_manually.neg();
+    machine.manual_dbus.neg();
+
+    std::ofstream ofs;
+
+    if (out_path) {
+        ofs.open(out_path);
+
+        if (!ofs)
+            return EXIT_FAILURE;
+    }
+
+    try {
+        COP2K::CommitLog log(machine, dis, out_path ? ofs : std::cout);
+
+        for (unsigned long i = 0; i < limit; i++) {
+            COP2K::CommitLog::Record r = log.step();
+
+            // a jump to itself halts
+            if (
+                !r.interrupt && log.get_next_addr() == r.addr &&
+                dis.decode(r.byte).flow == COP2K::InstructionFlow::JUMP
+            )
+                break;
+        }
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
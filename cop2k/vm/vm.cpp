@@ -1 +1,122 @@
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+
+#include "libopcode.hpp"
+#include "isa_image.hpp"
+#include "engine/program.hpp"
 #include "vm.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: vm [-b <banks>] [-m <max clocks>] [-i <in>] [-s] <instr.txt> <file.asm|file.bin>" << std::endl
+              << "       <banks> is 1, 2, 4, 8 or 16, by default as many as the image holds" << std::endl;
+}
+
+template <unsigned BANKS>
+static int run(const COP2K::Opcode &opcode, const std::string &image, uint8_t in, uint64_t max, bool whole_state)
+{
+    COP2K::VM<COP2K::BankedMemory<BANKS>> vm;
+    COP2K::VMResult r;
+
+    try {
+        r = vm.run(opcode, image, in, max);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (whole_state)
+        std::cout << vm.machine.to_string();
+
+    std::cout << std::format(
+                     "{} clocks, {} instructions, OUT={:02X}{}\n",
+                     r.clocks, r.instructions, vm.machine.out.get(), r.halted ? ", halted" : ""
+                 );
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    std::string image;
+    unsigned long banks = 0, max = 1000000, in = 0;
+    bool whole_state = false;
+    int i = 1;
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for (; i + 2 < argc && argv[i][0] == '-'; i += 2) {
+        unsigned long n = strtoul(argv[i + 1], nullptr, 0);
+
+        if (!strcmp(argv[i], "-s")) {
+            whole_state = true;
+            i--;
+
+        } else if (!strcmp(argv[i], "-b") && n && std::has_single_bit(n))
+            banks = n;
+
+        else if (!strcmp(argv[i], "-m") && n)
+            max = n;
+
+        else if (!strcmp(argv[i], "-i") && n <= 0xff)
+            in = n;
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (i + 2 != argc) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[i], opcode);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        image = COP2K::load_program(argv[i + 1], opcode, true);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << std::format("error: {}: {}", argv[i + 1], e.what()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the fewest the image fits in
+    if (!banks)
+        banks = std::bit_ceil((image.size() - 0x80) / 0x80);
+
+    switch (banks) {
+        case 1:
+            return run<1>(opcode, image, in, max, whole_state);
+
+        case 2:
+            return run<2>(opcode, image, in, max, whole_state);
+
+        case 4:
+            return run<4>(opcode, image, in, max, whole_state);
+
+        case 8:
+            return run<8>(opcode, image, in, max, whole_state);
+
+        case 16:
+            return run<16>(opcode, image, in, max, whole_state);
+    }
+
+    std::cerr << "error: at most 16 banks" << std::endl;
+    return EXIT_FAILURE;
+}
@@ -1,15 +1,76 @@
 #ifndef VM_HPP_INCLUDED
 #define VM_HPP_INCLUDED
 
-namespace COP2K {
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
 
-class VM
+#include "libcop2k.hpp"
+#include "libopcode.hpp"
+
+namespace COP2K
 {
-    public:
+    struct VMResult {
+        uint64_t clocks;
+        uint64_t instructions;
+        bool halted; // jumped to itself
+    };
+
+    /* a memory image run at full speed on the datapath of libcop2k with
+     * EM as its memory, so a banked image needs a machine of as many
+     * banks or more. the default memory costs nothing over COP2K
+     */
+    template <typename EM = Memory>
+    class VM
+    {
+        public:
+            VM() : machine([](BasicCOP2K<EM> &, COP2KCallbackType) {}) {}
+
+            // up to a jump to itself or max clocks
+            VMResult run(const Opcode &opcode, const std::string &image, uint8_t in, uint64_t max)
+            {
+                VMResult ret = {};
+                int last_fetch = -1;
+
+                if (image.size() < 256 || image.size() > EM::SIZE || image.size() % 0x80)
+                    throw std::invalid_argument(std::format("memory image must be 256 to {} bytes, by 128", EM::SIZE));
+
+                machine.load_instruction(opcode);
+                machine.clear_em();
+
+                for (unsigned i = 0; i < image.size(); i++)
+                    machine.set_em_data(i, image.at(i));
+
+                machine.running_manually.neg();
+                machine.manual_dbus.neg();
+                machine.in.set(in);
+
+                while (ret.clocks < max) {
+                    typename BasicCOP2K<EM>::EMAccess access = machine.next_em_access();
+
+                    machine.run_clock();
+                    ret.clocks++;
+
+                    // IR was loaded, from where the instruction was fetched
+                    if (machine.iren.get())
+                        continue;
+
+                    ret.instructions++;
+
+                    if (access.addr == last_fetch) {
+                        ret.halted = true;
+                        break;
+                    }
+
+                    last_fetch = access.addr;
+                }
 
-    private:
-};
+                return ret;
+            }
 
-} // namespace COP2K
+            BasicCOP2K<EM> machine;
+    };
+}
 
 #endif // VM_HPP_INCLUDED
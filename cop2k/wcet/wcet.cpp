@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "isa_image.hpp"
+#include "engine/program.hpp"
+#include "debug_info.hpp"
+#include "wcet.hpp"
+
+static void print_usage()
+{
+    std::cerr << "usage: wcet <instr.txt> <file.bin> [-g <file.dbg>] [-b <loop>=<bound>]..." << std::endl
+              << "       <loop> is the address of a loop header, e.g. 04H, or a label with -g"
+              << std::endl;
+}
+
+// an address like 04H, or a label from the debug information
+static unsigned char parse_addr(const std::string &s, const COP2K::DebugInfoView *debug_info)
+{
+    COP2K::DebugInfoSymbol symbol;
+    std::string name = s;
+
+    // the assembler ignores case of labels
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    if (debug_info && debug_info->find_symbol(name, symbol))
+        return symbol.value;
+
+    return COP2K::parse_addr(s);
+}
+
+static std::string addr_name(unsigned char addr, const COP2K::DebugInfoView *debug_info)
+{
+    if (debug_info)
+        for (size_t i = 0; i < debug_info->get_symbol_count(); i++) {
+            COP2K::DebugInfoSymbol s = debug_info->get_symbol(i);
+
+            if (s.kind == COP2K::SYMBOL_LABEL && s.value == addr)
+                return std::format("{:02X}H ({})", addr, debug_info->get_symbol_name(i));
+        }
+
+    return std::format("{:02X}H", addr);
+}
+
+int main(int argc, char **argv)
+{
+    COP2K::Opcode opcode;
+    std::unique_ptr<COP2K::DebugInfo> debug_info;
+    std::vector<std::string> bound_args;
+
+    if (argc < 3 || !strcmp(argv[1], "--help")) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 3; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        if (!strcmp(argv[i], "-b"))
+            bound_args.push_back(argv[i + 1]);
+
+        else if (!strcmp(argv[i], "-g")) {
+            try {
+                debug_info = std::make_unique<COP2K::DebugInfo>(argv[i + 1]);
+
+            } catch (const std::runtime_error &e) {
+                std::cerr << "error: " << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        COP2K::load_instruction_set(argv[1], opcode);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string image;
+
+    try {
+        image = COP2K::read_image(argv[2]);
+
+    } catch (const std::runtime_error &e) {
+        std::cerr << std::format("error: {}: {}", argv[2], e.what()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    COP2K::WCET wcet(opcode);
+    unsigned total;
+
+    try {
+        for (const std::string &i : bound_args) {
+            size_t eq = i.find('=');
+
+            if (eq == std::string::npos)
+                throw std::runtime_error(std::format("bad loop bound {}", i));
+
+            wcet.bounds[parse_addr(i.substr(0, eq), debug_info.get())] = std::stoul(i.substr(eq + 1));
+        }
+
+        total = wcet.analyze(image);
+
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (const auto &[entry, f] : wcet.get_functions()) {
+        std::cout << "function " << addr_name(entry, debug_info.get()) << std::endl;
+
+        for (const auto &[addr, b] : f.blocks)
+            std::cout << std::format("  block {:02X}H-{:02X}H {:>8}", addr, b.last, b.cycles) << std::endl;
+
+        for (const COP2K::WCET::Loop &l : f.loops)
+            std::cout << "  loop " << addr_name(l.header, debug_info.get())
+                      << std::format(" {} x {} = {}", l.bound, l.iteration_cycles, l.cycles)
+                      << std::endl;
+
+        std::cout << "  worst case " << f.cycles << std::endl;
+    }
+
+    std::cout << "wcet: " << total << " clocks" << std::endl;
+}
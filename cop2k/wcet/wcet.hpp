@@ -0,0 +1,385 @@
+#ifndef WCET_HPP_INCLUDED
+#define WCET_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <format>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    /* static worst case execution time of a program image
+     *
+     * the control flow graph is rebuilt from the image by following
+     * every path from reset. an instruction loads PC in the step with
+     * !elp, and like modify_bus_data() the IR bits decide whether it
+     * does: bit 3 jumps unconditionally, otherwise bits 2-3 select
+     * carry or zero, so both ways are taken. a PC saved in ST before
+     * loading PC makes a call, and PC loaded from ST is a return.
+     *
+     * every instruction costs its signal_count, as its last step fetches
+     * the next one. every loop needs a bound, the most times its header
+     * runs per entry, and costs bound times its longest iteration.
+     * a jump to itself halts the program. interrupts are not counted
+     */
+    class WCET
+    {
+        public:
+            struct Decoded {
+                const Opcode::Instruction *ins;
+                unsigned char size;
+                InstructionFlow flow;
+                bool conditional;
+                unsigned char target;
+            };
+
+            struct Block {
+                unsigned char addr, last; // of the first and the last instruction
+                unsigned cycles; // calls included
+                std::vector<unsigned char> succ;
+            };
+
+            struct Loop {
+                unsigned char header;
+                std::bitset<256> body;
+                unsigned bound;
+                unsigned iteration_cycles;
+                unsigned cycles;
+            };
+
+            struct Function {
+                unsigned char entry;
+                std::map<unsigned char, Block> blocks;
+                std::vector<Loop> loops; // inner loops first
+                unsigned cycles;
+            };
+
+            WCET(const Opcode &opcode) : opcode(opcode) {}
+
+            // worst case clocks from reset, _FATCH_ included
+            unsigned analyze(const std::string &image)
+            {
+                const Opcode::Instruction *fatch = opcode.find_from_byte(0);
+
+                if (image.size() != 256)
+                    throw std::invalid_argument("memory image must be 256 bytes");
+
+                this->image = image;
+                functions.clear();
+                in_progress.reset();
+
+                return (fatch ? fatch->signal_count : 0) + analyze_function(0).cycles;
+            }
+
+            Decoded decode(unsigned char addr) const
+            {
+                unsigned char byte = image.at(addr);
+                Decoded ret = { opcode.find_from_byte(byte & ~0x3), 1, InstructionFlow::NEXT, false, 0 };
+                const Opcode::Instruction *ins = ret.ins;
+
+                if (!ins)
+                    throw std::runtime_error(
+                        std::format("undefined instruction {:02X}H at {:02X}H", byte, addr)
+                    );
+
+                for (OperandType i : { ins->src, ins->dst })
+                    if (i == OperandType::IMMED || i == OperandType::MEMADDR) {
+                        if (i == OperandType::MEMADDR)
+                            ret.target = image.at((addr + ret.size) & 0xff);
+
+                        ret.size++;
+                    }
+
+                ret.flow = ins->get_flow();
+                ret.conditional = ret.flow != InstructionFlow::NEXT && ins->is_conditional();
+
+                if (ret.flow == InstructionFlow::INDIRECT)
+                    throw std::runtime_error(
+                        std::format("indirect jump {} at {:02X}H", ins->mnemonic, addr)
+                    );
+
+                return ret;
+            }
+
+            const std::map<unsigned char, Function> &get_functions() const
+            {
+                return functions;
+            }
+
+            const Opcode &opcode;
+            std::map<unsigned char, unsigned> bounds; // loop header and its bound
+
+        private:
+            const Function &analyze_function(unsigned char entry)
+            {
+                auto found = functions.find(entry);
+
+                if (found != functions.end())
+                    return found->second;
+
+                if (in_progress.test(entry))
+                    throw std::runtime_error(std::format("recursive call of {:02X}H", entry));
+
+                in_progress.set(entry);
+
+                Function f;
+                f.entry = entry;
+                build_blocks(f);
+                find_loops(f);
+
+                for (Loop &l : f.loops) {
+                    l.iteration_cycles = longest_path(f, l.body, l.header, l.header);
+                    l.cycles = l.bound * l.iteration_cycles;
+                }
+
+                f.cycles = longest_path(f, std::bitset<256>().set(), entry, -1);
+                in_progress.reset(entry);
+                return functions.emplace(entry, std::move(f)).first->second;
+            }
+
+            void build_blocks(Function &f)
+            {
+                std::map<unsigned char, Decoded> code;
+                std::bitset<256> leaders;
+                std::vector<unsigned char> pending = { f.entry };
+
+                leaders.set(f.entry);
+
+                // every reachable instruction, and where blocks start
+                while (!pending.empty()) {
+                    unsigned char addr = pending.back();
+                    pending.pop_back();
+
+                    if (code.count(addr))
+                        continue;
+
+                    Decoded d = code.emplace(addr, decode(addr)).first->second;
+                    unsigned char next = addr + d.size;
+                    bool falls_through = d.flow != InstructionFlow::JUMP && d.flow != InstructionFlow::RETURN;
+
+                    // a flag never changes while jumping to itself, so that is not taken
+                    if (d.flow == InstructionFlow::JUMP && !(d.conditional && d.target == addr)) {
+                        leaders.set(d.target);
+
+                        // jumping to itself halts
+                        if (d.target != addr)
+                            pending.push_back(d.target);
+                    }
+
+                    if (d.flow != InstructionFlow::NEXT)
+                        leaders.set(next);
+
+                    if (falls_through || d.conditional)
+                        pending.push_back(next);
+                }
+
+                for (const auto &[addr, d] : code) {
+                    if (!leaders.test(addr))
+                        continue;
+
+                    Block b = { addr, addr, 0, {} };
+                    unsigned char cur = addr;
+
+                    while (true) {
+                        const Decoded &i = code.at(cur);
+                        unsigned char next = cur + i.size;
+
+                        b.last = cur;
+                        b.cycles += i.ins->signal_count;
+
+                        if (i.flow == InstructionFlow::CALL)
+                            b.cycles += analyze_function(i.target).cycles;
+
+                        if (i.flow == InstructionFlow::JUMP && i.target != cur)
+                            b.succ.push_back(i.target);
+
+                        if (
+                            (i.flow != InstructionFlow::JUMP && i.flow != InstructionFlow::RETURN) ||
+                            i.conditional
+                        ) {
+                            if (!code.count(next))
+                                throw std::runtime_error(
+                                    std::format("no instruction after {:02X}H", cur)
+                                );
+
+                            if (leaders.test(next) || i.flow != InstructionFlow::NEXT) {
+                                if (std::find(b.succ.begin(), b.succ.end(), next) == b.succ.end())
+                                    b.succ.push_back(next);
+
+                                break;
+                            }
+
+                            cur = next;
+                            continue;
+                        }
+
+                        break;
+                    }
+
+                    f.blocks.emplace(addr, std::move(b));
+                }
+            }
+
+            void find_loops(Function &f)
+            {
+                std::map<unsigned char, std::bitset<256>> dom;
+                std::map<unsigned char, std::vector<unsigned char>> pred;
+                std::map<unsigned char, Loop> loops;
+                bool changed = true;
+
+                for (const auto &[addr, b] : f.blocks) {
+                    dom[addr].set();
+
+                    for (unsigned char s : b.succ)
+                        pred[s].push_back(addr);
+                }
+
+                dom.at(f.entry).reset().set(f.entry);
+
+                while (changed) {
+                    changed = false;
+
+                    for (const auto &[addr, b] : f.blocks) {
+                        std::bitset<256> d;
+
+                        if (addr == f.entry)
+                            continue;
+
+                        d.set();
+
+                        for (unsigned char p : pred[addr])
+                            d &= dom.at(p);
+
+                        d.set(addr);
+
+                        if (d != dom.at(addr)) {
+                            dom.at(addr) = d;
+                            changed = true;
+                        }
+                    }
+                }
+
+                // natural loops of back edges, merged by header
+                for (const auto &[addr, b] : f.blocks)
+                    for (unsigned char h : b.succ) {
+                        if (!dom.at(addr).test(h))
+                            continue;
+
+                        Loop &l = loops[h];
+                        std::vector<unsigned char> pending = { addr };
+
+                        l.header = h;
+                        l.body.set(h);
+
+                        while (!pending.empty()) {
+                            unsigned char n = pending.back();
+                            pending.pop_back();
+
+                            if (l.body.test(n))
+                                continue;
+
+                            l.body.set(n);
+
+                            for (unsigned char p : pred[n])
+                                pending.push_back(p);
+                        }
+                    }
+
+                for (auto &[h, l] : loops) {
+                    auto bound = bounds.find(h);
+
+                    if (bound == bounds.end())
+                        throw std::runtime_error(std::format("loop at {:02X}H has no bound", h));
+
+                    l.bound = bound->second;
+                    l.iteration_cycles = l.cycles = 0;
+                    f.loops.push_back(l);
+                }
+
+                std::sort(f.loops.begin(), f.loops.end(), [](const Loop & a, const Loop & b) {
+                    return a.body.count() < b.body.count();
+                });
+            }
+
+            /* longest path from entry through the blocks in region, with the
+             * loops inside it collapsed into their headers. edges back to
+             * header end the path, and so do edges leaving the region
+             */
+            unsigned longest_path(
+                const Function &f,
+                const std::bitset<256> &region,
+                unsigned char entry,
+                int header
+            )
+            {
+                std::array<const Loop *, 256> outer = {}; // outermost loop inside region
+                std::map<unsigned char, unsigned> memo;
+                std::bitset<256> on_path;
+
+                for (const Loop &l : f.loops) {
+                    if (l.header == header || (l.body & ~region).any())
+                        continue;
+
+                    for (unsigned i = 0; i < 256; i++)
+                        if (l.body.test(i))
+                            outer.at(i) = &l;
+                }
+
+                auto rep = [&](unsigned char n) {
+                    return outer.at(n) ? outer.at(n)->header : n;
+                };
+
+                auto visit = [&](auto &self, unsigned char n) -> unsigned {
+                    auto found = memo.find(n);
+                    unsigned longest = 0;
+
+                    if (found != memo.end())
+                        return found->second;
+
+                    if (on_path.test(n))
+                        throw std::runtime_error(
+                            std::format("irreducible control flow at {:02X}H", n)
+                        );
+
+                    on_path.set(n);
+
+                    for (const auto &[addr, b] : f.blocks) {
+                        if (!region.test(addr) || rep(addr) != n)
+                            continue;
+
+                        for (unsigned char s : b.succ) {
+                            if (!region.test(s) || s == header || rep(s) == n)
+                                continue;
+
+                            if (rep(s) != s && outer.at(s)->header != s)
+                                throw std::runtime_error(
+                                    std::format("irreducible control flow at {:02X}H", s)
+                                );
+
+                            longest = std::max(longest, self(self, rep(s)));
+                        }
+                    }
+
+                    on_path.reset(n);
+                    longest += outer.at(n) ? outer.at(n)->cycles : f.blocks.at(n).cycles;
+                    memo.emplace(n, longest);
+                    return longest;
+                };
+
+                return visit(visit, rep(entry));
+            }
+
+            std::string image;
+            std::map<unsigned char, Function> functions;
+            std::bitset<256> in_progress; // functions being analyzed, to catch recursion
+    };
+}
+
+#endif // WCET_HPP_INCLUDED
@@ -0,0 +1,526 @@
+#ifndef DEBUG_INFO_HPP_INCLUDED
+#define DEBUG_INFO_HPP_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    /* debug information written by the assembler next to the program
+     *
+     * layout (all integers are little endian):
+     *   DebugInfoHeader
+     *   uint8_t[256]                   memory image
+     *   uint32_t[256]                  source line of every address, 0 if none
+     *   uint8_t[256]                   DebugAddrFlag of every address
+     *   DebugInfoLine[line_count]      one per source line, line n at n - 1
+     *   DebugInfoSymbol[symbol_count]  labels and consts, sorted by name
+     *   char[strings_size]             source text and symbol names
+     *
+     * every section is naturally aligned, so the file can be used
+     * straight from a read-only mapping
+     */
+    constexpr char DEBUG_INFO_MAGIC[8] = { 'C', 'O', 'P', '2', 'K', 'D', 'B', 'G' };
+    constexpr uint16_t DEBUG_INFO_VERSION = 2;
+
+    struct DebugInfoHeader {
+        char magic[8];
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t line_count;
+        uint32_t symbol_count;
+        uint32_t strings_size;
+    };
+
+    struct DebugInfoLine {
+        uint32_t text_offset;
+        uint16_t text_size;
+        uint8_t addr; // of the first byte
+        uint8_t size; // bytes emitted by this line
+    };
+
+    enum DebugAddrFlag : uint8_t {
+        ADDR_INSTRUCTION = 1 // first byte of an instruction
+    };
+
+    enum DebugSymbolKind : uint8_t {
+        SYMBOL_LABEL,
+        SYMBOL_CONST
+    };
+
+    struct DebugInfoSymbol {
+        uint32_t name_offset;
+        uint32_t line;
+        uint16_t name_size;
+        uint8_t value;
+        uint8_t kind;
+    };
+
+    static_assert(sizeof(DebugInfoHeader) == 24);
+    static_assert(sizeof(DebugInfoLine) == 8);
+    static_assert(sizeof(DebugInfoSymbol) == 12);
+
+    constexpr size_t DEBUG_INFO_IMAGE_OFFSET = sizeof(DebugInfoHeader);
+    constexpr size_t DEBUG_INFO_ADDR_LINES_OFFSET = DEBUG_INFO_IMAGE_OFFSET + 256;
+    constexpr size_t DEBUG_INFO_ADDR_FLAGS_OFFSET = DEBUG_INFO_ADDR_LINES_OFFSET + 256 * 4;
+    constexpr size_t DEBUG_INFO_LINES_OFFSET = DEBUG_INFO_ADDR_FLAGS_OFFSET + 256;
+
+    struct DebugSymbol {
+        std::string name;
+        unsigned char value;
+        unsigned line;
+        DebugSymbolKind kind;
+    };
+
+    inline std::string make_debug_info(
+        const std::string &source,
+        const std::string &image,
+        const std::array<unsigned, 256> &addr_lines,
+        const std::bitset<256> &instructions,
+        std::vector<DebugSymbol> symbols
+    )
+    {
+        std::vector<DebugInfoLine> lines;
+        std::vector<DebugInfoSymbol> symbol_entries;
+        std::array<uint32_t, 256> addr_line_entries;
+        std::array<uint8_t, 256> addr_flags;
+        std::string strings;
+        std::string::size_type begin = 0, end;
+
+        if (image.size() != 256)
+            throw std::invalid_argument("memory image must be 256 bytes");
+
+        do {
+            end = std::min(source.find('\n', begin), source.size());
+            lines.push_back({
+                htole32(strings.size()),
+                htole16(std::min<size_t>(end - begin, UINT16_MAX)),
+                0,
+                0
+            });
+            strings.append(source, begin, std::min<size_t>(end - begin, UINT16_MAX));
+            begin = end + 1;
+        } while (begin < source.size());
+
+        for (unsigned i = 0; i < 256; i++) {
+            unsigned line = addr_lines.at(i);
+
+            addr_line_entries.at(i) = htole32(line);
+            addr_flags.at(i) = instructions.test(i) ? ADDR_INSTRUCTION : 0;
+
+            if (!line || line > lines.size())
+                continue;
+
+            DebugInfoLine &l = lines.at(line - 1);
+
+            if (!l.size++)
+                l.addr = i;
+        }
+
+        std::sort(symbols.begin(), symbols.end(), [](const DebugSymbol & a, const DebugSymbol & b) {
+            return a.name < b.name;
+        });
+
+        for (const DebugSymbol &i : symbols) {
+            symbol_entries.push_back({
+                htole32(strings.size()),
+                htole32(i.line),
+                htole16(i.name.size()),
+                i.value,
+                i.kind
+            });
+            strings.append(i.name);
+        }
+
+        DebugInfoHeader header;
+        memcpy(header.magic, DEBUG_INFO_MAGIC, sizeof(header.magic));
+        header.version = htole16(DEBUG_INFO_VERSION);
+        header.reserved = 0;
+        header.line_count = htole32(lines.size());
+        header.symbol_count = htole32(symbol_entries.size());
+        header.strings_size = htole32(strings.size());
+
+        std::string ret(reinterpret_cast<const char *>(&header), sizeof(header));
+        ret.append(image);
+        ret.append(reinterpret_cast<const char *>(addr_line_entries.data()), 256 * 4);
+        ret.append(reinterpret_cast<const char *>(addr_flags.data()), 256);
+        ret.append(reinterpret_cast<const char *>(lines.data()), lines.size() * sizeof(DebugInfoLine));
+        ret.append(
+            reinterpret_cast<const char *>(symbol_entries.data()),
+            symbol_entries.size() * sizeof(DebugInfoSymbol)
+        );
+        ret.append(strings);
+        return ret;
+    }
+
+    inline void save_debug_info(
+        FILE *out,
+        const std::string &source,
+        const std::string &image,
+        const std::array<unsigned, 256> &addr_lines,
+        const std::bitset<256> &instructions,
+        const std::vector<DebugSymbol> &symbols
+    )
+    {
+        std::string data = make_debug_info(source, image, addr_lines, instructions, symbols);
+
+        if (fwrite(data.data(), 1, data.size(), out) != data.size())
+            throw std::runtime_error("failed to write debug information");
+    }
+
+    // read-only view of debug information in memory
+    class DebugInfoView
+    {
+        public:
+            DebugInfoView() : base(nullptr), size(0), line_count(0), symbol_count(0), strings_size(0) {}
+
+            DebugInfoView(const void *data, size_t size) :
+                base(static_cast<const unsigned char *>(data)), size(size)
+            {
+                DebugInfoHeader header;
+
+                if (
+                    size < DEBUG_INFO_LINES_OFFSET ||
+                    memcmp(base, DEBUG_INFO_MAGIC, sizeof(DEBUG_INFO_MAGIC))
+                )
+                    throw std::runtime_error("not a debug information file");
+
+                memcpy(&header, base, sizeof(header));
+
+                if (le16toh(header.version) != DEBUG_INFO_VERSION)
+                    throw std::runtime_error(
+                        std::format("unsupported debug information version {}", le16toh(header.version))
+                    );
+
+                line_count = le32toh(header.line_count);
+                symbol_count = le32toh(header.symbol_count);
+                strings_size = le32toh(header.strings_size);
+
+                if (
+                    size != DEBUG_INFO_LINES_OFFSET + line_count * sizeof(DebugInfoLine) +
+                    symbol_count * sizeof(DebugInfoSymbol) + strings_size
+                )
+                    throw std::runtime_error("corrupted debug information");
+            }
+
+            std::string_view image() const
+            {
+                return std::string_view(reinterpret_cast<const char *>(base) + DEBUG_INFO_IMAGE_OFFSET, 256);
+            }
+
+            // source line (1 based) of the byte at addr, 0 if none
+            unsigned get_line(unsigned char addr) const
+            {
+                uint32_t line;
+                memcpy(&line, base + DEBUG_INFO_ADDR_LINES_OFFSET + addr * 4, 4);
+                return le32toh(line);
+            }
+
+            bool is_instruction(unsigned char addr) const
+            {
+                return base[DEBUG_INFO_ADDR_FLAGS_OFFSET + addr] & ADDR_INSTRUCTION;
+            }
+
+            size_t get_line_count() const
+            {
+                return line_count;
+            }
+
+            // n is 1 based
+            DebugInfoLine get_line_info(unsigned n) const
+            {
+                DebugInfoLine l;
+
+                if (!n || n > line_count)
+                    throw std::out_of_range("line out of range");
+
+                memcpy(&l, base + DEBUG_INFO_LINES_OFFSET + (n - 1) * sizeof(l), sizeof(l));
+                l.text_offset = le32toh(l.text_offset);
+                l.text_size = le16toh(l.text_size);
+                return l;
+            }
+
+            std::string_view get_line_text(unsigned n) const
+            {
+                DebugInfoLine l = get_line_info(n);
+                return get_string(l.text_offset, l.text_size);
+            }
+
+            size_t get_symbol_count() const
+            {
+                return symbol_count;
+            }
+
+            DebugInfoSymbol get_symbol(size_t index) const
+            {
+                DebugInfoSymbol s;
+
+                if (index >= symbol_count)
+                    throw std::out_of_range("symbol out of range");
+
+                memcpy(&s, symbols_base() + index * sizeof(s), sizeof(s));
+                s.name_offset = le32toh(s.name_offset);
+                s.line = le32toh(s.line);
+                s.name_size = le16toh(s.name_size);
+                return s;
+            }
+
+            std::string_view get_symbol_name(size_t index) const
+            {
+                DebugInfoSymbol s = get_symbol(index);
+                return get_string(s.name_offset, s.name_size);
+            }
+
+            // binary search by name, false if missing
+            bool find_symbol(std::string_view name, DebugInfoSymbol &ret) const
+            {
+                size_t lo = 0, hi = symbol_count;
+
+                while (lo < hi) {
+                    size_t mid = (lo + hi) / 2;
+                    std::string_view n = get_symbol_name(mid);
+
+                    if (n == name) {
+                        ret = get_symbol(mid);
+                        return true;
+                    }
+
+                    if (n < name)
+                        lo = mid + 1;
+
+                    else
+                        hi = mid;
+                }
+
+                return false;
+            }
+
+            /* address, bytes and text of every source line
+             *
+             * with an instruction set, every instruction is also annotated
+             * with its clocks and every basic block with its total. the
+             * last step of each instruction fetches the next one, so an
+             * instruction costs its signal_count and _FATCH_ is only paid
+             * once at reset
+             */
+            std::string to_listing(const Opcode *opcode = nullptr) const
+            {
+                std::string ret, pending; // lines without bytes wait for the block before them
+                std::string_view img = image();
+                std::bitset<256> leaders;
+                int block_first = -1;
+                unsigned block_last = 0, block_cycles = 0, next_addr = 0;
+                unsigned block_count = 0, instruction_count = 0, total_cycles = 0;
+
+                auto end_block = [&]() {
+                    if (block_first < 0)
+                        return;
+
+                    ret += std::format(
+                               "{:20}{:>3}  ; block {:02X}H-{:02X}H\n", "", block_cycles, block_first, block_last
+                           );
+                    block_count++;
+                    block_first = -1;
+                };
+
+                if (opcode) {
+                    const Opcode::Instruction *fatch = opcode->find_from_byte(0);
+
+                    leaders = find_leaders(*opcode);
+                    ret += std::format(
+                               "; clocks per instruction, _FATCH_ takes {} more once at reset\n",
+                               fatch ? fatch->signal_count : 0
+                           );
+                }
+
+                for (unsigned i = 1; i <= line_count; i++) {
+                    DebugInfoLine l = get_line_info(i);
+                    const Opcode::Instruction *ins = nullptr;
+                    std::string bytes;
+
+                    for (unsigned j = 0; j < l.size; j++)
+                        bytes += std::format("{:02X} ", static_cast<unsigned char>(img.at((l.addr + j) & 0xff)));
+
+                    if (!l.size) {
+                        pending += std::format("{:4}      {:<10}{}\n", i, "", get_line_text(i));
+                        continue;
+                    }
+
+                    if (!opcode) {
+                        ret += pending;
+                        pending.clear();
+                        ret += std::format("{:4}  {:02X}  {:<10}{}\n", i, l.addr, bytes, get_line_text(i));
+                        continue;
+                    }
+
+                    if (is_instruction(l.addr))
+                        ins = opcode->find_from_byte(img.at(l.addr) & ~0x3);
+
+                    // blocks end on data, gaps and before jump targets
+                    if (!ins || leaders.test(l.addr) || l.addr != next_addr)
+                        end_block();
+
+                    ret += pending;
+                    pending.clear();
+
+                    if (!ins) {
+                        ret += std::format("{:4}  {:02X}  {:<10}     {}\n", i, l.addr, bytes, get_line_text(i));
+                        continue;
+                    }
+
+                    ret += std::format(
+                               "{:4}  {:02X}  {:<10}{:>3}  {}\n", i, l.addr, bytes, ins->signal_count, get_line_text(i)
+                           );
+
+                    if (block_first < 0) {
+                        block_first = l.addr;
+                        block_cycles = 0;
+                    }
+
+                    block_last = l.addr;
+                    block_cycles += ins->signal_count;
+                    next_addr = l.addr + l.size;
+                    instruction_count++;
+                    total_cycles += ins->signal_count;
+
+                    // and after anything that may load PC
+                    if (ins->loads_pc())
+                        end_block();
+                }
+
+                end_block();
+                ret += pending;
+
+                if (opcode)
+                    ret += std::format(
+                               "; {} instructions in {} blocks, {} clocks if each runs once\n",
+                               instruction_count, block_count, total_cycles
+                           );
+
+                return ret;
+            }
+
+        private:
+            // addresses starting a basic block: reset, labels and jump targets
+            std::bitset<256> find_leaders(const Opcode &opcode) const
+            {
+                std::bitset<256> ret;
+                std::string_view img = image();
+
+                ret.set(0);
+
+                for (size_t i = 0; i < symbol_count; i++) {
+                    DebugInfoSymbol s = get_symbol(i);
+
+                    if (s.kind == SYMBOL_LABEL)
+                        ret.set(s.value);
+                }
+
+                for (unsigned addr = 0; addr < 256; addr++) {
+                    if (!is_instruction(addr))
+                        continue;
+
+                    const Opcode::Instruction *ins = opcode.find_from_byte(img.at(addr) & ~0x3);
+
+                    if (!ins || !ins->loads_pc())
+                        continue;
+
+                    if (ins->src == OperandType::MEMADDR)
+                        ret.set(static_cast<unsigned char>(img.at((addr + 1) & 0xff)));
+
+                    else if (ins->dst == OperandType::MEMADDR)
+                        ret.set(static_cast<unsigned char>(
+                                    img.at((addr + (ins->src == OperandType::IMMED ? 2 : 1)) & 0xff)
+                                ));
+                }
+
+                return ret;
+            }
+
+            const unsigned char *symbols_base() const
+            {
+                return base + DEBUG_INFO_LINES_OFFSET + line_count * sizeof(DebugInfoLine);
+            }
+
+            std::string_view get_string(size_t offset, size_t len) const
+            {
+                const char *strings = reinterpret_cast<const char *>(symbols_base()) +
+                                      symbol_count * sizeof(DebugInfoSymbol);
+
+                if (offset > strings_size || len > strings_size - offset)
+                    throw std::runtime_error("corrupted debug information");
+
+                return std::string_view(strings + offset, len);
+            }
+
+            const unsigned char *base;
+            size_t size;
+            size_t line_count, symbol_count, strings_size;
+    };
+
+    // debug information mapped from a file
+    class DebugInfo : public DebugInfoView
+    {
+        public:
+            DebugInfo(const char *path) : data(MAP_FAILED), data_size(0)
+            {
+                int fd = open(path, O_RDONLY);
+                struct stat st;
+
+                if (fd < 0)
+                    throw std::runtime_error(std::format("failed to open {}", path));
+
+                if (fstat(fd, &st) || !st.st_size) {
+                    close(fd);
+                    throw std::runtime_error(std::format("failed to stat {}", path));
+                }
+
+                data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+
+                if (data == MAP_FAILED)
+                    throw std::runtime_error(std::format("failed to map {}", path));
+
+                data_size = st.st_size;
+
+                try {
+                    DebugInfoView::operator=(DebugInfoView(data, data_size));
+
+                } catch (...) {
+                    munmap(data, data_size);
+                    throw;
+                }
+            }
+
+            DebugInfo(const DebugInfo &) = delete;
+            DebugInfo &operator=(const DebugInfo &) = delete;
+
+            ~DebugInfo()
+            {
+                munmap(data, data_size);
+            }
+
+        private:
+            void *data;
+            size_t data_size;
+    };
+}
+
+#endif // DEBUG_INFO_HPP_INCLUDED
@@ -8,11 +8,13 @@
 #include <stdexcept>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 #include <format>
 #include <variant>
 
 #include "libopcode.hpp"
+#include "isa_image.hpp"
 
 namespace COP2K
 {
@@ -349,9 +351,10 @@ namespace COP2K
                 return reader;
             }
 
-            void set_writer(WriterType val)
+            // conflict check may be skipped for micro words proven safe
+            void set_writer(WriterType val, bool check = true)
             {
-                if (has_writer())
+                if (check && has_writer())
                     throw std::logic_error("this bus already has a writer");
 
                 writer = val;
@@ -618,9 +621,25 @@ namespace COP2K
             }
     };
 
-    class Memory
+    /* main memory, the 256 bytes the address bus reaches by default
+     *
+     * with BANKS above 1, 0x00 to 0x7F stay common and 0x80 to 0xFF are a
+     * window onto one of BANKS banks of 128 bytes, chosen by writing the
+     * bank to BANK_PORT of the I/O space. physical addresses run through
+     * the common half, then bank 0, 1 and on, so the default layout is
+     * indexed as directly as ever
+     */
+    template <unsigned BANKS = 1>
+    class BankedMemory
     {
+        static_assert(BANKS && !(BANKS & (BANKS - 1)) && BANKS <= 256, "banks must be a power of 2 up to 256");
+
         public:
+            static constexpr unsigned BANK_COUNT = BANKS;
+            static constexpr unsigned SIZE = 0x80 + BANKS * 0x80;
+            static constexpr uint8_t BANK_PORT = 0xFF;
+            using Address = std::conditional_t<BANKS == 1, uint8_t, uint16_t>;
+
             void set_addr(uint8_t val)
             {
                 addr = val;
@@ -628,7 +647,7 @@ namespace COP2K
 
             void set_data(uint8_t val)
             {
-                mem.at(addr) = val;
+                mem.at(get_physical_addr()) = val;
             }
 
             uint8_t get_addr() const
@@ -638,24 +657,52 @@ namespace COP2K
 
             uint8_t get_data() const
             {
-                return mem.at(addr);
+                return mem.at(get_physical_addr());
+            }
+
+            Address get_physical_addr() const
+            {
+                if constexpr (BANKS == 1)
+                    return addr;
+
+                else
+                    return addr < 0x80 ? addr : addr + bank * 0x80;
+            }
+
+            // OUT with an address on the address bus
+            void write_port(uint8_t port, uint8_t val)
+            {
+                if constexpr (BANKS > 1)
+                    if (port == BANK_PORT)
+                        set_bank(val);
+            }
+
+            void set_bank(uint8_t val)
+            {
+                bank = val & (BANKS - 1);
+            }
+
+            uint8_t get_bank() const
+            {
+                return bank;
             }
 
             void clear()
             {
-                for (unsigned i = 0; i < 256; i++)
+                for (unsigned i = 0; i < SIZE; i++)
                     set_data_at(i, 0);
 
                 set_addr(0);
+                set_bank(0);
             }
 
-            // bypass normal addr lookup mode
-            void set_data_at(uint8_t actaddr, uint8_t val)
+            // bypass normal addr lookup mode, actaddr is physical
+            void set_data_at(Address actaddr, uint8_t val)
             {
                 mem.at(actaddr) = val;
             }
 
-            uint8_t get_data_at(uint8_t actaddr) const
+            uint8_t get_data_at(Address actaddr) const
             {
                 return mem.at(actaddr);
             }
@@ -664,7 +711,7 @@ namespace COP2K
             {
                 std::string ret;
 
-                for (unsigned i = 0; i < 256; i++)
+                for (unsigned i = 0; i < SIZE; i++)
                     ret.push_back(get_data_at(i));
 
                 return ret;
@@ -674,9 +721,12 @@ namespace COP2K
             {
                 std::string ret("Memory status:");
 
-                for (unsigned i = 0; i < 256; i++) {
+                if constexpr (BANKS > 1)
+                    ret.append(std::format(" bank {}", bank));
+
+                for (unsigned i = 0; i < SIZE; i++) {
                     if (!(i & 0xf))
-                        ret.append(std::format("\n0x{:02X}: ", i));
+                        ret.append(std::format("\n0x{:0{}X}: ", i, SIZE > 256 ? 3 : 2));
 
                     ret.append(std::format("{:02X} ", get_data_at(i)));
                 }
@@ -686,10 +736,13 @@ namespace COP2K
             }
 
         private:
-            std::array<uint8_t, 256> mem;
+            std::array<uint8_t, SIZE> mem;
             uint8_t addr;
+            uint8_t bank = 0;
     };
 
+    using Memory = BankedMemory<>;
+
     class MicroProgramMemory
     {
         public:
@@ -786,14 +839,16 @@ namespace COP2K
         ABusReaderType, ABusWriterType, // abus io
         uint8_t,// em/um i
         std::pair<uint8_t, uint8_t>, // em o
-        std::pair<uint8_t, std::bitset<24>>, // um o
+        std::pair<uint8_t, std::bitset<24>> // um o
         >;
 
 
-    class COP2K
+    // the machine, with EM its main memory
+    template <typename EM = Memory>
+    class BasicCOP2K
     {
         public:
-            COP2K(std::function<void(COP2K &, COP2KCallbackType)> callback) :
+            BasicCOP2K(std::function<void(BasicCOP2K &, COP2KCallbackType)> callback) :
                 l(0, "L"),
                 d(0, "D"),
                 r(0, "R"),
@@ -948,12 +1003,22 @@ namespace COP2K
                 return alu.cy.get();
             }
 
-            uint8_t get_em_data(uint8_t addr) const
+            void set_z(bool val)
+            {
+                alu.z.set(val);
+            }
+
+            bool get_z() const
+            {
+                return alu.z.get();
+            }
+
+            uint8_t get_em_data(typename EM::Address addr) const
             {
                 return em.get_data_at(addr);
             }
 
-            void set_em_data(uint8_t addr, uint8_t val)
+            void set_em_data(typename EM::Address addr, uint8_t val)
             {
                 em.set_data_at(addr, val);
             }
@@ -963,6 +1028,33 @@ namespace COP2K
                 em.clear();
             }
 
+            struct EMAccess {
+                bool read, write;
+                uint8_t addr;
+            };
+
+            /* what the next clock will do to memory when running
+             * automatically, worked out from the micro word at UPC as
+             * set_bus_status() will, so memory shared with others can be
+             * filled in before the clock and read back after it
+             */
+            EMAccess next_em_access() const
+            {
+                const std::bitset<24> &word = um.get_data_at(upc.get());
+                bool emrd = !word.test(21) && !(ireq.get() && !iack.get());
+                bool emen = !word.test(19), emwr = !word.test(22);
+                EMAccess ret = { emrd, emen && emwr, em.get_addr() };
+
+                // MAR wins over PC on a word proven safe
+                if ((ret.read || ret.write) && !word.test(14))
+                    ret.addr = mar.get();
+
+                else if ((ret.read || ret.write) && !word.test(20))
+                    ret.addr = pc.get();
+
+                return ret;
+            }
+
             const std::bitset<24> &get_um_data(uint8_t addr) const
             {
                 return um.get_data_at(addr);
@@ -1004,10 +1096,20 @@ namespace COP2K
             void load_instruction(FILE *in)
             {
                 opcode.load_instr_txt(in);
+                load_um_from_opcode();
+            }
 
-                for (const Opcode::Instruction &i : opcode)
-                    for (unsigned char j = 0; j < 4; j++)
-                        um.set_data_at(i.byte | j, i.microprogram.at(j));
+            // instr.txt, COP2000 DE .ins or compiled image
+            void load_instruction(const char *path)
+            {
+                load_instruction_set(path, opcode);
+                load_um_from_opcode();
+            }
+
+            void load_instruction(const Opcode &val)
+            {
+                opcode = val;
+                load_um_from_opcode();
             }
 
             std::string reg_to_string() const
@@ -1141,9 +1243,20 @@ namespace COP2K
             Flag x2, x1, x0;
             Flag wen, aen;
             FlagWithCallback s2, s1, s0;
-            std::function<void(COP2K &, COP2KCallbackType)> callback;
+            std::function<void(BasicCOP2K &, COP2KCallbackType)> callback;
 
         private:
+            void load_um_from_opcode()
+            {
+                // slots without an instruction all claim byte 0
+                um.clear();
+
+                for (const Opcode::Instruction &i : opcode)
+                    if (i.exist)
+                        for (unsigned char j = 0; j < 4; j++)
+                            um.set_data_at(i.byte | j, i.microprogram.at(j));
+            }
+
             void update_alu()
             {
                 // note: must be careful not to cause another callback to
@@ -1160,6 +1273,9 @@ namespace COP2K
 
             void get_control_signal()
             {
+                // upc may have been changed since the last clock
+                um.set_addr(upc.get());
+
                 // get control signal if running automatically
                 if (running_manually.get())
                     return;
@@ -1199,6 +1315,11 @@ namespace COP2K
                 abus.clear_reader();
                 abus.clear_writer();
 
+                // words checked when the instruction set was loaded
+                // can never cause a bus conflict
+                const bool check =
+                    running_manually.get() || !opcode.is_um_safe(um.get_addr());
+
                 // if somebody is interrupting reply to them
                 if (ireq.get() && !iack.get()) {
                     ibus.set_writer(IBusWriterType::INTERRUPT);
@@ -1207,17 +1328,17 @@ namespace COP2K
                 }
 
                 if (!emrd.get())
-                    ibus.set_writer(IBusWriterType::EM);
+                    ibus.set_writer(IBusWriterType::EM, check);
 
                 if (!pcoe.get())
-                    abus.set_writer(ABusWriterType::PC);
+                    abus.set_writer(ABusWriterType::PC, check);
 
                 if (!emen.get()) {
                     if (!emwr.get())
                         dbus.add_reader(DBusReaderType::EM);
 
                     if (!emrd.get())
-                        dbus.set_writer(DBusWriterType::EM);
+                        dbus.set_writer(DBusWriterType::EM, check);
                 }
 
                 if (!iren.get()) {
@@ -1237,7 +1358,7 @@ namespace COP2K
                     dbus.add_reader(DBusReaderType::MAR);
 
                 if (!maroe.get())
-                    abus.set_writer(ABusWriterType::MAR);
+                    abus.set_writer(ABusWriterType::MAR, check);
 
                 if (!outen.get())
                     dbus.add_reader(DBusReaderType::OUT);
@@ -1246,7 +1367,7 @@ namespace COP2K
                     dbus.add_reader(DBusReaderType::ST);
 
                 if (!rrd.get())
-                    dbus.set_writer(DBusWriterType::REG);
+                    dbus.set_writer(DBusWriterType::REG, check);
 
                 if (!rwr.get())
                     dbus.add_reader(DBusReaderType::REG);
@@ -1259,37 +1380,45 @@ namespace COP2K
 
                 switch (x2.get() << 2 | x1.get() << 1 | x0.get()) {
                     case 0:
-                        dbus.set_writer(DBusWriterType::IN);
+                        dbus.set_writer(DBusWriterType::IN, check);
                         break;
 
                     case 1:
-                        dbus.set_writer(DBusWriterType::IA);
+                        dbus.set_writer(DBusWriterType::IA, check);
                         break;
 
                     case 2:
-                        dbus.set_writer(DBusWriterType::ST);
+                        dbus.set_writer(DBusWriterType::ST, check);
                         break;
 
                     case 3:
-                        dbus.set_writer(DBusWriterType::PC);
+                        dbus.set_writer(DBusWriterType::PC, check);
                         break;
 
                     case 4:
-                        dbus.set_writer(DBusWriterType::D);
+                        dbus.set_writer(DBusWriterType::D, check);
                         break;
 
                     case 5:
-                        dbus.set_writer(DBusWriterType::R);
+                        dbus.set_writer(DBusWriterType::R, check);
                         break;
 
                     case 6:
-                        dbus.set_writer(DBusWriterType::L);
+                        dbus.set_writer(DBusWriterType::L, check);
                         break;
 
                     case 7:
                         break;
                 }
 
+                // memory takes its address from the address bus
+                // whenever it is read or written
+                if (
+                    abus.has_writer() &&
+                    (!emrd.get() || (!emen.get() && !emwr.get()))
+                )
+                    abus.add_reader(ABusReaderType::EM);
+
                 // manual dbus will override previous writer
                 if (manual_dbus.get()) {
                     dbus.clear_writer();
@@ -1308,12 +1437,19 @@ namespace COP2K
                         break;
 
                     case ABusWriterType::PC:
-                        // it may be subsequently overwritten by !ELP
+                        // incremented once the data bus has been driven
                         abus.set_data(pc.get());
-                        pc.set(pc.get() + 1);
                         break;
                 }
 
+                // memory must see the new address before it is accessed
+                for (ABusReaderType i : abus.get_reader())
+                    switch (i) {
+                        case ABusReaderType::EM:
+                            em.set_addr(abus.get_data());
+                            break;
+                    }
+
                 switch (dbus.get_writer()) {
                     case DBusWriterType::NONE:
                         break;
@@ -1376,6 +1512,11 @@ namespace COP2K
                         break;
                 }
 
+                // a PC driven on the data bus in the same clock is the old one,
+                // and !ELP below still overrides the increment
+                if (abus.get_writer() == ABusWriterType::PC)
+                    pc.set(pc.get() + 1);
+
                 switch (ibus.get_writer()) {
                     case IBusWriterType::NONE:
                         break;
@@ -1389,13 +1530,6 @@ namespace COP2K
                         break;
                 }
 
-                for (ABusReaderType i : abus.get_reader())
-                    switch (i) {
-                        case ABusReaderType::EM:
-                            em.set_addr(abus.get_data());
-                            break;
-                    }
-
                 for (DBusReaderType i : dbus.get_reader())
                     switch (i) {
                         case DBusReaderType::MAR:
@@ -1404,6 +1538,12 @@ namespace COP2K
 
                         case DBusReaderType::OUT:
                             out.set(dbus.get_data());
+
+                            // to a port when MAR addresses the I/O space, as WRITE does
+                            if constexpr (EM::BANK_COUNT > 1)
+                                if (abus.get_writer() == ABusWriterType::MAR)
+                                    em.write_port(abus.get_data(), dbus.get_data());
+
                             break;
 
                         case DBusReaderType::ST:
@@ -1476,7 +1616,7 @@ namespace COP2K
             }
 
             Opcode opcode;
-            Memory em;
+            EM em;
             MicroProgramMemory um;
             ALU alu;
             DBus dbus;
@@ -1484,5 +1624,7 @@ namespace COP2K
             IBus ibus;
     };
 
+    using COP2K = BasicCOP2K<>;
+
 }
 #endif // COP2K_H_INCLUDED
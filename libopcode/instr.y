@@ -4,21 +4,36 @@
 
 #include "libopcode.hpp"
 #include "libopcode_yacc.hpp"
+%}
+
+%define api.pure full
+
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
 
-extern int yyinstrlex(void);
-extern int yyinstrlineno;
-extern void yyinstrset_lineno(int);
-extern void yyinstrset_in(FILE *);
-extern FILE *yyinstrin;
+struct InstrParseContext;
+}
 
-static COP2K::Opcode *current_opcode = nullptr;
-static bool has_error = false;
+%code {
+extern int yyinstrlex(YYSTYPE *, yyscan_t);
+extern int yyinstrlex_init_extra(struct InstrParseContext *, yyscan_t *);
+extern int yyinstrlex_destroy(yyscan_t);
+extern int yyinstrget_lineno(yyscan_t);
+extern void yyinstrset_lineno(int, yyscan_t);
+extern void yyinstrset_in(FILE *, yyscan_t);
 
-void yyerror(const char *s)
+void yyerror(yyscan_t scanner, struct InstrParseContext *, const char *s)
 {
-    std::cerr << "syntax error at line " << yyinstrlineno << ": " << s << std::endl;
+    std::cerr << "syntax error at line " << yyinstrget_lineno(scanner) << ": " << s << std::endl;
+}
 }
-%}
+
+// all parser state lives in ctx, so files can be parsed concurrently
+%param {yyscan_t scanner}
+%parse-param {struct InstrParseContext *ctx}
 
 %union {
     unsigned char number_v;
@@ -65,13 +80,13 @@ instructions
         for (unsigned char i = 0; i < 4; i++)
             arr.at(i) = $2.microprogram.signals[i].to_bitset();
 
-        current_opcode->add($2.byte, $2.mnemonic, "", $2.src, $2.dst, arr);
+        ctx->opcode->add($2.byte, $2.mnemonic, "", $2.src, $2.dst, arr);
         free($2.mnemonic);
         $2.mnemonic = nullptr;
     }
     | error instruction {
         // error messages has been printed by their perspective rules
-        has_error = true;
+        ctx->has_error = true;
         yyerrok;
         yyclearin;
     }
@@ -87,7 +102,7 @@ instruction
          */
         if (!strcasecmp($1, "_FATCH_")) {
             if ($4 != 0x0) {
-                yyerror("_FATCH_ instruction address != 0x0");
+                yyerror(scanner, ctx, "_FATCH_ instruction address != 0x0");
                 YYERROR;
             }
 
@@ -95,17 +110,17 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_FATCH_ must have no operands");
+                yyerror(scanner, ctx, "_FATCH_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0x0 && strcasecmp($1, "_FATCH_")) {
-            yyerror("instruction @ 0x0 MUST be _FATCH_");
+            yyerror(scanner, ctx, "instruction @ 0x0 MUST be _FATCH_");
             YYERROR;
         }
         if (!strcasecmp($1, "_INT_")) {
             if ($4 != 0xB8) {
-                yyerror("_INT_ instruction address != 0xB8");
+                yyerror(scanner, ctx, "_INT_ instruction address != 0xB8");
                 YYERROR;
             }
 
@@ -113,40 +128,40 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_INT_ must have no operands");
+                yyerror(scanner, ctx, "_INT_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0xB8 && strcasecmp($1, "_INT_")) {
-            yyerror("instruction @ 0xB8 MUST be _INT_");
+            yyerror(scanner, ctx, "instruction @ 0xB8 MUST be _INT_");
             YYERROR;
         }
         if (!strcasecmp($1, "DB")) {
-            yyerror("DB must not be defined");
+            yyerror(scanner, ctx, "DB must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ORG")) {
-            yyerror("ORG must not be defined");
+            yyerror(scanner, ctx, "ORG must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "END")) {
-            yyerror("END must not be defined");
+            yyerror(scanner, ctx, "END must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "IF")) {
-            yyerror("IF must not be defined");
+            yyerror(scanner, ctx, "IF must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ELSE")) {
-            yyerror("ELSE must not be defined");
+            yyerror(scanner, ctx, "ELSE must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ENDIF")) {
-            yyerror("ENDIF must not be defined");
+            yyerror(scanner, ctx, "ENDIF must not be defined");
             YYERROR;
         }
         if ($4 & 3) {
-            yyerror("instruction address not aligned to 4 bit");
+            yyerror(scanner, ctx, "instruction address not aligned to 4 bit");
             YYERROR;
         }
 
@@ -156,6 +171,8 @@ instruction
 
             if (($4 & 0x8) >> 3 != 1) {
                 yyerror(
+                    scanner,
+                    ctx,
                     "to make sure jump unconditionally, "
                     "(address & 0x8) >> 3 MUST == 1"
                 );
@@ -179,7 +196,7 @@ instruction
          */
         if (!strcasecmp($1, "_FATCH_")) {
             if ($4 != 0x0) {
-                yyerror("_FATCH_ instruction address != 0x0");
+                yyerror(scanner, ctx, "_FATCH_ instruction address != 0x0");
                 YYERROR;
             }
 
@@ -187,17 +204,17 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_FATCH_ must have no operands");
+                yyerror(scanner, ctx, "_FATCH_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0x0 && strcasecmp($1, "_FATCH_")) {
-            yyerror("instruction @ 0x0 MUST be _FATCH_");
+            yyerror(scanner, ctx, "instruction @ 0x0 MUST be _FATCH_");
             YYERROR;
         }
         if (!strcasecmp($1, "_INT_")) {
             if ($4 != 0xB8) {
-                yyerror("_INT_ instruction address != 0xB8");
+                yyerror(scanner, ctx, "_INT_ instruction address != 0xB8");
                 YYERROR;
             }
 
@@ -205,44 +222,44 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_INT_ must have no operands");
+                yyerror(scanner, ctx, "_INT_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0xB8 && strcasecmp($1, "_INT_")) {
-            yyerror("instruction @ 0xB8 MUST be _INT_");
+            yyerror(scanner, ctx, "instruction @ 0xB8 MUST be _INT_");
             YYERROR;
         }
         if (!strcasecmp($1, "DB")) {
-            yyerror("DB must not be defined");
+            yyerror(scanner, ctx, "DB must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ORG")) {
-            yyerror("ORG must not be defined");
+            yyerror(scanner, ctx, "ORG must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "END")) {
-            yyerror("END must not be defined");
+            yyerror(scanner, ctx, "END must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "IF")) {
-            yyerror("IF must not be defined");
+            yyerror(scanner, ctx, "IF must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ELSE")) {
-            yyerror("ELSE must not be defined");
+            yyerror(scanner, ctx, "ELSE must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ENDIF")) {
-            yyerror("ENDIF must not be defined");
+            yyerror(scanner, ctx, "ENDIF must not be defined");
             YYERROR;
         }
         if ($4 & 3) {
-            yyerror("instruction address not aligned to 4 bit");
+            yyerror(scanner, ctx, "instruction address not aligned to 4 bit");
             YYERROR;
         }
         if (($4 & 0xC) >> 2 != 1) {
-            yyerror("to utilize jump on zero feature, (address & 0xC) >> 2 MUST == 1");
+            yyerror(scanner, ctx, "to utilize jump on zero feature, (address & 0xC) >> 2 MUST == 1");
             YYERROR;
         }
         $$.byte = $4;
@@ -261,7 +278,7 @@ instruction
          */
         if (!strcasecmp($1, "_FATCH_")) {
             if ($4 != 0x0) {
-                yyerror("_FATCH_ instruction address != 0x0");
+                yyerror(scanner, ctx, "_FATCH_ instruction address != 0x0");
                 YYERROR;
             }
 
@@ -269,17 +286,17 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_FATCH_ must have no operands");
+                yyerror(scanner, ctx, "_FATCH_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0x0 && strcasecmp($1, "_FATCH_")) {
-            yyerror("instruction @ 0x0 MUST be _FATCH_");
+            yyerror(scanner, ctx, "instruction @ 0x0 MUST be _FATCH_");
             YYERROR;
         }
         if (!strcasecmp($1, "_INT_")) {
             if ($4 != 0xB8) {
-                yyerror("_INT_ instruction address != 0xB8");
+                yyerror(scanner, ctx, "_INT_ instruction address != 0xB8");
                 YYERROR;
             }
 
@@ -287,44 +304,44 @@ instruction
                 $2.src != COP2K::OperandType::NONE ||
                 $2.dst != COP2K::OperandType::NONE
             ) {
-                yyerror("_INT_ must have no operands");
+                yyerror(scanner, ctx, "_INT_ must have no operands");
                 YYERROR;
             }
         }
         if ($4 == 0xB8 && strcasecmp($1, "_INT_")) {
-            yyerror("instruction @ 0xB8 MUST be _INT_");
+            yyerror(scanner, ctx, "instruction @ 0xB8 MUST be _INT_");
             YYERROR;
         }
         if (!strcasecmp($1, "DB")) {
-            yyerror("DB must not be defined");
+            yyerror(scanner, ctx, "DB must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ORG")) {
-            yyerror("ORG must not be defined");
+            yyerror(scanner, ctx, "ORG must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "END")) {
-            yyerror("END must not be defined");
+            yyerror(scanner, ctx, "END must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "IF")) {
-            yyerror("IF must not be defined");
+            yyerror(scanner, ctx, "IF must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ELSE")) {
-            yyerror("ELSE must not be defined");
+            yyerror(scanner, ctx, "ELSE must not be defined");
             YYERROR;
         }
         if (!strcasecmp($1, "ENDIF")) {
-            yyerror("ENDIF must not be defined");
+            yyerror(scanner, ctx, "ENDIF must not be defined");
             YYERROR;
         }
         if ($4 & 3) {
-            yyerror("instruction address not aligned to 4 bit");
+            yyerror(scanner, ctx, "instruction address not aligned to 4 bit");
             YYERROR;
         }
         if (($4 & 0xC) >> 2 != 0) {
-            yyerror("to utilize jump on carry feature, (address & 0xC) >> 2 MUST == 0");
+            yyerror(scanner, ctx, "to utilize jump on carry feature, (address & 0xC) >> 2 MUST == 0");
             YYERROR;
         }
         $$.byte = $4;
@@ -384,11 +401,11 @@ operand
         $$.dst = COP2K::OperandType::REG_A;
     }
     | OPERAND_REG ',' OPERAND_REG {
-        yyerror("xxx R?, R? cannot be constructed");
+        yyerror(scanner, ctx, "xxx R?, R? cannot be constructed");
         YYERROR;
     }
     | OPERAND_REG ',' OPERAND_REGADDR {
-        yyerror("xxx R?, @R? cannot be constructed");
+        yyerror(scanner, ctx, "xxx R?, @R? cannot be constructed");
         YYERROR;
     }
     | OPERAND_REG ',' OPERAND_IMMED {
@@ -404,11 +421,11 @@ operand
         $$.dst = COP2K::OperandType::REG_A;
     }
     | OPERAND_REGADDR ',' OPERAND_REG {
-        yyerror("xxx @R?, R? cannot be constructed");
+        yyerror(scanner, ctx, "xxx @R?, R? cannot be constructed");
         YYERROR;
     }
     | OPERAND_REGADDR ',' OPERAND_REGADDR {
-        yyerror("xxx @R?, @R? cannot be constructed");
+        yyerror(scanner, ctx, "xxx @R?, @R? cannot be constructed");
         YYERROR;
     }
     | OPERAND_REGADDR ',' OPERAND_IMMED {
@@ -469,7 +486,7 @@ micro_program
 
         if (!$2.signal.empty()) {
             if ($$.signal_count++ != $2.index) {
-                yyerror("micro program index not continous");
+                yyerror(scanner, ctx, "micro program index not continous");
                 YYERROR;
             }
 
@@ -481,7 +498,7 @@ micro_program
 micro_program_signal
     : NUMBER ':' signals {
         if ($1 > 3) {
-            yyerror("micro program index > 3");
+            yyerror(scanner, ctx, "micro program index > 3");
             YYERROR;
         }
 
@@ -566,7 +583,7 @@ signals
             $$.s0 = $2.val;
 
         else {
-            yyerror("Invalid signal name");
+            yyerror(scanner, ctx, "Invalid signal name");
             YYERROR;
         }
 
@@ -590,15 +607,29 @@ signal
 
 void COP2K::parse_instruction_file(FILE *in, COP2K::Opcode *opcode)
 {
-    yyinstrset_lineno(1);
-    yyinstrset_in(in);
-    has_error = false;
-    current_opcode = opcode;
+    struct InstrParseContext ctx;
+    yyscan_t scanner;
+    int result;
+
+    ctx.opcode = opcode;
+    ctx.has_error = false;
+
+    if (yyinstrlex_init_extra(&ctx, &scanner))
+        throw std::runtime_error("failed to initialize scanner");
 
-    int result = yyparse();
+    yyinstrset_lineno(1, scanner);
+    yyinstrset_in(in, scanner);
+
+    try {
+        result = yyparse(scanner, &ctx);
+
+    } catch (...) {
+        yyinstrlex_destroy(scanner);
+        throw;
+    }
 
-    current_opcode = nullptr;
+    yyinstrlex_destroy(scanner);
 
-    if (result || has_error)
+    if (result || ctx.has_error)
         throw std::runtime_error("failed to parse file");
 }
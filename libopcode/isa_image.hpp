@@ -0,0 +1,398 @@
+#ifndef ISA_IMAGE_HPP_INCLUDED
+#define ISA_IMAGE_HPP_INCLUDED
+
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libopcode.hpp"
+
+namespace COP2K
+{
+    /* compiled instruction set image
+     *
+     * layout (all integers are little endian):
+     *   ISAImageHeader
+     *   ISAImageSlot[64]          one per instruction slot (byte >> 2)
+     *   uint32_t[256]             the whole micro program memory
+     *   char[strings_size]        mnemonics and descriptions
+     *
+     * every section is naturally aligned, so the image can be used
+     * straight from a read-only mapping
+     */
+    constexpr char ISA_IMAGE_MAGIC[8] = { 'C', 'O', 'P', '2', 'K', 'I', 'S', 'A' };
+    constexpr uint16_t ISA_IMAGE_VERSION = 1;
+
+    struct ISAImageHeader {
+        char magic[8];
+        uint16_t version;
+        uint16_t slot_count;
+        uint32_t payload_size; // everything after the header
+        uint32_t checksum; // FNV-1a of the payload
+        uint32_t strings_size;
+    };
+
+    struct ISAImageSlot {
+        uint8_t exist;
+        uint8_t byte;
+        uint8_t src;
+        uint8_t dst;
+        uint16_t mnemonic_offset;
+        uint16_t mnemonic_len;
+        uint16_t desc_offset;
+        uint16_t desc_len;
+    };
+
+    static_assert(sizeof(ISAImageHeader) == 24);
+    static_assert(sizeof(ISAImageSlot) == 12);
+
+    constexpr size_t ISA_IMAGE_UM_OFFSET =
+        sizeof(ISAImageHeader) + 64 * sizeof(ISAImageSlot);
+    constexpr size_t ISA_IMAGE_STRINGS_OFFSET = ISA_IMAGE_UM_OFFSET + 256 * 4;
+
+    // magic of instruction description files of COP2000 DE
+    constexpr const char *INS_FILE_MAGIC = "INSTURCTION & uM file for COP2000\x1a";
+
+    inline uint32_t isa_image_checksum(const unsigned char *data, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+
+        for (size_t i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    inline void save_isa_image(const Opcode &opcode, FILE *out)
+    {
+        std::string payload(ISA_IMAGE_STRINGS_OFFSET - sizeof(ISAImageHeader), '\0');
+        std::string strings;
+        ISAImageSlot *slots = reinterpret_cast<ISAImageSlot *>(payload.data());
+        unsigned char *um = reinterpret_cast<unsigned char *>(payload.data()) +
+                            64 * sizeof(ISAImageSlot);
+        unsigned index = 0;
+
+        for (const Opcode::Instruction &i : opcode) {
+            ISAImageSlot &slot = slots[index];
+            std::array<std::bitset<24>, 4> words = i.microprogram;
+
+            if (!i.exist)
+                words.fill(std::bitset<24>().set());
+
+            for (unsigned char j = 0; j < 4; j++) {
+                uint32_t w = htole32(words.at(j).to_ulong());
+                memcpy(um + (index << 2 | j) * 4, &w, 4);
+            }
+
+            index++;
+
+            if (!i.exist)
+                continue;
+
+            if (strings.size() + i.mnemonic.size() + i.desc.size() > 0xffff)
+                throw std::length_error("instruction set strings too long");
+
+            slot.exist = 1;
+            slot.byte = i.byte;
+            slot.src = static_cast<uint8_t>(i.src);
+            slot.dst = static_cast<uint8_t>(i.dst);
+            slot.mnemonic_offset = htole16(strings.size());
+            slot.mnemonic_len = htole16(i.mnemonic.size());
+            strings.append(i.mnemonic);
+            slot.desc_offset = htole16(strings.size());
+            slot.desc_len = htole16(i.desc.size());
+            strings.append(i.desc);
+        }
+
+        payload.append(strings);
+
+        ISAImageHeader header;
+        memcpy(header.magic, ISA_IMAGE_MAGIC, sizeof(header.magic));
+        header.version = htole16(ISA_IMAGE_VERSION);
+        header.slot_count = htole16(64);
+        header.payload_size = htole32(payload.size());
+        header.checksum = htole32(isa_image_checksum(
+                                      reinterpret_cast<const unsigned char *>(payload.data()),
+                                      payload.size()
+                                  ));
+        header.strings_size = htole32(strings.size());
+
+        if (
+            fwrite(&header, sizeof(header), 1, out) != 1 ||
+            fwrite(payload.data(), 1, payload.size(), out) != payload.size()
+        )
+            throw std::runtime_error("failed to write instruction set image");
+    }
+
+    /* a C++ header embedding the micro program of an instruction set as
+     * constexpr data, in a struct named name, for engines specialized to
+     * it at compile time:
+     *
+     *     MICRO_PROGRAM    256 words by uPC, all ones in empty slots
+     *     SAFE             one bit by uPC, set when Opcode::is_um_safe()
+     */
+    inline void save_isa_header(const Opcode &opcode, const std::string &name, const std::string &source, FILE *out)
+    {
+        std::string guard, text;
+        std::array<uint64_t, 4> safe = {};
+        unsigned index = 0;
+
+        if (
+            name.empty() || isdigit(static_cast<unsigned char>(name.front())) ||
+            name.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_") != std::string::npos
+        )
+            throw std::invalid_argument(std::format("{} is not a C++ identifier", name));
+
+        for (size_t i = 0; i < name.size(); i++) {
+            if (i && isupper(static_cast<unsigned char>(name.at(i))) && islower(static_cast<unsigned char>(name.at(i - 1))))
+                guard += '_';
+
+            guard += toupper(static_cast<unsigned char>(name.at(i)));
+        }
+
+        guard += "_HPP_INCLUDED";
+        text = std::format("// generated by isa_compiler --header from {}, do not edit\n", source);
+        text += std::format("#ifndef {0}\n#define {0}\n\n#include <array>\n#include <cstdint>\n\n", guard);
+        text += std::format("namespace COP2K\n{{\n    struct {} {{\n", name);
+        text += "        static constexpr std::array<uint32_t, 256> MICRO_PROGRAM = {";
+
+        for (const Opcode::Instruction &i : opcode) {
+            for (unsigned char j = 0; j < 4; j++) {
+                unsigned upc = index << 2 | j;
+
+                text += upc % 8 ? " " : "\n            ";
+                text += std::format("0x{:06X},", i.exist ? i.microprogram.at(j).to_ulong() : 0xFFFFFF);
+
+                if (opcode.is_um_safe(upc))
+                    safe.at(upc >> 6) |= uint64_t(1) << (upc & 0x3F);
+            }
+
+            index++;
+        }
+
+        text += "\n        };\n        static constexpr std::array<uint64_t, 4> SAFE = {";
+
+        for (uint64_t i : safe)
+            text += std::format("\n            0x{:016X},", i);
+
+        text += std::format("\n        }};\n    }};\n}}\n\n#endif // {}\n", guard);
+
+        if (fputs(text.c_str(), out) == EOF)
+            throw std::runtime_error("failed to write instruction set header");
+    }
+
+    inline bool is_isa_image(const void *data, size_t size)
+    {
+        return size >= sizeof(ISA_IMAGE_MAGIC) &&
+               !memcmp(data, ISA_IMAGE_MAGIC, sizeof(ISA_IMAGE_MAGIC));
+    }
+
+    inline void load_isa_image(const void *data, size_t size, Opcode &opcode)
+    {
+        const unsigned char *base = static_cast<const unsigned char *>(data);
+        ISAImageHeader header;
+
+        if (size < ISA_IMAGE_STRINGS_OFFSET || !is_isa_image(data, size))
+            throw std::runtime_error("not an instruction set image");
+
+        memcpy(&header, base, sizeof(header));
+
+        if (le16toh(header.version) != ISA_IMAGE_VERSION)
+            throw std::runtime_error(
+                std::format("unsupported instruction set image version {}",
+                            le16toh(header.version))
+            );
+
+        if (
+            le16toh(header.slot_count) != 64 ||
+            le32toh(header.payload_size) != size - sizeof(header) ||
+            le32toh(header.strings_size) != size - ISA_IMAGE_STRINGS_OFFSET
+        )
+            throw std::runtime_error("corrupted instruction set image");
+
+        if (
+            isa_image_checksum(base + sizeof(header), size - sizeof(header)) !=
+            le32toh(header.checksum)
+        )
+            throw std::runtime_error("instruction set image checksum mismatch");
+
+        const ISAImageSlot *slots =
+            reinterpret_cast<const ISAImageSlot *>(base + sizeof(header));
+        const unsigned char *um = base + ISA_IMAGE_UM_OFFSET;
+        const char *strings = reinterpret_cast<const char *>(base + ISA_IMAGE_STRINGS_OFFSET);
+        size_t strings_size = size - ISA_IMAGE_STRINGS_OFFSET;
+
+        opcode.clear();
+
+        for (unsigned i = 0; i < 64; i++) {
+            const ISAImageSlot &slot = slots[i];
+            std::array<std::bitset<24>, 4> microprogram;
+
+            if (!slot.exist)
+                continue;
+
+            if (
+                slot.byte >> 2 != i ||
+                slot.src > static_cast<uint8_t>(OperandType::MEMADDR) ||
+                slot.dst > static_cast<uint8_t>(OperandType::MEMADDR) ||
+                le16toh(slot.mnemonic_offset) + le16toh(slot.mnemonic_len) > strings_size ||
+                le16toh(slot.desc_offset) + le16toh(slot.desc_len) > strings_size
+            )
+                throw std::runtime_error("corrupted instruction set image");
+
+            for (unsigned char j = 0; j < 4; j++) {
+                uint32_t w;
+                memcpy(&w, um + (i << 2 | j) * 4, 4);
+                microprogram.at(j) = std::bitset<24>(le32toh(w));
+            }
+
+            opcode.add(
+                slot.byte,
+                std::string(strings + le16toh(slot.mnemonic_offset), le16toh(slot.mnemonic_len)),
+                std::string(strings + le16toh(slot.desc_offset), le16toh(slot.desc_len)),
+                static_cast<OperandType>(slot.src),
+                static_cast<OperandType>(slot.dst),
+                microprogram
+            );
+        }
+    }
+
+    inline void load_isa_image(const char *path, Opcode &opcode)
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+
+        if (fd < 0)
+            throw std::runtime_error(std::format("failed to open {}", path));
+
+        if (fstat(fd, &st) || !st.st_size) {
+            close(fd);
+            throw std::runtime_error(std::format("failed to stat {}", path));
+        }
+
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+            throw std::runtime_error(std::format("failed to map {}", path));
+
+        try {
+            load_isa_image(data, st.st_size, opcode);
+
+        } catch (...) {
+            munmap(data, st.st_size);
+            throw;
+        }
+
+        munmap(data, st.st_size);
+    }
+
+    // instruction description file of COP2000 DE
+    inline void load_ins_file(std::istream &in, Opcode &opcode)
+    {
+        std::array<Opcode::Instruction, 64> ins;
+        std::array<std::array<std::bitset<24>, 4>, 64> um;
+        std::string magic(strlen(INS_FILE_MAGIC), '\0');
+
+        in.read(magic.data(), magic.size());
+
+        if (magic != INS_FILE_MAGIC)
+            throw std::runtime_error("not an instruction description file of COP2000");
+
+        for (Opcode::Instruction &i : ins) {
+            if (!(i.exist = in.get()))
+                continue;
+
+            i.mnemonic.resize(in.get());
+            in.read(i.mnemonic.data(), i.mnemonic.size());
+            i.byte = in.get();
+            i.src = static_cast<OperandType>(in.get());
+            i.dst = static_cast<OperandType>(in.get());
+            i.desc.resize(in.get());
+            in.read(i.desc.data(), i.desc.size());
+        }
+
+        // every word takes 4 bytes, with the 24 bits in the lower 3
+        for (std::array<std::bitset<24>, 4> &u : um)
+            for (std::bitset<24> &i : u) {
+                uint32_t a = 0;
+                in.read(reinterpret_cast<char *>(&a), 3);
+                i = std::bitset<24>(le32toh(a));
+                in.get();
+            }
+
+        if (!in)
+            throw std::runtime_error("truncated instruction description file");
+
+        opcode.clear();
+
+        for (unsigned i = 0; i < 64; i++)
+            if (ins.at(i).exist)
+                opcode.add(
+                    ins.at(i).byte,
+                    ins.at(i).mnemonic,
+                    ins.at(i).desc,
+                    ins.at(i).src,
+                    ins.at(i).dst,
+                    um.at(i)
+                );
+    }
+
+    /* load an instruction set from any supported file:
+     * compiled image, COP2000 DE .ins or instr.txt
+     */
+    inline void load_instruction_set(const char *path, Opcode &opcode)
+    {
+        char magic[64] = {};
+        FILE *in = fopen(path, "rb");
+
+        if (!in)
+            throw std::runtime_error(std::format("failed to open {}", path));
+
+        size_t magic_size = fread(magic, 1, sizeof(magic), in);
+
+        if (is_isa_image(magic, magic_size)) {
+            fclose(in);
+            load_isa_image(path, opcode);
+
+        } else if (
+            magic_size >= strlen(INS_FILE_MAGIC) &&
+            !memcmp(magic, INS_FILE_MAGIC, strlen(INS_FILE_MAGIC))
+        ) {
+            fclose(in);
+            std::ifstream ifs(path, std::ios::binary);
+            load_ins_file(ifs, opcode);
+
+        } else {
+            rewind(in);
+
+            try {
+                opcode.load_instr_txt(in);
+
+            } catch (...) {
+                fclose(in);
+                throw;
+            }
+
+            fclose(in);
+        }
+    }
+}
+
+#endif // ISA_IMAGE_HPP_INCLUDED
@@ -5,12 +5,16 @@
 #include <stdexcept>
 #include <format>
 #include <cstring>
+#include <strings.h>
 #include <cctype>
 #include <bitset>
 #include <array>
 #include <sstream>
 #include <iterator>
 #include <cstdio>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 
 namespace COP2K
 {
@@ -23,9 +27,88 @@ namespace COP2K
         MEMADDR
     };
 
+    // how an instruction changes PC
+    enum class InstructionFlow : unsigned char {
+        NEXT,
+        JUMP, // to its MM operand
+        CALL, // to its MM operand, saving PC in ST
+        RETURN, // to the PC saved in ST
+        INDIRECT // to anything else
+    };
+
+    // problems found by statically checking a single micro word
+    enum MicroWordIssue : unsigned char {
+        MICRO_WORD_OK = 0,
+        // more than one writer on a bus
+        MICRO_WORD_DBUS_CONFLICT = 1 << 0,
+        MICRO_WORD_IBUS_CONFLICT = 1 << 1,
+        MICRO_WORD_ABUS_CONFLICT = 1 << 2,
+        // a bus is read but nobody writes to it
+        MICRO_WORD_DBUS_UNDRIVEN = 1 << 3,
+        MICRO_WORD_IBUS_UNDRIVEN = 1 << 4,
+        MICRO_WORD_ABUS_UNDRIVEN = 1 << 5,
+        // the last step of an instruction does not fetch the next one (!iren)
+        MICRO_WORD_NO_REFETCH = 1 << 6,
+
+        MICRO_WORD_CONFLICT =
+            MICRO_WORD_DBUS_CONFLICT |
+            MICRO_WORD_IBUS_CONFLICT |
+            MICRO_WORD_ABUS_CONFLICT
+    };
+
     class Opcode;
     void parse_instruction_file(FILE *in, Opcode *opcode);
 
+    // mnemonics are case insensitive
+    struct MnemonicKey {
+        std::string_view mnemonic;
+        OperandType src, dst;
+    };
+
+    struct MnemonicKeyHash {
+        using is_transparent = void;
+
+        size_t operator()(const MnemonicKey &key) const
+        {
+            size_t hash = 14695981039346656037ull;
+
+            for (char c : key.mnemonic) {
+                hash ^= toupper(static_cast<unsigned char>(c));
+                hash *= 1099511628211ull;
+            }
+
+            return hash ^ (static_cast<size_t>(key.src) << 3 | static_cast<size_t>(key.dst));
+        }
+
+        size_t operator()(const std::tuple<std::string, OperandType, OperandType> &key) const
+        {
+            return (*this)(MnemonicKey{std::get<0>(key), std::get<1>(key), std::get<2>(key)});
+        }
+    };
+
+    struct MnemonicKeyEqual {
+        using is_transparent = void;
+
+        static MnemonicKey view(const MnemonicKey &key)
+        {
+            return key;
+        }
+
+        static MnemonicKey view(const std::tuple<std::string, OperandType, OperandType> &key)
+        {
+            return MnemonicKey{std::get<0>(key), std::get<1>(key), std::get<2>(key)};
+        }
+
+        template<typename L, typename R>
+        bool operator()(const L &lhs, const R &rhs) const
+        {
+            MnemonicKey l = view(lhs), r = view(rhs);
+            return l.src == r.src && l.dst == r.dst &&
+                   l.mnemonic.size() == r.mnemonic.size() &&
+                   !strncasecmp(l.mnemonic.data(), r.mnemonic.data(), l.mnemonic.size());
+        }
+    };
+
     class Opcode
     {
         public:
@@ -61,6 +144,52 @@ namespace COP2K
                     for (std::bitset<24> &i : microprogram)
                         i.set();
                 }
+
+                // whether any step loads PC (elp is active low), i.e. a jump, call or return
+                bool loads_pc() const
+                {
+                    for (unsigned char i = 0; i < signal_count; i++)
+                        if (!microprogram.at(i).test(16))
+                            return true;
+
+                    return false;
+                }
+
+                /* judged from the step with !elp, and whether ST was loaded
+                 * from PC before it. whether PC is loaded at all depends on
+                 * IR at run time: see is_conditional()
+                 */
+                InstructionFlow get_flow() const
+                {
+                    bool saves_pc = false;
+
+                    for (unsigned char i = 0; i < signal_count; i++) {
+                        const std::bitset<24> &w = microprogram.at(i);
+                        unsigned x = w.to_ulong() >> 5 & 0x7;
+
+                        if (!w.test(12) && x == 3)
+                            saves_pc = true;
+
+                        if (w.test(16))
+                            continue;
+
+                        if (x == 2)
+                            return InstructionFlow::RETURN;
+
+                        if (!w.test(21) && (src == OperandType::MEMADDR || dst == OperandType::MEMADDR))
+                            return saves_pc ? InstructionFlow::CALL : InstructionFlow::JUMP;
+
+                        return InstructionFlow::INDIRECT;
+                    }
+
+                    return InstructionFlow::NEXT;
+                }
+
+                // PC is only loaded on carry, or on zero with bit 2, unless bit 3 of IR is set
+                bool is_conditional() const
+                {
+                    return !(byte & 0x8);
+                }
             };
 
             Opcode()
@@ -101,15 +230,11 @@ namespace COP2K
                 LOAD(dst);
                 LOAD(microprogram);
 #undef LOAD
-                // *INDENT-OFF*
-                instructions.at(byte >> 2).signal_count = std::count_if(
-                    microprogram.cbegin(),
-                    microprogram.cend(),
-                    [](const std::bitset<24> &i) {
-                        return !i.all();
-                    }
-                );
-                // *INDENT-ON*
+                instructions.at(byte >> 2).signal_count = count_signals(microprogram);
+                verify_instruction(byte >> 2);
+                byte_index.at(byte) = byte >> 2;
+                // duplicated forms resolve to the first one, like the old linear scan did
+                mnemonic_index.emplace(std::make_tuple(mnemonic, src, dst), byte >> 2);
             }
 
             void load_instr_txt(FILE *in)
@@ -128,6 +253,29 @@ namespace COP2K
             {
                 for (Instruction &i : instructions)
                     i.clear();
+
+                // an all-ones word does nothing, so it is always legal
+                um_issues.fill(MICRO_WORD_OK);
+                byte_index.fill(NO_INSTRUCTION);
+                mnemonic_index.clear();
+            }
+
+            // returns nullptr if not found
+            const Instruction *find_from_mnemonic(
+                std::string_view mnemonic,
+                OperandType src,
+                OperandType dst
+            ) const
+            {
+                auto it = mnemonic_index.find(MnemonicKey{mnemonic, src, dst});
+                return it == mnemonic_index.cend() ? nullptr : &instructions.at(it->second);
+            }
+
+            // returns nullptr if not found
+            const Instruction *find_from_byte(unsigned char byte) const
+            {
+                unsigned char index = byte_index.at(byte);
+                return index == NO_INSTRUCTION ? nullptr : &instructions.at(index);
             }
 
             const Instruction &get_from_mnemonic(
@@ -136,32 +284,26 @@ namespace COP2K
                 OperandType dst
             ) const
             {
-                std::string n;
-                std::transform(
-                    mnemonic.cbegin(),
-                    mnemonic.cend(),
-                    std::back_inserter(n),
-                    toupper
-                );
+                const Instruction *ins = find_from_mnemonic(mnemonic, src, dst);
 
-                for (const Instruction &i : instructions)
-                    if (i.exist && i.mnemonic == n && i.src == src && i.dst == dst)
-                        return i;
+                if (!ins)
+                    throw std::out_of_range(
+                        std::format("instruction {} undefined", mnemonic)
+                    );
 
-                throw std::out_of_range(
-                    std::format("instruction {} undefined", mnemonic)
-                );
+                return *ins;
             }
 
             const Instruction &get_from_byte(unsigned char byte) const
             {
-                for (const Instruction &i : instructions)
-                    if (i.exist && i.byte == byte)
-                        return i;
+                const Instruction *ins = find_from_byte(byte);
 
-                throw std::out_of_range(
-                    std::format("instruction 0x{:02X} undefined", byte)
-                );
+                if (!ins)
+                    throw std::out_of_range(
+                        std::format("instruction 0x{:02X} undefined", byte)
+                    );
+
+                return *ins;
             }
 
             void patch_um(uint8_t addr, const std::bitset<24> &val)
@@ -174,15 +316,11 @@ namespace COP2K
                                     addr)
                     );
 
+                // only the micro program changes,
+                // so both lookup indexes stay valid
                 ins.microprogram.at(addr & 3) = val;
-
-                if (addr & 3 == ins.signal_count - 1) {
-                    if (val.all())
-                        ins.signal_count--;
-
-                    else
-                        ins.signal_count++;
-                }
+                ins.signal_count = count_signals(ins.microprogram);
+                verify_instruction(addr >> 2);
             }
 
             void patch_um(uint8_t addr, unsigned bit_pos, bool val)
@@ -196,14 +334,120 @@ namespace COP2K
                     );
 
                 ins.microprogram.at(addr & 3).set(bit_pos, val);
+                ins.signal_count = count_signals(ins.microprogram);
+                verify_instruction(addr >> 2);
+            }
+
+            // bitwise OR of MicroWordIssue found at a micro program address
+            unsigned char get_um_issues(uint8_t addr) const
+            {
+                return um_issues.at(addr);
+            }
+
+            /* a word is safe when it is bound to an instruction and
+             * can never put two writers on the same bus,
+             * so the machine does not need to check for conflicts
+             */
+            bool is_um_safe(uint8_t addr) const
+            {
+                return instructions.at(addr >> 2).exist &&
+                       !(um_issues.at(addr) & MICRO_WORD_CONFLICT);
+            }
+
+            static unsigned char check_micro_word(const std::bitset<24> &word)
+            {
+                // all signals are valid when FALSE
+#define SIGNAL(pos) (!word.test(pos))
+                unsigned char ret = MICRO_WORD_OK;
+                unsigned char x = (word.to_ulong() >> 5) & 0x7;
+                bool mem_read = SIGNAL(19) && SIGNAL(21); // !emen !emrd
+                bool mem_write = SIGNAL(19) && SIGNAL(22); // !emen !emwr
+                unsigned dbus_writer =
+                    (x != 7) + // X2..X0 selector
+                    SIGNAL(11) + // rrd
+                    mem_read;
+                bool dbus_reader =
+                    mem_write ||
+                    SIGNAL(16) || // elp
+                    SIGNAL(15) || // maren
+                    SIGNAL(13) || // outen
+                    SIGNAL(12) || // sten
+                    SIGNAL(10) || // rwr
+                    SIGNAL(4) || // wen
+                    SIGNAL(3); // aen
+                unsigned ibus_writer = SIGNAL(21); // emrd
+                bool ibus_reader = SIGNAL(18); // iren
+                unsigned abus_writer =
+                    SIGNAL(20) + // pcoe
+                    SIGNAL(14); // maroe
+                // memory needs an address whenever it is accessed
+                bool abus_reader = SIGNAL(21) || mem_write;
+#undef SIGNAL
+
+                if (dbus_writer > 1)
+                    ret |= MICRO_WORD_DBUS_CONFLICT;
+
+                if (ibus_writer > 1)
+                    ret |= MICRO_WORD_IBUS_CONFLICT;
+
+                if (abus_writer > 1)
+                    ret |= MICRO_WORD_ABUS_CONFLICT;
+
+                if (dbus_reader && !dbus_writer)
+                    ret |= MICRO_WORD_DBUS_UNDRIVEN;
+
+                if (ibus_reader && !ibus_writer)
+                    ret |= MICRO_WORD_IBUS_UNDRIVEN;
+
+                if (abus_reader && !abus_writer)
+                    ret |= MICRO_WORD_ABUS_UNDRIVEN;
+
+                return ret;
+            }
+
+            std::string um_issues_to_string() const
+            {
+                std::ostringstream oss;
+
+                for (const Instruction &i : instructions) {
+                    if (!i.exist)
+                        continue;
+
+                    for (unsigned char j = 0; j < 4; j++) {
+                        unsigned char addr = (i.byte & ~0x3) | j;
+                        unsigned char issues = um_issues.at(addr);
+
+                        if (!issues)
+                            continue;
+
+                        oss << std::format("0x{:02X} ({} step {}):", addr, i.mnemonic, j);
+
+                        if (issues & MICRO_WORD_DBUS_CONFLICT)
+                            oss << " multiple data bus writers;";
+
+                        if (issues & MICRO_WORD_IBUS_CONFLICT)
+                            oss << " multiple instruction bus writers;";
 
-                if (addr & 3 == ins.signal_count - 1) {
-                    if (ins.microprogram.at(addr & 3).all())
-                        ins.signal_count--;
+                        if (issues & MICRO_WORD_ABUS_CONFLICT)
+                            oss << " multiple address bus writers;";
 
-                    else
-                        ins.signal_count++;
+                        if (issues & MICRO_WORD_DBUS_UNDRIVEN)
+                            oss << " data bus read but not driven;";
+
+                        if (issues & MICRO_WORD_IBUS_UNDRIVEN)
+                            oss << " instruction bus read but not driven;";
+
+                        if (issues & MICRO_WORD_ABUS_UNDRIVEN)
+                            oss << " address bus read but not driven;";
+
+                        if (issues & MICRO_WORD_NO_REFETCH)
+                            oss << " last step does not fetch next instruction (!iren);";
+
+                        oss << std::endl;
+                    }
                 }
+
+                return oss.str();
             }
 
             std::array<Instruction, 64>::const_iterator begin() const
@@ -287,7 +531,7 @@ namespace COP2K
                     for (unsigned char j = 0; j < i.signal_count; j++) {
                         std::ostringstream oss2;
 #define GET_BIT(pos, name) \
-    if (!i.microprogram.at(j).test(23 - pos)) oss2 << "!" #name " "
+    if (!i.microprogram.at(j).test(pos)) oss2 << "!" #name " "
                         GET_BIT(22, emwr);
                         GET_BIT(21, emrd);
                         GET_BIT(20, pcoe);
@@ -324,7 +568,53 @@ namespace COP2K
             }
 
         private:
+            static unsigned char count_signals(
+                const std::array<std::bitset<24>, 4> &microprogram
+            )
+            {
+                // *INDENT-OFF*
+                return std::count_if(
+                    microprogram.cbegin(),
+                    microprogram.cend(),
+                    [](const std::bitset<24> &i) {
+                        // bit 23 is not a signal, parsed words leave it cleared
+                        return (i.to_ulong() & 0x7FFFFF) != 0x7FFFFF;
+                    }
+                );
+                // *INDENT-ON*
+            }
+
+            void verify_instruction(unsigned char index)
+            {
+                const Instruction &ins = instructions.at(index);
+
+                for (unsigned char j = 0; j < 4; j++)
+                    um_issues.at(index << 2 | j) = check_micro_word(ins.microprogram.at(j));
+
+                if (!ins.exist)
+                    return;
+
+                if (!ins.signal_count)
+                    um_issues.at(index << 2) |= MICRO_WORD_NO_REFETCH;
+
+                else if (ins.microprogram.at(ins.signal_count - 1).test(18))
+                    um_issues.at(index << 2 | (ins.signal_count - 1)) |= MICRO_WORD_NO_REFETCH;
+            }
+
+            static constexpr unsigned char NO_INSTRUCTION = 0xff;
+
             std::array<Instruction, 64> instructions;
+            std::array<unsigned char, 256> um_issues;
+            // byte -> slot in instructions
+            std::array<unsigned char, 256> byte_index;
+            // *INDENT-OFF*
+            std::unordered_map<
+                std::tuple<std::string, OperandType, OperandType>,
+                unsigned char, // slot in instructions
+                MnemonicKeyHash,
+                MnemonicKeyEqual
+            > mnemonic_index;
+            // *INDENT-ON*
     };
 }
 
@@ -51,6 +51,17 @@ struct Signals {
     }
 };
 
+namespace COP2K
+{
+    class Opcode;
+}
+
+// state of one instruction file parse
+struct InstrParseContext {
+    COP2K::Opcode *opcode;
+    bool has_error;
+};
+
 struct MicroProgram {
     unsigned char signal_count;
     struct Signals signals[4];